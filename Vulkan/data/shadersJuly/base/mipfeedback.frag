@@ -0,0 +1,30 @@
+#version 450
+
+// Writes the finest mip level each visible texel of a streamed texture needs into the feedback buffer
+// The level is computed from the derivatives against the full size of the texture, not the resident levels it is bound with,
+// and lodBias compensates for the reduced resolution of the pass (-log2 of the downscale factor)
+
+layout (early_fragment_tests) in;
+
+layout (binding = 1) buffer Feedback
+{
+	uint requestedLevel[];
+} feedback;
+
+layout (push_constant) uniform PushConstants
+{
+	mat4 model;
+	vec2 textureSize;
+	uint textureIndex;
+	float lodBias;
+} pushConstants;
+
+layout (location = 0) in vec2 inUV;
+
+void main()
+{
+	vec2 dx = dFdx(inUV * pushConstants.textureSize);
+	vec2 dy = dFdy(inUV * pushConstants.textureSize);
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + pushConstants.lodBias;
+	atomicMin(feedback.requestedLevel[pushConstants.textureIndex], uint(max(floor(lod), 0.0)));
+}
@@ -0,0 +1,34 @@
+#version 450
+
+// Mip streaming feedback pass, drawn at a reduced resolution into a depth only target so only visible surfaces report
+// Vertex attribute locations are set up by the pipeline to map position and texture coordinates
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec2 inUV;
+
+layout (binding = 0) uniform UBO
+{
+	mat4 projection;
+	mat4 view;
+} ubo;
+
+layout (push_constant) uniform PushConstants
+{
+	mat4 model;
+	vec2 textureSize;
+	uint textureIndex;
+	float lodBias;
+} pushConstants;
+
+layout (location = 0) out vec2 outUV;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+void main()
+{
+	outUV = inUV;
+	gl_Position = ubo.projection * ubo.view * pushConstants.model * vec4(inPos, 1.0);
+}
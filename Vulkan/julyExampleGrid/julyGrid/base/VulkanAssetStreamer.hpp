@@ -0,0 +1,568 @@
+/*
+* Asynchronous asset streamer
+*
+* Loads assets on worker threads in priority order and meters their GPU uploads to a byte budget per frame
+* Requested assets keep their placeholder until their upload has finished on the GPU
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+#include "vulkan/vulkan.h"
+
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "VulkanInitializers.hpp"
+#include "ktxfile.hpp"
+
+#if defined(__ANDROID__)
+#include <android/asset_manager.h>
+#endif
+
+namespace vks
+{
+	/** @brief Texture filled in by the streamer, its descriptor points at the streamer's placeholder until the texture is ready */
+	struct StreamedTexture {
+		VkDevice device = VK_NULL_HANDLE;
+		VkImage image = VK_NULL_HANDLE;
+		VkDeviceMemory deviceMemory = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkSampler sampler = VK_NULL_HANDLE;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		uint32_t width = 0, height = 0;
+		uint32_t mipLevels = 0;
+		VkDescriptorImageInfo descriptor = {};
+
+		/** @brief Release all Vulkan resources, the placeholder's resources are not owned by the texture */
+		void destroy()
+		{
+			if (device) {
+				vkDestroyImageView(device, view, nullptr);
+				vkDestroyImage(device, image, nullptr);
+				vkDestroySampler(device, sampler, nullptr);
+				vkFreeMemory(device, deviceMemory, nullptr);
+			}
+			*this = StreamedTexture();
+		}
+	};
+
+	class AssetStreamer
+	{
+	public:
+		enum class State { queued, loading, loaded, uploading, ready, failed, cancelled };
+
+		/** @brief CPU side result of a load, copied into the staging memory of the frame that uploads it */
+		struct Payload {
+			std::vector<uint8_t> data;
+		};
+
+		/** @brief One streamed asset, the callbacks define how it is loaded and uploaded */
+		class Request {
+		public:
+			std::atomic<State> state{ State::queued };
+			/** @brief Higher priorities are loaded and uploaded first, may be changed at any time */
+			std::atomic<float> priority{ 0.0f };
+			/** @brief Called on a worker thread for file I/O and decoding, returns false if the asset could not be loaded */
+			std::function<bool(Payload &payload)> load;
+			/** @brief Called on the thread calling update to record the copies out of the staging buffer range that holds the payload */
+			std::function<void(VkCommandBuffer commandBuffer, VkBuffer staging, VkDeviceSize offset, const Payload &payload)> upload;
+			/** @brief Called on the thread calling update once the upload has finished on the GPU, or with false if the load failed */
+			std::function<void(bool success)> complete;
+
+			bool ready() const { return state == State::ready; }
+		private:
+			friend class AssetStreamer;
+			Payload payload;
+			uint64_t sequence = 0;
+		};
+
+	private:
+		// Uploads recorded in one frame, the slot is reused once its fence has signalled
+		struct Frame {
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			VkFence fence = VK_NULL_HANDLE;
+			vks::Buffer staging;
+			// Dedicated staging for a payload larger than the per frame budget
+			vks::Buffer oversized;
+			std::vector<std::shared_ptr<Request>> requests;
+			bool pending = false;
+		};
+
+		vks::VulkanDevice *device;
+		VkQueue queue;
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		VkDeviceSize uploadBudget;
+		std::vector<Frame> frames;
+		uint32_t frameIndex = 0;
+
+		std::vector<std::thread> workers;
+		std::mutex queueMutex;
+		std::condition_variable condition;
+		bool stopping = false;
+		uint64_t sequence = 0;
+		// Requests that are neither ready, failed nor cancelled
+		std::atomic<size_t> outstanding{ 0 };
+		// Guarded by queueMutex
+		std::vector<std::shared_ptr<Request>> queued;
+		std::vector<std::shared_ptr<Request>> loaded;
+
+		static bool comparePriority(const std::shared_ptr<Request> &a, const std::shared_ptr<Request> &b)
+		{
+			const float pa = a->priority, pb = b->priority;
+			return (pa != pb) ? (pa > pb) : (a->sequence < b->sequence);
+		}
+
+		void workerLoop()
+		{
+			while (true) {
+				std::shared_ptr<Request> request;
+				{
+					std::unique_lock<std::mutex> lock(queueMutex);
+					condition.wait(lock, [this] { return !queued.empty() || stopping; });
+					if (stopping) {
+						return;
+					}
+					// Priorities may change after enqueueing, so the best request is searched instead of kept in a heap
+					auto best = std::min_element(queued.begin(), queued.end(), comparePriority);
+					request = *best;
+					queued.erase(best);
+					request->state = State::loading;
+				}
+
+				const bool success = request->load ? request->load(request->payload) : true;
+
+				std::lock_guard<std::mutex> lock(queueMutex);
+				// Cancelled while loading, the payload is owned by this thread until here
+				if (request->state == State::cancelled) {
+					request->payload = Payload();
+					continue;
+				}
+				request->state = success ? State::loaded : State::failed;
+				loaded.push_back(request);
+			}
+		}
+
+		/** @brief Completes the uploads of all frame slots whose fence has signalled */
+		void retireFrames()
+		{
+			for (Frame &frame : frames) {
+				if (!frame.pending || (vkGetFenceStatus(device->logicalDevice, frame.fence) != VK_SUCCESS)) {
+					continue;
+				}
+				frame.pending = false;
+				if (frame.oversized.buffer != VK_NULL_HANDLE) {
+					frame.oversized.destroy();
+					frame.oversized = vks::Buffer();
+				}
+				for (auto &request : frame.requests) {
+					request->state = State::ready;
+					outstanding--;
+					if (request->complete) {
+						request->complete(true);
+					}
+				}
+				frame.requests.clear();
+			}
+		}
+
+	public:
+		/** @brief 1x1 white texture shown by streamed textures until they are ready */
+		StreamedTexture placeholder;
+
+		/**
+		* Create the streamer and start its workers
+		*
+		* @param device Vulkan device the assets are uploaded to
+		* @param queue Queue the uploads are submitted to, must belong to the device's graphics queue family and only be used from the thread calling update
+		* @param uploadBudget (Optional) Maximum number of bytes uploaded per frame, a single larger asset is uploaded alone in its own frame
+		* @param workerCount (Optional) Number of loader threads, zero picks one less than the number of cores
+		* @param frameCount (Optional) Number of frames whose uploads may be in flight at once
+		*/
+		AssetStreamer(vks::VulkanDevice *device, VkQueue queue, VkDeviceSize uploadBudget = 8 * 1024 * 1024, uint32_t workerCount = 0, uint32_t frameCount = 2)
+			: device(device), queue(queue), uploadBudget(uploadBudget)
+		{
+			VkCommandPoolCreateInfo cmdPoolInfo = vks::initializers::commandPoolCreateInfo();
+			cmdPoolInfo.queueFamilyIndex = device->queueFamilyIndices.graphics;
+			cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			VK_CHECK_RESULT(vkCreateCommandPool(device->logicalDevice, &cmdPoolInfo, nullptr, &commandPool));
+
+			frames.resize(std::max(frameCount, 1u));
+			for (Frame &frame : frames) {
+				VkCommandBufferAllocateInfo allocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &allocateInfo, &frame.commandBuffer));
+				VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo();
+				VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceInfo, nullptr, &frame.fence));
+				VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.staging, uploadBudget));
+				VK_CHECK_RESULT(frame.staging.map());
+			}
+
+			createPlaceholder();
+
+			if (workerCount == 0) {
+				workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+			}
+			for (uint32_t i = 0; i < workerCount; i++) {
+				workers.push_back(std::thread(&AssetStreamer::workerLoop, this));
+			}
+		}
+
+		~AssetStreamer()
+		{
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				stopping = true;
+			}
+			condition.notify_all();
+			for (auto &worker : workers) {
+				worker.join();
+			}
+			for (Frame &frame : frames) {
+				if (frame.pending) {
+					VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &frame.fence, VK_TRUE, UINT64_MAX));
+				}
+				frame.staging.destroy();
+				if (frame.oversized.buffer != VK_NULL_HANDLE) {
+					frame.oversized.destroy();
+				}
+				vkDestroyFence(device->logicalDevice, frame.fence, nullptr);
+			}
+			vkDestroyCommandPool(device->logicalDevice, commandPool, nullptr);
+			placeholder.destroy();
+		}
+
+		/** @brief Queue a request, its load callback runs on a worker once all requests with a higher priority have been picked up */
+		void enqueue(const std::shared_ptr<Request> &request)
+		{
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				request->state = State::queued;
+				request->sequence = sequence++;
+				outstanding++;
+				queued.push_back(request);
+			}
+			condition.notify_one();
+		}
+
+		/**
+		* Cancel a request that has not started uploading yet, call from the thread calling update
+		*
+		* @return False if the upload has already been recorded, the request completes normally then
+		*/
+		bool cancel(const std::shared_ptr<Request> &request)
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			const State state = request->state;
+			if ((state == State::uploading) || (state == State::ready) || (state == State::failed) || (state == State::cancelled)) {
+				return false;
+			}
+			queued.erase(std::remove(queued.begin(), queued.end(), request), queued.end());
+			loaded.erase(std::remove(loaded.begin(), loaded.end(), request), loaded.end());
+			request->state = State::cancelled;
+			if (state != State::loading) {
+				request->payload = Payload();
+			}
+			outstanding--;
+			return true;
+		}
+
+		/** @brief Number of requests that are not ready, failed or cancelled yet */
+		size_t pendingCount() const
+		{
+			return outstanding;
+		}
+
+		/**
+		* Retire finished uploads and record the next ones, call once per frame from the thread that owns the queue
+		* Never waits for the GPU, if no frame slot is free the uploads are deferred to a later frame
+		*/
+		void update()
+		{
+			retireFrames();
+
+			std::vector<std::shared_ptr<Request>> ready;
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				ready.swap(loaded);
+			}
+			// Failed loads are reported right away, they keep their placeholder
+			auto failed = std::stable_partition(ready.begin(), ready.end(), [](const std::shared_ptr<Request> &request) { return request->state != State::failed; });
+			for (auto it = failed; it != ready.end(); it++) {
+				(*it)->payload = Payload();
+				outstanding--;
+				if ((*it)->complete) {
+					(*it)->complete(false);
+				}
+			}
+			ready.erase(failed, ready.end());
+
+			Frame &frame = frames[frameIndex];
+			if (!ready.empty() && !frame.pending) {
+				std::sort(ready.begin(), ready.end(), comparePriority);
+
+				VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+				beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+				VK_CHECK_RESULT(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo));
+
+				// Offsets are kept 16 byte aligned, which satisfies the copy alignment of all uncompressed and block compressed formats
+				VkDeviceSize offset = 0;
+				size_t uploaded = 0;
+				for (; uploaded < ready.size(); uploaded++) {
+					Request &request = *ready[uploaded];
+					const VkDeviceSize size = request.payload.data.size();
+					VkBuffer staging = frame.staging.buffer;
+					VkDeviceSize stagingOffset = offset;
+					if (size > uploadBudget) {
+						// Too large for any frame's budget, so it gets a frame of its own
+						if (uploaded > 0) {
+							break;
+						}
+						VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.oversized, size, request.payload.data.data()));
+						staging = frame.oversized.buffer;
+						stagingOffset = 0;
+						offset = uploadBudget;
+					} else {
+						if (offset + size > uploadBudget) {
+							break;
+						}
+						memcpy(static_cast<uint8_t*>(frame.staging.mapped) + offset, request.payload.data.data(), static_cast<size_t>(size));
+						offset = (offset + size + 15) & ~static_cast<VkDeviceSize>(15);
+					}
+					request.state = State::uploading;
+					if (request.upload) {
+						request.upload(frame.commandBuffer, staging, stagingOffset, request.payload);
+					}
+					request.payload = Payload();
+					frame.requests.push_back(ready[uploaded]);
+				}
+
+				VK_CHECK_RESULT(vkEndCommandBuffer(frame.commandBuffer));
+				VK_CHECK_RESULT(vkResetFences(device->logicalDevice, 1, &frame.fence));
+				VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+				submitInfo.commandBufferCount = 1;
+				submitInfo.pCommandBuffers = &frame.commandBuffer;
+				VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, frame.fence));
+				frame.pending = true;
+				frameIndex = (frameIndex + 1) % static_cast<uint32_t>(frames.size());
+
+				ready.erase(ready.begin(), ready.begin() + uploaded);
+			}
+
+			// Whatever didn't fit goes back to the loaded list for the next frame
+			if (!ready.empty()) {
+				std::lock_guard<std::mutex> lock(queueMutex);
+				loaded.insert(loaded.end(), ready.begin(), ready.end());
+			}
+		}
+
+		/**
+		* Stream a texture from a KTX file
+		* Source images (e.g. .jpg) are replaced by their cooked variant (see ktx::loadVariant), the request fails if there is none
+		*
+		* @param filename KTX file or source image with cooked variants
+		* @param texture Texture to fill in, shows the placeholder until ready and must stay alive until the request has completed or been cancelled
+		* @param priority (Optional) Load and upload priority
+		* @param onReady (Optional) Called once the texture is ready, e.g. to update descriptor sets that use it
+		*/
+		std::shared_ptr<Request> requestTexture(const std::string &filename, StreamedTexture *texture, float priority = 0.0f, std::function<void(StreamedTexture *texture)> onReady = nullptr)
+		{
+			*texture = StreamedTexture();
+			texture->descriptor = placeholder.descriptor;
+
+			auto image = std::make_shared<ktx::Image>();
+			auto request = std::make_shared<Request>();
+			request->priority = priority;
+			vks::VulkanDevice *device = this->device;
+
+			request->load = [device, filename, image](Payload &payload) {
+				const bool isKtx = (filename.size() > 4) && (filename.compare(filename.size() - 4, 4, ".ktx") == 0);
+#if defined(__ANDROID__)
+				if (!isKtx) {
+					return false;
+				}
+				AAsset *asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
+				if (!asset) {
+					return false;
+				}
+				std::vector<uint8_t> fileData(AAsset_getLength(asset));
+				AAsset_read(asset, fileData.data(), fileData.size());
+				AAsset_close(asset);
+				if (!ktx::read(fileData.data(), fileData.size(), *image) || !ktx::isSupported(device->physicalDevice, device->enabledFeatures, image->format)) {
+					return false;
+				}
+#else
+				if (isKtx) {
+					if (!ktx::readFile(filename, *image) || !ktx::isSupported(device->physicalDevice, device->enabledFeatures, image->format)) {
+						return false;
+					}
+				} else if (ktx::loadVariant(device->physicalDevice, device->enabledFeatures, filename, *image).empty()) {
+					return false;
+				}
+#endif
+				payload.data.swap(image->data);
+				return true;
+			};
+
+			request->upload = [device, texture, image](VkCommandBuffer commandBuffer, VkBuffer staging, VkDeviceSize offset, const Payload &) {
+				texture->device = device->logicalDevice;
+				texture->format = image->format;
+				texture->width = image->width;
+				texture->height = image->height;
+				texture->mipLevels = static_cast<uint32_t>(image->levels.size());
+
+				VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+				imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+				imageCreateInfo.format = texture->format;
+				imageCreateInfo.mipLevels = texture->mipLevels;
+				imageCreateInfo.arrayLayers = 1;
+				imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+				imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+				imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+				imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				imageCreateInfo.extent = { texture->width, texture->height, 1 };
+				imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+				VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &texture->image));
+
+				VkMemoryRequirements memReqs;
+				vkGetImageMemoryRequirements(device->logicalDevice, texture->image, &memReqs);
+				VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
+				memAllocInfo.allocationSize = memReqs.size;
+				memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+				VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &texture->deviceMemory));
+				VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, texture->image, texture->deviceMemory, 0));
+
+				VkImageSubresourceRange subresourceRange = {};
+				subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				subresourceRange.levelCount = texture->mipLevels;
+				subresourceRange.layerCount = 1;
+				vks::tools::setImageLayout(commandBuffer, texture->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+
+				std::vector<VkBufferImageCopy> regions(image->levels.size());
+				for (size_t i = 0; i < image->levels.size(); i++) {
+					regions[i] = {};
+					regions[i].bufferOffset = offset + image->levels[i].offset;
+					regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+					regions[i].imageSubresource.mipLevel = static_cast<uint32_t>(i);
+					regions[i].imageSubresource.layerCount = 1;
+					regions[i].imageExtent = { image->levels[i].width, image->levels[i].height, 1 };
+				}
+				vkCmdCopyBufferToImage(commandBuffer, staging, texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+				vks::tools::setImageLayout(commandBuffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
+
+				VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo();
+				samplerInfo.magFilter = VK_FILTER_LINEAR;
+				samplerInfo.minFilter = VK_FILTER_LINEAR;
+				samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+				samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+				samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+				samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+				samplerInfo.compareOp = VK_COMPARE_OP_NEVER;
+				samplerInfo.maxLod = static_cast<float>(texture->mipLevels);
+				samplerInfo.maxAnisotropy = device->enabledFeatures.samplerAnisotropy ? device->properties.limits.maxSamplerAnisotropy : 1.0f;
+				samplerInfo.anisotropyEnable = device->enabledFeatures.samplerAnisotropy;
+				samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+				VK_CHECK_RESULT(vkCreateSampler(device->logicalDevice, &samplerInfo, nullptr, &texture->sampler));
+
+				VkImageViewCreateInfo viewInfo = vks::initializers::imageViewCreateInfo();
+				viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+				viewInfo.format = texture->format;
+				viewInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
+				viewInfo.subresourceRange = subresourceRange;
+				viewInfo.image = texture->image;
+				VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewInfo, nullptr, &texture->view));
+			};
+
+			// The descriptor is only switched once the copies have finished, draws recorded until then keep sampling the placeholder
+			request->complete = [texture, image, onReady](bool success) {
+				*image = ktx::Image();
+				if (!success) {
+					return;
+				}
+				texture->descriptor.sampler = texture->sampler;
+				texture->descriptor.imageView = texture->view;
+				texture->descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				if (onReady) {
+					onReady(texture);
+				}
+			};
+
+			enqueue(request);
+			return request;
+		}
+
+	private:
+		void createPlaceholder()
+		{
+			placeholder.device = device->logicalDevice;
+			placeholder.format = VK_FORMAT_R8G8B8A8_UNORM;
+			placeholder.width = placeholder.height = placeholder.mipLevels = 1;
+
+			VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageCreateInfo.format = placeholder.format;
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageCreateInfo.extent = { 1, 1, 1 };
+			imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &placeholder.image));
+
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(device->logicalDevice, placeholder.image, &memReqs);
+			VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
+			memAllocInfo.allocationSize = memReqs.size;
+			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &placeholder.deviceMemory));
+			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, placeholder.image, placeholder.deviceMemory, 0));
+
+			// Cleared to white instead of copied, so no staging is needed
+			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			VkImageSubresourceRange subresourceRange = {};
+			subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			subresourceRange.levelCount = 1;
+			subresourceRange.layerCount = 1;
+			vks::tools::setImageLayout(copyCmd, placeholder.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+			VkClearColorValue white = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+			vkCmdClearColorImage(copyCmd, placeholder.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &white, 1, &subresourceRange);
+			vks::tools::setImageLayout(copyCmd, placeholder.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
+			device->flushCommandBuffer(copyCmd, queue, true);
+
+			VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo();
+			samplerInfo.magFilter = VK_FILTER_NEAREST;
+			samplerInfo.minFilter = VK_FILTER_NEAREST;
+			samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+			samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+			samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+			samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+			samplerInfo.maxAnisotropy = 1.0f;
+			samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+			VK_CHECK_RESULT(vkCreateSampler(device->logicalDevice, &samplerInfo, nullptr, &placeholder.sampler));
+
+			VkImageViewCreateInfo viewInfo = vks::initializers::imageViewCreateInfo();
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = placeholder.format;
+			viewInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
+			viewInfo.subresourceRange = subresourceRange;
+			viewInfo.image = placeholder.image;
+			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewInfo, nullptr, &placeholder.view));
+
+			placeholder.descriptor.sampler = placeholder.sampler;
+			placeholder.descriptor.imageView = placeholder.view;
+			placeholder.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		}
+	};
+}
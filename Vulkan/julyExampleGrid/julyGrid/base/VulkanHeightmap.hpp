@@ -6,31 +6,50 @@
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
-#include <glm/glm.hpp>
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include <glm/glm.hpp>
 #include <gli/gli.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define VKS_HEIGHTMAP_SSE2
+#endif
+
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
+#include "threadpool.hpp"
+#include "mappedfile.hpp"
 
 namespace vks 
 {
 	class HeightMap
 	{
 	private:
-		uint16_t *heightdata;
 		uint32_t dim;
 		uint32_t scale;
+		/** @brief Scaled heights sampled at the patch's grid positions (patchsize * patchsize) */
+		std::vector<float> heights;
+		uint32_t patchsize = 0;
 
 		vks::VulkanDevice *device = nullptr;
 		VkQueue copyQueue = VK_NULL_HANDLE;
+
 	public:
 		enum Topology { topologyTriangles, topologyQuads };
 
 		float heightScale = 1.0f;
 		float uvScale = 1.0f;
 
+		/** @brief Thread pool used for generating the terrain, if not set a temporary pool with one thread per core is used */
+		vks::ThreadPool *threadPool = nullptr;
+
 		vks::Buffer vertexBuffer;
 		vks::Buffer indexBuffer;
 
@@ -54,16 +73,12 @@ namespace vks
 		{
 			vertexBuffer.destroy();
 			indexBuffer.destroy();
-			delete[] heightdata;
 		}
 
+		/** @brief Scaled height at a grid position, clamped to the grid */
 		float getHeight(uint32_t x, uint32_t y)
 		{
-			glm::ivec2 rpos = glm::ivec2(x, y) * glm::ivec2(scale);
-			rpos.x = std::max(0, std::min(rpos.x, (int)dim - 1));
-			rpos.y = std::max(0, std::min(rpos.y, (int)dim - 1));
-			rpos /= glm::ivec2(scale);
-			return *(heightdata + (rpos.x + rpos.y * dim) * scale) / 65535.0f * heightScale;
+			return heights[std::min(x, patchsize - 1) + std::min(y, patchsize - 1) * patchsize];
 		}
 
 #if defined(__ANDROID__)
@@ -74,6 +89,7 @@ namespace vks
 		{
 			assert(device);
 			assert(copyQueue != VK_NULL_HANDLE);
+			assert(patchsize > 1);
 
 #if defined(__ANDROID__)
 			AAsset* asset = AAssetManager_open(assetManager, filename.c_str(), AASSET_MODE_STREAMING);
@@ -86,141 +102,243 @@ namespace vks
 			gli::texture2d heightTex(gli::load((const char*)textureData, size));
 			free(textureData);
 #else
-			gli::texture2d heightTex(gli::load(filename));
+			vks::vfs::File file = vks::vfs::open(filename);
+			gli::texture2d heightTex(gli::load(reinterpret_cast<const char*>(file.data()), file.size()));
 #endif
-			dim = static_cast<uint32_t>(heightTex.extent().x);
-			heightdata = new uint16_t[dim * dim];
-			memcpy(heightdata, heightTex.data(), heightTex.size());
-			this->scale = dim / patchsize;
-			this->heightScale = scale.y;
-
-			// Generate vertices
-
-			Vertex * vertices = new Vertex[patchsize * patchsize * 4];
-
-			const float wx = 2.0f;
-			const float wy = 2.0f;
-
-			for (uint32_t x = 0; x < patchsize; x++)
+			// Heights are read directly from the first mip level of the texture
+			const uint16_t *src = static_cast<const uint16_t*>(heightTex[0].data());
+			setupGrid(static_cast<uint32_t>(heightTex.extent().x), patchsize, scale.y);
+			assert(heightTex[0].size() >= static_cast<size_t>(dim) * dim * sizeof(uint16_t));
+
+			vks::ThreadPool localPool;
+			vks::ThreadPool &pool = getThreadPool(localPool);
+			const std::vector<uint32_t> columns = gridColumns();
+			pool.parallelFor(patchsize, [&](uint32_t first, uint32_t last)
 			{
-				for (uint32_t y = 0; y < patchsize; y++)
+				for (uint32_t y = first; y < last; y++)
 				{
-					uint32_t index = (x + y * patchsize);
-					vertices[index].pos[0] = (x * wx + wx / 2.0f - (float)patchsize * wx / 2.0f) * scale.x;
-					vertices[index].pos[1] = -getHeight(x, y);
-					vertices[index].pos[2] = (y * wy + wy / 2.0f - (float)patchsize * wy / 2.0f) * scale.z;
-					vertices[index].uv = glm::vec2((float)x / patchsize, (float)y / patchsize) * uvScale;
+					convertRow(src + static_cast<size_t>(sourceIndex(y)) * dim, columns, &heights[static_cast<size_t>(y) * patchsize]);
 				}
-			}
+			});
 
-			for (uint32_t y = 0; y < patchsize; y++)
-			{
-				for (uint32_t x = 0; x < patchsize; x++)
-				{
-					float dx = getHeight(x < patchsize - 1 ? x + 1 : x, y) - getHeight(x > 0 ? x - 1 : x, y);
-					if (x == 0 || x == patchsize - 1)
-						dx *= 2.0f;
+			createBuffers(pool, scale, topology);
+		}
 
-					float dy = getHeight(x, y < patchsize - 1 ? y + 1 : y) - getHeight(x, y > 0 ? y - 1 : y);
-					if (y == 0 || y == patchsize - 1)
-						dy *= 2.0f;
+		/** @brief Sample layout of a raw 16 bit little endian height field file */
+		struct RawLayout {
+			/** @brief Number of samples per row and number of rows of the whole height field */
+			uint32_t width = 0;
+			uint32_t height = 0;
+			/** @brief Edge length of square tiles stored one after another in row major order, 0 for a plain scanline layout */
+			uint32_t tileSize = 0;
+			/** @brief Size of a header preceding the samples in bytes */
+			uint64_t headerSize = 0;
+		};
 
-					glm::vec3 A = glm::vec3(1.0f, 0.0f, dx);
-					glm::vec3 B = glm::vec3(0.0f, 1.0f, dy);
+		/** @brief Square region of a height field */
+		struct Region {
+			uint32_t x = 0;
+			uint32_t y = 0;
+			/** @brief Edge length in samples, 0 uses the largest square starting at x, y */
+			uint32_t size = 0;
+		};
 
-					glm::vec3 normal = (glm::normalize(glm::cross(A, B)) + 1.0f) * 0.5f;
+		/**
+		* Load a region of a raw 16 bit height field by memory mapping the file
+		*
+		* @param filename Raw height field file (R16, scanline or tiled layout)
+		* @param layout Sample layout of the file
+		* @param region Region of the height field to generate the terrain from
+		* @param patchsize Number of vertices along an edge of the generated patch
+		* @param scale World scale of the patch, y scales the heights
+		* @param topology Primitive topology of the generated indices
+		*
+		* @note Samples are read in place through sliding windows of the file, only the samples used by the patch are paged in
+		* so height fields larger than the available memory are supported
+		*
+		* @return False if the file can't be opened, is smaller than the layout or can't be mapped
+		*/
+		bool loadFromRaw(const std::string filename, const RawLayout &layout, Region region, uint32_t patchsize, glm::vec3 scale, Topology topology)
+		{
+			assert(device);
+			assert(copyQueue != VK_NULL_HANDLE);
+			assert(patchsize > 1);
+			assert(region.x < layout.width && region.y < layout.height);
 
-					vertices[x + y * patchsize].normal = glm::vec3(normal.x, normal.z, normal.y);
-				}
+			vks::MappedFile file;
+			if (!file.open(filename))
+			{
+				std::cerr << "Could not open height field \"" << filename << "\"" << std::endl;
+				return false;
+			}
+			uint64_t sampleCount = static_cast<uint64_t>(layout.width) * layout.height;
+			if (layout.tileSize > 0)
+			{
+				const uint64_t tilesX = (layout.width + layout.tileSize - 1) / layout.tileSize;
+				const uint64_t tilesY = (layout.height + layout.tileSize - 1) / layout.tileSize;
+				sampleCount = tilesX * tilesY * layout.tileSize * layout.tileSize;
+			}
+			if (file.size() < layout.headerSize + sampleCount * sizeof(uint16_t))
+			{
+				std::cerr << "Height field \"" << filename << "\" is smaller than its layout" << std::endl;
+				return false;
 			}
 
-			// Generate indices
-
-			const uint32_t w = (patchsize - 1);
-			uint32_t *indices;
+			const uint32_t maxSize = std::min(layout.width - region.x, layout.height - region.y);
+			region.size = (region.size == 0) ? maxSize : std::min(region.size, maxSize);
+			setupGrid(region.size, patchsize, scale.y);
 
-			switch (topology)
+			vks::ThreadPool localPool;
+			vks::ThreadPool &pool = getThreadPool(localPool);
+			const std::vector<uint32_t> columns = gridColumns();
+			// Set by the first job that fails to map a window, the remaining rows are skipped
+			std::atomic<bool> failed(false);
+			pool.parallelFor(patchsize, [&](uint32_t first, uint32_t last)
 			{
-				// Indices for triangles
-			case topologyTriangles:
-			{
-				indices = new uint32_t[w * w * 6];
-				for (uint32_t x = 0; x < w; x++)
+				// Each thread slides its own window over the file
+				vks::MappedFile::Window window(file);
+				std::vector<uint16_t> samples;
+				std::vector<uint32_t> identity;
+				for (uint32_t y = first; y < last; y++)
 				{
-					for (uint32_t y = 0; y < w; y++)
+					if (failed)
 					{
-						uint32_t index = (x + y * w) * 6;
-						indices[index] = (x + y * patchsize);
-						indices[index + 1] = indices[index] + patchsize;
-						indices[index + 2] = indices[index + 1] + 1;
-
-						indices[index + 3] = indices[index + 1] + 1;
-						indices[index + 4] = indices[index] + 1;
-						indices[index + 5] = indices[index];
+						return;
 					}
-				}
-				indexCount = (patchsize - 1) * (patchsize - 1) * 6;
-				indexBufferSize = (w * w * 6) * sizeof(uint32_t);
-				break;
-			}
-			// Indices for quad patches (tessellation)
-			case topologyQuads:
-			{
-
-				indices = new uint32_t[w * w * 4];
-				for (uint32_t x = 0; x < w; x++)
-				{
-					for (uint32_t y = 0; y < w; y++)
+					const uint64_t sy = region.y + sourceIndex(y);
+					float *dst = &heights[static_cast<size_t>(y) * patchsize];
+					if (layout.tileSize == 0)
+					{
+						// Rows are contiguous, only the span covered by the grid's columns is mapped
+						const uint64_t offset = layout.headerSize + (sy * layout.width + region.x) * sizeof(uint16_t);
+						const uint16_t *row = reinterpret_cast<const uint16_t*>(window.get(offset, (columns.back() + 1) * sizeof(uint16_t)));
+						if (!row)
+						{
+							failed = true;
+							return;
+						}
+						convertRow(row, columns, dst);
+					}
+					else
 					{
-						uint32_t index = (x + y * w) * 4;
-						indices[index] = (x + y * patchsize);
-						indices[index + 1] = indices[index] + patchsize;
-						indices[index + 2] = indices[index + 1] + 1;
-						indices[index + 3] = indices[index] + 1;
+						// Tiled rows are gathered sample by sample, consecutive samples mostly share a tile and the window
+						const uint64_t tilesX = (layout.width + layout.tileSize - 1) / layout.tileSize;
+						const uint64_t tileSamples = static_cast<uint64_t>(layout.tileSize) * layout.tileSize;
+						samples.resize(patchsize);
+						for (uint32_t x = 0; x < patchsize; x++)
+						{
+							const uint64_t sx = region.x + columns[x];
+							const uint64_t index = ((sy / layout.tileSize) * tilesX + sx / layout.tileSize) * tileSamples + (sy % layout.tileSize) * layout.tileSize + (sx % layout.tileSize);
+							const uint8_t *sample = window.get(layout.headerSize + index * sizeof(uint16_t), sizeof(uint16_t));
+							if (!sample)
+							{
+								failed = true;
+								return;
+							}
+							samples[x] = static_cast<uint16_t>(sample[0] | (sample[1] << 8));
+						}
+						if (identity.empty())
+						{
+							identity.resize(patchsize);
+							for (uint32_t x = 0; x < patchsize; x++)
+							{
+								identity[x] = x;
+							}
+						}
+						convertRow(samples.data(), identity, dst);
 					}
 				}
-				indexCount = (patchsize - 1) * (patchsize - 1) * 4;
-				indexBufferSize = (w * w * 4) * sizeof(uint32_t);
-				break;
+			});
+			if (failed)
+			{
+				std::cerr << "Could not map height field \"" << filename << "\"" << std::endl;
+				return false;
 			}
 
+			createBuffers(pool, scale, topology);
+			return true;
+		}
+
+	private:
+		vks::ThreadPool &getThreadPool(vks::ThreadPool &localPool)
+		{
+			if (threadPool)
+			{
+				return *threadPool;
 			}
+			localPool.setThreadCount(std::max(std::thread::hardware_concurrency(), 1u));
+			return localPool;
+		}
 
-			assert(indexBufferSize > 0);
+		void setupGrid(uint32_t dim, uint32_t patchsize, float heightScale)
+		{
+			this->dim = dim;
+			this->patchsize = patchsize;
+			this->scale = std::max(dim / patchsize, 1u);
+			this->heightScale = heightScale;
+			heights.resize(static_cast<size_t>(patchsize) * patchsize);
+		}
 
-			vertexBufferSize = (patchsize * patchsize * 4) * sizeof(Vertex);
+		/** @brief Source column of each grid column, heights are fetched once per grid position, the normals reference each of them up to four times */
+		std::vector<uint32_t> gridColumns() const
+		{
+			std::vector<uint32_t> columns(patchsize);
+			for (uint32_t x = 0; x < patchsize; x++)
+			{
+				columns[x] = sourceIndex(x);
+			}
+			return columns;
+		}
 
-			// Generate Vulkan buffers
+		/** @brief Generate the vertices and indices from the height grid and upload them */
+		void createBuffers(vks::ThreadPool &pool, const glm::vec3 &scale, Topology topology)
+		{
+			const uint32_t w = (patchsize - 1);
+			indexCount = w * w * ((topology == topologyTriangles) ? 6 : 4);
+			indexBufferSize = indexCount * sizeof(uint32_t);
+			vertexBufferSize = static_cast<size_t>(patchsize) * patchsize * sizeof(Vertex);
+
+			// Generate Vulkan buffers, vertices and indices are written directly to the staging buffers
 
 			vks::Buffer vertexStaging, indexStaging;
 
 			// Create staging buffers
-			device->createBuffer(
+			VK_CHECK_RESULT(device->createBuffer(
 				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 				&vertexStaging,
-				vertexBufferSize,
-				vertices);
+				vertexBufferSize));
 
-			device->createBuffer(
+			VK_CHECK_RESULT(device->createBuffer(
 				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 				&indexStaging,
-				indexBufferSize,
-				indices);
+				indexBufferSize));
+
+			VK_CHECK_RESULT(vertexStaging.map());
+			VK_CHECK_RESULT(indexStaging.map());
+			Vertex *vertices = static_cast<Vertex*>(vertexStaging.mapped);
+			uint32_t *indices = static_cast<uint32_t*>(indexStaging.mapped);
+			pool.parallelFor(patchsize, [&](uint32_t first, uint32_t last)
+			{
+				generateVertices(first, last, vertices, scale);
+				generateIndices(first, std::min(last, w), indices, topology);
+			});
+			vertexStaging.unmap();
+			indexStaging.unmap();
 
 			// Device local (target) buffer
-			device->createBuffer(
+			VK_CHECK_RESULT(device->createBuffer(
 				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 				&vertexBuffer,
-				vertexBufferSize);
+				vertexBufferSize));
 
-			device->createBuffer(
+			VK_CHECK_RESULT(device->createBuffer(
 				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 				&indexBuffer,
-				indexBufferSize);
+				indexBufferSize));
 
 			// Copy from staging buffers
 			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
@@ -250,5 +368,132 @@ namespace vks
 			vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
 			vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
 		}
+
+		/** @brief Source texel index of a grid coordinate, clamped to the height map */
+		uint32_t sourceIndex(uint32_t x) const
+		{
+			return std::min(x * scale, dim - 1) / scale * scale;
+		}
+
+		/** @brief Scale the source samples of a grid row, src points to the first sample of the row */
+		void convertRow(const uint16_t *src, const std::vector<uint32_t> &columns, float *dst) const
+		{
+			const float factor = heightScale / 65535.0f;
+			uint32_t x = 0;
+#if defined(VKS_HEIGHTMAP_SSE2)
+			// Grid columns map to consecutive samples, so rows can be converted eight samples at a time
+			if (columns.back() == patchsize - 1)
+			{
+				const __m128 f = _mm_set1_ps(factor);
+				const __m128i zero = _mm_setzero_si128();
+				for (; x + 8 <= patchsize; x += 8)
+				{
+					const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+					_mm_storeu_ps(dst + x, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(h, zero)), f));
+					_mm_storeu_ps(dst + x + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(h, zero)), f));
+				}
+			}
+#endif
+			for (; x < patchsize; x++)
+			{
+				dst[x] = src[columns[x]] * factor;
+			}
+		}
+
+		/** @brief Generate positions, normals and texture coordinates of grid rows [first, last) */
+		void generateVertices(uint32_t first, uint32_t last, Vertex *vertices, const glm::vec3 &worldScale)
+		{
+			const float wx = 2.0f;
+			const float wy = 2.0f;
+			const uint32_t n = patchsize;
+			for (uint32_t y = first; y < last; y++)
+			{
+				const float *row = &heights[static_cast<size_t>(y) * n];
+				const float *rowUp = &heights[static_cast<size_t>(y > 0 ? y - 1 : y) * n];
+				const float *rowDown = &heights[static_cast<size_t>(y < n - 1 ? y + 1 : y) * n];
+				// Central differences, one sided differences at the borders are doubled to match their spacing
+				const float dyScale = (y == 0 || y == n - 1) ? 2.0f : 1.0f;
+				const float posZ = (y * wy + wy / 2.0f - (float)n * wy / 2.0f) * worldScale.z;
+				const float v = (float)y / n * uvScale;
+				Vertex *dst = vertices + static_cast<size_t>(y) * n;
+
+				uint32_t x = 0;
+				auto normal = [&](uint32_t i, float dx, float dy)
+				{
+					// normalize(cross((1, 0, dx), (0, 1, dy))) = (-dx, -dy, 1) / length, mapped to [0, 1] with y and z swapped
+					const float invLength = 1.0f / sqrtf(dx * dx + dy * dy + 1.0f);
+					dst[i].normal = glm::vec3((-dx * invLength + 1.0f) * 0.5f, (invLength + 1.0f) * 0.5f, (-dy * invLength + 1.0f) * 0.5f);
+				};
+				// First column uses a one sided difference
+				if (n > 1)
+				{
+					normal(0, (row[1] - row[0]) * 2.0f, (rowDown[0] - rowUp[0]) * dyScale);
+					x = 1;
+				}
+#if defined(VKS_HEIGHTMAP_SSE2)
+				const __m128 half = _mm_set1_ps(0.5f);
+				const __m128 one = _mm_set1_ps(1.0f);
+				const __m128 signMask = _mm_set1_ps(-0.0f);
+				const __m128 dyScale4 = _mm_set1_ps(dyScale);
+				for (; x + 4 < n; x += 4)
+				{
+					const __m128 dx = _mm_sub_ps(_mm_loadu_ps(row + x + 1), _mm_loadu_ps(row + x - 1));
+					const __m128 dy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(rowDown + x), _mm_loadu_ps(rowUp + x)), dyScale4);
+					const __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), one)));
+					alignas(16) float nx[4], ny[4], nz[4];
+					_mm_store_ps(nx, _mm_mul_ps(_mm_add_ps(_mm_xor_ps(_mm_mul_ps(dx, invLength), signMask), one), half));
+					_mm_store_ps(ny, _mm_mul_ps(_mm_add_ps(invLength, one), half));
+					_mm_store_ps(nz, _mm_mul_ps(_mm_add_ps(_mm_xor_ps(_mm_mul_ps(dy, invLength), signMask), one), half));
+					for (uint32_t i = 0; i < 4; i++)
+					{
+						dst[x + i].normal = glm::vec3(nx[i], ny[i], nz[i]);
+					}
+				}
+#endif
+				for (; x < n; x++)
+				{
+					const uint32_t right = (x < n - 1) ? x + 1 : x;
+					const float dx = (row[right] - row[x - 1]) * ((x == n - 1) ? 2.0f : 1.0f);
+					normal(x, dx, (rowDown[x] - rowUp[x]) * dyScale);
+				}
+
+				for (x = 0; x < n; x++)
+				{
+					dst[x].pos = glm::vec3((x * wx + wx / 2.0f - (float)n * wx / 2.0f) * worldScale.x, -row[x], posZ);
+					dst[x].uv = glm::vec2((float)x / n * uvScale, v);
+				}
+			}
+		}
+
+		/** @brief Generate the indices of the grid cells in rows [first, last) */
+		void generateIndices(uint32_t first, uint32_t last, uint32_t *indices, Topology topology)
+		{
+			const uint32_t w = patchsize - 1;
+			for (uint32_t y = first; y < last; y++)
+			{
+				for (uint32_t x = 0; x < w; x++)
+				{
+					const uint32_t base = x + y * patchsize;
+					if (topology == topologyTriangles)
+					{
+						uint32_t *index = indices + static_cast<size_t>(x + y * w) * 6;
+						index[0] = base;
+						index[1] = base + patchsize;
+						index[2] = base + patchsize + 1;
+						index[3] = base + patchsize + 1;
+						index[4] = base + 1;
+						index[5] = base;
+					}
+					else
+					{
+						uint32_t *index = indices + static_cast<size_t>(x + y * w) * 4;
+						index[0] = base;
+						index[1] = base + patchsize;
+						index[2] = base + patchsize + 1;
+						index[3] = base + 1;
+					}
+				}
+			}
+		}
 	};
 }
@@ -0,0 +1,609 @@
+/*
+* Hierarchical-Z (Hi-Z) occlusion culling
+*
+* Builds a depth pyramid with compute from the depth buffer created by the example base
+* and tests object bounds against it in a culling compute shader that writes indirect draw commands
+*
+* Uses a two-phase scheme to avoid popping of objects that become visible:
+*	Phase 1 (early): Objects are frustum culled and tested against the pyramid built from the previous frame's depth
+*	Phase 2 (late): After the early objects have been drawn, the pyramid is rebuilt from the current depth
+*	and all objects rejected by the early phase are tested again, newly visible objects are drawn in a second pass
+*
+* Typical frame:
+*	cmdBuildPyramid (previous frame's depth) -> cmdCull(PHASE_EARLY) -> render pass (clear) + cmdDraw(PHASE_EARLY)
+*	-> cmdBuildPyramid (current depth) -> cmdCull(PHASE_LATE) -> render pass (load) + cmdDraw(PHASE_LATE)
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "frustum.hpp"
+
+#include <glm/glm.hpp>
+
+namespace vks
+{
+	class HiZCulling
+	{
+	public:
+		enum Phase { PHASE_EARLY = 0, PHASE_LATE = 1 };
+
+		vks::VulkanDevice *device = nullptr;
+
+		/** @brief Compute shaders for the pyramid reduction and the culling pass (must be set before calling prepare) */
+		struct {
+			VkPipelineShaderStageCreateInfo reduce;
+			VkPipelineShaderStageCreateInfo cull;
+		} shaders;
+
+		/**
+		* @brief Per object data as read by the culling shader
+		* @note Matches the std430 layout of the ObjectData struct in hizcull.comp
+		*/
+		struct ObjectData {
+			// World space bounding box (w unused)
+			glm::vec4 boundsMin;
+			glm::vec4 boundsMax;
+			// Draw parameters for the object's indexed draw
+			uint32_t indexCount;
+			uint32_t firstIndex;
+			int32_t vertexOffset;
+			uint32_t pad;
+		};
+
+		/** @brief Culling statistics of the last completed frame */
+		struct Statistics {
+			// Objects drawn in the early phase
+			uint32_t earlyDrawn;
+			// Objects that became visible and were drawn in the late phase
+			uint32_t lateDrawn;
+			// Objects outside of the view frustum
+			uint32_t frustumCulled;
+			// Objects inside of the frustum but hidden behind occluders
+			uint32_t occluded;
+		};
+
+		/** @brief Object data, visibility and draw command buffers */
+		vks::Buffer objectBuffer;
+		vks::Buffer visibilityBuffer;
+		vks::Buffer statisticsBuffer;
+		vks::Buffer uniformBuffer;
+		// Indirect draw commands written by the early and late culling phase (one per object, culled objects have an instance count of zero)
+		vks::Buffer drawCommandBuffers[2];
+
+		uint32_t maxObjectCount = 0;
+		uint32_t objectCount = 0;
+
+		struct {
+			VkImage image = VK_NULL_HANDLE;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			// View of the complete mip chain used for sampling
+			VkImageView view = VK_NULL_HANDLE;
+			// Single level views used as storage image targets for the reduction
+			std::vector<VkImageView> levelViews;
+			uint32_t width = 0;
+			uint32_t height = 0;
+			uint32_t levels = 0;
+		} pyramid;
+
+		/**
+		* Create buffers, pipelines and descriptor layouts
+		*
+		* @param device Vulkan device to create the resources on
+		* @param maxObjectCount Maximum number of objects that can be culled per frame
+		* @param pipelineCache Pipeline cache used for the compute pipelines
+		*/
+		void prepare(vks::VulkanDevice *device, uint32_t maxObjectCount, VkPipelineCache pipelineCache)
+		{
+			assert(shaders.reduce.module && shaders.cull.module);
+			// The culling shader passes the object index to the draws as firstInstance of the indirect commands
+			if (!device->enabledFeatures.drawIndirectFirstInstance) {
+				vks::tools::exitFatal("Hi-Z culling requires the drawIndirectFirstInstance device feature to be enabled!", -1);
+			}
+			this->device = device;
+			this->maxObjectCount = maxObjectCount;
+			uniformData.maxObjectCount = maxObjectCount;
+
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&objectBuffer,
+				maxObjectCount * sizeof(ObjectData)));
+			VK_CHECK_RESULT(objectBuffer.map());
+
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&visibilityBuffer,
+				maxObjectCount * sizeof(uint32_t)));
+
+			for (auto &drawCommandBuffer : drawCommandBuffers) {
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					&drawCommandBuffer,
+					maxObjectCount * sizeof(VkDrawIndexedIndirectCommand)));
+			}
+
+			// Statistics are written by the GPU and read back on the host after the frame's fence has been signaled
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&statisticsBuffer,
+				sizeof(Statistics)));
+			VK_CHECK_RESULT(statisticsBuffer.map());
+
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&uniformBuffer,
+				sizeof(uniformData)));
+			VK_CHECK_RESULT(uniformBuffer.map());
+
+			// Nearest filtering, the reduction takes the maximum depth explicitly
+			VkSamplerCreateInfo samplerCI = vks::initializers::samplerCreateInfo();
+			samplerCI.magFilter = VK_FILTER_NEAREST;
+			samplerCI.minFilter = VK_FILTER_NEAREST;
+			samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+			samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			samplerCI.minLod = 0.0f;
+			samplerCI.maxLod = VK_LOD_CLAMP_NONE;
+			samplerCI.maxAnisotropy = 1.0f;
+			VK_CHECK_RESULT(vkCreateSampler(device->logicalDevice, &samplerCI, nullptr, &sampler));
+
+			// Reduction: input (depth buffer or previous pyramid level) and output level
+			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+			};
+			VkDescriptorSetLayoutCreateInfo descriptorLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &reduce.descriptorSetLayout));
+
+			VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(glm::uvec4), 0);
+			VkPipelineLayoutCreateInfo pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(&reduce.descriptorSetLayout, 1);
+			pipelineLayoutCI.pushConstantRangeCount = 1;
+			pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+			VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutCI, nullptr, &reduce.pipelineLayout));
+
+			VkComputePipelineCreateInfo computePipelineCI = vks::initializers::computePipelineCreateInfo(reduce.pipelineLayout, 0);
+			computePipelineCI.stage = shaders.reduce;
+			VK_CHECK_RESULT(vkCreateComputePipelines(device->logicalDevice, pipelineCache, 1, &computePipelineCI, nullptr, &reduce.pipeline));
+
+			// Culling: objects, visibility, draw commands, statistics, uniforms and the depth pyramid
+			setLayoutBindings = {
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 5),
+			};
+			descriptorLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &cull.descriptorSetLayout));
+
+			pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(uint32_t), 0);
+			pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(&cull.descriptorSetLayout, 1);
+			pipelineLayoutCI.pushConstantRangeCount = 1;
+			pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+			VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutCI, nullptr, &cull.pipelineLayout));
+
+			computePipelineCI = vks::initializers::computePipelineCreateInfo(cull.pipelineLayout, 0);
+			computePipelineCI.stage = shaders.cull;
+			VK_CHECK_RESULT(vkCreateComputePipelines(device->logicalDevice, pipelineCache, 1, &computePipelineCI, nullptr, &cull.pipeline));
+		}
+
+		/**
+		* (Re)create the depth pyramid for the given depth buffer
+		*
+		* @param depthImage Depth (stencil) image created by VulkanExampleBase::setupDepthStencil (must have been created with VK_IMAGE_USAGE_SAMPLED_BIT, exits if the format can't be sampled)
+		* @param depthFormat Format of the depth image
+		* @param width Width of the depth image
+		* @param height Height of the depth image
+		* @param queue Queue used for the initial layout transition of the depth image
+		*
+		* @note Needs to be called again after the depth buffer has been recreated (e.g. on window resize)
+		*/
+		void setDepthBuffer(VkImage depthImage, VkFormat depthFormat, uint32_t width, uint32_t height, VkQueue queue)
+		{
+			assert(device);
+			// The pyramid is built by sampling the depth buffer, which is only created with sampled usage if the format supports it
+			VkFormatProperties formatProps;
+			vkGetPhysicalDeviceFormatProperties(device->physicalDevice, depthFormat, &formatProps);
+			if (!(formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+				vks::tools::exitFatal("Hi-Z culling requires a depth format that supports sampling!", -1);
+			}
+			destroyPyramid();
+
+			this->depthImage = depthImage;
+			depthAspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+			if ((depthFormat == VK_FORMAT_D16_UNORM_S8_UINT) || (depthFormat == VK_FORMAT_D24_UNORM_S8_UINT) || (depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT)) {
+				depthAspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+			}
+
+			// Depth only view for sampling
+			VkImageViewCreateInfo viewCI = vks::initializers::imageViewCreateInfo();
+			viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewCI.format = depthFormat;
+			viewCI.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+			viewCI.image = depthImage;
+			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewCI, nullptr, &depthView));
+
+			// Pyramid uses the previous power of two of the depth buffer dimensions so that each level halves exactly
+			pyramid.width = previousPowerOfTwo(width);
+			pyramid.height = previousPowerOfTwo(height);
+			pyramid.levels = 1;
+			while ((std::max(pyramid.width, pyramid.height) >> pyramid.levels) > 0) {
+				pyramid.levels++;
+			}
+			depthWidth = width;
+			depthHeight = height;
+
+			VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+			imageCI.imageType = VK_IMAGE_TYPE_2D;
+			imageCI.format = VK_FORMAT_R32_SFLOAT;
+			imageCI.extent = { pyramid.width, pyramid.height, 1 };
+			imageCI.mipLevels = pyramid.levels;
+			imageCI.arrayLayers = 1;
+			imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCI, nullptr, &pyramid.image));
+
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(device->logicalDevice, pyramid.image, &memReqs);
+			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+			memAlloc.allocationSize = memReqs.size;
+			memAlloc.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAlloc, nullptr, &pyramid.memory));
+			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, pyramid.image, pyramid.memory, 0));
+
+			viewCI.format = VK_FORMAT_R32_SFLOAT;
+			viewCI.image = pyramid.image;
+			viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramid.levels, 0, 1 };
+			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewCI, nullptr, &pyramid.view));
+			pyramid.levelViews.resize(pyramid.levels);
+			for (uint32_t i = 0; i < pyramid.levels; i++) {
+				viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1 };
+				VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewCI, nullptr, &pyramid.levelViews[i]));
+			}
+
+			// The pyramid stays in general layout (written as storage image, read as sampled image)
+			// The depth buffer is moved to the attachment layout so that the first pyramid build doesn't read from an undefined layout
+			VkCommandBuffer layoutCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			vks::tools::setImageLayout(layoutCmd, pyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, { VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramid.levels, 0, 1 });
+			vks::tools::setImageLayout(layoutCmd, depthImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, { depthAspectMask, 0, 1, 0, 1 });
+			vkCmdFillBuffer(layoutCmd, visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+			device->flushCommandBuffer(layoutCmd, queue, true);
+
+			// No depth from a previous frame yet
+			frameCount = 0;
+
+			setupDescriptorSets();
+		}
+
+		/**
+		* Set the objects to be culled
+		*
+		* @param objects Bounds and draw parameters for each object, the object index is passed to the draws as firstInstance
+		*/
+		void setObjects(const std::vector<ObjectData> &objects)
+		{
+			assert(objects.size() <= maxObjectCount);
+			objectCount = static_cast<uint32_t>(objects.size());
+			memcpy(objectBuffer.mapped, objects.data(), objects.size() * sizeof(ObjectData));
+			uniformData.objectCount = objectCount;
+		}
+
+		/**
+		* Update the culling uniforms, must be called once per frame before submitting the frame's command buffer
+		*
+		* @param viewProjection Combined view and projection matrix of the current frame
+		*/
+		void update(const glm::mat4 &viewProjection)
+		{
+			// The early phase tests against the pyramid built from last frame's depth, so it needs the matrix that depth was rendered with
+			// Until a frame has been rendered there is no previous depth and the early phase only does frustum culling
+			uniformData.previousValid = (frameCount > 0) ? 1 : 0;
+			uniformData.previousViewProjection = (frameCount > 0) ? uniformData.viewProjection : viewProjection;
+			uniformData.viewProjection = viewProjection;
+			vks::Frustum frustum;
+			frustum.update(viewProjection);
+			for (size_t i = 0; i < frustum.planes.size(); i++) {
+				uniformData.frustumPlanes[i] = frustum.planes[i];
+			}
+			uniformData.pyramidSize = glm::vec2(static_cast<float>(pyramid.width), static_cast<float>(pyramid.height));
+			uniformData.pyramidLevels = pyramid.levels;
+			memcpy(uniformBuffer.mapped, &uniformData, sizeof(uniformData));
+			frameCount++;
+		}
+
+		/**
+		* Build the depth pyramid from the current contents of the depth buffer
+		*
+		* @note Must be recorded outside of a render pass, the depth buffer is expected to be in VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL and is returned to it
+		*/
+		void cmdBuildPyramid(VkCommandBuffer commandBuffer)
+		{
+			VkImageSubresourceRange depthRange = { depthAspectMask, 0, 1, 0, 1 };
+
+			vks::tools::insertImageMemoryBarrier(
+				commandBuffer,
+				depthImage,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				depthRange);
+
+			// Previous readers of the pyramid (culling pass) need to finish before it's overwritten
+			vks::tools::insertImageMemoryBarrier(
+				commandBuffer,
+				pyramid.image,
+				VK_ACCESS_SHADER_READ_BIT,
+				VK_ACCESS_SHADER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_GENERAL,
+				VK_IMAGE_LAYOUT_GENERAL,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				{ VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramid.levels, 0, 1 });
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.pipeline);
+			for (uint32_t i = 0; i < pyramid.levels; i++) {
+				const uint32_t levelWidth = std::max(1u, pyramid.width >> i);
+				const uint32_t levelHeight = std::max(1u, pyramid.height >> i);
+				// x, y = output size, z, w = input size
+				glm::uvec4 pushConstants(levelWidth, levelHeight, i == 0 ? depthWidth : std::max(1u, pyramid.width >> (i - 1)), i == 0 ? depthHeight : std::max(1u, pyramid.height >> (i - 1)));
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.pipelineLayout, 0, 1, &reduce.descriptorSets[i], 0, nullptr);
+				vkCmdPushConstants(commandBuffer, reduce.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+				vkCmdDispatch(commandBuffer, (levelWidth + 15) / 16, (levelHeight + 15) / 16, 1);
+
+				// Next level reads the one just written
+				vks::tools::insertImageMemoryBarrier(
+					commandBuffer,
+					pyramid.image,
+					VK_ACCESS_SHADER_WRITE_BIT,
+					VK_ACCESS_SHADER_READ_BIT,
+					VK_IMAGE_LAYOUT_GENERAL,
+					VK_IMAGE_LAYOUT_GENERAL,
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					{ VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1 });
+			}
+
+			vks::tools::insertImageMemoryBarrier(
+				commandBuffer,
+				depthImage,
+				VK_ACCESS_SHADER_READ_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+				depthRange);
+		}
+
+		/**
+		* Run the culling shader for the given phase, writes the draw commands for that phase
+		*
+		* @note Must be recorded outside of a render pass
+		*/
+		void cmdCull(VkCommandBuffer commandBuffer, Phase phase)
+		{
+			if (phase == PHASE_EARLY) {
+				// Statistics are accumulated over both phases
+				vkCmdFillBuffer(commandBuffer, statisticsBuffer.buffer, 0, sizeof(Statistics), 0);
+				VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+				memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+			}
+
+			// Draw commands may still be consumed by a previous indirect draw
+			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+			bufferBarrier.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.buffer = drawCommandBuffers[phase].buffer;
+			bufferBarrier.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+			uint32_t phaseIndex = static_cast<uint32_t>(phase);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull.pipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull.pipelineLayout, 0, 1, &cull.descriptorSets[phase], 0, nullptr);
+			vkCmdPushConstants(commandBuffer, cull.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &phaseIndex);
+			vkCmdDispatch(commandBuffer, (maxObjectCount + 63) / 64, 1, 1);
+
+			// Make the draw commands visible to the indirect draw and the visibility flags to the next phase
+			bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+			VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+			memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		/**
+		* Issue the indirect draws written by the culling shader for the given phase
+		*
+		* @note Vertex and index buffers, pipeline and descriptors need to be bound by the caller
+		* @note Uses multi draws of up to maxDrawIndirectCount commands if supported by the device, one indirect draw per object otherwise
+		*/
+		void cmdDraw(VkCommandBuffer commandBuffer, Phase phase)
+		{
+			if (device->enabledFeatures.multiDrawIndirect) {
+				const uint32_t maxDrawCount = std::max(device->properties.limits.maxDrawIndirectCount, 1u);
+				for (uint32_t first = 0; first < objectCount; first += maxDrawCount) {
+					const uint32_t drawCount = std::min(objectCount - first, maxDrawCount);
+					vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffers[phase].buffer, first * sizeof(VkDrawIndexedIndirectCommand), drawCount, sizeof(VkDrawIndexedIndirectCommand));
+				}
+			} else {
+				for (uint32_t i = 0; i < objectCount; i++) {
+					vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffers[phase].buffer, i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+				}
+			}
+		}
+
+		/**
+		* Returns the statistics written by the last frame
+		*
+		* @note Only valid after the fence of the frame that did the culling has been signaled
+		*/
+		Statistics getStatistics()
+		{
+			Statistics statistics;
+			memcpy(&statistics, statisticsBuffer.mapped, sizeof(Statistics));
+			return statistics;
+		}
+
+		/** @brief Release all Vulkan resources */
+		void destroy()
+		{
+			if (!device) {
+				return;
+			}
+			destroyPyramid();
+			objectBuffer.destroy();
+			visibilityBuffer.destroy();
+			statisticsBuffer.destroy();
+			uniformBuffer.destroy();
+			for (auto &drawCommandBuffer : drawCommandBuffers) {
+				drawCommandBuffer.destroy();
+			}
+			vkDestroySampler(device->logicalDevice, sampler, nullptr);
+			vkDestroyPipeline(device->logicalDevice, reduce.pipeline, nullptr);
+			vkDestroyPipelineLayout(device->logicalDevice, reduce.pipelineLayout, nullptr);
+			vkDestroyDescriptorSetLayout(device->logicalDevice, reduce.descriptorSetLayout, nullptr);
+			vkDestroyPipeline(device->logicalDevice, cull.pipeline, nullptr);
+			vkDestroyPipelineLayout(device->logicalDevice, cull.pipelineLayout, nullptr);
+			vkDestroyDescriptorSetLayout(device->logicalDevice, cull.descriptorSetLayout, nullptr);
+			device = nullptr;
+		}
+
+	private:
+		struct {
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+			VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+			std::vector<VkDescriptorSet> descriptorSets;
+		} reduce;
+
+		struct {
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+			VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+			VkDescriptorSet descriptorSets[2];
+		} cull;
+
+		// Matches the uniform block in hizcull.comp
+		struct {
+			glm::mat4 viewProjection;
+			glm::mat4 previousViewProjection;
+			glm::vec4 frustumPlanes[6];
+			glm::vec2 pyramidSize;
+			uint32_t pyramidLevels = 0;
+			uint32_t objectCount = 0;
+			uint32_t previousValid = 0;
+			uint32_t maxObjectCount = 0;
+		} uniformData;
+
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkSampler sampler = VK_NULL_HANDLE;
+		VkImage depthImage = VK_NULL_HANDLE;
+		VkImageView depthView = VK_NULL_HANDLE;
+		VkImageAspectFlags depthAspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		uint32_t depthWidth = 0;
+		uint32_t depthHeight = 0;
+		uint32_t frameCount = 0;
+
+		static uint32_t previousPowerOfTwo(uint32_t v)
+		{
+			uint32_t r = 1;
+			while ((r << 1) <= v) {
+				r <<= 1;
+			}
+			return r;
+		}
+
+		void setupDescriptorSets()
+		{
+			std::vector<VkDescriptorPoolSize> poolSizes = {
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, pyramid.levels + 2),
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, pyramid.levels),
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8),
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
+			};
+			VkDescriptorPoolCreateInfo descriptorPoolCI = vks::initializers::descriptorPoolCreateInfo(poolSizes, pyramid.levels + 2);
+			VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolCI, nullptr, &descriptorPool));
+
+			reduce.descriptorSets.resize(pyramid.levels);
+			for (uint32_t i = 0; i < pyramid.levels; i++) {
+				VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &reduce.descriptorSetLayout, 1);
+				VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &reduce.descriptorSets[i]));
+				// Level 0 reduces the depth buffer, all others the previous pyramid level
+				VkDescriptorImageInfo inputDescriptor = (i == 0) ?
+					vks::initializers::descriptorImageInfo(sampler, depthView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) :
+					vks::initializers::descriptorImageInfo(sampler, pyramid.levelViews[i - 1], VK_IMAGE_LAYOUT_GENERAL);
+				VkDescriptorImageInfo outputDescriptor = vks::initializers::descriptorImageInfo(VK_NULL_HANDLE, pyramid.levelViews[i], VK_IMAGE_LAYOUT_GENERAL);
+				std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+					vks::initializers::writeDescriptorSet(reduce.descriptorSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &inputDescriptor),
+					vks::initializers::writeDescriptorSet(reduce.descriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &outputDescriptor),
+				};
+				vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+			}
+
+			VkDescriptorImageInfo pyramidDescriptor = vks::initializers::descriptorImageInfo(sampler, pyramid.view, VK_IMAGE_LAYOUT_GENERAL);
+			for (uint32_t i = 0; i < 2; i++) {
+				VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &cull.descriptorSetLayout, 1);
+				VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &cull.descriptorSets[i]));
+				std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+					vks::initializers::writeDescriptorSet(cull.descriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &objectBuffer.descriptor),
+					vks::initializers::writeDescriptorSet(cull.descriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &visibilityBuffer.descriptor),
+					vks::initializers::writeDescriptorSet(cull.descriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &drawCommandBuffers[i].descriptor),
+					vks::initializers::writeDescriptorSet(cull.descriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &statisticsBuffer.descriptor),
+					vks::initializers::writeDescriptorSet(cull.descriptorSets[i], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &uniformBuffer.descriptor),
+					vks::initializers::writeDescriptorSet(cull.descriptorSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &pyramidDescriptor),
+				};
+				vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+			}
+		}
+
+		void destroyPyramid()
+		{
+			if (descriptorPool) {
+				vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
+				descriptorPool = VK_NULL_HANDLE;
+			}
+			for (auto view : pyramid.levelViews) {
+				vkDestroyImageView(device->logicalDevice, view, nullptr);
+			}
+			pyramid.levelViews.clear();
+			if (pyramid.view) {
+				vkDestroyImageView(device->logicalDevice, pyramid.view, nullptr);
+				vkDestroyImage(device->logicalDevice, pyramid.image, nullptr);
+				vkFreeMemory(device->logicalDevice, pyramid.memory, nullptr);
+				pyramid.view = VK_NULL_HANDLE;
+				pyramid.image = VK_NULL_HANDLE;
+				pyramid.memory = VK_NULL_HANDLE;
+			}
+			if (depthView) {
+				vkDestroyImageView(device->logicalDevice, depthView, nullptr);
+				depthView = VK_NULL_HANDLE;
+			}
+		}
+	};
+}
@@ -0,0 +1,469 @@
+/*
+* Mip level texture streaming
+*
+* Keeps the coarse mip tail of every texture resident and streams finer levels in on demand
+* Demand comes from a GPU feedback buffer (see shadersJuly/base/mipfeedback.frag) or from CPU estimates of the screen space size,
+* when the memory budget is exceeded the finest levels of the textures that have gone unseen the longest are evicted
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <cfloat>
+#include <thread>
+
+#include "vulkan/vulkan.h"
+
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "VulkanInitializers.hpp"
+#include "VulkanAssetStreamer.hpp"
+#include "ktxfile.hpp"
+#include "vfs.hpp"
+
+namespace vks
+{
+	class MipStreamer
+	{
+	public:
+		/** @brief Streamed texture, its view only covers the resident levels so sampling is implicitly clamped to them */
+		class Texture {
+		public:
+			/** @brief Slot of the texture in the feedback buffer */
+			uint32_t index = 0;
+			std::string filename;
+			/** @brief Format and level extents, level offsets point into the mapped file */
+			ktx::Image layout;
+			uint32_t levelCount = 0;
+			/** @brief Finest level of the always resident mip tail */
+			uint32_t tailLevel = 0;
+			/** @brief Finest resident level, levelCount while nothing is resident yet */
+			uint32_t residentLevel = 0;
+			VkImage image = VK_NULL_HANDLE;
+			VkDeviceMemory deviceMemory = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			VkDeviceSize memorySize = 0;
+			/** @brief Points at the streamer's placeholder until the tail is resident */
+			VkDescriptorImageInfo descriptor = {};
+			/** @brief Called whenever the view changed, e.g. to update descriptor sets that use the texture */
+			std::function<void(Texture *texture)> onChanged;
+		private:
+			friend class MipStreamer;
+			vks::vfs::File file;
+			// Finest level requested since the last update
+			uint32_t requestedLevel = 0;
+			uint64_t lastRequestFrame = 0;
+			// Residency change in flight, only one per texture at a time
+			std::shared_ptr<AssetStreamer::Request> pending;
+			int64_t pendingDelta = 0;
+			VkImage nextImage = VK_NULL_HANDLE;
+			VkDeviceMemory nextMemory = VK_NULL_HANDLE;
+			VkImageView nextView = VK_NULL_HANDLE;
+			VkDeviceSize nextMemorySize = 0;
+		};
+
+	private:
+		// Images replaced by a residency change, destroyed once no frame in flight can still use them
+		struct Retired {
+			VkImage image;
+			VkDeviceMemory deviceMemory;
+			VkImageView view;
+			uint64_t frame;
+		};
+
+		vks::VulkanDevice *device;
+		AssetStreamer *streamer;
+		VkDeviceSize memoryBudget;
+		uint32_t maxTextures;
+		uint32_t framesInFlight;
+		uint64_t frame = 1;
+		VkDeviceSize residentMemory = 0;
+		std::vector<std::unique_ptr<Texture>> textures;
+		std::vector<Retired> retired;
+
+		static VkDeviceSize getLevelSize(const Texture *texture, uint32_t first, uint32_t last)
+		{
+			VkDeviceSize size = 0;
+			for (uint32_t level = first; level < last; level++) {
+				size += texture->layout.levels[level].size;
+			}
+			return size;
+		}
+
+		void destroyImage(VkImage image, VkDeviceMemory deviceMemory, VkImageView view)
+		{
+			vkDestroyImageView(device->logicalDevice, view, nullptr);
+			vkDestroyImage(device->logicalDevice, image, nullptr);
+			vkFreeMemory(device->logicalDevice, deviceMemory, nullptr);
+		}
+
+		/** @brief Records the copies into a new image that holds levels [newLevel, levelCount) of the texture */
+		void recordResidencyChange(VkCommandBuffer commandBuffer, Texture *texture, uint32_t newLevel, VkBuffer staging, VkDeviceSize offset)
+		{
+			const uint32_t oldLevel = texture->residentLevel;
+			const ktx::Image &layout = texture->layout;
+
+			VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageCreateInfo.format = layout.format;
+			imageCreateInfo.mipLevels = texture->levelCount - newLevel;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageCreateInfo.extent = { layout.levels[newLevel].width, layout.levels[newLevel].height, 1 };
+			imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &texture->nextImage));
+
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(device->logicalDevice, texture->nextImage, &memReqs);
+			VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
+			memAllocInfo.allocationSize = memReqs.size;
+			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &texture->nextMemory));
+			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, texture->nextImage, texture->nextMemory, 0));
+			texture->nextMemorySize = memReqs.size;
+
+			VkImageSubresourceRange newRange = {};
+			newRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			newRange.levelCount = imageCreateInfo.mipLevels;
+			newRange.layerCount = 1;
+			vks::tools::setImageLayout(commandBuffer, texture->nextImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, newRange);
+
+			// Levels both images share are copied on the GPU
+			if (texture->image != VK_NULL_HANDLE) {
+				VkImageSubresourceRange oldRange = newRange;
+				oldRange.levelCount = texture->levelCount - oldLevel;
+				vks::tools::setImageLayout(commandBuffer, texture->image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, oldRange);
+				std::vector<VkImageCopy> copies;
+				for (uint32_t level = std::max(newLevel, oldLevel); level < texture->levelCount; level++) {
+					VkImageCopy copy = {};
+					copy.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - oldLevel, 0, 1 };
+					copy.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - newLevel, 0, 1 };
+					copy.extent = { layout.levels[level].width, layout.levels[level].height, 1 };
+					copies.push_back(copy);
+				}
+				vkCmdCopyImage(commandBuffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture->nextImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copies.size()), copies.data());
+				vks::tools::setImageLayout(commandBuffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, oldRange);
+			}
+
+			// Levels that weren't resident before come from the staging buffer, packed in level order by the load callback
+			std::vector<VkBufferImageCopy> regions;
+			VkDeviceSize bufferOffset = offset;
+			for (uint32_t level = newLevel; level < std::min(oldLevel, texture->levelCount); level++) {
+				VkBufferImageCopy region = {};
+				region.bufferOffset = bufferOffset;
+				region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - newLevel, 0, 1 };
+				region.imageExtent = { layout.levels[level].width, layout.levels[level].height, 1 };
+				regions.push_back(region);
+				bufferOffset += layout.levels[level].size;
+			}
+			if (!regions.empty()) {
+				vkCmdCopyBufferToImage(commandBuffer, staging, texture->nextImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+			}
+			vks::tools::setImageLayout(commandBuffer, texture->nextImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, newRange);
+
+			VkImageViewCreateInfo viewInfo = vks::initializers::imageViewCreateInfo();
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = layout.format;
+			viewInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
+			viewInfo.subresourceRange = newRange;
+			viewInfo.image = texture->nextImage;
+			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewInfo, nullptr, &texture->nextView));
+		}
+
+		/**
+		* Queue a change of the finest resident level, finer levels are read from the file and coarser ones are copied from the current image
+		*
+		* @param priority Upload priority, the mip tail of new textures uses the highest one
+		*/
+		void changeResidency(Texture *texture, uint32_t newLevel, float priority)
+		{
+			assert(!texture->pending && (newLevel != texture->residentLevel));
+			const uint32_t oldLevel = texture->residentLevel;
+			texture->pendingDelta = (newLevel < oldLevel) ? static_cast<int64_t>(getLevelSize(texture, newLevel, std::min(oldLevel, texture->levelCount))) : -static_cast<int64_t>(getLevelSize(texture, oldLevel, newLevel));
+
+			auto request = std::make_shared<AssetStreamer::Request>();
+			request->priority = priority;
+			request->load = [texture, newLevel, oldLevel](AssetStreamer::Payload &payload) {
+				const uint32_t last = std::min(oldLevel, texture->levelCount);
+				if (newLevel >= last) {
+					return true;
+				}
+				payload.data.resize(static_cast<size_t>(getLevelSize(texture, newLevel, last)));
+				size_t offset = 0;
+				for (uint32_t level = newLevel; level < last; level++) {
+					const mipgen::Level &source = texture->layout.levels[level];
+					memcpy(payload.data.data() + offset, texture->file.data() + source.offset, source.size);
+					offset += source.size;
+				}
+				return true;
+			};
+			request->upload = [this, texture, newLevel](VkCommandBuffer commandBuffer, VkBuffer staging, VkDeviceSize offset, const AssetStreamer::Payload &) {
+				recordResidencyChange(commandBuffer, texture, newLevel, staging, offset);
+			};
+			request->complete = [this, texture, newLevel](bool success) {
+				texture->pending.reset();
+				texture->pendingDelta = 0;
+				if (!success) {
+					return;
+				}
+				// Frames recorded before this point may still sample the old image
+				if (texture->image != VK_NULL_HANDLE) {
+					retired.push_back({ texture->image, texture->deviceMemory, texture->view, frame });
+				}
+				residentMemory += texture->nextMemorySize;
+				residentMemory -= texture->memorySize;
+				texture->image = texture->nextImage;
+				texture->deviceMemory = texture->nextMemory;
+				texture->view = texture->nextView;
+				texture->memorySize = texture->nextMemorySize;
+				texture->nextImage = VK_NULL_HANDLE;
+				texture->nextMemory = VK_NULL_HANDLE;
+				texture->nextView = VK_NULL_HANDLE;
+				texture->residentLevel = newLevel;
+				texture->descriptor.sampler = sampler;
+				texture->descriptor.imageView = texture->view;
+				texture->descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				if (texture->onChanged) {
+					texture->onChanged(texture);
+				}
+			};
+			texture->pending = request;
+			streamer->enqueue(request);
+		}
+
+		/** @brief Texture whose finest level is dropped next, the one unseen the longest with levels above its tail */
+		Texture *findEvictionCandidate()
+		{
+			Texture *candidate = nullptr;
+			for (auto &texture : textures) {
+				if (texture->pending || (texture->lastRequestFrame == frame) || (texture->residentLevel >= texture->tailLevel)) {
+					continue;
+				}
+				if (!candidate || (texture->lastRequestFrame < candidate->lastRequestFrame)) {
+					candidate = texture.get();
+				}
+			}
+			return candidate;
+		}
+
+	public:
+		/** @brief Shared by all streamed textures, views differ in the number of levels so maxLod is left unclamped */
+		VkSampler sampler = VK_NULL_HANDLE;
+		/** @brief One uint per texture slot holding the finest level requested by the feedback pass, reset to ~0u by update */
+		vks::Buffer feedbackBuffer;
+		/** @brief Levels whose extents are both at or below this size form the always resident mip tail */
+		uint32_t tailSize = 64;
+
+		/**
+		* @param device Vulkan device the textures are created on
+		* @param streamer Asset streamer that loads and uploads the levels, must outlive this object
+		* @param memoryBudget Upper bound for the memory of all streamed textures, mip tails are always kept even if they exceed it
+		* @param maxTextures (Optional) Number of slots in the feedback buffer
+		* @param framesInFlight (Optional) Number of frames after which a replaced image is no longer in use
+		*/
+		MipStreamer(vks::VulkanDevice *device, AssetStreamer *streamer, VkDeviceSize memoryBudget, uint32_t maxTextures = 1024, uint32_t framesInFlight = 2)
+			: device(device), streamer(streamer), memoryBudget(memoryBudget), maxTextures(maxTextures), framesInFlight(framesInFlight)
+		{
+			VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo();
+			samplerInfo.magFilter = VK_FILTER_LINEAR;
+			samplerInfo.minFilter = VK_FILTER_LINEAR;
+			samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+			samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+			samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+			samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+			samplerInfo.compareOp = VK_COMPARE_OP_NEVER;
+			samplerInfo.minLod = 0.0f;
+			samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+			samplerInfo.maxAnisotropy = device->enabledFeatures.samplerAnisotropy ? device->properties.limits.maxSamplerAnisotropy : 1.0f;
+			samplerInfo.anisotropyEnable = device->enabledFeatures.samplerAnisotropy;
+			samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+			VK_CHECK_RESULT(vkCreateSampler(device->logicalDevice, &samplerInfo, nullptr, &sampler));
+
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &feedbackBuffer, maxTextures * sizeof(uint32_t)));
+			VK_CHECK_RESULT(feedbackBuffer.map());
+			memset(feedbackBuffer.mapped, 0xFF, maxTextures * sizeof(uint32_t));
+			feedbackBuffer.setupDescriptor();
+		}
+
+		~MipStreamer()
+		{
+			// Loads may still be reading the mapped files, so residency changes in flight are completed instead of cancelled
+			while (std::any_of(textures.begin(), textures.end(), [](const std::unique_ptr<Texture> &texture) { return texture->pending != nullptr; })) {
+				streamer->update();
+				vkDeviceWaitIdle(device->logicalDevice);
+				std::this_thread::yield();
+			}
+			for (auto &texture : textures) {
+				destroyImage(texture->image, texture->deviceMemory, texture->view);
+				destroyImage(texture->nextImage, texture->nextMemory, texture->nextView);
+			}
+			for (auto &image : retired) {
+				destroyImage(image.image, image.deviceMemory, image.view);
+			}
+			vkDestroySampler(device->logicalDevice, sampler, nullptr);
+			feedbackBuffer.destroy();
+		}
+
+		/**
+		* Open a KTX texture and queue the upload of its mip tail, finer levels are streamed on request
+		*
+		* @param filename KTX file with a full mip chain, the file stays open while the texture exists (mapped in place unless it is a compressed archive entry)
+		* @param onChanged (Optional) Called whenever the texture's view changed
+		*
+		* @return The texture, or nullptr if the file can't be read, the device can't sample its format or all feedback slots are used
+		*/
+		Texture *load(const std::string &filename, std::function<void(Texture *texture)> onChanged = nullptr)
+		{
+			if (textures.size() >= maxTextures) {
+				std::cerr << "No feedback slot left for streamed texture " << filename << std::endl;
+				return nullptr;
+			}
+			std::unique_ptr<Texture> texture(new Texture());
+			texture->filename = filename;
+			texture->onChanged = onChanged;
+			texture->file = vks::vfs::open(filename);
+			if (!texture->file.valid()) {
+				std::cerr << "Could not open streamed texture " << filename << std::endl;
+				return nullptr;
+			}
+			if (!ktx::parse(texture->file.data(), texture->file.size(), texture->layout) ||
+				!ktx::isSupported(device->physicalDevice, device->enabledFeatures, texture->layout.format)) {
+				std::cerr << "Could not stream texture " << filename << ", it is not a supported KTX file" << std::endl;
+				return nullptr;
+			}
+
+			texture->index = static_cast<uint32_t>(textures.size());
+			texture->levelCount = static_cast<uint32_t>(texture->layout.levels.size());
+			texture->tailLevel = texture->levelCount - 1;
+			while ((texture->tailLevel > 0) && (texture->layout.levels[texture->tailLevel - 1].width <= tailSize) && (texture->layout.levels[texture->tailLevel - 1].height <= tailSize)) {
+				texture->tailLevel--;
+			}
+			texture->residentLevel = texture->levelCount;
+			texture->requestedLevel = texture->levelCount;
+			texture->descriptor = streamer->placeholder.descriptor;
+
+			changeResidency(texture.get(), texture->tailLevel, FLT_MAX);
+			textures.push_back(std::move(texture));
+			return textures.back().get();
+		}
+
+		/** @brief Request a level for the next update, e.g. from a CPU side estimate, textures requested in a frame are never evicted in it */
+		void request(Texture *texture, uint32_t level)
+		{
+			texture->requestedLevel = std::min(texture->requestedLevel, level);
+			texture->lastRequestFrame = frame;
+		}
+
+		/**
+		* Request the level that matches the texture's screen space size
+		*
+		* @param screenSize Number of pixels the texture's largest extent covers on screen
+		*/
+		void requestScreenSize(Texture *texture, float screenSize)
+		{
+			const float size = static_cast<float>(std::max(texture->layout.width, texture->layout.height));
+			const float level = (screenSize > 0.0f) ? floorf(log2f(size / screenSize)) : static_cast<float>(texture->levelCount);
+			request(texture, static_cast<uint32_t>(std::min(std::max(level, 0.0f), static_cast<float>(texture->levelCount - 1))));
+		}
+
+		/** @brief Screen space size in pixels of a sphere, for use with requestScreenSize */
+		static float getScreenSize(float radius, float distance, float fovY, float viewportHeight)
+		{
+			if (distance <= radius) {
+				return viewportHeight;
+			}
+			return (radius / (tanf(fovY * 0.5f) * distance)) * viewportHeight;
+		}
+
+		/** @brief Memory of all resident levels */
+		VkDeviceSize getResidentMemory() const
+		{
+			return residentMemory;
+		}
+
+		/**
+		* Read the feedback buffer, evict unseen levels when over budget and queue the next finer level of requested textures
+		* Call once per frame after the frame that wrote the feedback buffer has finished and before the asset streamer's update
+		*/
+		void update()
+		{
+			retired.erase(std::remove_if(retired.begin(), retired.end(), [this](const Retired &image) {
+				if (frame < image.frame + framesInFlight) {
+					return false;
+				}
+				destroyImage(image.image, image.deviceMemory, image.view);
+				return true;
+			}), retired.end());
+
+			uint32_t *feedback = static_cast<uint32_t*>(feedbackBuffer.mapped);
+			for (auto &texture : textures) {
+				if (feedback[texture->index] != UINT32_MAX) {
+					request(texture.get(), std::min(feedback[texture->index], texture->levelCount - 1));
+				}
+			}
+			memset(feedbackBuffer.mapped, 0xFF, textures.size() * sizeof(uint32_t));
+
+			// Memory once all residency changes in flight have completed
+			int64_t projectedMemory = static_cast<int64_t>(residentMemory);
+			for (auto &texture : textures) {
+				projectedMemory += texture->pendingDelta;
+			}
+			const int64_t budget = static_cast<int64_t>(memoryBudget);
+
+			// Finer levels one at a time, the textures missing the most levels first
+			std::vector<Texture*> candidates;
+			for (auto &texture : textures) {
+				if (!texture->pending && (texture->residentLevel <= texture->tailLevel) && (texture->requestedLevel < texture->residentLevel)) {
+					candidates.push_back(texture.get());
+				}
+			}
+			std::sort(candidates.begin(), candidates.end(), [](const Texture *a, const Texture *b) {
+				return (a->residentLevel - a->requestedLevel) > (b->residentLevel - b->requestedLevel);
+			});
+			for (Texture *texture : candidates) {
+				const uint32_t level = texture->residentLevel - 1;
+				const int64_t size = static_cast<int64_t>(texture->layout.levels[level].size);
+				while (projectedMemory + size > budget) {
+					Texture *victim = findEvictionCandidate();
+					if (!victim) {
+						break;
+					}
+					changeResidency(victim, victim->residentLevel + 1, 0.0f);
+					projectedMemory += victim->pendingDelta;
+				}
+				if (projectedMemory + size > budget) {
+					break;
+				}
+				projectedMemory += size;
+				changeResidency(texture, level, static_cast<float>(texture->residentLevel - texture->requestedLevel));
+			}
+
+			// A lowered budget is enforced even without new requests
+			while (projectedMemory > budget) {
+				Texture *victim = findEvictionCandidate();
+				if (!victim) {
+					break;
+				}
+				changeResidency(victim, victim->residentLevel + 1, 0.0f);
+				projectedMemory += victim->pendingDelta;
+			}
+
+			for (auto &texture : textures) {
+				texture->requestedLevel = texture->levelCount;
+			}
+			frame++;
+		}
+	};
+}
@@ -9,9 +9,11 @@
 #pragma once
 
 #include <stdlib.h>
+#include <cstdio>
 #include <string>
 #include <fstream>
 #include <vector>
+#include <functional>
 
 #include "vulkan/vulkan.h"
 
@@ -19,6 +21,8 @@
 #include "../assimp/scene.h"     
 #include "../assimp/postprocess.h"
 #include "../assimp/cimport.h"
+#include "../assimp/IOStream.hpp"
+#include "../assimp/IOSystem.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -26,11 +30,21 @@
 
 #include "VulkanDevice.hpp"
 #include "VulkanBuffer.hpp"
+#include "meshoptimizer.hpp"
+#include "meshlet.hpp"
+#include "camera.hpp"
+#include "mappedfile.hpp"
+#include "vfs.hpp"
 
 #if defined(__ANDROID__)
 #include <android/asset_manager.h>
 #endif
 
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+#include <sys/stat.h>
+
 namespace vks
 {
 	/** @brief Vertex layout components */
@@ -42,7 +56,18 @@ namespace vks
 		VERTEX_COMPONENT_TANGENT = 0x4,
 		VERTEX_COMPONENT_BITANGENT = 0x5,
 		VERTEX_COMPONENT_DUMMY_FLOAT = 0x6,
-		VERTEX_COMPONENT_DUMMY_VEC4 = 0x7
+		VERTEX_COMPONENT_DUMMY_VEC4 = 0x7,
+		// Quantized components
+		// Position as 4 x 16 bit snorm (w unused) relative to the part's bounds, see ModelPart::dequantization
+		VERTEX_COMPONENT_POSITION_SNORM16 = 0x8,
+		// Unit vectors as 2 x 16 bit snorm octahedral encoding, see VertexLayout::encodeOctahedral
+		VERTEX_COMPONENT_NORMAL_OCT16 = 0x9,
+		VERTEX_COMPONENT_TANGENT_OCT16 = 0xA,
+		VERTEX_COMPONENT_BITANGENT_OCT16 = 0xB,
+		// Texture coordinates as 2 x 16 bit half float
+		VERTEX_COMPONENT_UV_HALF = 0xC,
+		// Color as 4 x 8 bit unorm (alpha is one)
+		VERTEX_COMPONENT_COLOR_UNORM8 = 0xD
 	} Component;
 
 	/** @brief Stores vertex layout components for model loading and Vulkan vertex input and atribute bindings  */
@@ -56,28 +81,167 @@ namespace vks
 			this->components = std::move(components);
 		}
 
+		/** @brief Size of a single component in bytes */
+		static uint32_t componentSize(Component component)
+		{
+			switch (component)
+			{
+			case VERTEX_COMPONENT_UV:
+				return 2 * sizeof(float);
+			case VERTEX_COMPONENT_DUMMY_FLOAT:
+				return sizeof(float);
+			case VERTEX_COMPONENT_DUMMY_VEC4:
+				return 4 * sizeof(float);
+			case VERTEX_COMPONENT_POSITION_SNORM16:
+				return 4 * sizeof(int16_t);
+			case VERTEX_COMPONENT_NORMAL_OCT16:
+			case VERTEX_COMPONENT_TANGENT_OCT16:
+			case VERTEX_COMPONENT_BITANGENT_OCT16:
+			case VERTEX_COMPONENT_UV_HALF:
+				return 2 * sizeof(int16_t);
+			case VERTEX_COMPONENT_COLOR_UNORM8:
+				return 4 * sizeof(uint8_t);
+			default:
+				// All components except the ones listed above are made up of 3 floats
+				return 3 * sizeof(float);
+			}
+		}
+
+		/** @brief Vulkan format used to fetch a component in the vertex shader */
+		static VkFormat componentFormat(Component component)
+		{
+			switch (component)
+			{
+			case VERTEX_COMPONENT_UV:
+				return VK_FORMAT_R32G32_SFLOAT;
+			case VERTEX_COMPONENT_DUMMY_FLOAT:
+				return VK_FORMAT_R32_SFLOAT;
+			case VERTEX_COMPONENT_DUMMY_VEC4:
+				return VK_FORMAT_R32G32B32A32_SFLOAT;
+			case VERTEX_COMPONENT_POSITION_SNORM16:
+				return VK_FORMAT_R16G16B16A16_SNORM;
+			case VERTEX_COMPONENT_NORMAL_OCT16:
+			case VERTEX_COMPONENT_TANGENT_OCT16:
+			case VERTEX_COMPONENT_BITANGENT_OCT16:
+				return VK_FORMAT_R16G16_SNORM;
+			case VERTEX_COMPONENT_UV_HALF:
+				return VK_FORMAT_R16G16_SFLOAT;
+			case VERTEX_COMPONENT_COLOR_UNORM8:
+				return VK_FORMAT_R8G8B8A8_UNORM;
+			default:
+				return VK_FORMAT_R32G32B32_SFLOAT;
+			}
+		}
+
 		uint32_t stride()
 		{
 			uint32_t res = 0;
 			for (auto& component : components)
 			{
-				switch (component)
+				res += componentSize(component);
+			}
+			return res;
+		}
+
+		/** @brief Vertex input binding description for a vertex buffer using this layout */
+		VkVertexInputBindingDescription inputBinding(uint32_t binding, VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX)
+		{
+			return vks::initializers::vertexInputBindingDescription(binding, stride(), inputRate);
+		}
+
+		/**
+		* Generate the vertex input attribute descriptions for this layout
+		*
+		* @param binding Binding index of the vertex buffer
+		* @param firstLocation (Optional) Shader location of the first component, following components use consecutive locations
+		*
+		* @note Dummy components are padding only and don't get an attribute
+		*/
+		std::vector<VkVertexInputAttributeDescription> inputAttributes(uint32_t binding, uint32_t firstLocation = 0)
+		{
+			std::vector<VkVertexInputAttributeDescription> attributes;
+			uint32_t location = firstLocation;
+			uint32_t offset = 0;
+			for (auto& component : components)
+			{
+				if ((component != VERTEX_COMPONENT_DUMMY_FLOAT) && (component != VERTEX_COMPONENT_DUMMY_VEC4))
 				{
-				case VERTEX_COMPONENT_UV:
-					res += 2 * sizeof(float);
-					break;
-				case VERTEX_COMPONENT_DUMMY_FLOAT:
-					res += sizeof(float);
-					break;
-				case VERTEX_COMPONENT_DUMMY_VEC4:
-					res += 4 * sizeof(float);
-					break;
-				default:
-					// All components except the ones listed above are made up of 3 floats
-					res += 3 * sizeof(float);
+					attributes.push_back(vks::initializers::vertexInputAttributeDescription(binding, location++, componentFormat(component), offset));
 				}
+				offset += componentSize(component);
 			}
-			return res;
+			return attributes;
+		}
+
+		/**
+		* Octahedral encoding of a unit vector into two 16 bit snorm values
+		*
+		* Decode in the shader with:
+		*	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+		*	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+		*	n = normalize(n);
+		*/
+		static uint32_t encodeOctahedral(glm::vec3 v)
+		{
+			const float l1 = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+			if (l1 == 0.0f)
+			{
+				return glm::packSnorm2x16(glm::vec2(0.0f));
+			}
+			v /= l1;
+			glm::vec2 e(v.x, v.y);
+			if (v.z < 0.0f)
+			{
+				e = (1.0f - glm::abs(glm::vec2(v.y, v.x))) * glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+			}
+			return glm::packSnorm2x16(e);
+		}
+
+		/**
+		* Write a single component into a vertex
+		*
+		* @param component Component to encode
+		* @param value Component value, positions for VERTEX_COMPONENT_POSITION_SNORM16 must already be normalized to [-1, 1]
+		* @param dst Destination, must have room for componentSize(component) bytes
+		*
+		* @return Number of bytes written
+		*/
+		static uint32_t encode(Component component, const glm::vec4 &value, uint8_t *dst)
+		{
+			const uint32_t size = componentSize(component);
+			switch (component)
+			{
+			case VERTEX_COMPONENT_POSITION_SNORM16:
+			{
+				const uint32_t packed[2] = { glm::packSnorm2x16(glm::vec2(value.x, value.y)), glm::packSnorm2x16(glm::vec2(value.z, 0.0f)) };
+				memcpy(dst, packed, size);
+				break;
+			}
+			case VERTEX_COMPONENT_NORMAL_OCT16:
+			case VERTEX_COMPONENT_TANGENT_OCT16:
+			case VERTEX_COMPONENT_BITANGENT_OCT16:
+			{
+				const uint32_t packed = encodeOctahedral(glm::vec3(value));
+				memcpy(dst, &packed, size);
+				break;
+			}
+			case VERTEX_COMPONENT_UV_HALF:
+			{
+				const uint32_t packed = glm::packHalf2x16(glm::vec2(value));
+				memcpy(dst, &packed, size);
+				break;
+			}
+			case VERTEX_COMPONENT_COLOR_UNORM8:
+			{
+				const uint32_t packed = glm::packUnorm4x8(value);
+				memcpy(dst, &packed, size);
+				break;
+			}
+			default:
+				// Float components are stored as is
+				memcpy(dst, &value.x, size);
+			}
+			return size;
 		}
 	};
 
@@ -86,6 +250,24 @@ namespace vks
 		glm::vec3 center;
 		glm::vec3 scale;
 		glm::vec2 uvscale;
+		/** @brief Reorder indices and vertices of each part for vertex cache, overdraw and vertex fetch efficiency */
+		bool optimize = true;
+		/** @brief Number of levels of detail generated for each part (including the full detail level) */
+		uint32_t lodCount = 1;
+		/** @brief Triangle count of each level relative to the previous one */
+		float lodReduction = 0.5f;
+		/** @brief Maximum simplification error relative to the part's extent, generation stops at the first level exceeding it */
+		float lodMaxError = 0.05f;
+		/** @brief Partition the full detail level of each part into meshlets for cluster culling (see updateMeshlets and drawMeshlets) */
+		bool meshlets = false;
+		/**
+		* @brief Store indices relative to each part, 16 bit if all parts have less than 65536 vertices
+		* Parts then have to be drawn separately with indexType (see draw and drawPart), otherwise indices are 32 bit and
+		* absolute so the whole model can be drawn with a single draw
+		*/
+		bool compactIndices = false;
+		/** @brief Directory for cooked models, if set warm loads skip the import (the cache is keyed by file, modification time, flags, layout and these settings) */
+		std::string cacheDirectory;
 
 		ModelCreateInfo() {};
 
@@ -105,12 +287,105 @@ namespace vks
 
 	};
 
+	/** @brief Read only ASSIMP stream over a file opened through the virtual file system */
+	class VfsIOStream : public Assimp::IOStream
+	{
+	private:
+		vks::vfs::File file;
+		size_t position = 0;
+	public:
+		explicit VfsIOStream(vks::vfs::File &&file) : file(std::move(file)) {}
+
+		size_t Read(void *pvBuffer, size_t pSize, size_t pCount) override
+		{
+			if (pSize == 0) {
+				return 0;
+			}
+			const size_t count = std::min(pCount, (file.size() - position) / pSize);
+			memcpy(pvBuffer, file.data() + position, count * pSize);
+			position += count * pSize;
+			return count;
+		}
+
+		size_t Write(const void*, size_t, size_t) override
+		{
+			return 0;
+		}
+
+		aiReturn Seek(size_t pOffset, aiOrigin pOrigin) override
+		{
+			size_t target;
+			switch (pOrigin) {
+			case aiOrigin_SET: target = pOffset; break;
+			case aiOrigin_CUR: target = position + pOffset; break;
+			// The offset is negative (wrapped around) relative to the end
+			case aiOrigin_END: target = file.size() + pOffset; break;
+			default: return aiReturn_FAILURE;
+			}
+			if (target > file.size()) {
+				return aiReturn_FAILURE;
+			}
+			position = target;
+			return aiReturn_SUCCESS;
+		}
+
+		size_t Tell() const override { return position; }
+		size_t FileSize() const override { return file.size(); }
+		void Flush() override {}
+	};
+
+	/** @brief Lets ASSIMP open models and the files they reference (e.g. material libraries) from mounted archives */
+	class VfsIOSystem : public Assimp::IOSystem
+	{
+	public:
+		bool Exists(const char *pFile) const override
+		{
+			return vks::vfs::exists(pFile);
+		}
+
+		char getOsSeparator() const override
+		{
+			return '/';
+		}
+
+		Assimp::IOStream *Open(const char *pFile, const char *pMode = "rb") override
+		{
+			if (strchr(pMode, 'w') || strchr(pMode, 'a')) {
+				return nullptr;
+			}
+			vks::vfs::File file = vks::vfs::open(pFile);
+			return file.valid() ? new VfsIOStream(std::move(file)) : nullptr;
+		}
+
+		void Close(Assimp::IOStream *pFile) override
+		{
+			delete pFile;
+		}
+	};
+
 	struct Model {
 		VkDevice device = nullptr;
 		vks::Buffer vertices;
 		vks::Buffer indices;
 		uint32_t indexCount = 0;
 		uint32_t vertexCount = 0;
+		/** @brief 16 bit indices are used for compact indices if all parts have less than 65536 vertices */
+		VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+		/** @brief Indices are relative to each part's vertex base (see ModelCreateInfo::compactIndices) */
+		bool partRelativeIndices = false;
+		/** @brief Vertex cache statistics of all parts before and after the import time optimization */
+		vks::meshopt::Statistics optimizationStatistics;
+		/** @brief Meshlets of all parts, the triangles of each meshlet are contiguous in the full detail index range of its part */
+		std::vector<vks::Meshlet> meshlets;
+		/** @brief Host visible indirect draw commands written by updateMeshlets, one per meshlet */
+		vks::Buffer meshletCommands;
+		/** @brief Number of meshlets that passed culling in the last call to updateMeshlets */
+		uint32_t visibleMeshletCount = 0;
+		/** @brief Host visible storage buffer with the dequantization matrix of each part, created with the meshlets and indexed by the part index passed as first instance by drawMeshlets */
+		vks::Buffer partDequantization;
+
+		/** @brief Called with the part index before the part is drawn, e.g. to push its dequantization matrix */
+		typedef std::function<void(uint32_t part)> PartCallback;
 
 		/** @brief Stores vertex and index base and counts for each part of a model */
 		struct ModelPart {
@@ -118,6 +393,30 @@ namespace vks
 			uint32_t vertexCount;
 			uint32_t indexBase;
 			uint32_t indexCount;
+			/** @brief Maps VERTEX_COMPONENT_POSITION_SNORM16 positions back to model space (position = snorm * scale + offset) */
+			struct Dequantization {
+				glm::vec3 offset = glm::vec3(0.0f);
+				glm::vec3 scale = glm::vec3(1.0f);
+			} dequantization;
+
+			/** @brief Dequantization as a matrix to be applied before the model matrix */
+			glm::mat4 dequantizationMatrix() const
+			{
+				return glm::scale(glm::translate(glm::mat4(1.0f), dequantization.offset), dequantization.scale);
+			}
+			/** @brief Model space bounds of the part */
+			glm::vec3 boundsMin = glm::vec3(0.0f);
+			glm::vec3 boundsMax = glm::vec3(0.0f);
+			/** @brief Index range and simplification error (in model space units) of a level of detail, level 0 is the full detail part */
+			struct Lod {
+				uint32_t indexBase;
+				uint32_t indexCount;
+				float error;
+			};
+			std::vector<Lod> lods;
+			/** @brief Range of the part's meshlets in the model's meshlet array */
+			uint32_t meshletOffset = 0;
+			uint32_t meshletCount = 0;
 		};
 		std::vector<ModelPart> parts;
 
@@ -141,6 +440,8 @@ namespace vks
 				vkDestroyBuffer(device, indices.buffer, nullptr);
 				vkFreeMemory(device, indices.memory, nullptr);
 			}
+			meshletCommands.destroy();
+			partDequantization.destroy();
 		}
 
 		/**
@@ -157,6 +458,54 @@ namespace vks
 		{
 			this->device = device->logicalDevice;
 
+#if !defined(__ANDROID__)
+			// Warm loads skip the import and upload the cooked vertex and index data straight from the mapped cache file
+			std::string cacheFile;
+			uint64_t cacheKey = 0;
+			if (createInfo && !createInfo->cacheDirectory.empty() && getCacheKey(filename, layout, *createInfo, flags, cacheKey))
+			{
+				char keyString[17];
+				snprintf(keyString, sizeof(keyString), "%016llx", static_cast<unsigned long long>(cacheKey));
+				cacheFile = createInfo->cacheDirectory + "/" + keyString + ".vkmesh";
+				if (loadFromCache(cacheFile, cacheKey, device, copyQueue))
+				{
+					return true;
+				}
+			}
+#endif
+
+			std::vector<uint8_t> vertexData;
+			std::vector<uint8_t> indexData;
+			if (!import(filename, layout, createInfo, flags, vertexData, indexData))
+			{
+				return false;
+			}
+
+#if !defined(__ANDROID__)
+			if (!cacheFile.empty())
+			{
+				writeCache(cacheFile, cacheKey, vertexData, indexData);
+			}
+#endif
+
+			upload(vertexData.data(), vertexData.size(), indexData.data(), indexData.size(), device, copyQueue);
+			return true;
+		}
+
+		/**
+		* Import a 3D model with ASSIMP and generate its interleaved vertex and index data
+		*
+		* @param filename File to load (must be a model format supported by ASSIMP)
+		* @param layout Vertex layout components (position, normals, tangents, etc.)
+		* @param createInfo (Optional) Load time settings like scale, center, etc.
+		* @param flags ASSIMP model loading flags
+		* @param vertexData Interleaved vertices of all parts
+		* @param indexData Indices of all parts (and their levels of detail) using indexType
+		*
+		* @note Parts, dimensions, meshlets and statistics of the model are set up, no Vulkan resources are created
+		*/
+		bool import(const std::string& filename, vks::VertexLayout &layout, const vks::ModelCreateInfo *createInfo, const int flags, std::vector<uint8_t> &vertexData, std::vector<uint8_t> &indexData)
+		{
 			Assimp::Importer Importer;
 			const aiScene* pScene;
 
@@ -183,6 +532,8 @@ namespace vks
 
 			free(meshData);
 #else
+			// The importer takes ownership of the IO handler
+			Importer.SetIOHandler(new VfsIOSystem());
 			pScene = Importer.ReadFile(filename.c_str(), flags);
 			if (!pScene) {
 				std::string error = Importer.GetErrorString();
@@ -198,18 +549,38 @@ namespace vks
 				glm::vec3 scale(1.0f);
 				glm::vec2 uvscale(1.0f);
 				glm::vec3 center(0.0f);
+				bool optimize = true;
+				uint32_t lodCount = 1;
+				float lodReduction = 0.5f;
+				float lodMaxError = 0.05f;
+				bool buildMeshlets = false;
+				bool compactIndices = false;
 				if (createInfo)
 				{
 					scale = createInfo->scale;
 					uvscale = createInfo->uvscale;
 					center = createInfo->center;
+					optimize = createInfo->optimize;
+					lodCount = std::max(createInfo->lodCount, 1u);
+					lodReduction = createInfo->lodReduction;
+					lodMaxError = createInfo->lodMaxError;
+					buildMeshlets = createInfo->meshlets;
+					compactIndices = createInfo->compactIndices;
 				}
+				meshlets.clear();
 
-				std::vector<float> vertexBuffer;
+				std::vector<uint8_t> vertexBuffer;
 				std::vector<uint32_t> indexBuffer;
+				std::vector<glm::vec3> partPositions;
+				// Normals and texture coordinates guide the simplifier so that it keeps shading and texturing intact
+				std::vector<float> partAttributes;
+				const float attributeWeights[5] = { 0.5f, 0.5f, 0.5f, 1.0f, 1.0f };
+				const uint32_t vertexStride = layout.stride();
 
 				vertexCount = 0;
 				indexCount = 0;
+				optimizationStatistics = {};
+				uint32_t maxPartVertexCount = 0;
 
 				// Load meshes
 				for (unsigned int i = 0; i < pScene->mNumMeshes; i++)
@@ -220,13 +591,34 @@ namespace vks
 					parts[i].vertexBase = vertexCount;
 					parts[i].indexBase = indexCount;
 
-					vertexCount += pScene->mMeshes[i]->mNumVertices;
+					// Scaled positions, also used to get the part's bounds for position quantization
+					partPositions.resize(paiMesh->mNumVertices);
+					glm::vec3 partMin(FLT_MAX);
+					glm::vec3 partMax(-FLT_MAX);
+					for (unsigned int j = 0; j < paiMesh->mNumVertices; j++)
+					{
+						const aiVector3D& pos = paiMesh->mVertices[j];
+						partPositions[j] = glm::vec3(pos.x * scale.x + center.x, -pos.y * scale.y + center.y, pos.z * scale.z + center.z);
+						partMin = glm::min(partMin, partPositions[j]);
+						partMax = glm::max(partMax, partPositions[j]);
+					}
+					if (paiMesh->mNumVertices > 0)
+					{
+						parts[i].boundsMin = partMin;
+						parts[i].boundsMax = partMax;
+						parts[i].dequantization.offset = (partMin + partMax) * 0.5f;
+						parts[i].dequantization.scale = glm::max((partMax - partMin) * 0.5f, glm::vec3(FLT_MIN));
+					}
 
 					aiColor3D pColor(0.f, 0.f, 0.f);
 					pScene->mMaterials[paiMesh->mMaterialIndex]->Get(AI_MATKEY_COLOR_DIFFUSE, pColor);
 
 					const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
 
+					const size_t partOffset = vertexBuffer.size();
+					vertexBuffer.resize(partOffset + static_cast<size_t>(paiMesh->mNumVertices) * vertexStride);
+					uint8_t* dst = vertexBuffer.data() + partOffset;
+
 					for (unsigned int j = 0; j < paiMesh->mNumVertices; j++)
 					{
 						const aiVector3D* pPos = &(paiMesh->mVertices[j]);
@@ -237,47 +629,40 @@ namespace vks
 
 						for (auto& component : layout.components)
 						{
+							glm::vec4 value(0.0f);
 							switch (component) {
 							case VERTEX_COMPONENT_POSITION:
-								vertexBuffer.push_back(pPos->x * scale.x + center.x);
-								vertexBuffer.push_back(-pPos->y * scale.y + center.y);
-								vertexBuffer.push_back(pPos->z * scale.z + center.z);
+								value = glm::vec4(partPositions[j], 0.0f);
+								break;
+							case VERTEX_COMPONENT_POSITION_SNORM16:
+								value = glm::vec4((partPositions[j] - parts[i].dequantization.offset) / parts[i].dequantization.scale, 0.0f);
 								break;
 							case VERTEX_COMPONENT_NORMAL:
-								vertexBuffer.push_back(pNormal->x);
-								vertexBuffer.push_back(-pNormal->y);
-								vertexBuffer.push_back(pNormal->z);
+							case VERTEX_COMPONENT_NORMAL_OCT16:
+								value = glm::vec4(pNormal->x, -pNormal->y, pNormal->z, 0.0f);
 								break;
 							case VERTEX_COMPONENT_UV:
-								vertexBuffer.push_back(pTexCoord->x * uvscale.s);
-								vertexBuffer.push_back(pTexCoord->y * uvscale.t);
+							case VERTEX_COMPONENT_UV_HALF:
+								value = glm::vec4(pTexCoord->x * uvscale.s, pTexCoord->y * uvscale.t, 0.0f, 0.0f);
 								break;
 							case VERTEX_COMPONENT_COLOR:
-								vertexBuffer.push_back(pColor.r);
-								vertexBuffer.push_back(pColor.g);
-								vertexBuffer.push_back(pColor.b);
+							case VERTEX_COMPONENT_COLOR_UNORM8:
+								value = glm::vec4(pColor.r, pColor.g, pColor.b, 1.0f);
 								break;
 							case VERTEX_COMPONENT_TANGENT:
-								vertexBuffer.push_back(pTangent->x);
-								vertexBuffer.push_back(pTangent->y);
-								vertexBuffer.push_back(pTangent->z);
+							case VERTEX_COMPONENT_TANGENT_OCT16:
+								value = glm::vec4(pTangent->x, pTangent->y, pTangent->z, 0.0f);
 								break;
 							case VERTEX_COMPONENT_BITANGENT:
-								vertexBuffer.push_back(pBiTangent->x);
-								vertexBuffer.push_back(pBiTangent->y);
-								vertexBuffer.push_back(pBiTangent->z);
+							case VERTEX_COMPONENT_BITANGENT_OCT16:
+								value = glm::vec4(pBiTangent->x, pBiTangent->y, pBiTangent->z, 0.0f);
 								break;
 							// Dummy components for padding
 							case VERTEX_COMPONENT_DUMMY_FLOAT:
-								vertexBuffer.push_back(0.0f);
-								break;
 							case VERTEX_COMPONENT_DUMMY_VEC4:
-								vertexBuffer.push_back(0.0f);
-								vertexBuffer.push_back(0.0f);
-								vertexBuffer.push_back(0.0f);
-								vertexBuffer.push_back(0.0f);
 								break;
 							};
+							dst += VertexLayout::encode(component, value, dst);
 						}
 
 						dim.max.x = fmax(pPos->x, dim.max.x);
@@ -293,77 +678,147 @@ namespace vks
 
 					parts[i].vertexCount = paiMesh->mNumVertices;
 
-					uint32_t indexBase = static_cast<uint32_t>(indexBuffer.size());
 					for (unsigned int j = 0; j < paiMesh->mNumFaces; j++)
 					{
 						const aiFace& Face = paiMesh->mFaces[j];
 						if (Face.mNumIndices != 3)
 							continue;
-						indexBuffer.push_back(indexBase + Face.mIndices[0]);
-						indexBuffer.push_back(indexBase + Face.mIndices[1]);
-						indexBuffer.push_back(indexBase + Face.mIndices[2]);
+						indexBuffer.push_back(Face.mIndices[0]);
+						indexBuffer.push_back(Face.mIndices[1]);
+						indexBuffer.push_back(Face.mIndices[2]);
 						parts[i].indexCount += 3;
 						indexCount += 3;
 					}
-				}
 
+					// Levels of detail are appended after the part's full detail indices and reference a subset of its vertices
+					parts[i].lods.push_back({ parts[i].indexBase, parts[i].indexCount, 0.0f });
+					if ((lodCount > 1) && (parts[i].indexCount > 0))
+					{
+						partAttributes.resize(static_cast<size_t>(paiMesh->mNumVertices) * 5);
+						for (unsigned int j = 0; j < paiMesh->mNumVertices; j++)
+						{
+							const aiVector3D normal = paiMesh->HasNormals() ? paiMesh->mNormals[j] : Zero3D;
+							const aiVector3D texCoord = paiMesh->HasTextureCoords(0) ? paiMesh->mTextureCoords[0][j] : Zero3D;
+							float *attribute = &partAttributes[j * 5];
+							attribute[0] = normal.x;
+							attribute[1] = -normal.y;
+							attribute[2] = normal.z;
+							attribute[3] = texCoord.x * uvscale.s;
+							attribute[4] = texCoord.y * uvscale.t;
+						}
 
-				uint32_t vBufferSize = static_cast<uint32_t>(vertexBuffer.size()) * sizeof(float);
-				uint32_t iBufferSize = static_cast<uint32_t>(indexBuffer.size()) * sizeof(uint32_t);
-
-				// Use staging buffer to move vertex and index buffer to device local memory
-				// Create staging buffers
-				vks::Buffer vertexStaging, indexStaging;
-
-				// Vertex buffer
-				VK_CHECK_RESULT(device->createBuffer(
-					VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					&vertexStaging,
-					vBufferSize,
-					vertexBuffer.data()));
-
-				// Index buffer
-				VK_CHECK_RESULT(device->createBuffer(
-					VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					&indexStaging,
-					iBufferSize,
-					indexBuffer.data()));
+						const float lodScale = vks::meshopt::simplifyScale(&partPositions[0].x, paiMesh->mNumVertices, sizeof(glm::vec3));
+						std::vector<uint32_t> lodIndices(parts[i].indexCount);
+						size_t targetIndexCount = parts[i].indexCount;
+						for (uint32_t l = 1; l < lodCount; l++)
+						{
+							targetIndexCount = static_cast<size_t>(targetIndexCount * lodReduction) / 3 * 3;
+							float lodError = 0.0f;
+							// Each level is simplified from the full detail indices so that its error is measured against the original surface
+							const size_t lodIndexCount = vks::meshopt::simplify(
+								lodIndices.data(),
+								indexBuffer.data() + parts[i].indexBase,
+								parts[i].indexCount,
+								&partPositions[0].x,
+								paiMesh->mNumVertices,
+								sizeof(glm::vec3),
+								targetIndexCount,
+								lodMaxError,
+								&lodError,
+								partAttributes.data(),
+								5 * sizeof(float),
+								attributeWeights,
+								5);
+							// Stop if the simplifier can't reduce any further within the error limit
+							if ((lodIndexCount == 0) || (lodIndexCount >= parts[i].lods.back().indexCount))
+								break;
+							parts[i].lods.push_back({ indexCount, static_cast<uint32_t>(lodIndexCount), lodError * lodScale });
+							indexBuffer.insert(indexBuffer.end(), lodIndices.begin(), lodIndices.begin() + lodIndexCount);
+							indexCount += static_cast<uint32_t>(lodIndexCount);
+						}
+					}
 
-				// Create device local target buffers
-				// Vertex buffer
-				VK_CHECK_RESULT(device->createBuffer(
-					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-					&vertices,
-					vBufferSize));
+					if (optimize && (parts[i].indexCount > 0))
+					{
+						optimizationStatistics.before += vks::meshopt::analyzeVertexCache(indexBuffer.data() + parts[i].indexBase, parts[i].indexCount, paiMesh->mNumVertices);
+						for (auto& lod : parts[i].lods)
+						{
+							vks::meshopt::optimizeIndices(indexBuffer.data() + lod.indexBase, lod.indexCount, &partPositions[0].x, paiMesh->mNumVertices, sizeof(glm::vec3));
+						}
+					}
 
-				// Index buffer
-				VK_CHECK_RESULT(device->createBuffer(
-					VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-					&indices,
-					iBufferSize));
+					// Meshlets reorder the full detail triangles, this has to happen after the index optimization and before vertices are remapped
+					if (buildMeshlets && (parts[i].indexCount > 0))
+					{
+						// Winding is flipped by the importer and again by the mirrored y axis of the positions
+						const bool clockwise = (flags & aiProcess_FlipWindingOrder) == 0;
+						parts[i].meshletOffset = static_cast<uint32_t>(meshlets.size());
+						parts[i].meshletCount = static_cast<uint32_t>(vks::meshlet::build(
+							meshlets,
+							indexBuffer.data() + parts[i].indexBase,
+							parts[i].indexCount,
+							&partPositions[0].x,
+							paiMesh->mNumVertices,
+							sizeof(glm::vec3),
+							parts[i].indexBase,
+							static_cast<int32_t>(parts[i].vertexBase),
+							clockwise));
+					}
 
-				// Copy from staging buffers
-				VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+					if (optimize && (parts[i].indexCount > 0))
+					{
+						// Part's vertices and indices are at the end of the buffers, fetch order follows the full detail level and unreferenced vertices are dropped
+						const size_t vertexOffset = static_cast<size_t>(parts[i].vertexBase) * vertexStride;
+						std::vector<uint8_t> sourceVertices(vertexBuffer.begin() + vertexOffset, vertexBuffer.end());
+						parts[i].vertexCount = static_cast<uint32_t>(vks::meshopt::optimizeVertexFetch(
+							vertexBuffer.data() + vertexOffset,
+							indexBuffer.data() + parts[i].indexBase,
+							indexCount - parts[i].indexBase,
+							sourceVertices.data(),
+							paiMesh->mNumVertices,
+							vertexStride));
+						vertexBuffer.resize(vertexOffset + static_cast<size_t>(parts[i].vertexCount) * vertexStride);
+						optimizationStatistics.after += vks::meshopt::analyzeVertexCache(indexBuffer.data() + parts[i].indexBase, parts[i].indexCount, parts[i].vertexCount);
+					}
 
-				VkBufferCopy copyRegion{};
+					// Indices are generated relative to the part, the default layout rebases them (and the part's meshlets) to the model's vertex buffer
+					if (!compactIndices)
+					{
+						for (uint32_t j = parts[i].indexBase; j < indexCount; j++)
+						{
+							indexBuffer[j] += parts[i].vertexBase;
+						}
+						for (uint32_t j = 0; j < parts[i].meshletCount; j++)
+						{
+							meshlets[parts[i].meshletOffset + j].vertexOffset = 0;
+						}
+					}
 
-				copyRegion.size = vertices.size;
-				vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
+					vertexCount += parts[i].vertexCount;
+					maxPartVertexCount = std::max(maxPartVertexCount, parts[i].vertexCount);
+				}
 
-				copyRegion.size = indices.size;
-				vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
+				// Relative indices only need 16 bits if the largest part has less than 65536 vertices
+				partRelativeIndices = compactIndices;
+				indexType = (compactIndices && (maxPartVertexCount < 65536)) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+				std::vector<uint16_t> indexBuffer16;
+				if (indexType == VK_INDEX_TYPE_UINT16)
+				{
+					indexBuffer16.assign(indexBuffer.begin(), indexBuffer.end());
+				}
 
-				device->flushCommandBuffer(copyCmd, copyQueue);
 
-				// Destroy staging resources
-				vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
-				vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
-				vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
-				vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
+				vertexData = std::move(vertexBuffer);
+				if (indexType == VK_INDEX_TYPE_UINT16)
+				{
+					indexData.resize(indexBuffer16.size() * sizeof(uint16_t));
+					memcpy(indexData.data(), indexBuffer16.data(), indexData.size());
+				}
+				else
+				{
+					indexData.resize(indexBuffer.size() * sizeof(uint32_t));
+					memcpy(indexData.data(), indexBuffer.data(), indexData.size());
+				}
 
 				return true;
 			}
@@ -377,6 +832,332 @@ namespace vks
 			}
 		};
 
+		/**
+		* Create the device local vertex and index buffers from the given data
+		*
+		* @param vertexData Interleaved vertex data
+		* @param vertexSize Size of the vertex data in bytes
+		* @param indexData Index data using indexType
+		* @param indexSize Size of the index data in bytes
+		* @param device Pointer to the Vulkan device to create the buffers on
+		* @param copyQueue Queue used for the memory staging copy commands (must support transfer)
+		*/
+		void upload(const void *vertexData, size_t vertexSize, const void *indexData, size_t indexSize, vks::VulkanDevice *device, VkQueue copyQueue)
+		{
+			this->device = device->logicalDevice;
+
+			// Use staging buffer to move vertex and index buffer to device local memory
+			// Create staging buffers
+			vks::Buffer vertexStaging, indexStaging;
+
+			// Vertex buffer
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&vertexStaging,
+				vertexSize,
+				const_cast<void*>(vertexData)));
+
+			// Index buffer
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&indexStaging,
+				indexSize,
+				const_cast<void*>(indexData)));
+
+			// Create device local target buffers
+			// Vertex buffer
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vertices,
+				vertexSize));
+
+			// Index buffer
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&indices,
+				indexSize));
+
+			// Copy from staging buffers
+			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+
+			VkBufferCopy copyRegion{};
+
+			copyRegion.size = vertexSize;
+			vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
+
+			copyRegion.size = indexSize;
+			vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
+
+			device->flushCommandBuffer(copyCmd, copyQueue);
+
+			// Destroy staging resources
+			vertexStaging.destroy();
+			indexStaging.destroy();
+
+			if (!meshlets.empty())
+			{
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					&meshletCommands,
+					meshlets.size() * sizeof(VkDrawIndexedIndirectCommand)));
+				VK_CHECK_RESULT(meshletCommands.map());
+
+				std::vector<glm::mat4> dequantizationMatrices(parts.size());
+				for (size_t i = 0; i < parts.size(); i++)
+				{
+					dequantizationMatrices[i] = parts[i].dequantizationMatrix();
+				}
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					&partDequantization,
+					dequantizationMatrices.size() * sizeof(glm::mat4),
+					dequantizationMatrices.data()));
+			}
+		}
+
+#if !defined(__ANDROID__)
+		/** @brief Cooked model file layout, all sections are 64 byte aligned */
+		struct CacheHeader {
+			char magic[4];
+			uint32_t version;
+			uint64_t key;
+			uint32_t indexType;
+			uint32_t partRelativeIndices;
+			uint32_t vertexCount;
+			uint32_t indexCount;
+			uint32_t partCount;
+			uint32_t lodCount;
+			uint32_t meshletCount;
+			uint64_t vertexOffset;
+			uint64_t vertexSize;
+			uint64_t indexOffset;
+			uint64_t indexSize;
+			uint64_t partOffset;
+			uint64_t lodOffset;
+			uint64_t meshletOffset;
+			glm::vec3 dimMin;
+			glm::vec3 dimMax;
+			vks::meshopt::Statistics statistics;
+		};
+		struct CachePart {
+			uint32_t vertexBase;
+			uint32_t vertexCount;
+			uint32_t indexBase;
+			uint32_t indexCount;
+			glm::vec3 dequantizationOffset;
+			glm::vec3 dequantizationScale;
+			glm::vec3 boundsMin;
+			glm::vec3 boundsMax;
+			uint32_t lodCount;
+			uint32_t meshletOffset;
+			uint32_t meshletCount;
+		};
+		static const uint32_t cacheVersion = 2;
+
+		/** @brief 64 bit FNV-1a hash */
+		static uint64_t hash(const void *data, size_t size, uint64_t value = 14695981039346656037ull)
+		{
+			const uint8_t *bytes = static_cast<const uint8_t*>(data);
+			for (size_t i = 0; i < size; i++)
+			{
+				value = (value ^ bytes[i]) * 1099511628211ull;
+			}
+			return value;
+		}
+
+		template <typename T>
+		static uint64_t hashValue(const T &data, uint64_t value)
+		{
+			return hash(&data, sizeof(T), value);
+		}
+
+		/*
+		* Key of a cooked model, changes whenever the source file or any of the settings that affect the generated data change
+		* The source is looked up through the virtual file system like the import, so archived and loose files both invalidate the cache
+		*/
+		static bool getCacheKey(const std::string &filename, const vks::VertexLayout &layout, const vks::ModelCreateInfo &createInfo, int flags, uint64_t &key)
+		{
+			vks::vfs::FileInfo fileInfo;
+			if (!vks::vfs::stat(filename, fileInfo))
+			{
+				return false;
+			}
+			key = hash(filename.data(), filename.size());
+			const uint32_t version = cacheVersion;
+			key = hashValue(version, key);
+			key = hashValue(fileInfo.archived, key);
+			key = hashValue(fileInfo.stamp, key);
+			key = hashValue(fileInfo.size, key);
+			key = hashValue(flags, key);
+			key = hash(layout.components.data(), layout.components.size() * sizeof(Component), key);
+			key = hashValue(createInfo.center, key);
+			key = hashValue(createInfo.scale, key);
+			key = hashValue(createInfo.uvscale, key);
+			key = hashValue(createInfo.optimize, key);
+			key = hashValue(createInfo.lodCount, key);
+			key = hashValue(createInfo.lodReduction, key);
+			key = hashValue(createInfo.lodMaxError, key);
+			key = hashValue(createInfo.meshlets, key);
+			key = hashValue(createInfo.compactIndices, key);
+			return true;
+		}
+
+		/** @brief Load a cooked model, returns false if the file doesn't exist or doesn't match the key */
+		bool loadFromCache(const std::string &cacheFile, uint64_t key, vks::VulkanDevice *device, VkQueue copyQueue)
+		{
+			vks::MappedFile file;
+			if (!file.open(cacheFile))
+			{
+				return false;
+			}
+			vks::MappedFile::View view = file.map();
+			if (!view.valid() || view.size() < sizeof(CacheHeader))
+			{
+				return false;
+			}
+			CacheHeader header;
+			memcpy(&header, view.data(), sizeof(CacheHeader));
+			auto inside = [&](uint64_t offset, uint64_t size) { return (offset <= view.size()) && (size <= view.size() - offset); };
+			if ((memcmp(header.magic, "VKMC", 4) != 0) || (header.version != cacheVersion) || (header.key != key)
+				|| !inside(header.vertexOffset, header.vertexSize) || !inside(header.indexOffset, header.indexSize)
+				|| !inside(header.partOffset, static_cast<uint64_t>(header.partCount) * sizeof(CachePart))
+				|| !inside(header.lodOffset, static_cast<uint64_t>(header.lodCount) * sizeof(ModelPart::Lod))
+				|| !inside(header.meshletOffset, static_cast<uint64_t>(header.meshletCount) * sizeof(vks::Meshlet)))
+			{
+				return false;
+			}
+
+			const CachePart *cacheParts = reinterpret_cast<const CachePart*>(view.data() + header.partOffset);
+			const ModelPart::Lod *cacheLods = reinterpret_cast<const ModelPart::Lod*>(view.data() + header.lodOffset);
+			parts.resize(header.partCount);
+			uint32_t lodOffset = 0;
+			for (uint32_t i = 0; i < header.partCount; i++)
+			{
+				const CachePart &cachePart = cacheParts[i];
+				if (lodOffset + cachePart.lodCount > header.lodCount)
+				{
+					return false;
+				}
+				parts[i] = {};
+				parts[i].vertexBase = cachePart.vertexBase;
+				parts[i].vertexCount = cachePart.vertexCount;
+				parts[i].indexBase = cachePart.indexBase;
+				parts[i].indexCount = cachePart.indexCount;
+				parts[i].dequantization.offset = cachePart.dequantizationOffset;
+				parts[i].dequantization.scale = cachePart.dequantizationScale;
+				parts[i].boundsMin = cachePart.boundsMin;
+				parts[i].boundsMax = cachePart.boundsMax;
+				parts[i].lods.assign(cacheLods + lodOffset, cacheLods + lodOffset + cachePart.lodCount);
+				parts[i].meshletOffset = cachePart.meshletOffset;
+				parts[i].meshletCount = cachePart.meshletCount;
+				lodOffset += cachePart.lodCount;
+			}
+			const vks::Meshlet *cacheMeshlets = reinterpret_cast<const vks::Meshlet*>(view.data() + header.meshletOffset);
+			meshlets.assign(cacheMeshlets, cacheMeshlets + header.meshletCount);
+			indexType = static_cast<VkIndexType>(header.indexType);
+			partRelativeIndices = header.partRelativeIndices != 0;
+			vertexCount = header.vertexCount;
+			indexCount = header.indexCount;
+			optimizationStatistics = header.statistics;
+			dim.min = header.dimMin;
+			dim.max = header.dimMax;
+			dim.size = dim.max - dim.min;
+
+			upload(view.data() + header.vertexOffset, static_cast<size_t>(header.vertexSize), view.data() + header.indexOffset, static_cast<size_t>(header.indexSize), device, copyQueue);
+			return true;
+		}
+
+		/** @brief Write the imported model to the cache, the file is written under a temporary name and renamed once complete */
+		void writeCache(const std::string &cacheFile, uint64_t key, const std::vector<uint8_t> &vertexData, const std::vector<uint8_t> &indexData)
+		{
+			const std::string directory = cacheFile.substr(0, cacheFile.find_last_of('/'));
+#if defined(_WIN32)
+			_mkdir(directory.c_str());
+#else
+			mkdir(directory.c_str(), 0755);
+#endif
+
+			std::vector<CachePart> cacheParts(parts.size());
+			std::vector<ModelPart::Lod> cacheLods;
+			for (size_t i = 0; i < parts.size(); i++)
+			{
+				CachePart &cachePart = cacheParts[i];
+				cachePart.vertexBase = parts[i].vertexBase;
+				cachePart.vertexCount = parts[i].vertexCount;
+				cachePart.indexBase = parts[i].indexBase;
+				cachePart.indexCount = parts[i].indexCount;
+				cachePart.dequantizationOffset = parts[i].dequantization.offset;
+				cachePart.dequantizationScale = parts[i].dequantization.scale;
+				cachePart.boundsMin = parts[i].boundsMin;
+				cachePart.boundsMax = parts[i].boundsMax;
+				cachePart.lodCount = static_cast<uint32_t>(parts[i].lods.size());
+				cachePart.meshletOffset = parts[i].meshletOffset;
+				cachePart.meshletCount = parts[i].meshletCount;
+				cacheLods.insert(cacheLods.end(), parts[i].lods.begin(), parts[i].lods.end());
+			}
+
+			auto align = [](uint64_t offset) { return (offset + 63) & ~static_cast<uint64_t>(63); };
+			CacheHeader header{};
+			memcpy(header.magic, "VKMC", 4);
+			header.version = cacheVersion;
+			header.key = key;
+			header.indexType = static_cast<uint32_t>(indexType);
+			header.partRelativeIndices = partRelativeIndices ? 1 : 0;
+			header.vertexCount = vertexCount;
+			header.indexCount = indexCount;
+			header.partCount = static_cast<uint32_t>(cacheParts.size());
+			header.lodCount = static_cast<uint32_t>(cacheLods.size());
+			header.meshletCount = static_cast<uint32_t>(meshlets.size());
+			header.vertexOffset = align(sizeof(CacheHeader));
+			header.vertexSize = vertexData.size();
+			header.indexOffset = align(header.vertexOffset + header.vertexSize);
+			header.indexSize = indexData.size();
+			header.partOffset = align(header.indexOffset + header.indexSize);
+			header.lodOffset = align(header.partOffset + cacheParts.size() * sizeof(CachePart));
+			header.meshletOffset = align(header.lodOffset + cacheLods.size() * sizeof(ModelPart::Lod));
+			header.dimMin = dim.min;
+			header.dimMax = dim.max;
+			header.statistics = optimizationStatistics;
+
+			const std::string tempFile = cacheFile + ".tmp";
+			{
+				std::ofstream stream(tempFile, std::ios::binary | std::ios::trunc);
+				if (!stream.is_open())
+				{
+					std::cerr << "Could not write model cache \"" << tempFile << "\"" << std::endl;
+					return;
+				}
+				auto write = [&](uint64_t offset, const void *data, size_t size)
+				{
+					// Zero padding up to the section's offset
+					static const char padding[64] = {};
+					stream.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(stream.tellp())));
+					stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+				};
+				write(0, &header, sizeof(CacheHeader));
+				write(header.vertexOffset, vertexData.data(), vertexData.size());
+				write(header.indexOffset, indexData.data(), indexData.size());
+				write(header.partOffset, cacheParts.data(), cacheParts.size() * sizeof(CachePart));
+				write(header.lodOffset, cacheLods.data(), cacheLods.size() * sizeof(ModelPart::Lod));
+				write(header.meshletOffset, meshlets.data(), meshlets.size() * sizeof(vks::Meshlet));
+				if (!stream.good())
+				{
+					stream.close();
+					std::remove(tempFile.c_str());
+					return;
+				}
+			}
+			std::remove(cacheFile.c_str());
+			std::rename(tempFile.c_str(), cacheFile.c_str());
+		}
+#endif
+
 		/**
 		* Loads a 3D model from a file into Vulkan buffers
 		*
@@ -392,5 +1173,151 @@ namespace vks
 			vks::ModelCreateInfo modelCreateInfo(scale, 1.0f, 0.0f);
 			return loadFromFile(filename, layout, &modelCreateInfo, device, copyQueue, flags);
 		}
+
+		/**
+		* Select the coarsest level of detail of a part whose simplification error projects to less than the given number of pixels
+		*
+		* @param part Index of the part
+		* @param modelMatrix Model matrix the part is drawn with
+		* @param camera Camera used for rendering, its view and perspective settings are used for the projection
+		* @param viewportHeight Height of the viewport in pixels
+		* @param pixelError (Optional) Maximum allowed screen space error in pixels
+		*/
+		uint32_t selectLod(uint32_t part, const glm::mat4 &modelMatrix, Camera &camera, float viewportHeight, float pixelError = 1.0f)
+		{
+			const ModelPart &modelPart = parts[part];
+			if (modelPart.lods.size() < 2)
+			{
+				return 0;
+			}
+			// Errors scale with the largest axis scale of the model matrix
+			const float maxScale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+			const glm::vec3 center = glm::vec3(modelMatrix * glm::vec4((modelPart.boundsMin + modelPart.boundsMax) * 0.5f, 1.0f));
+			const float radius = glm::length(modelPart.boundsMax - modelPart.boundsMin) * 0.5f * maxScale;
+			const glm::vec3 eye = glm::vec3(glm::inverse(camera.matrices.view)[3]);
+			const float distance = std::max(glm::length(center - eye) - radius, camera.getNearClip());
+			// Pixels per world space unit at the given distance
+			const float projection = viewportHeight / (2.0f * tanf(glm::radians(camera.getFov()) * 0.5f) * distance);
+			for (uint32_t lod = static_cast<uint32_t>(modelPart.lods.size()) - 1; lod > 0; lod--)
+			{
+				if (modelPart.lods[lod].error * maxScale * projection <= pixelError)
+				{
+					return lod;
+				}
+			}
+			return 0;
+		}
+
+		/**
+		* Draw a single part of the model
+		*
+		* @note Vertex and index buffers need to be bound with indexType (see draw)
+		*/
+		void drawPart(VkCommandBuffer commandBuffer, uint32_t part, uint32_t instanceCount = 1, uint32_t lod = 0)
+		{
+			const ModelPart &modelPart = parts[part];
+			const uint32_t firstIndex = (lod < modelPart.lods.size()) ? modelPart.lods[lod].indexBase : modelPart.indexBase;
+			const uint32_t count = (lod < modelPart.lods.size()) ? modelPart.lods[lod].indexCount : modelPart.indexCount;
+			const int32_t vertexOffset = partRelativeIndices ? static_cast<int32_t>(modelPart.vertexBase) : 0;
+			vkCmdDrawIndexed(commandBuffer, count, instanceCount, firstIndex, vertexOffset, 0);
+		}
+
+		/**
+		* Bind the vertex and index buffers and draw all parts of the model
+		*
+		* @param partCallback (Optional) Called before each part is drawn, required for layouts with VERTEX_COMPONENT_POSITION_SNORM16 to pass the part's dequantization
+		*/
+		void draw(VkCommandBuffer commandBuffer, uint32_t instanceCount = 1, const PartCallback &partCallback = PartCallback())
+		{
+			const VkDeviceSize offsets[1] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, indexType);
+			for (uint32_t i = 0; i < static_cast<uint32_t>(parts.size()); i++)
+			{
+				if (partCallback)
+				{
+					partCallback(i);
+				}
+				drawPart(commandBuffer, i, instanceCount);
+			}
+		}
+
+		/**
+		* Bind the vertex and index buffers and draw all parts at the level of detail selected for the given camera
+		*
+		* @param partCallback (Optional) Called before each part is drawn, required for layouts with VERTEX_COMPONENT_POSITION_SNORM16 to pass the part's dequantization
+		*/
+		void draw(VkCommandBuffer commandBuffer, const glm::mat4 &modelMatrix, Camera &camera, float viewportHeight, float pixelError = 1.0f, uint32_t instanceCount = 1, const PartCallback &partCallback = PartCallback())
+		{
+			const VkDeviceSize offsets[1] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, indexType);
+			for (uint32_t i = 0; i < static_cast<uint32_t>(parts.size()); i++)
+			{
+				if (partCallback)
+				{
+					partCallback(i);
+				}
+				drawPart(commandBuffer, i, instanceCount, selectLod(i, modelMatrix, camera, viewportHeight, pixelError));
+			}
+		}
+
+		/**
+		* Cull the model's meshlets against the view frustum and their normal cones and write the indirect draw commands used by drawMeshlets
+		* The commands pass the index of the meshlet's part as first instance
+		*
+		* @param viewProjection Combined view and projection matrix
+		* @param modelMatrix Model matrix the model is drawn with
+		* @param cameraPosition Camera position in world space
+		*
+		* @return Number of visible meshlets
+		*/
+		uint32_t updateMeshlets(const glm::mat4 &viewProjection, const glm::mat4 &modelMatrix, const glm::vec3 &cameraPosition)
+		{
+			assert(meshletCommands.mapped);
+			VkDrawIndexedIndirectCommand *commands = static_cast<VkDrawIndexedIndirectCommand*>(meshletCommands.mapped);
+			visibleMeshletCount = 0;
+			for (uint32_t i = 0; i < static_cast<uint32_t>(parts.size()); i++)
+			{
+				const ModelPart &part = parts[i];
+				if (part.meshletCount > 0)
+				{
+					visibleMeshletCount += vks::meshlet::cull(meshlets.data() + part.meshletOffset, part.meshletCount, viewProjection, modelMatrix, cameraPosition, commands + part.meshletOffset, i);
+				}
+			}
+			return visibleMeshletCount;
+		}
+
+		/**
+		* Bind the vertex and index buffers and draw all meshlets with the commands written by updateMeshlets
+		*
+		* @param commandBuffer Command buffer to record the draws to
+		* @param multiDrawIndirect Issue a single indirect draw for all meshlets (requires the multiDrawIndirect device feature), otherwise one indirect draw per meshlet is recorded
+		*
+		* @note Draw parameters are read from the indirect buffer at execution time, so culling doesn't require re-recording the command buffer
+		* @note gl_InstanceIndex is the meshlet's part index (requires the drawIndirectFirstInstance device feature), shaders for layouts with
+		* VERTEX_COMPONENT_POSITION_SNORM16 index partDequantization with it
+		*/
+		void drawMeshlets(VkCommandBuffer commandBuffer, bool multiDrawIndirect)
+		{
+			if (meshlets.empty())
+			{
+				return;
+			}
+			const VkDeviceSize offsets[1] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, indexType);
+			if (multiDrawIndirect)
+			{
+				vkCmdDrawIndexedIndirect(commandBuffer, meshletCommands.buffer, 0, static_cast<uint32_t>(meshlets.size()), sizeof(VkDrawIndexedIndirectCommand));
+			}
+			else
+			{
+				for (uint32_t i = 0; i < static_cast<uint32_t>(meshlets.size()); i++)
+				{
+					vkCmdDrawIndexedIndirect(commandBuffer, meshletCommands.buffer, i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+				}
+			}
+		}
 	};
 };
\ No newline at end of file
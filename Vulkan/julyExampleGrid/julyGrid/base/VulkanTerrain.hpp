@@ -0,0 +1,669 @@
+/*
+* Chunked quadtree terrain
+*
+* Splits a height field into a quadtree of tiles with a fixed vertex count, each level covering twice the area of the next one
+* Tiles are selected by their projected geometric error and cracks between levels are hidden with skirts
+* Tile vertices are generated on demand and streamed into a fixed size GPU tile pool, so memory and draw count stay bounded
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cfloat>
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <gli/gli.hpp>
+
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "camera.hpp"
+#include "frustum.hpp"
+#include "threadpool.hpp"
+
+namespace vks
+{
+	class Terrain
+	{
+	public:
+		struct Vertex {
+			glm::vec3 pos;
+			glm::vec3 normal;
+			glm::vec2 uv;
+		};
+
+		/** @brief Number of quads along the edge of a tile, tiles of all levels share the same index buffer */
+		uint32_t tileSize = 64;
+		/** @brief Number of tiles the GPU tile pool can hold */
+		uint32_t poolSize = 256;
+		/** @brief Maximum number of tiles generated and uploaded per frame */
+		uint32_t maxUploadsPerFrame = 8;
+		/** @brief Number of frames that may be in flight, tiles are only evicted once they are no longer referenced by any of them */
+		uint32_t framesInFlight = 2;
+		/** @brief Maximum projected geometric error of a tile in pixels */
+		float pixelError = 2.0f;
+		/** @brief World space size of a height field texel */
+		float texelSize = 1.0f;
+		/** @brief World space height of the maximum height field value */
+		float heightScale = 1.0f;
+		float uvScale = 1.0f;
+
+		/** @brief Thread pool used for generating tiles, if not set the terrain creates its own pool with one thread per core */
+		vks::ThreadPool *threadPool = nullptr;
+
+		vks::Buffer vertexBuffer;
+		vks::Buffer indexBuffer;
+		VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+		uint32_t indexCount = 0;
+
+		struct Statistics {
+			uint32_t drawnTiles = 0;
+			uint32_t residentTiles = 0;
+			uint32_t requestedTiles = 0;
+			uint32_t uploadedTiles = 0;
+		} statistics;
+
+		Terrain(vks::VulkanDevice *device, VkQueue copyQueue)
+		{
+			this->device = device;
+			this->copyQueue = copyQueue;
+		}
+
+		~Terrain()
+		{
+			vertexBuffer.destroy();
+			indexBuffer.destroy();
+			stagingBuffer.destroy();
+		}
+
+		/**
+		* Load a 16 bit single channel height field from a texture file
+		*
+		* @param filename Texture file to load (must be a format supported by gli)
+		*/
+#if defined(__ANDROID__)
+		void loadFromFile(const std::string filename, AAssetManager* assetManager)
+#else
+		void loadFromFile(const std::string filename)
+#endif
+		{
+#if defined(__ANDROID__)
+			AAsset* asset = AAssetManager_open(assetManager, filename.c_str(), AASSET_MODE_STREAMING);
+			assert(asset);
+			size_t size = AAsset_getLength(asset);
+			assert(size > 0);
+			void *textureData = malloc(size);
+			AAsset_read(asset, textureData, size);
+			AAsset_close(asset);
+			gli::texture2d heightTex(gli::load((const char*)textureData, size));
+			free(textureData);
+#else
+			vks::vfs::File file = vks::vfs::open(filename);
+			gli::texture2d heightTex(gli::load(reinterpret_cast<const char*>(file.data()), file.size()));
+#endif
+			assert(!heightTex.empty());
+			const uint32_t dim = static_cast<uint32_t>(heightTex.extent().x);
+			assert(heightTex[0].size() >= static_cast<size_t>(dim) * dim * sizeof(uint16_t));
+			setHeights(static_cast<const uint16_t*>(heightTex[0].data()), dim);
+		}
+
+		/**
+		* Build the tile quadtree for a square height field and create the tile pool
+		*
+		* @param data Height values (dim * dim, row major)
+		* @param dim Number of texels along an edge of the height field
+		*
+		* @note The root tile is uploaded immediately so the whole terrain can always be drawn
+		*/
+		void setHeights(const uint16_t *data, uint32_t dim)
+		{
+			assert(device);
+			assert(copyQueue != VK_NULL_HANDLE);
+			assert(dim > 1 && tileSize > 1 && poolSize > 0 && maxUploadsPerFrame > 0);
+
+			this->dim = dim;
+			heights.assign(data, data + static_cast<size_t>(dim) * dim);
+
+			buildQuadtree(getThreadPool());
+			createBuffers();
+
+			// Upload the root tile
+			generateTile(0, static_cast<Vertex*>(stagingBuffer.mapped));
+			assignSlot(0);
+			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			VkBufferCopy copyRegion{};
+			copyRegion.size = tileVertexCount * sizeof(Vertex);
+			copyRegion.dstOffset = nodes[0].slot * copyRegion.size;
+			vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, vertexBuffer.buffer, 1, &copyRegion);
+			device->flushCommandBuffer(copyCmd, copyQueue, true);
+		}
+
+		/**
+		* Select the tiles to draw for the given camera and generate missing tiles
+		*
+		* @param camera Camera used for rendering, view and projection of the terrain's world space are taken from it
+		* @param viewportHeight Height of the viewport in pixels
+		*
+		* @note Has to be followed by cmdUpload in the same frame
+		*/
+		void update(Camera &camera, float viewportHeight)
+		{
+			assert(!nodes.empty());
+			frame++;
+			frustum.update(camera.matrices.perspective * camera.matrices.view);
+			eye = glm::vec3(glm::inverse(camera.matrices.view)[3]);
+			nearClip = camera.getNearClip();
+			// Pixels per world space unit at a distance of one
+			projectionScale = viewportHeight / (2.0f * tanf(glm::radians(camera.getFov()) * 0.5f));
+
+			selected.clear();
+			requests.clear();
+			select(0);
+
+			// Highest screen space error first
+			std::sort(requests.begin(), requests.end(), [](const Request &a, const Request &b) { return a.priority > b.priority; });
+			statistics.requestedTiles = static_cast<uint32_t>(requests.size());
+
+			// Assign pool slots, stop once no slot can be evicted
+			uploads.clear();
+			for (const Request &request : requests)
+			{
+				if (uploads.size() >= maxUploadsPerFrame || !assignSlot(request.node))
+				{
+					break;
+				}
+				uploads.push_back(request.node);
+			}
+
+			// Tile vertices are written to this frame's part of the persistently mapped staging buffer
+			Vertex *staging = static_cast<Vertex*>(stagingBuffer.mapped) + static_cast<size_t>(frame % framesInFlight) * maxUploadsPerFrame * tileVertexCount;
+			getThreadPool().parallelFor(static_cast<uint32_t>(uploads.size()), [&](uint32_t first, uint32_t last)
+			{
+				for (uint32_t i = first; i < last; i++)
+				{
+					generateTile(uploads[i], staging + static_cast<size_t>(i) * tileVertexCount);
+				}
+			});
+
+			statistics.drawnTiles = static_cast<uint32_t>(selected.size());
+			statistics.uploadedTiles = static_cast<uint32_t>(uploads.size());
+			statistics.residentTiles = static_cast<uint32_t>(std::count_if(slots.begin(), slots.end(), [](uint32_t node) { return node != UINT32_MAX; }));
+		}
+
+		/**
+		* Record the copies of the tiles generated by the last update into the tile pool
+		*
+		* @note Must be recorded outside of a render pass and before draw
+		*/
+		void cmdUpload(VkCommandBuffer commandBuffer)
+		{
+			if (uploads.empty())
+			{
+				return;
+			}
+			const VkDeviceSize tileBytes = tileVertexCount * sizeof(Vertex);
+			const VkDeviceSize stagingOffset = static_cast<VkDeviceSize>(frame % framesInFlight) * maxUploadsPerFrame * tileBytes;
+			std::vector<VkBufferCopy> copyRegions(uploads.size());
+			for (size_t i = 0; i < uploads.size(); i++)
+			{
+				copyRegions[i].srcOffset = stagingOffset + i * tileBytes;
+				copyRegions[i].dstOffset = nodes[uploads[i]].slot * tileBytes;
+				copyRegions[i].size = tileBytes;
+			}
+			vkCmdCopyBuffer(commandBuffer, stagingBuffer.buffer, vertexBuffer.buffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+			VkBufferMemoryBarrier barrier = vks::initializers::bufferMemoryBarrier();
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = vertexBuffer.buffer;
+			barrier.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		}
+
+		/** @brief Draw the tiles selected by the last update */
+		void draw(VkCommandBuffer commandBuffer)
+		{
+			const VkDeviceSize offsets[1] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer.buffer, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, indexType);
+			for (uint32_t node : selected)
+			{
+				vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, static_cast<int32_t>(nodes[node].slot * tileVertexCount), 0);
+			}
+		}
+
+		/** @brief Height at a world space position (bilinear), in the terrain's y down convention */
+		float getHeight(float x, float z) const
+		{
+			const float fx = glm::clamp(x / texelSize + (dim - 1) * 0.5f, 0.0f, (float)(dim - 1));
+			const float fz = glm::clamp(z / texelSize + (dim - 1) * 0.5f, 0.0f, (float)(dim - 1));
+			const int32_t x0 = static_cast<int32_t>(fx);
+			const int32_t z0 = static_cast<int32_t>(fz);
+			const float tx = fx - x0;
+			const float tz = fz - z0;
+			const float h0 = glm::mix(sample(x0, z0), sample(x0 + 1, z0), tx);
+			const float h1 = glm::mix(sample(x0, z0 + 1), sample(x0 + 1, z0 + 1), tx);
+			return -glm::mix(h0, h1, tz) * heightScale;
+		}
+
+	private:
+		vks::VulkanDevice *device = nullptr;
+		VkQueue copyQueue = VK_NULL_HANDLE;
+
+		std::vector<uint16_t> heights;
+		uint32_t dim = 0;
+
+		/** @brief Quadtree node, nodes are stored breadth first so each level is a contiguous range */
+		struct Node {
+			// First texel and texel distance between two tile vertices
+			uint32_t x, y;
+			uint32_t stride;
+			uint32_t children[4] = { UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX };
+			// Maximum height deviation (normalized) from the full resolution height field
+			float error = 0.0f;
+			// Normalized height range of the covered texels
+			float minHeight = FLT_MAX;
+			float maxHeight = -FLT_MAX;
+			// Pool slot holding the tile's vertices
+			uint32_t slot = UINT32_MAX;
+			uint32_t lastUsed = 0;
+		};
+		std::vector<Node> nodes;
+		std::vector<uint32_t> levelOffsets;
+
+		/** @brief Node index stored in each pool slot */
+		std::vector<uint32_t> slots;
+		uint32_t tileVertexCount = 0;
+		vks::Buffer stagingBuffer;
+
+		struct Request {
+			uint32_t node;
+			float priority;
+		};
+		std::vector<Request> requests;
+		std::vector<uint32_t> selected;
+		std::vector<uint32_t> uploads;
+
+		uint32_t frame = 0;
+		vks::Frustum frustum;
+		glm::vec3 eye;
+		float nearClip = 0.1f;
+		float projectionScale = 1.0f;
+
+		vks::ThreadPool ownThreadPool;
+
+		vks::ThreadPool &getThreadPool()
+		{
+			if (threadPool)
+			{
+				return *threadPool;
+			}
+			if (ownThreadPool.threads.empty())
+			{
+				ownThreadPool.setThreadCount(std::max(std::thread::hardware_concurrency(), 1u));
+			}
+			return ownThreadPool;
+		}
+
+		/** @brief Normalized height at a texel, clamped to the height field */
+		float sample(int32_t x, int32_t y) const
+		{
+			x = std::max(0, std::min(x, (int32_t)dim - 1));
+			y = std::max(0, std::min(y, (int32_t)dim - 1));
+			return heights[x + static_cast<size_t>(y) * dim] / 65535.0f;
+		}
+
+		glm::vec3 worldPosition(float x, float y, float height) const
+		{
+			return glm::vec3((x - (dim - 1) * 0.5f) * texelSize, -height * heightScale, (y - (dim - 1) * 0.5f) * texelSize);
+		}
+
+		/** @brief World space bounds of a tile including its skirts */
+		void nodeBounds(const Node &node, glm::vec3 &min, glm::vec3 &max) const
+		{
+			const float extent = static_cast<float>(node.stride * tileSize);
+			min = worldPosition((float)node.x, (float)node.y, node.maxHeight);
+			max = worldPosition((float)node.x + extent, (float)node.y + extent, node.minHeight);
+			max.y += skirtDepth(node);
+		}
+
+		/** @brief Skirts cover cracks to neighbours up to one level coarser */
+		float skirtDepth(const Node &node) const
+		{
+			return (2.0f * node.error + 1.0f / 65535.0f) * heightScale + node.stride * texelSize * 0.5f;
+		}
+
+		void buildQuadtree(vks::ThreadPool &pool)
+		{
+			// The root is the smallest tile covering the height field, leaves sample every texel
+			uint32_t rootStride = 1;
+			while (rootStride * tileSize < dim - 1)
+			{
+				rootStride *= 2;
+			}
+
+			nodes.clear();
+			levelOffsets.clear();
+			Node root;
+			root.x = 0;
+			root.y = 0;
+			root.stride = rootStride;
+			nodes.push_back(root);
+			levelOffsets.push_back(0);
+			for (uint32_t level = 0; nodes[levelOffsets[level]].stride > 1; level++)
+			{
+				const uint32_t levelEnd = static_cast<uint32_t>(nodes.size());
+				levelOffsets.push_back(levelEnd);
+				for (uint32_t n = levelOffsets[level]; n < levelEnd; n++)
+				{
+					const uint32_t childStride = nodes[n].stride / 2;
+					const uint32_t childExtent = childStride * tileSize;
+					for (uint32_t c = 0; c < 4; c++)
+					{
+						Node child;
+						child.x = nodes[n].x + (c & 1) * childExtent;
+						child.y = nodes[n].y + (c >> 1) * childExtent;
+						child.stride = childStride;
+						// Tiles entirely outside of the height field are skipped
+						if (child.x >= dim - 1 || child.y >= dim - 1)
+						{
+							continue;
+						}
+						nodes[n].children[c] = static_cast<uint32_t>(nodes.size());
+						nodes.push_back(child);
+					}
+				}
+			}
+			levelOffsets.push_back(static_cast<uint32_t>(nodes.size()));
+
+			// Errors and height ranges are accumulated bottom up, each level is processed in parallel
+			for (int32_t level = static_cast<int32_t>(levelOffsets.size()) - 2; level >= 0; level--)
+			{
+				const uint32_t first = levelOffsets[level];
+				pool.parallelFor(levelOffsets[level + 1] - first, [&](uint32_t begin, uint32_t end)
+				{
+					for (uint32_t n = first + begin; n < first + end; n++)
+					{
+						computeNodeError(nodes[n]);
+					}
+				});
+			}
+		}
+
+		void computeNodeError(Node &node)
+		{
+			const uint32_t s = node.stride;
+			if (s == 1)
+			{
+				// Leaves are exact, only the height range is needed
+				for (uint32_t j = 0; j <= tileSize; j++)
+				{
+					for (uint32_t i = 0; i <= tileSize; i++)
+					{
+						const float h = sample(node.x + i, node.y + j);
+						node.minHeight = std::min(node.minHeight, h);
+						node.maxHeight = std::max(node.maxHeight, h);
+					}
+				}
+				return;
+			}
+			for (uint32_t child : node.children)
+			{
+				if (child != UINT32_MAX)
+				{
+					node.error = std::max(node.error, nodes[child].error);
+					node.minHeight = std::min(node.minHeight, nodes[child].minHeight);
+					node.maxHeight = std::max(node.maxHeight, nodes[child].maxHeight);
+				}
+			}
+			// Deviation of the child level's vertices from this tile's surface
+			const uint32_t h = s / 2;
+			for (uint32_t j = 0; j <= tileSize * 2; j++)
+			{
+				for (uint32_t i = 0; i <= tileSize * 2; i++)
+				{
+					if (((i | j) & 1) == 0)
+					{
+						continue;
+					}
+					const int32_t x = node.x + i * h;
+					const int32_t y = node.y + j * h;
+					const int32_t x0 = node.x + (i / 2) * s;
+					const int32_t y0 = node.y + (j / 2) * s;
+					const int32_t x1 = x0 + ((i & 1) ? s : 0);
+					const int32_t y1 = y0 + ((j & 1) ? s : 0);
+					// Edge midpoints interpolate along the edge, cell centers along the diagonal the index buffer splits quads at
+					const float interpolated = (sample(x0, y0) + sample(x1, y1)) * 0.5f;
+					node.error = std::max(node.error, fabsf(sample(x, y) - interpolated));
+				}
+			}
+		}
+
+		void createBuffers()
+		{
+			const uint32_t n = tileSize + 1;
+			// Grid vertices followed by one row of skirt vertices per edge
+			tileVertexCount = n * n + 4 * n;
+			indexType = (tileVertexCount < 65536) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+			std::vector<uint32_t> indices;
+			indices.reserve(tileSize * tileSize * 6 + 4 * tileSize * 12);
+			for (uint32_t y = 0; y < tileSize; y++)
+			{
+				for (uint32_t x = 0; x < tileSize; x++)
+				{
+					const uint32_t base = x + y * n;
+					indices.insert(indices.end(), { base, base + n, base + n + 1, base + n + 1, base + 1, base });
+				}
+			}
+			// Skirts are double sided so they don't depend on the pipeline's cull mode
+			for (uint32_t edge = 0; edge < 4; edge++)
+			{
+				const uint32_t skirtBase = n * n + edge * n;
+				for (uint32_t i = 0; i < tileSize; i++)
+				{
+					const uint32_t a = edgeVertex(edge, i);
+					const uint32_t b = edgeVertex(edge, i + 1);
+					const uint32_t sa = skirtBase + i;
+					const uint32_t sb = skirtBase + i + 1;
+					indices.insert(indices.end(), { a, b, sb, sb, sa, a, a, sa, sb, sb, b, a });
+				}
+			}
+			indexCount = static_cast<uint32_t>(indices.size());
+
+			std::vector<uint16_t> indices16;
+			if (indexType == VK_INDEX_TYPE_UINT16)
+			{
+				indices16.assign(indices.begin(), indices.end());
+			}
+			const VkDeviceSize indexBufferSize = indexCount * ((indexType == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t));
+
+			vertexBuffer.destroy();
+			indexBuffer.destroy();
+			stagingBuffer.destroy();
+
+			vks::Buffer indexStaging;
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&indexStaging,
+				indexBufferSize,
+				(indexType == VK_INDEX_TYPE_UINT16) ? static_cast<void*>(indices16.data()) : static_cast<void*>(indices.data())));
+
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&indexBuffer,
+				indexBufferSize));
+
+			// Tile pool
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&vertexBuffer,
+				static_cast<VkDeviceSize>(poolSize) * tileVertexCount * sizeof(Vertex)));
+
+			// Staging space for the tiles generated in each frame in flight
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&stagingBuffer,
+				static_cast<VkDeviceSize>(framesInFlight) * maxUploadsPerFrame * tileVertexCount * sizeof(Vertex)));
+			VK_CHECK_RESULT(stagingBuffer.map());
+
+			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			VkBufferCopy copyRegion{};
+			copyRegion.size = indexBufferSize;
+			vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indexBuffer.buffer, 1, &copyRegion);
+			device->flushCommandBuffer(copyCmd, copyQueue, true);
+			indexStaging.destroy();
+
+			slots.assign(poolSize, UINT32_MAX);
+		}
+
+		/** @brief Grid vertex index of the i-th vertex along an edge (0 = top, 1 = bottom, 2 = left, 3 = right) */
+		uint32_t edgeVertex(uint32_t edge, uint32_t i) const
+		{
+			const uint32_t n = tileSize + 1;
+			switch (edge)
+			{
+			case 0: return i;
+			case 1: return tileSize * n + i;
+			case 2: return i * n;
+			default: return i * n + tileSize;
+			}
+		}
+
+		/** @brief Generate the vertices of a tile, including its skirts */
+		void generateTile(uint32_t nodeIndex, Vertex *vertices) const
+		{
+			const Node &node = nodes[nodeIndex];
+			const uint32_t n = tileSize + 1;
+			const int32_t s = static_cast<int32_t>(node.stride);
+			const float gradientScale = heightScale / (2.0f * s * texelSize);
+			for (uint32_t j = 0; j < n; j++)
+			{
+				for (uint32_t i = 0; i < n; i++)
+				{
+					const int32_t x = node.x + i * s;
+					const int32_t y = node.y + j * s;
+					Vertex &vertex = vertices[i + j * n];
+					vertex.pos = worldPosition((float)x, (float)y, sample(x, y));
+					// Gradients at the tile's resolution, the terrain's up direction is -y
+					const float dx = (sample(x + s, y) - sample(x - s, y)) * gradientScale;
+					const float dy = (sample(x, y + s) - sample(x, y - s)) * gradientScale;
+					vertex.normal = glm::normalize(glm::vec3(-dx, -1.0f, -dy));
+					vertex.uv = glm::vec2((float)x, (float)y) / (float)(dim - 1) * uvScale;
+				}
+			}
+			const float depth = skirtDepth(node);
+			for (uint32_t edge = 0; edge < 4; edge++)
+			{
+				for (uint32_t i = 0; i < n; i++)
+				{
+					Vertex &vertex = vertices[n * n + edge * n + i];
+					vertex = vertices[edgeVertex(edge, i)];
+					vertex.pos.y += depth;
+				}
+			}
+		}
+
+		/** @brief Find a pool slot for a node, evicting the least recently used tile that is no longer in flight */
+		bool assignSlot(uint32_t nodeIndex)
+		{
+			uint32_t best = UINT32_MAX;
+			for (uint32_t i = 0; i < static_cast<uint32_t>(slots.size()); i++)
+			{
+				if (slots[i] == UINT32_MAX)
+				{
+					best = i;
+					break;
+				}
+				const Node &resident = nodes[slots[i]];
+				// The root is never evicted
+				if (slots[i] == 0 || resident.lastUsed + framesInFlight > frame)
+				{
+					continue;
+				}
+				if (best == UINT32_MAX || resident.lastUsed < nodes[slots[best]].lastUsed)
+				{
+					best = i;
+				}
+			}
+			if (best == UINT32_MAX)
+			{
+				return false;
+			}
+			if (slots[best] != UINT32_MAX)
+			{
+				nodes[slots[best]].slot = UINT32_MAX;
+			}
+			slots[best] = nodeIndex;
+			nodes[nodeIndex].slot = best;
+			nodes[nodeIndex].lastUsed = frame;
+			return true;
+		}
+
+		float screenError(const Node &node, const glm::vec3 &min, const glm::vec3 &max) const
+		{
+			const glm::vec3 closest = glm::clamp(eye, min, max);
+			const float distance = std::max(glm::length(closest - eye), nearClip);
+			return node.error * heightScale * projectionScale / distance;
+		}
+
+		/** @brief Select the tiles to draw below a resident node, children are only used once all visible ones are resident */
+		void select(uint32_t nodeIndex)
+		{
+			Node &node = nodes[nodeIndex];
+			glm::vec3 min, max;
+			nodeBounds(node, min, max);
+			if (!frustum.checkBox(min, max))
+			{
+				return;
+			}
+			node.lastUsed = frame;
+
+			if (node.stride > 1)
+			{
+				const float error = screenError(node, min, max);
+				if (error > pixelError)
+				{
+					bool childrenResident = true;
+					for (uint32_t child : node.children)
+					{
+						if (child == UINT32_MAX || nodes[child].slot != UINT32_MAX)
+						{
+							continue;
+						}
+						glm::vec3 childMin, childMax;
+						nodeBounds(nodes[child], childMin, childMax);
+						if (frustum.checkBox(childMin, childMax))
+						{
+							childrenResident = false;
+							requests.push_back({ child, error });
+						}
+					}
+					if (childrenResident)
+					{
+						for (uint32_t child : node.children)
+						{
+							if (child != UINT32_MAX)
+							{
+								select(child);
+							}
+						}
+						return;
+					}
+				}
+			}
+			selected.push_back(nodeIndex);
+		}
+	};
+}
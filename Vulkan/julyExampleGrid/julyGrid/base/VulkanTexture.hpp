@@ -106,10 +106,11 @@ namespace vks
 
 			free(textureData);
 #else
-			if (!vks::tools::fileExists(filename)) {
+			vks::vfs::File file = vks::vfs::open(filename);
+			if (!file.valid()) {
 				vks::tools::exitFatal("Could not load texture from " + filename + "\n\nThe file may be part of the additional asset pack.\n\nRun \"download_assets.py\" in the repository root to download the latest version.", -1);
 			}
-			gli::texture2d tex2D(gli::load(filename.c_str()));
+			gli::texture2d tex2D(gli::load(reinterpret_cast<const char*>(file.data()), file.size()));
 #endif		
 			assert(!tex2D.empty());
 
@@ -586,10 +587,11 @@ namespace vks
 
 			free(textureData);
 #else
-			if (!vks::tools::fileExists(filename)) {
+			vks::vfs::File file = vks::vfs::open(filename);
+			if (!file.valid()) {
 				vks::tools::exitFatal("Could not load texture from " + filename + "\n\nThe file may be part of the additional asset pack.\n\nRun \"download_assets.py\" in the repository root to download the latest version.", -1);
 			}
-			gli::texture2d_array tex2DArray(gli::load(filename));
+			gli::texture2d_array tex2DArray(gli::load(reinterpret_cast<const char*>(file.data()), file.size()));
 #endif	
 			assert(!tex2DArray.empty());
 
@@ -798,10 +800,11 @@ namespace vks
 
 			free(textureData);
 #else
-			if (!vks::tools::fileExists(filename)) {
+			vks::vfs::File file = vks::vfs::open(filename);
+			if (!file.valid()) {
 				vks::tools::exitFatal("Could not load texture from " + filename + "\n\nThe file may be part of the additional asset pack.\n\nRun \"download_assets.py\" in the repository root to download the latest version.", -1);
 			}
-			gli::texture_cube texCube(gli::load(filename));
+			gli::texture_cube texCube(gli::load(reinterpret_cast<const char*>(file.data()), file.size()));
 #endif	
 			assert(!texCube.empty());
 
@@ -285,19 +285,12 @@ namespace vks
 
 		std::string readTextFile(const char *fileName)
 		{
-			std::string fileContent;
-			std::ifstream fileStream(fileName, std::ios::in);
-			if (!fileStream.is_open()) {
+			vks::vfs::File file = vks::vfs::open(fileName);
+			if (!file.valid()) {
 				printf("File %s not found\n", fileName);
 				return "";
 			}
-			std::string line = "";
-			while (!fileStream.eof()) {
-				getline(fileStream, line);
-				fileContent.append(line + "\n");
-			}
-			fileStream.close();
-			return fileContent;
+			return std::string(reinterpret_cast<const char*>(file.data()), file.size());
 		}
 
 #if defined(__ANDROID__)
@@ -332,28 +325,22 @@ namespace vks
 #else
 		VkShaderModule loadShader(const char *fileName, VkDevice device)
 		{
-			std::ifstream is(fileName, std::ios::binary | std::ios::in | std::ios::ate);
+			vks::vfs::File file = vks::vfs::open(fileName);
 
-			if (is.is_open())
+			if (file.valid())
 			{
-				size_t size = is.tellg();
-				is.seekg(0, std::ios::beg);
-				char* shaderCode = new char[size];
-				is.read(shaderCode, size);
-				is.close();
-
+				size_t size = file.size();
 				assert(size > 0);
 
+				// SPIR-V needs to be 4 byte aligned, mapped files and archive entries always are
 				VkShaderModule shaderModule;
 				VkShaderModuleCreateInfo moduleCreateInfo{};
 				moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 				moduleCreateInfo.codeSize = size;
-				moduleCreateInfo.pCode = (uint32_t*)shaderCode;
+				moduleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(file.data());
 
 				VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, NULL, &shaderModule));
 
-				delete[] shaderCode;
-
 				return shaderModule;
 			}
 			else
@@ -392,8 +379,7 @@ namespace vks
 
 		bool fileExists(const std::string &filename)
 		{
-			std::ifstream f(filename.c_str());
-			return !f.fail();
+			return vks::vfs::exists(filename);
 		}
 	}
 }
\ No newline at end of file
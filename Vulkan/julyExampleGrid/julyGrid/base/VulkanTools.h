@@ -10,6 +10,7 @@
 
 #include "vulkan/vulkan.h"
 #include "VulkanInitializers.hpp"
+#include "vfs.hpp"
 
 #include <math.h>
 #include <stdlib.h>
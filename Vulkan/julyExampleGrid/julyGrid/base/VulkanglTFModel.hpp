@@ -13,8 +13,30 @@
 #include <fstream>
 #include <vector>
 
+#include <cfloat>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define VKS_GLTF_SSE2
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define VKS_GLTF_SSSE3
+#endif
+
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.hpp"
+#include "bvh.hpp"
+#include "transformhierarchy.hpp"
+#include "animation.hpp"
+#include "animator.hpp"
+#include "meshoptimizer.hpp"
+#include "meshlet.hpp"
+#include "renderqueue.hpp"
+#include "mipgen.hpp"
+#include "vfs.hpp"
+#include "threadpool.hpp"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -36,6 +58,184 @@ namespace vkglTF
 {
 	struct Node;
 
+	/*
+		glTF accessor decoding
+		Reads accessors with any component type and buffer view stride into strided destination arrays (e.g. members of interleaved vertices)
+	*/
+	namespace accessor
+	{
+		/** @brief Source elements of an accessor */
+		struct View {
+			const unsigned char *data = nullptr;
+			size_t count = 0;
+			// Distance between two elements in bytes, larger than the element size for interleaved buffer views
+			size_t stride = 0;
+			int componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+			uint32_t components = 1;
+			bool normalized = false;
+		};
+
+		/** @brief Factor that maps normalized integers to [0, 1] (unsigned) or [-1, 1] (signed) */
+		inline float normalizationScale(const View &src)
+		{
+			if (!src.normalized) {
+				return 1.0f;
+			}
+			switch (src.componentType) {
+			case TINYGLTF_COMPONENT_TYPE_BYTE: return 1.0f / 127.0f;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: return 1.0f / 255.0f;
+			case TINYGLTF_COMPONENT_TYPE_SHORT: return 1.0f / 32767.0f;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: return 1.0f / 65535.0f;
+			default: return 1.0f;
+			}
+		}
+
+		template<typename T>
+		inline void readComponents(const View &src, float *dst, size_t dstStride, uint32_t components)
+		{
+			const float scale = normalizationScale(src);
+			// Signed normalized values are clamped as -128 and -32768 would map slightly below -1
+			const float minValue = (src.normalized && std::is_signed<T>::value) ? -1.0f : -FLT_MAX;
+			unsigned char *dstBytes = reinterpret_cast<unsigned char*>(dst);
+			for (size_t i = 0; i < src.count; i++) {
+				const unsigned char *element = src.data + i * src.stride;
+				float *out = reinterpret_cast<float*>(dstBytes + i * dstStride);
+				for (uint32_t c = 0; c < components; c++) {
+					T value;
+					memcpy(&value, element + c * sizeof(T), sizeof(T));
+					out[c] = std::max(static_cast<float>(value) * scale, minValue);
+				}
+			}
+		}
+
+		/**
+		* Decode an accessor to floats
+		*
+		* @param src Accessor to read
+		* @param dst First destination element
+		* @param dstStride Distance between two destination elements in bytes
+		* @param dstComponents Number of components written per element, additional source components are skipped and missing ones are left untouched
+		*/
+		inline void readFloats(const View &src, float *dst, size_t dstStride, uint32_t dstComponents)
+		{
+			const uint32_t components = std::min(src.components, dstComponents);
+			unsigned char *dstBytes = reinterpret_cast<unsigned char*>(dst);
+			switch (src.componentType) {
+			case TINYGLTF_COMPONENT_TYPE_FLOAT:
+				if ((src.stride == dstStride) && (components == src.components) && (src.stride == components * sizeof(float))) {
+					memcpy(dst, src.data, src.count * src.stride);
+					break;
+				}
+				for (size_t i = 0; i < src.count; i++) {
+					memcpy(dstBytes + i * dstStride, src.data + i * src.stride, components * sizeof(float));
+				}
+				break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+#if defined(VKS_GLTF_SSE2)
+				// Four component vectors (joints, weights, colors) are converted one element per iteration
+				if (components == 4) {
+					const __m128 scale = _mm_set1_ps(normalizationScale(src));
+					const __m128i zero = _mm_setzero_si128();
+					for (size_t i = 0; i < src.count; i++) {
+						int32_t packed;
+						memcpy(&packed, src.data + i * src.stride, sizeof(int32_t));
+						const __m128i values = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+						_mm_storeu_ps(reinterpret_cast<float*>(dstBytes + i * dstStride), _mm_mul_ps(_mm_cvtepi32_ps(values), scale));
+					}
+					break;
+				}
+#endif
+				readComponents<uint8_t>(src, dst, dstStride, components);
+				break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+#if defined(VKS_GLTF_SSE2)
+				if (components == 4) {
+					const __m128 scale = _mm_set1_ps(normalizationScale(src));
+					const __m128i zero = _mm_setzero_si128();
+					for (size_t i = 0; i < src.count; i++) {
+						const __m128i values = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src.data + i * src.stride)), zero);
+						_mm_storeu_ps(reinterpret_cast<float*>(dstBytes + i * dstStride), _mm_mul_ps(_mm_cvtepi32_ps(values), scale));
+					}
+					break;
+				}
+#endif
+				readComponents<uint16_t>(src, dst, dstStride, components);
+				break;
+			case TINYGLTF_COMPONENT_TYPE_BYTE:
+				readComponents<int8_t>(src, dst, dstStride, components);
+				break;
+			case TINYGLTF_COMPONENT_TYPE_SHORT:
+				readComponents<int16_t>(src, dst, dstStride, components);
+				break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+				readComponents<uint32_t>(src, dst, dstStride, components);
+				break;
+			default:
+				std::cerr << "Accessor component type " << src.componentType << " not supported!" << std::endl;
+				break;
+			}
+		}
+
+		/**
+		* Decode a scalar unsigned integer accessor (e.g. indices) to 32 bit integers
+		*
+		* @return False if the component type is not an unsigned integer type
+		*/
+		inline bool readIndices(const View &src, uint32_t *dst)
+		{
+			size_t i = 0;
+			switch (src.componentType) {
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+				if (src.stride == sizeof(uint32_t)) {
+					memcpy(dst, src.data, src.count * sizeof(uint32_t));
+					return true;
+				}
+				for (; i < src.count; i++) {
+					memcpy(&dst[i], src.data + i * src.stride, sizeof(uint32_t));
+				}
+				return true;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+#if defined(VKS_GLTF_SSE2)
+				if (src.stride == sizeof(uint16_t)) {
+					const __m128i zero = _mm_setzero_si128();
+					for (; i + 8 <= src.count; i += 8) {
+						const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.data + i * sizeof(uint16_t)));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(values, zero));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(values, zero));
+					}
+				}
+#endif
+				for (; i < src.count; i++) {
+					uint16_t value;
+					memcpy(&value, src.data + i * src.stride, sizeof(uint16_t));
+					dst[i] = value;
+				}
+				return true;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+#if defined(VKS_GLTF_SSE2)
+				if (src.stride == sizeof(uint8_t)) {
+					const __m128i zero = _mm_setzero_si128();
+					for (; i + 16 <= src.count; i += 16) {
+						const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.data + i));
+						const __m128i low = _mm_unpacklo_epi8(values, zero);
+						const __m128i high = _mm_unpackhi_epi8(values, zero);
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(low, zero));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(low, zero));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpacklo_epi16(high, zero));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 12), _mm_unpackhi_epi16(high, zero));
+					}
+				}
+#endif
+				for (; i < src.count; i++) {
+					dst[i] = src.data[i * src.stride];
+				}
+				return true;
+			default:
+				return false;
+			}
+		}
+	}
+
 	/*
 		glTF texture loading class
 	*/
@@ -48,6 +248,8 @@ namespace vkglTF
 		uint32_t width, height;
 		uint32_t mipLevels;
 		uint32_t layerCount;
+		// Lower mip levels are generated on the CPU and uploaded together with the top level instead of being blitted
+		bool cpuMips = false;
 		VkDescriptorImageInfo descriptor;
 		VkSampler sampler;
 
@@ -66,73 +268,46 @@ namespace vkglTF
 			vkDestroySampler(device->logicalDevice, sampler, nullptr);
 		}
 
+		/** @brief Expand tightly packed RGB pixels to RGBA with an opaque alpha channel */
+		static void convertRGBToRGBA(const unsigned char *rgb, unsigned char *rgba, size_t pixelCount)
+		{
+			size_t i = 0;
+#if defined(VKS_GLTF_SSSE3)
+			// Four pixels per iteration, the 16 byte load reads past the fourth pixel so the last pixels are done in the scalar loop
+			const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+			for (; i + 6 <= pixelCount; i += 4) {
+				const __m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + i * 3));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4), _mm_or_si128(_mm_shuffle_epi8(src, shuffle), alpha));
+			}
+#endif
+			for (; i < pixelCount; i++) {
+				rgba[i * 4 + 0] = rgb[i * 3 + 0];
+				rgba[i * 4 + 1] = rgb[i * 3 + 1];
+				rgba[i * 4 + 2] = rgb[i * 3 + 2];
+				rgba[i * 4 + 3] = 255;
+			}
+		}
+
 		/*
-			Load a texture from a glTF image (stored as vector of chars loaded via stb_image)
-			Also generates the mip chain as glTF images are stored as jpg or png without any mips
+			Create the image with a full mip chain, its view and sampler
+			Image contents are uploaded with upload()
+			Mips are generated on the CPU (see mipgen.hpp) if requested or if the format doesn't support linear blits
 		*/
-		void fromglTfImage(tinygltf::Image &gltfimage, vks::VulkanDevice *device, VkQueue copyQueue)
+		void create(vks::VulkanDevice *device, uint32_t width, uint32_t height, bool forceCpuMips = false)
 		{
 			this->device = device;
-
-			unsigned char* buffer = nullptr;
-			VkDeviceSize bufferSize = 0;
-			bool deleteBuffer = false;
-			if (gltfimage.component == 3) {
-				// Most devices don't support RGB only on Vulkan so convert if necessary
-				// TODO: Check actual format support and transform only if required
-				bufferSize = gltfimage.width * gltfimage.height * 4;
-				buffer = new unsigned char[bufferSize];
-				unsigned char* rgba = buffer;
-				unsigned char* rgb = &gltfimage.image[0];
-				for (size_t i = 0; i< gltfimage.width * gltfimage.height; ++i) {
-					for (int32_t j = 0; j < 3; ++j) {
-						rgba[j] = rgb[j];
-					}
-					rgba += 4;
-					rgb += 3;
-				}
-				deleteBuffer = true;
-			}
-			else {
-				buffer = &gltfimage.image[0];
-				bufferSize = gltfimage.image.size();
-			}
+			this->width = width;
+			this->height = height;
+			mipLevels = static_cast<uint32_t>(floor(log2(std::max(width, height))) + 1.0);
+			layerCount = 1;
 
 			VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
 
 			VkFormatProperties formatProperties;
-
-			width = gltfimage.width;
-			height = gltfimage.height;
-			mipLevels = static_cast<uint32_t>(floor(log2(std::max(width, height))) + 1.0);
-
 			vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
-			assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
-			assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
-
-			VkMemoryAllocateInfo memAllocInfo{};
-			memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-			VkMemoryRequirements memReqs{};
-
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-
-			VkBufferCreateInfo bufferCreateInfo{};
-			bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-			bufferCreateInfo.size = bufferSize;
-			bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-			memAllocInfo.allocationSize = memReqs.size;
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-			VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-			uint8_t *data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void **)&data));
-			memcpy(data, buffer, bufferSize);
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
+			const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+			cpuMips = forceCpuMips || ((formatProperties.optimalTilingFeatures & blitFeatures) != blitFeatures);
 
 			VkImageCreateInfo imageCreateInfo{};
 			imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -142,134 +317,21 @@ namespace vkglTF
 			imageCreateInfo.arrayLayers = 1;
 			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-			imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
 			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 			imageCreateInfo.extent = { width, height, 1 };
-			imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (cpuMips ? 0 : VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
+
+			VkMemoryRequirements memReqs{};
 			vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
+			VkMemoryAllocateInfo memAllocInfo{};
+			memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 			memAllocInfo.allocationSize = memReqs.size;
 			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
 			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
 
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-			VkImageSubresourceRange subresourceRange = {};
-			subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			subresourceRange.levelCount = 1;
-			subresourceRange.layerCount = 1;
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = 0;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
-
-			VkBufferImageCopy bufferCopyRegion = {};
-			bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			bufferCopyRegion.imageSubresource.mipLevel = 0;
-			bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
-			bufferCopyRegion.imageSubresource.layerCount = 1;
-			bufferCopyRegion.imageExtent.width = width;
-			bufferCopyRegion.imageExtent.height = height;
-			bufferCopyRegion.imageExtent.depth = 1;
-
-			vkCmdCopyBufferToImage(copyCmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
-
-			device->flushCommandBuffer(copyCmd, copyQueue, true);
-
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
-			// Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
-			VkCommandBuffer blitCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-			for (uint32_t i = 1; i < mipLevels; i++) {
-				VkImageBlit imageBlit{};
-
-				imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				imageBlit.srcSubresource.layerCount = 1;
-				imageBlit.srcSubresource.mipLevel = i - 1;
-				imageBlit.srcOffsets[1].x = int32_t(width >> (i - 1));
-				imageBlit.srcOffsets[1].y = int32_t(height >> (i - 1));
-				imageBlit.srcOffsets[1].z = 1;
-
-				imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				imageBlit.dstSubresource.layerCount = 1;
-				imageBlit.dstSubresource.mipLevel = i;
-				imageBlit.dstOffsets[1].x = int32_t(width >> i);
-				imageBlit.dstOffsets[1].y = int32_t(height >> i);
-				imageBlit.dstOffsets[1].z = 1;
-
-				VkImageSubresourceRange mipSubRange = {};
-				mipSubRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				mipSubRange.baseMipLevel = i;
-				mipSubRange.levelCount = 1;
-				mipSubRange.layerCount = 1;
-
-				{
-					VkImageMemoryBarrier imageMemoryBarrier{};
-					imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-					imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-					imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-					imageMemoryBarrier.srcAccessMask = 0;
-					imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-					imageMemoryBarrier.image = image;
-					imageMemoryBarrier.subresourceRange = mipSubRange;
-					vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-				}
-
-				vkCmdBlitImage(blitCmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
-
-				{
-					VkImageMemoryBarrier imageMemoryBarrier{};
-					imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-					imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-					imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-					imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-					imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-					imageMemoryBarrier.image = image;
-					imageMemoryBarrier.subresourceRange = mipSubRange;
-					vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-				}
-			}
-
-			subresourceRange.levelCount = mipLevels;
-			imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
-
-			device->flushCommandBuffer(blitCmd, copyQueue, true);
-
 			VkSamplerCreateInfo samplerInfo{};
 			samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 			samplerInfo.magFilter = VK_FILTER_LINEAR;
@@ -280,8 +342,6 @@ namespace vkglTF
 			samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
 			samplerInfo.compareOp = VK_COMPARE_OP_NEVER;
 			samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-			samplerInfo.maxAnisotropy = 1.0;
-			samplerInfo.anisotropyEnable = VK_FALSE;
 			samplerInfo.maxLod = (float)mipLevels;
 			samplerInfo.maxAnisotropy = 8.0f;
 			samplerInfo.anisotropyEnable = VK_TRUE;
@@ -298,9 +358,157 @@ namespace vkglTF
 			viewInfo.subresourceRange.levelCount = mipLevels;
 			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewInfo, nullptr, &view));
 
-			descriptor.sampler = sampler;
-			descriptor.imageView = view;
-			descriptor.imageLayout = imageLayout;
+			imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			updateDescriptor();
+		}
+
+		/*
+			Record the upload of the top level of several textures and the generation of their mip chains (glTF uses jpg and png, so we need to create them manually)
+			Barriers and blits of all textures are batched per mip level, so the whole set is uploaded with a single submission
+
+			@param copyCmd Command buffer to record to
+			@param textures Textures created with create()
+			@param count Number of textures
+			@param staging Buffer with the RGBA top levels of all textures, or their whole chain for textures with CPU generated mips
+			@param offsets Offset of each texture's data in the staging buffer (chains are laid out as returned by mipgen::getLevels)
+		*/
+		static void upload(VkCommandBuffer copyCmd, Texture *const *textures, size_t count, VkBuffer staging, const VkDeviceSize *offsets)
+		{
+			std::vector<VkImageMemoryBarrier> barriers;
+			barriers.reserve(count * 2);
+			auto addBarrier = [&](const Texture *texture, uint32_t baseMipLevel, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) {
+				VkImageMemoryBarrier imageMemoryBarrier{};
+				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				imageMemoryBarrier.oldLayout = oldLayout;
+				imageMemoryBarrier.newLayout = newLayout;
+				imageMemoryBarrier.srcAccessMask = srcAccessMask;
+				imageMemoryBarrier.dstAccessMask = dstAccessMask;
+				imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageMemoryBarrier.image = texture->image;
+				imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				imageMemoryBarrier.subresourceRange.baseMipLevel = baseMipLevel;
+				imageMemoryBarrier.subresourceRange.levelCount = levelCount;
+				imageMemoryBarrier.subresourceRange.layerCount = 1;
+				barriers.push_back(imageMemoryBarrier);
+			};
+			auto flushBarriers = [&](VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask) {
+				if (!barriers.empty()) {
+					vkCmdPipelineBarrier(copyCmd, srcStageMask, dstStageMask, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+					barriers.clear();
+				}
+			};
+
+			// All levels are transitioned once, the lower levels are written by the blits
+			uint32_t maxMipLevels = 0;
+			for (size_t i = 0; i < count; i++) {
+				addBarrier(textures[i], 0, textures[i]->mipLevels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+				maxMipLevels = std::max(maxMipLevels, textures[i]->mipLevels);
+			}
+			flushBarriers(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+			std::vector<VkBufferImageCopy> bufferCopyRegions;
+			for (size_t i = 0; i < count; i++) {
+				const std::vector<vks::mipgen::Level> levels = vks::mipgen::getLevels(textures[i]->width, textures[i]->height, textures[i]->cpuMips ? textures[i]->mipLevels : 1);
+				bufferCopyRegions.clear();
+				for (uint32_t level = 0; level < levels.size(); level++) {
+					VkBufferImageCopy bufferCopyRegion = {};
+					bufferCopyRegion.bufferOffset = offsets[i] + levels[level].offset;
+					bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+					bufferCopyRegion.imageSubresource.mipLevel = level;
+					bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
+					bufferCopyRegion.imageSubresource.layerCount = 1;
+					bufferCopyRegion.imageExtent.width = levels[level].width;
+					bufferCopyRegion.imageExtent.height = levels[level].height;
+					bufferCopyRegion.imageExtent.depth = 1;
+					bufferCopyRegions.push_back(bufferCopyRegion);
+				}
+				vkCmdCopyBufferToImage(copyCmd, staging, textures[i]->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(bufferCopyRegions.size()), bufferCopyRegions.data());
+			}
+
+			// Generate the mip chains, each level is blitted from the previous one
+			for (uint32_t level = 1; level < maxMipLevels; level++) {
+				for (size_t i = 0; i < count; i++) {
+					if (level < textures[i]->mipLevels && !textures[i]->cpuMips) {
+						addBarrier(textures[i], level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+					}
+				}
+				flushBarriers(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+				for (size_t i = 0; i < count; i++) {
+					const Texture *texture = textures[i];
+					if (level >= texture->mipLevels || texture->cpuMips) {
+						continue;
+					}
+					VkImageBlit imageBlit{};
+					imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+					imageBlit.srcSubresource.layerCount = 1;
+					imageBlit.srcSubresource.mipLevel = level - 1;
+					imageBlit.srcOffsets[1].x = int32_t(std::max(texture->width >> (level - 1), 1u));
+					imageBlit.srcOffsets[1].y = int32_t(std::max(texture->height >> (level - 1), 1u));
+					imageBlit.srcOffsets[1].z = 1;
+					imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+					imageBlit.dstSubresource.layerCount = 1;
+					imageBlit.dstSubresource.mipLevel = level;
+					imageBlit.dstOffsets[1].x = int32_t(std::max(texture->width >> level, 1u));
+					imageBlit.dstOffsets[1].y = int32_t(std::max(texture->height >> level, 1u));
+					imageBlit.dstOffsets[1].z = 1;
+					vkCmdBlitImage(copyCmd, texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
+				}
+			}
+
+			// All but the last level have been blit sources
+			for (size_t i = 0; i < count; i++) {
+				const Texture *texture = textures[i];
+				if (texture->cpuMips) {
+					addBarrier(texture, 0, texture->mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+					continue;
+				}
+				if (texture->mipLevels > 1) {
+					addBarrier(texture, 0, texture->mipLevels - 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT);
+				}
+				addBarrier(texture, texture->mipLevels - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+			}
+			flushBarriers(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+		}
+
+		/*
+			Load a texture from a glTF image (stored as vector of chars loaded via stb_image)
+			Also generates the mip chain as glTF images are stored as jpg or png without any mips
+			Model::loadImages uploads all images of a model at once, this is for loading single images
+			Mips are generated on the CPU with cpuMipOptions if given or if the format doesn't support linear blits
+		*/
+		void fromglTfImage(tinygltf::Image &gltfimage, vks::VulkanDevice *device, VkQueue copyQueue, const vks::mipgen::Options *cpuMipOptions = nullptr)
+		{
+			const size_t pixelCount = static_cast<size_t>(gltfimage.width) * gltfimage.height;
+
+			create(device, gltfimage.width, gltfimage.height, cpuMipOptions != nullptr);
+			const std::vector<vks::mipgen::Level> levels = vks::mipgen::getLevels(width, height, cpuMips ? mipLevels : 1);
+
+			vks::Buffer staging;
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&staging,
+				vks::mipgen::getSize(levels)));
+			VK_CHECK_RESULT(staging.map());
+			// Most devices don't support RGB only on Vulkan so convert if necessary
+			std::vector<unsigned char> rgba;
+			const unsigned char *pixels = gltfimage.image.data();
+			if (gltfimage.component == 3) {
+				rgba.resize(pixelCount * 4);
+				convertRGBToRGBA(gltfimage.image.data(), rgba.data(), pixelCount);
+				pixels = rgba.data();
+			}
+			vks::mipgen::generate(pixels, static_cast<uint8_t*>(staging.mapped), levels, cpuMipOptions ? *cpuMipOptions : vks::mipgen::Options());
+			staging.unmap();
+
+			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			Texture *texture = this;
+			const VkDeviceSize offset = 0;
+			upload(copyCmd, &texture, 1, staging.buffer, &offset);
+			device->flushCommandBuffer(copyCmd, copyQueue, true);
+
+			staging.destroy();
 		}
 	};
 
@@ -333,6 +541,12 @@ namespace vkglTF
 	struct Primitive {
 		uint32_t firstIndex;
 		uint32_t indexCount;
+		// Indices are relative to the primitive's first vertex
+		uint32_t vertexStart = 0;
+		uint32_t vertexCount = 0;
+		// Range of the primitive's meshlets in the model's meshlet array
+		uint32_t meshletOffset = 0;
+		uint32_t meshletCount = 0;
 		Material &material;
 
 		struct Dimensions {
@@ -363,39 +577,24 @@ namespace vkglTF
 		std::vector<Primitive*> primitives;
 		std::string name;
 
-		struct UniformBuffer {
-			VkBuffer buffer;
-			VkDeviceMemory memory;
-			VkDescriptorBufferInfo descriptor;
-			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
-			void *mapped;
-		} uniformBuffer;
-
 		struct UniformBlock {
 			glm::mat4 matrix;
-			glm::mat4 jointMatrix[64]{};
-			float jointcount{ 0 };
+			// Range of the mesh's joint matrices in the model's joint palette
+			uint32_t jointOffset{ 0 };
+			uint32_t jointCount{ 0 };
 		} uniformBlock;
 
+		// Joint matrices of a skinned mesh, points into the model's mapped joint palette
+		glm::mat4 *jointMatrices = nullptr;
+
+		// Slot of the mesh in the model's per mesh uniform buffer, bound with this dynamic offset
+		uint32_t dynamicOffset = 0;
+		UniformBlock *uniformData = nullptr;
+
 		Mesh(vks::VulkanDevice *device, glm::mat4 matrix) {
 			this->device = device;
 			this->uniformBlock.matrix = matrix;
-			VK_CHECK_RESULT(device->createBuffer(
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				sizeof(uniformBlock),
-				&uniformBuffer.buffer,
-				&uniformBuffer.memory,
-				&uniformBlock));
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, uniformBuffer.memory, 0, sizeof(uniformBlock), 0, &uniformBuffer.mapped));
-			uniformBuffer.descriptor = { uniformBuffer.buffer, 0, sizeof(uniformBlock) };
 		};
-
-		~Mesh() {
-			vkDestroyBuffer(device->logicalDevice, uniformBuffer.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, uniformBuffer.memory, nullptr);
-		}
-
 	};
 
 	/*
@@ -410,56 +609,45 @@ namespace vkglTF
 
 	/*
 		glTF node
+		The local transform and the cached world matrix are stored in the model's flattened transform hierarchy
 	*/
 	struct Node {
 		Node *parent;
 		uint32_t index;
 		std::vector<Node*> children;
-		glm::mat4 matrix;
 		std::string name;
 		Mesh *mesh;
 		Skin *skin;
 		int32_t skinIndex = -1;
-		glm::vec3 translation{};
-		glm::vec3 scale{ 1.0f };
-		glm::quat rotation{};
+		vks::TransformHierarchy *transforms = nullptr;
+		// Index of the node's transform in the hierarchy
+		uint32_t transform = 0;
 
-		glm::mat4 localMatrix() {
-			return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
+		glm::mat4 localMatrix() const {
+			return transforms->getLocalMatrix(transform);
 		}
 
-		glm::mat4 getMatrix() {
-			glm::mat4 m = localMatrix();
-			vkglTF::Node *p = parent;
-			while (p) {
-				m = p->localMatrix() * m;
-				p = p->parent;
-			}
-			return m;
+		/** @brief World matrix as of the last update of the transform hierarchy */
+		const glm::mat4 &getMatrix() const {
+			return transforms->getWorldMatrix(transform);
 		}
 
+		/** @brief Write the node's world matrix to the mesh's uniform buffer slot and its joint matrices to the joint palette, children are not updated */
 		void update() {
-			if (mesh) {
-				glm::mat4 m = getMatrix();
-				if (skin) {
-					mesh->uniformBlock.matrix = m;
-					// Update join matrices
-					glm::mat4 inverseTransform = glm::inverse(m);
-					for (size_t i = 0; i < skin->joints.size(); i++) {
-						vkglTF::Node *jointNode = skin->joints[i];
-						glm::mat4 jointMat = jointNode->getMatrix() * skin->inverseBindMatrices[i];
-						jointMat = inverseTransform * jointMat;
-						mesh->uniformBlock.jointMatrix[i] = jointMat;
-					}
-					mesh->uniformBlock.jointcount = (float)skin->joints.size();
-					memcpy(mesh->uniformBuffer.mapped, &mesh->uniformBlock, sizeof(mesh->uniformBlock));
-				} else {
-					memcpy(mesh->uniformBuffer.mapped, &m, sizeof(glm::mat4));
+			if (!mesh) {
+				return;
+			}
+			const glm::mat4 &m = getMatrix();
+			mesh->uniformBlock.matrix = m;
+			if (skin && mesh->jointMatrices) {
+				// Joint matrices are relative to the mesh's node
+				const glm::mat4 inverseTransform = glm::inverse(m);
+				for (size_t i = 0; i < skin->joints.size(); i++) {
+					mesh->jointMatrices[i] = inverseTransform * skin->joints[i]->getMatrix() * skin->inverseBindMatrices[i];
 				}
 			}
-
-			for (auto& child : children) {
-				child->update();
+			if (mesh->uniformData) {
+				*mesh->uniformData = mesh->uniformBlock;
 			}
 		}
 
@@ -474,35 +662,11 @@ namespace vkglTF
 	};
 
 	/*
-		glTF animation channel
-	*/
-	struct AnimationChannel {
-		enum PathType { TRANSLATION, ROTATION, SCALE };
-		PathType path;
-		Node *node;
-		uint32_t samplerIndex;
-	};
-
-	/*
-		glTF animation sampler
-	*/
-	struct AnimationSampler {
-		enum InterpolationType { LINEAR, STEP, CUBICSPLINE };
-		InterpolationType interpolation;
-		std::vector<float> inputs;
-		std::vector<glm::vec4> outputsVec4;
-	};
-
-	/*
-		glTF animation
+		glTF animation, channels target the nodes' transforms in the model's hierarchy
 	*/
-	struct Animation {
-		std::string name;
-		std::vector<AnimationSampler> samplers;
-		std::vector<AnimationChannel> channels;
-		float start = std::numeric_limits<float>::max();
-		float end = std::numeric_limits<float>::min();
-	};
+	typedef vks::animation::Sampler AnimationSampler;
+	typedef vks::animation::Channel AnimationChannel;
+	typedef vks::animation::Clip Animation;
 
 	/*
 		glTF model loading and rendering class
@@ -512,6 +676,8 @@ namespace vkglTF
 		vks::VulkanDevice *device;
 		VkDescriptorPool descriptorPool;
 		VkDescriptorSetLayout descriptorSetLayout;
+		// Single set for all meshes, the mesh's uniform block is selected with its dynamic offset
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
 
 		struct Vertex {
 			glm::vec3 pos;
@@ -522,23 +688,32 @@ namespace vkglTF
 		};
 
 		struct Vertices {
+			uint32_t count = 0;
 			VkBuffer buffer;
 			VkDeviceMemory memory;
 		} vertices;
 		struct Indices {
 			int count;
+			// 16 bit indices are used if all primitives have less than 65536 vertices
+			VkIndexType type = VK_INDEX_TYPE_UINT32;
 			VkBuffer buffer;
 			VkDeviceMemory memory;
 		} indices;
 
 		std::vector<Node*> nodes;
 		std::vector<Node*> linearNodes;
+		// Local transforms and world matrices of all nodes, parents are stored before their children
+		vks::TransformHierarchy transforms;
+		// Copy of the transforms in their loaded pose, animations only change the live hierarchy
+		vks::TransformHierarchy restTransforms;
 
 		std::vector<Skin*> skins;
 
 		std::vector<Texture> textures;
 		std::vector<Material> materials;
 		std::vector<Animation> animations;
+		// Key cursors and sampled values of each animation
+		std::vector<vks::animation::State> animationStates;
 
 		struct Dimensions {
 			glm::vec3 min = glm::vec3(FLT_MAX);
@@ -548,8 +723,94 @@ namespace vkglTF
 			float radius;
 		} dimensions;
 
+		/*
+			Scene primitives referenced by the bounding volume hierarchy
+			Primitives of the same node are stored next to each other
+		*/
+		struct ScenePrimitive {
+			Node *node;
+			Primitive *primitive;
+		};
+		std::vector<ScenePrimitive> scenePrimitives;
+		vks::BVH bvh;
+
 		bool metallicRoughnessWorkflow = true;
 
+		// Reorder indices and vertices of each primitive at load time for vertex cache, overdraw and vertex fetch efficiency
+		bool optimizeMeshes = true;
+		vks::meshopt::Statistics optimizationStatistics;
+
+		// Partition each primitive into meshlets at load time for cluster culling (see updateMeshlets and drawMeshlets)
+		bool buildMeshlets = false;
+		std::vector<vks::Meshlet> meshlets;
+		// Host visible indirect draw commands written by updateMeshlets, one per meshlet
+		vks::Buffer meshletCommands;
+		uint32_t visibleMeshletCount = 0;
+
+		// Uniform blocks of all meshes in one persistently mapped buffer, one slot per mesh aligned for dynamic offsets
+		vks::Buffer meshBuffer;
+		uint32_t meshBufferStride = 0;
+
+		// Joint matrices of all skinned meshes, each mesh owns the range given by its uniform block's jointOffset and jointCount
+		vks::Buffer jointBuffer;
+		uint32_t jointCount = 0;
+
+		/** @brief Vertex range and joint palette range of a skinned mesh */
+		struct SkinnedRange {
+			uint32_t vertexStart;
+			uint32_t vertexCount;
+			uint32_t jointOffset;
+			uint32_t pad;
+		};
+		std::vector<SkinnedRange> skinnedRanges;
+
+		/*
+			Compute pre-skinning (see prepareSkinning and cmdSkin)
+			Skinned positions and normals are written once per frame to a copy of the vertex buffer that all passes draw from
+		*/
+		struct {
+			vks::Buffer vertices;
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+			VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+			VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		} skinning;
+
+		/** @brief Pipelines and binding points used by the state sorted draw */
+		struct DrawBindings {
+			VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+			// Set the model's descriptor set is bound to with the mesh's dynamic offset
+			uint32_t meshSet = 0;
+			// Set the material descriptor sets are bound to, materials without a descriptor set are skipped
+			uint32_t materialSet = 1;
+			// Pipeline per material alpha mode (opaque, mask, blend), VK_NULL_HANDLE keeps the bound pipeline
+			VkPipeline pipelines[3] = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE };
+		};
+
+		/** @brief Thread pool used for decoding images, if not set a temporary pool with one thread per core is used */
+		vks::ThreadPool *threadPool = nullptr;
+
+		// Generate texture mip chains on the CPU with a Kaiser filter and sRGB correct color filtering instead of linear blits (always done for formats without blit support)
+		bool cpuMipmaps = false;
+
+		/*
+			Base pointers of the glTF buffers used while loading
+			The BIN chunk of binary glTF files is read in place from the memory mapped file
+		*/
+		std::vector<const unsigned char*> bufferData;
+
+		/** @brief Destination of the vertex and index data written by loadNode, points into the mapped staging buffers */
+		struct LoaderInfo {
+			Vertex *vertexBuffer = nullptr;
+			void *indexBuffer = nullptr;
+			size_t vertexPos = 0;
+			size_t indexPos = 0;
+			// Scratch data of the primitive that's currently loaded, reused for all primitives
+			std::vector<Vertex> vertices;
+			std::vector<uint32_t> indices;
+		};
+
 		Model() {};
 
 		~Model() 
@@ -558,6 +819,16 @@ namespace vkglTF
 			vkFreeMemory(device->logicalDevice, vertices.memory, nullptr);
 			vkDestroyBuffer(device->logicalDevice, indices.buffer, nullptr);
 			vkFreeMemory(device->logicalDevice, indices.memory, nullptr);
+			meshletCommands.destroy();
+			meshBuffer.destroy();
+			jointBuffer.destroy();
+			if (skinning.pipeline) {
+				skinning.vertices.destroy();
+				vkDestroyPipeline(device->logicalDevice, skinning.pipeline, nullptr);
+				vkDestroyPipelineLayout(device->logicalDevice, skinning.pipelineLayout, nullptr);
+				vkDestroyDescriptorSetLayout(device->logicalDevice, skinning.descriptorSetLayout, nullptr);
+				vkDestroyDescriptorPool(device->logicalDevice, skinning.descriptorPool, nullptr);
+			}
 			for (auto texture : textures) {
 				texture.destroy();
 			}
@@ -568,156 +839,201 @@ namespace vkglTF
 			vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
 		}
 
-		void loadNode(vkglTF::Node *parent, const tinygltf::Node &node, uint32_t nodeIndex, const tinygltf::Model &model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale)
+		accessor::View accessorView(const tinygltf::Model &model, const tinygltf::Accessor &accessor)
+		{
+			const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
+			accessor::View view;
+			view.data = bufferData[bufferView.buffer] + bufferView.byteOffset + accessor.byteOffset;
+			view.count = accessor.count;
+			view.componentType = accessor.componentType;
+			// Returns the number of components, not bytes
+			view.components = static_cast<uint32_t>(tinygltf::GetTypeSizeInBytes(accessor.type));
+			view.normalized = accessor.normalized;
+			const size_t elementSize = static_cast<size_t>(tinygltf::GetComponentSizeInBytes(accessor.componentType)) * view.components;
+			view.stride = (bufferView.byteStride > 0) ? bufferView.byteStride : elementSize;
+			return view;
+		}
+
+		/** @brief Returns the BIN chunk of a binary glTF file, nullptr if the file has none */
+		static const unsigned char *getBinaryChunk(const unsigned char *data, size_t size, size_t *chunkSize)
+		{
+			if ((size < 20) || (memcmp(data, "glTF", 4) != 0)) {
+				return nullptr;
+			}
+			uint32_t jsonLength;
+			memcpy(&jsonLength, data + 12, sizeof(uint32_t));
+			const size_t offset = 20 + static_cast<size_t>(jsonLength);
+			if (offset + 8 > size) {
+				return nullptr;
+			}
+			uint32_t binLength, binType;
+			memcpy(&binLength, data + offset, sizeof(uint32_t));
+			memcpy(&binType, data + offset + 4, sizeof(uint32_t));
+			if ((binType != 0x004E4942) || (offset + 8 + binLength > size)) {
+				return nullptr;
+			}
+			*chunkSize = binLength;
+			return data + offset + 8;
+		}
+
+		/** @brief Sum up the vertex and index counts of a node hierarchy to size the staging buffers before loading */
+		void getNodeProps(const tinygltf::Node &node, const tinygltf::Model &model, size_t &vertexCount, size_t &indexCount, size_t &maxPrimitiveVertexCount)
+		{
+			for (auto child : node.children) {
+				getNodeProps(model.nodes[child], model, vertexCount, indexCount, maxPrimitiveVertexCount);
+			}
+			if (node.mesh > -1) {
+				const tinygltf::Mesh &mesh = model.meshes[node.mesh];
+				for (const tinygltf::Primitive &primitive : mesh.primitives) {
+					if ((primitive.indices < 0) || (primitive.attributes.find("POSITION") == primitive.attributes.end())) {
+						continue;
+					}
+					const size_t primitiveVertexCount = model.accessors[primitive.attributes.find("POSITION")->second].count;
+					vertexCount += primitiveVertexCount;
+					indexCount += model.accessors[primitive.indices].count;
+					maxPrimitiveVertexCount = std::max(maxPrimitiveVertexCount, primitiveVertexCount);
+				}
+			}
+		}
+
+		void loadNode(vkglTF::Node *parent, const tinygltf::Node &node, uint32_t nodeIndex, const tinygltf::Model &model, LoaderInfo &loaderInfo, float globalscale)
 		{
 			vkglTF::Node *newNode = new Node{};
 			newNode->index = nodeIndex;
 			newNode->parent = parent;
 			newNode->name = node.name;
 			newNode->skinIndex = node.skin;
-			newNode->matrix = glm::mat4(1.0f);
 
-			// Generate local node matrix
+			// Local transform, the node's slot is allocated before its children's to keep the hierarchy topologically sorted
 			glm::vec3 translation = glm::vec3(0.0f);
 			if (node.translation.size() == 3) {
 				translation = glm::make_vec3(node.translation.data());
-				newNode->translation = translation;
 			}
-			glm::mat4 rotation = glm::mat4(1.0f);
+			glm::quat rotation = glm::quat();
 			if (node.rotation.size() == 4) {
-				glm::quat q = glm::make_quat(node.rotation.data());
-				newNode->rotation = glm::mat4(q);
+				rotation = glm::make_quat(node.rotation.data());
 			}
 			glm::vec3 scale = glm::vec3(1.0f);
 			if (node.scale.size() == 3) {
 				scale = glm::make_vec3(node.scale.data());
-				newNode->scale = scale;
 			}
+			glm::mat4 matrix = glm::mat4(1.0f);
 			if (node.matrix.size() == 16) {
-				newNode->matrix = glm::make_mat4x4(node.matrix.data());
-				if (globalscale != 1.0f) {
-					//newNode->matrix = glm::scale(newNode->matrix, glm::vec3(globalscale));
-				}
+				matrix = glm::make_mat4x4(node.matrix.data());
 			};
+			newNode->transforms = &transforms;
+			newNode->transform = transforms.add(parent ? static_cast<int32_t>(parent->transform) : -1, translation, rotation, scale, matrix);
 
 			// Node with children
 			if (node.children.size() > 0) {
 				for (auto i = 0; i < node.children.size(); i++) {
-					loadNode(newNode, model.nodes[node.children[i]], node.children[i], model, indexBuffer, vertexBuffer, globalscale);
+					loadNode(newNode, model.nodes[node.children[i]], node.children[i], model, loaderInfo, globalscale);
 				}
 			}
 
 			// Node contains mesh data
 			if (node.mesh > -1) {
-				const tinygltf::Mesh mesh = model.meshes[node.mesh];
-				Mesh *newMesh = new Mesh(device, newNode->matrix);
+				const tinygltf::Mesh &mesh = model.meshes[node.mesh];
+				Mesh *newMesh = new Mesh(device, matrix);
 				newMesh->name = mesh.name;
 				for (size_t j = 0; j < mesh.primitives.size(); j++) {
 					const tinygltf::Primitive &primitive = mesh.primitives[j];
 					if (primitive.indices < 0) {
 						continue;
 					}
-					uint32_t indexStart = static_cast<uint32_t>(indexBuffer.size());
-					uint32_t vertexStart = static_cast<uint32_t>(vertexBuffer.size());
+					uint32_t indexStart = static_cast<uint32_t>(loaderInfo.indexPos);
+					uint32_t vertexStart = static_cast<uint32_t>(loaderInfo.vertexPos);
 					uint32_t indexCount = 0;
 					glm::vec3 posMin{};
 					glm::vec3 posMax{};
 					bool hasSkin = false;
 					// Vertices
 					{
-						const float *bufferPos = nullptr;
-						const float *bufferNormals = nullptr;
-						const float *bufferTexCoords = nullptr;
-						const uint16_t *bufferJoints = nullptr;
-						const float *bufferWeights = nullptr;
-
 						// Position attribute is required
 						assert(primitive.attributes.find("POSITION") != primitive.attributes.end());
 
 						const tinygltf::Accessor &posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
-						const tinygltf::BufferView &posView = model.bufferViews[posAccessor.bufferView];
-						bufferPos = reinterpret_cast<const float *>(&(model.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
 						posMin = glm::vec3(posAccessor.minValues[0], posAccessor.minValues[1], posAccessor.minValues[2]);
 						posMax = glm::vec3(posAccessor.maxValues[0], posAccessor.maxValues[1], posAccessor.maxValues[2]);
 
-						if (primitive.attributes.find("NORMAL") != primitive.attributes.end()) {
-							const tinygltf::Accessor &normAccessor = model.accessors[primitive.attributes.find("NORMAL")->second];
-							const tinygltf::BufferView &normView = model.bufferViews[normAccessor.bufferView];
-							bufferNormals = reinterpret_cast<const float *>(&(model.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
-						}
-
-						if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end()) {
-							const tinygltf::Accessor &uvAccessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-							const tinygltf::BufferView &uvView = model.bufferViews[uvAccessor.bufferView];
-							bufferTexCoords = reinterpret_cast<const float *>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
-						}
+						// The scratch array keeps its capacity, so this only allocates for primitives larger than any before
+						loaderInfo.vertices.assign(posAccessor.count, Vertex{});
+						Vertex *vertices = loaderInfo.vertices.data();
+						accessor::readFloats(accessorView(model, posAccessor), &vertices[0].pos.x, sizeof(Vertex), 3);
 
-						// Skinning
-						// Joints
-						if (primitive.attributes.find("JOINTS_0") != primitive.attributes.end()) {
-							const tinygltf::Accessor &jointAccessor = model.accessors[primitive.attributes.find("JOINTS_0")->second];
-							const tinygltf::BufferView &jointView = model.bufferViews[jointAccessor.bufferView];
-							bufferJoints = reinterpret_cast<const uint16_t *>(&(model.buffers[jointView.buffer].data[jointAccessor.byteOffset + jointView.byteOffset]));
+						auto attribute = primitive.attributes.find("NORMAL");
+						if (attribute != primitive.attributes.end()) {
+							accessor::readFloats(accessorView(model, model.accessors[attribute->second]), &vertices[0].normal.x, sizeof(Vertex), 3);
+							for (size_t v = 0; v < posAccessor.count; v++) {
+								vertices[v].normal = glm::normalize(vertices[v].normal);
+							}
 						}
 
-						if (primitive.attributes.find("WEIGHTS_0") != primitive.attributes.end()) {
-							const tinygltf::Accessor &uvAccessor = model.accessors[primitive.attributes.find("WEIGHTS_0")->second];
-							const tinygltf::BufferView &uvView = model.bufferViews[uvAccessor.bufferView];
-							bufferWeights = reinterpret_cast<const float *>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
+						attribute = primitive.attributes.find("TEXCOORD_0");
+						if (attribute != primitive.attributes.end()) {
+							accessor::readFloats(accessorView(model, model.accessors[attribute->second]), &vertices[0].uv.x, sizeof(Vertex), 2);
 						}
 
-						hasSkin = (bufferJoints && bufferWeights);
-
-						for (size_t v = 0; v < posAccessor.count; v++) {
-							Vertex vert{};
-							vert.pos = glm::vec4(glm::make_vec3(&bufferPos[v * 3]), 1.0f);
-							vert.normal = glm::normalize(glm::vec3(bufferNormals ? glm::make_vec3(&bufferNormals[v * 3]) : glm::vec3(0.0f)));
-							vert.uv = bufferTexCoords ? glm::make_vec2(&bufferTexCoords[v * 2]) : glm::vec3(0.0f);
-							
-							vert.joint0 = hasSkin ? glm::vec4(glm::make_vec4(&bufferJoints[v * 4])) : glm::vec4(0.0f);
-							vert.weight0 = hasSkin ? glm::make_vec4(&bufferWeights[v * 4]) : glm::vec4(0.0f);
-							vertexBuffer.push_back(vert);
+						// Skinning
+						auto joints = primitive.attributes.find("JOINTS_0");
+						auto weights = primitive.attributes.find("WEIGHTS_0");
+						hasSkin = (joints != primitive.attributes.end()) && (weights != primitive.attributes.end());
+						if (hasSkin) {
+							accessor::readFloats(accessorView(model, model.accessors[joints->second]), &vertices[0].joint0.x, sizeof(Vertex), 4);
+							accessor::readFloats(accessorView(model, model.accessors[weights->second]), &vertices[0].weight0.x, sizeof(Vertex), 4);
 						}
 					}
 					// Indices
 					{
 						const tinygltf::Accessor &accessor = model.accessors[primitive.indices];
-						const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
-						const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
-
 						indexCount = static_cast<uint32_t>(accessor.count);
-
-						switch (accessor.componentType) {
-						case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
-							uint32_t *buf = new uint32_t[accessor.count];
-							memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint32_t));
-							for (size_t index = 0; index < accessor.count; index++) {
-								indexBuffer.push_back(buf[index] + vertexStart);
-							}
-							break;
-						}
-						case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
-							uint16_t *buf = new uint16_t[accessor.count];
-							memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint16_t));
-							for (size_t index = 0; index < accessor.count; index++) {
-								indexBuffer.push_back(buf[index] + vertexStart);
-							}
-							break;
-						}
-						case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
-							uint8_t *buf = new uint8_t[accessor.count];
-							memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint8_t));
-							for (size_t index = 0; index < accessor.count; index++) {
-								indexBuffer.push_back(buf[index] + vertexStart);
-							}
-							break;
-						}
-						default:
+						loaderInfo.indices.resize(accessor.count);
+						if (!accessor::readIndices(accessorView(model, accessor), loaderInfo.indices.data())) {
 							std::cerr << "Index component type " << accessor.componentType << " not supported!" << std::endl;
-							return;
+							continue;
 						}
 					}
+					uint32_t vertexCount = static_cast<uint32_t>(loaderInfo.vertices.size());
+					if (optimizeMeshes && (indexCount > 0)) {
+						vertexCount = static_cast<uint32_t>(vks::meshopt::optimizeMesh(
+							loaderInfo.indices.data(),
+							indexCount,
+							loaderInfo.vertices.data(),
+							vertexCount,
+							sizeof(Vertex),
+							&loaderInfo.vertices[0].pos.x,
+							sizeof(Vertex),
+							&optimizationStatistics));
+					}
 					Primitive *newPrimitive = new Primitive(indexStart, indexCount, materials[primitive.material]);
+					newPrimitive->vertexStart = vertexStart;
+					newPrimitive->vertexCount = vertexCount;
+					if (buildMeshlets && (indexCount > 0)) {
+						newPrimitive->meshletOffset = static_cast<uint32_t>(meshlets.size());
+						newPrimitive->meshletCount = static_cast<uint32_t>(vks::meshlet::build(
+							meshlets,
+							loaderInfo.indices.data(),
+							indexCount,
+							&loaderInfo.vertices[0].pos.x,
+							vertexCount,
+							sizeof(Vertex),
+							indexStart,
+							static_cast<int32_t>(vertexStart)));
+					}
+
+					// Write the final vertices and indices to the staging buffers
+					memcpy(loaderInfo.vertexBuffer + vertexStart, loaderInfo.vertices.data(), vertexCount * sizeof(Vertex));
+					if (indices.type == VK_INDEX_TYPE_UINT16) {
+						uint16_t *dst = static_cast<uint16_t*>(loaderInfo.indexBuffer) + indexStart;
+						for (uint32_t index = 0; index < indexCount; index++) {
+							dst[index] = static_cast<uint16_t>(loaderInfo.indices[index]);
+						}
+					} else {
+						memcpy(static_cast<uint32_t*>(loaderInfo.indexBuffer) + indexStart, loaderInfo.indices.data(), indexCount * sizeof(uint32_t));
+					}
+					loaderInfo.vertexPos += vertexCount;
+					loaderInfo.indexPos += indexCount;
+
 					newPrimitive->setDimensions(posMin, posMax);
 					newMesh->primitives.push_back(newPrimitive);
 				}
@@ -753,37 +1069,201 @@ namespace vkglTF
 				// Get inverse bind matrices from buffer
 				if (source.inverseBindMatrices > -1) {
 					const tinygltf::Accessor &accessor = gltfModel.accessors[source.inverseBindMatrices];
-					const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
-					const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
 					newSkin->inverseBindMatrices.resize(accessor.count);
-					memcpy(newSkin->inverseBindMatrices.data(), &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::mat4));
+					accessor::readFloats(accessorView(gltfModel, accessor), &newSkin->inverseBindMatrices[0][0].x, sizeof(glm::mat4), 16);
 				}
 
 				skins.push_back(newSkin);
 			}
 		}
 
-		void loadImages(tinygltf::Model &gltfModel, vks::VulkanDevice *device, VkQueue transferQueue)
+		// A pool without threads can't take the per thread jobs of loadImages, a local pool is used instead
+		vks::ThreadPool &getThreadPool(vks::ThreadPool &localPool)
 		{
-			for (tinygltf::Image &image : gltfModel.images) {
-				vkglTF::Texture texture;
-				texture.fromglTfImage(image, device, transferQueue);
-				textures.push_back(texture);
+			if (threadPool && !threadPool->threads.empty()) {
+				return *threadPool;
 			}
+			localPool.setThreadCount(std::max(std::thread::hardware_concurrency(), 1u));
+			return localPool;
 		}
 
-		void loadMaterials(tinygltf::Model &gltfModel)
+		/*
+			Image loader callback for tinygltf that only keeps the encoded image
+			Decoding is deferred to loadImages, which decodes all images of the model in parallel
+		*/
+		static bool loadImageDataDeferred(tinygltf::Image *image, const int imageIndex, std::string *error, std::string *warning, int reqWidth, int reqHeight, const unsigned char *bytes, int size, void *userData)
 		{
-			for (tinygltf::Material &mat : gltfModel.materials) {
-				vkglTF::Material material{};
-				if (mat.values.find("baseColorTexture") != mat.values.end()) {
-					material.baseColorTexture = &textures[gltfModel.textures[mat.values["baseColorTexture"].TextureIndex()].source];
-				}
-				// Metallic roughness workflow
-				if (mat.values.find("metallicRoughnessTexture") != mat.values.end()) {
-					material.metallicRoughnessTexture = &textures[gltfModel.textures[mat.values["metallicRoughnessTexture"].TextureIndex()].source];
-				}
-				if (mat.values.find("roughnessFactor") != mat.values.end()) {
+			image->image.assign(bytes, bytes + size);
+			image->width = 0;
+			image->height = 0;
+			// A component count of zero marks the image data as still encoded
+			image->component = 0;
+			return true;
+		}
+
+		/*
+			Decode images on the thread pool and expand them to RGBA directly in a shared staging buffer
+			All images are then uploaded and get their mip chains generated with a single command buffer
+		*/
+		void loadImages(tinygltf::Model &gltfModel, vks::VulkanDevice *device, VkQueue transferQueue)
+		{
+			const size_t imageCount = gltfModel.images.size();
+			if (imageCount == 0) {
+				return;
+			}
+
+			vks::ThreadPool localPool;
+			vks::ThreadPool &pool = getThreadPool(localPool);
+			const size_t threadCount = pool.threads.size();
+
+			struct DecodedImage {
+				const unsigned char *pixels = nullptr;
+				// Set if the pixels were decoded by stb_image and need to be freed
+				unsigned char *decoded = nullptr;
+				uint32_t width = 1;
+				uint32_t height = 1;
+				int components = 4;
+				// Reason reported by stb_image on the decoding thread if the image could not be decoded
+				const char *failure = nullptr;
+			};
+			std::vector<DecodedImage> images(imageCount);
+			const unsigned char placeholder[4] = { 255, 255, 255, 255 };
+
+			// Images are distributed round robin as there are usually only a few of them, each one is a single job
+			for (size_t i = 0; i < imageCount; i++) {
+				pool.threads[i % threadCount]->addJob([&, i] {
+					tinygltf::Image &source = gltfModel.images[i];
+					DecodedImage &image = images[i];
+					image.pixels = placeholder;
+					if (source.component > 0) {
+						// Already decoded by tinygltf
+						image.pixels = source.image.data();
+						image.width = static_cast<uint32_t>(source.width);
+						image.height = static_cast<uint32_t>(source.height);
+						image.components = source.component;
+						return;
+					}
+					int width, height, components;
+					if (stbi_info_from_memory(source.image.data(), static_cast<int>(source.image.size()), &width, &height, &components)) {
+						// RGB is expanded by convertRGBToRGBA, everything else is converted to RGBA by stb_image
+						const int requestedComponents = (components == 3) ? 3 : 4;
+						image.decoded = stbi_load_from_memory(source.image.data(), static_cast<int>(source.image.size()), &width, &height, &components, requestedComponents);
+						if (image.decoded) {
+							image.pixels = image.decoded;
+							image.width = static_cast<uint32_t>(width);
+							image.height = static_cast<uint32_t>(height);
+							image.components = requestedComponents;
+						}
+					}
+					if (!image.decoded) {
+						image.failure = stbi_failure_reason();
+					}
+				});
+			}
+			pool.wait();
+
+			// Textures are created first as the format's blit support decides whether the staging buffer holds whole mip chains
+			textures.resize(imageCount);
+			std::vector<Texture*> uploads(imageCount);
+			for (size_t i = 0; i < imageCount; i++) {
+				if (images[i].pixels == placeholder) {
+					std::cerr << "Could not decode image " << i << " (" << gltfModel.images[i].uri << "): " << (images[i].failure ? images[i].failure : "unknown error") << std::endl;
+				}
+				textures[i].create(device, images[i].width, images[i].height, cpuMipmaps);
+				uploads[i] = &textures[i];
+			}
+
+			std::vector<VkDeviceSize> offsets(imageCount);
+			VkDeviceSize stagingSize = 0;
+			for (size_t i = 0; i < imageCount; i++) {
+				offsets[i] = stagingSize;
+				stagingSize += vks::mipgen::getSize(vks::mipgen::getLevels(textures[i].width, textures[i].height, textures[i].cpuMips ? textures[i].mipLevels : 1));
+			}
+
+			// Color textures are filtered in linear space and alpha tested ones keep their coverage
+			std::vector<vks::mipgen::Options> mipOptions(imageCount);
+			for (tinygltf::Material &mat : gltfModel.materials) {
+				for (const char *name : { "baseColorTexture", "emissiveTexture" }) {
+					tinygltf::ParameterMap &values = (mat.values.find(name) != mat.values.end()) ? mat.values : mat.additionalValues;
+					if (values.find(name) == values.end()) {
+						continue;
+					}
+					const int textureIndex = values[name].TextureIndex();
+					if ((textureIndex < 0) || (textureIndex >= static_cast<int>(gltfModel.textures.size()))) {
+						continue;
+					}
+					// Textures without a source (e.g. only provided by an extension) have no image to set options for
+					const int source = gltfModel.textures[textureIndex].source;
+					if ((source < 0) || (source >= static_cast<int>(imageCount))) {
+						continue;
+					}
+					mipOptions[source].srgb = true;
+					if ((strcmp(name, "baseColorTexture") == 0) && (mat.additionalValues.find("alphaMode") != mat.additionalValues.end()) && (mat.additionalValues["alphaMode"].string_value == "MASK")) {
+						const bool hasCutoff = mat.additionalValues.find("alphaCutoff") != mat.additionalValues.end();
+						mipOptions[source].alphaCutoff = hasCutoff ? static_cast<float>(mat.additionalValues["alphaCutoff"].Factor()) : 0.5f;
+					}
+				}
+			}
+
+			vks::Buffer staging;
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&staging,
+				stagingSize));
+			VK_CHECK_RESULT(staging.map());
+
+			// One job per image, mips of different images are generated in parallel
+			for (size_t i = 0; i < imageCount; i++) {
+				pool.threads[i % threadCount]->addJob([&, i] {
+					DecodedImage &image = images[i];
+					const Texture &texture = textures[i];
+					unsigned char *dst = static_cast<unsigned char*>(staging.mapped) + offsets[i];
+					const size_t pixelCount = static_cast<size_t>(image.width) * image.height;
+					if (texture.cpuMips) {
+						// The top level is expanded to system memory first, as the mip generator reads it back
+						std::vector<unsigned char> rgba;
+						const unsigned char *pixels = image.pixels;
+						if (image.components == 3) {
+							rgba.resize(pixelCount * 4);
+							Texture::convertRGBToRGBA(image.pixels, rgba.data(), pixelCount);
+							pixels = rgba.data();
+						}
+						vks::mipgen::generate(pixels, dst, vks::mipgen::getLevels(texture.width, texture.height, texture.mipLevels), mipOptions[i]);
+					} else if (image.components == 3) {
+						Texture::convertRGBToRGBA(image.pixels, dst, pixelCount);
+					} else {
+						memcpy(dst, image.pixels, pixelCount * 4);
+					}
+					if (image.decoded) {
+						stbi_image_free(image.decoded);
+					}
+					// Pixels live in the image from now on
+					std::vector<unsigned char>().swap(gltfModel.images[i].image);
+				});
+			}
+			pool.wait();
+			staging.unmap();
+
+			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			Texture::upload(copyCmd, uploads.data(), imageCount, staging.buffer, offsets.data());
+			device->flushCommandBuffer(copyCmd, transferQueue, true);
+
+			staging.destroy();
+		}
+
+		void loadMaterials(tinygltf::Model &gltfModel)
+		{
+			for (tinygltf::Material &mat : gltfModel.materials) {
+				vkglTF::Material material{};
+				if (mat.values.find("baseColorTexture") != mat.values.end()) {
+					material.baseColorTexture = &textures[gltfModel.textures[mat.values["baseColorTexture"].TextureIndex()].source];
+				}
+				// Metallic roughness workflow
+				if (mat.values.find("metallicRoughnessTexture") != mat.values.end()) {
+					material.metallicRoughnessTexture = &textures[gltfModel.textures[mat.values["metallicRoughnessTexture"].TextureIndex()].source];
+				}
+				if (mat.values.find("roughnessFactor") != mat.values.end()) {
 					material.roughnessFactor = static_cast<float>(mat.values["roughnessFactor"].Factor());
 				}
 				if (mat.values.find("metallicFactor") != mat.values.end()) {
@@ -832,28 +1312,22 @@ namespace vkglTF
 					vkglTF::AnimationSampler sampler{};
 
 					if (samp.interpolation == "LINEAR") {
-						sampler.interpolation = AnimationSampler::InterpolationType::LINEAR;
+						sampler.interpolation = vks::animation::interpolationLinear;
 					}
 					if (samp.interpolation == "STEP") {
-						sampler.interpolation = AnimationSampler::InterpolationType::STEP;
+						sampler.interpolation = vks::animation::interpolationStep;
 					}
 					if (samp.interpolation == "CUBICSPLINE") {
-						sampler.interpolation = AnimationSampler::InterpolationType::CUBICSPLINE;
+						sampler.interpolation = vks::animation::interpolationCubicSpline;
 					}
 
 					// Read sampler input time values
 					{
 						const tinygltf::Accessor &accessor = gltfModel.accessors[samp.input];
-						const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
-						const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
-
 						assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
 
-						float *buf = new float[accessor.count];
-						memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(float));
-						for (size_t index = 0; index < accessor.count; index++) {
-							sampler.inputs.push_back(buf[index]);
-						}
+						sampler.inputs.resize(accessor.count);
+						accessor::readFloats(accessorView(gltfModel, accessor), sampler.inputs.data(), sizeof(float), 1);
 
 						for (auto input : sampler.inputs) {
 							if (input < animation.start) {
@@ -868,26 +1342,13 @@ namespace vkglTF
 					// Read sampler output T/R/S values 
 					{
 						const tinygltf::Accessor &accessor = gltfModel.accessors[samp.output];
-						const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
-						const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
-
-						assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
 
+						// Normalized integer rotations (KHR_mesh_quantization) are converted to floats as well
 						switch (accessor.type) {
-						case TINYGLTF_TYPE_VEC3: {
-							glm::vec3 *buf = new glm::vec3[accessor.count];
-							memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::vec3));
-							for (size_t index = 0; index < accessor.count; index++) {
-								sampler.outputsVec4.push_back(glm::vec4(buf[index], 0.0f));
-							}
-							break;
-						}
+						case TINYGLTF_TYPE_VEC3:
 						case TINYGLTF_TYPE_VEC4: {
-							glm::vec4 *buf = new glm::vec4[accessor.count];
-							memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::vec4));
-							for (size_t index = 0; index < accessor.count; index++) {
-								sampler.outputsVec4.push_back(buf[index]);
-							}
+							sampler.outputs.assign(accessor.count, glm::vec4(0.0f));
+							accessor::readFloats(accessorView(gltfModel, accessor), &sampler.outputs[0].x, sizeof(glm::vec4), 4);
 							break;
 						}
 						default: {
@@ -905,28 +1366,34 @@ namespace vkglTF
 					vkglTF::AnimationChannel channel{};
 
 					if (source.target_path == "rotation") {
-						channel.path = AnimationChannel::PathType::ROTATION;
+						channel.path = vks::animation::pathRotation;
 					}
 					if (source.target_path == "translation") {
-						channel.path = AnimationChannel::PathType::TRANSLATION;
+						channel.path = vks::animation::pathTranslation;
 					}
 					if (source.target_path == "scale") {
-						channel.path = AnimationChannel::PathType::SCALE;
+						channel.path = vks::animation::pathScale;
 					}
 					if (source.target_path == "weights") {
 						std::cout << "weights not yet supported, skipping channel" << std::endl;
 						continue;
 					}
-					channel.samplerIndex = source.sampler;
-					channel.node = nodeFromIndex(source.target_node);
-					if (!channel.node) {
+					if ((source.sampler < 0) || (source.sampler >= static_cast<int>(animation.samplers.size())) || !animation.samplers[source.sampler].valid()) {
+						continue;
+					}
+					channel.sampler = static_cast<uint32_t>(source.sampler);
+					Node *node = nodeFromIndex(source.target_node);
+					if (!node) {
 						continue;
 					}
+					channel.target = node->transform;
 
 					animation.channels.push_back(channel);
 				}
 
 				animations.push_back(animation);
+				animationStates.push_back(vks::animation::State());
+				vks::animation::reset(animations.back(), animationStates.back());
 			}
 		}
 
@@ -938,6 +1405,12 @@ namespace vkglTF
 
 			this->device = device;
 
+			// Images are only read by tinygltf and decoded in parallel by loadImages
+			gltfContext.SetImageLoader(loadImageDataDeferred, this);
+
+			// Binary glTF files are detected by their magic, not by extension
+			const unsigned char *binaryChunk = nullptr;
+			size_t binaryChunkSize = 0;
 #if defined(__ANDROID__)
 			AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
 			assert(asset);
@@ -947,84 +1420,134 @@ namespace vkglTF
 			AAsset_read(asset, fileData, size);
 			AAsset_close(asset);
 			std::string baseDir;
-			bool fileLoaded = gltfContext.LoadASCIIFromString(&gltfModel, &error, &warning, fileData, size, baseDir);
-			free(fileData);
+			bool fileLoaded;
+			if ((size >= 4) && (memcmp(fileData, "glTF", 4) == 0)) {
+				fileLoaded = gltfContext.LoadBinaryFromMemory(&gltfModel, &error, &warning, reinterpret_cast<const unsigned char*>(fileData), static_cast<unsigned int>(size), baseDir);
+			} else {
+				fileLoaded = gltfContext.LoadASCIIFromString(&gltfModel, &error, &warning, fileData, static_cast<unsigned int>(size), baseDir);
+			}
+			delete[] fileData;
 #else
-			bool fileLoaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename);
+			// The file stays open while loading so accessors can read the BIN chunk in place
+			// External buffers and images of text glTF files are still read by tinygltf relative to the base directory
+			vks::vfs::File file = vks::vfs::open(filename);
+			const size_t separator = filename.find_last_of("/\\");
+			const std::string baseDir = (separator != std::string::npos) ? filename.substr(0, separator) : "";
+			bool fileLoaded = false;
+			if (!file.valid()) {
+				error = "File not found: " + filename;
+			} else if ((file.size() >= 4) && (memcmp(file.data(), "glTF", 4) == 0)) {
+				fileLoaded = gltfContext.LoadBinaryFromMemory(&gltfModel, &error, &warning, file.data(), static_cast<unsigned int>(file.size()), baseDir);
+				binaryChunk = getBinaryChunk(file.data(), file.size(), &binaryChunkSize);
+			} else {
+				fileLoaded = gltfContext.LoadASCIIFromString(&gltfModel, &error, &warning, reinterpret_cast<const char*>(file.data()), static_cast<unsigned int>(file.size()), baseDir);
+			}
 #endif
-			std::vector<uint32_t> indexBuffer;
-			std::vector<Vertex> vertexBuffer;
-
-			if (fileLoaded) {
-				loadImages(gltfModel, device, transferQueue);
-				loadMaterials(gltfModel);
-				const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
-				for (size_t i = 0; i < scene.nodes.size(); i++) {
-					const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
-					loadNode(nullptr, node, scene.nodes[i], gltfModel, indexBuffer, vertexBuffer, scale);
-				}
-				if (gltfModel.animations.size() > 0) {
-					loadAnimations(gltfModel);
-				}
-				loadSkins(gltfModel);
 
-				for (auto node : linearNodes) {
-					// Assign skins
-					if (node->skinIndex > -1) {
-						node->skin = skins[node->skinIndex];
-					}
-					// Initial pose
-					if (node->mesh) {
-						node->update();
-					}
-				}
-			}
-			else {
+			if (!fileLoaded) {
 				// TODO: throw
 				std::cerr << "Could not load gltf file: " << error << std::endl;
 				return;
 			}
 
-			for (auto extension : gltfModel.extensionsUsed) {
-				if (extension == "KHR_materials_pbrSpecularGlossiness") {
-					std::cout << "Required extension: " << extension;
-					metallicRoughnessWorkflow = false;
+			// The first buffer of a binary glTF without uri is the BIN chunk, tinygltf keeps a copy of it that is released in favor of the mapped chunk
+			bufferData.resize(gltfModel.buffers.size());
+			for (size_t i = 0; i < gltfModel.buffers.size(); i++) {
+				tinygltf::Buffer &buffer = gltfModel.buffers[i];
+				if ((i == 0) && binaryChunk && buffer.uri.empty() && (buffer.data.size() <= binaryChunkSize)) {
+					bufferData[i] = binaryChunk;
+					std::vector<unsigned char>().swap(buffer.data);
+				} else {
+					bufferData[i] = buffer.data.data();
 				}
 			}
 
-			size_t vertexBufferSize = vertexBuffer.size() * sizeof(Vertex);
-			size_t indexBufferSize = indexBuffer.size() * sizeof(uint32_t);
-			indices.count = static_cast<uint32_t>(indexBuffer.size());
+			loadImages(gltfModel, device, transferQueue);
+			loadMaterials(gltfModel);
 
-			assert((vertexBufferSize > 0) && (indexBufferSize > 0));
+			const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
+
+			// Size the staging buffers up front so loadNode can write the final vertices and indices to them directly
+			size_t vertexCount = 0;
+			size_t indexCount = 0;
+			size_t maxPrimitiveVertexCount = 0;
+			for (size_t i = 0; i < scene.nodes.size(); i++) {
+				getNodeProps(gltfModel.nodes[scene.nodes[i]], gltfModel, vertexCount, indexCount, maxPrimitiveVertexCount);
+			}
+			// Mesh optimization only ever removes vertices, so the unoptimized count is an upper bound for the index type
+			indices.type = (maxPrimitiveVertexCount < 65536) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+			const size_t indexSize = (indices.type == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
 
-			struct StagingBuffer {
-				VkBuffer buffer;
-				VkDeviceMemory memory;
-			} vertexStaging, indexStaging;
+			assert((vertexCount > 0) && (indexCount > 0));
+
+			vks::Buffer vertexStaging, indexStaging;
 
 			// Create staging buffers
 			// Vertex data
 			VK_CHECK_RESULT(device->createBuffer(
 				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				vertexBufferSize,
-				&vertexStaging.buffer,
-				&vertexStaging.memory,
-				vertexBuffer.data()));
+				&vertexStaging,
+				vertexCount * sizeof(Vertex)));
 			// Index data
 			VK_CHECK_RESULT(device->createBuffer(
 				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				indexBufferSize,
-				&indexStaging.buffer,
-				&indexStaging.memory,
-				indexBuffer.data()));
+				&indexStaging,
+				indexCount * indexSize));
+			VK_CHECK_RESULT(vertexStaging.map());
+			VK_CHECK_RESULT(indexStaging.map());
+
+			LoaderInfo loaderInfo{};
+			loaderInfo.vertexBuffer = static_cast<Vertex*>(vertexStaging.mapped);
+			loaderInfo.indexBuffer = indexStaging.mapped;
+
+			for (size_t i = 0; i < scene.nodes.size(); i++) {
+				const tinygltf::Node &node = gltfModel.nodes[scene.nodes[i]];
+				loadNode(nullptr, node, scene.nodes[i], gltfModel, loaderInfo, scale);
+			}
+			if (gltfModel.animations.size() > 0) {
+				loadAnimations(gltfModel);
+			}
+			loadSkins(gltfModel);
+
+			// Assign skins
+			for (auto node : linearNodes) {
+				if (node->skinIndex > -1) {
+					node->skin = skins[node->skinIndex];
+				}
+			}
+			createJointPalette();
+			createMeshBuffer();
+			// Initial pose
+			transforms.update();
+			restTransforms = transforms;
+			for (auto node : linearNodes) {
+				node->update();
+			}
+
+			// Buffer pointers are only valid while the file is loaded
+			bufferData.clear();
+
+			for (auto extension : gltfModel.extensionsUsed) {
+				if (extension == "KHR_materials_pbrSpecularGlossiness") {
+					std::cout << "Required extension: " << extension;
+					metallicRoughnessWorkflow = false;
+				}
+			}
+
+			// Only the used part of the staging buffers is copied, mesh optimization may have removed vertices
+			size_t vertexBufferSize = loaderInfo.vertexPos * sizeof(Vertex);
+			size_t indexBufferSize = loaderInfo.indexPos * indexSize;
+			indices.count = static_cast<uint32_t>(loaderInfo.indexPos);
+			vertices.count = static_cast<uint32_t>(loaderInfo.vertexPos);
+
+			assert((vertexBufferSize > 0) && (indexBufferSize > 0));
 
 			// Create device local buffers
-			// Vertex buffer
+			// Vertex buffer, also read by the pre-skinning compute shader
 			VK_CHECK_RESULT(device->createBuffer(
-				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 				vertexBufferSize,
 				&vertices.buffer,
@@ -1050,73 +1573,362 @@ namespace vkglTF
 
 			device->flushCommandBuffer(copyCmd, transferQueue, true);
 
-			vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
+			vertexStaging.unmap();
+			indexStaging.unmap();
+			vertexStaging.destroy();
+			indexStaging.destroy();
+
+			if (!meshlets.empty()) {
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					&meshletCommands,
+					meshlets.size() * sizeof(VkDrawIndexedIndirectCommand)));
+				VK_CHECK_RESULT(meshletCommands.map());
+			}
 
+			buildBVH();
 			getSceneDimensions();
 
 			// Setup descriptors
-			uint32_t uboCount{ 0 };
-			for (auto node : linearNodes) {
-				if (node->mesh) {
-					uboCount++;
-				}
-			}
 			std::vector<VkDescriptorPoolSize> poolSizes = {
-				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, uboCount),
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1),
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1),
 			};
-			VkDescriptorPoolCreateInfo descriptorPoolCI = vks::initializers::descriptorPoolCreateInfo(static_cast<uint32_t>(poolSizes.size()), poolSizes.data(), uboCount);
+			VkDescriptorPoolCreateInfo descriptorPoolCI = vks::initializers::descriptorPoolCreateInfo(static_cast<uint32_t>(poolSizes.size()), poolSizes.data(), 1);
 			VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolCI, nullptr, &descriptorPool));
 
+			// Binding 1 is the joint palette for shaders that skin in the vertex stage instead of drawing pre-skinned vertices
 			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT, 0),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1),
 			};
 			VkDescriptorSetLayoutCreateInfo descriptorLayoutCI{};
 			descriptorLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 			descriptorLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
 			descriptorLayoutCI.pBindings = setLayoutBindings.data();
 			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &descriptorSetLayout));
-			for (auto node : nodes) {
-				prepareNodeDescriptor(node, descriptorSetLayout);
+
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &descriptorSet));
+			// The dynamic offset selects the slot, so the descriptor only covers a single uniform block
+			VkDescriptorBufferInfo meshDescriptor = { meshBuffer.buffer, 0, sizeof(Mesh::UniformBlock) };
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 0, &meshDescriptor),
+				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &jointBuffer.descriptor),
+			};
+			vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+		}
+
+		/*
+			Allocate one uniform block slot per mesh in a single persistently mapped buffer
+			Slots are aligned to the device's minimum uniform buffer offset alignment so they can be bound with dynamic offsets
+		*/
+		void createMeshBuffer()
+		{
+			const VkDeviceSize alignment = std::max<VkDeviceSize>(device->properties.limits.minUniformBufferOffsetAlignment, 1);
+			meshBufferStride = static_cast<uint32_t>((sizeof(Mesh::UniformBlock) + alignment - 1) / alignment * alignment);
+			uint32_t meshCount = 0;
+			for (auto node : linearNodes) {
+				if (node->mesh) {
+					node->mesh->dynamicOffset = meshCount * meshBufferStride;
+					meshCount++;
+				}
+			}
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&meshBuffer,
+				std::max(meshCount, 1u) * meshBufferStride));
+			VK_CHECK_RESULT(meshBuffer.map());
+			for (auto node : linearNodes) {
+				if (node->mesh) {
+					node->mesh->uniformData = reinterpret_cast<Mesh::UniformBlock*>(static_cast<uint8_t*>(meshBuffer.mapped) + node->mesh->dynamicOffset);
+				}
 			}
 		}
 
-		void drawNode(Node *node, VkCommandBuffer commandBuffer)
+		/*
+			Allocate the joint palette ranges of all skinned meshes and collect their vertex ranges for the pre-skinning pass
+			Every skinned mesh gets its own range as joint matrices are relative to the mesh's node
+		*/
+		void createJointPalette()
+		{
+			jointCount = 0;
+			skinnedRanges.clear();
+			for (auto node : linearNodes) {
+				if (!node->mesh || !node->skin) {
+					continue;
+				}
+				Mesh *mesh = node->mesh;
+				const uint32_t count = static_cast<uint32_t>(node->skin->joints.size());
+				node->skin->inverseBindMatrices.resize(count, glm::mat4(1.0f));
+				mesh->uniformBlock.jointOffset = jointCount;
+				mesh->uniformBlock.jointCount = count;
+				// Primitives of a mesh are written to the vertex buffer one after another
+				if (!mesh->primitives.empty()) {
+					const Primitive *first = mesh->primitives.front();
+					const Primitive *last = mesh->primitives.back();
+					skinnedRanges.push_back({ first->vertexStart, last->vertexStart + last->vertexCount - first->vertexStart, jointCount, 0 });
+				}
+				jointCount += count;
+			}
+			// The palette is bound to every mesh's descriptor set, so it always holds at least one matrix
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&jointBuffer,
+				std::max(jointCount, 1u) * sizeof(glm::mat4)));
+			VK_CHECK_RESULT(jointBuffer.map());
+			glm::mat4 *palette = static_cast<glm::mat4*>(jointBuffer.mapped);
+			for (auto node : linearNodes) {
+				if (node->mesh && node->skin) {
+					node->mesh->jointMatrices = palette + node->mesh->uniformBlock.jointOffset;
+				}
+			}
+		}
+
+		/*
+			Create the compute pipeline and the skinned vertex buffer for pre-skinning
+			Draws use the skinned vertices from then on, cmdSkin has to be recorded before the first pass using them in every frame
+
+			@param shader Compute shader stage (skinning.comp)
+			@param queue Queue used to initialize the skinned vertex buffer
+			@param pipelineCache (Optional) Pipeline cache used for the compute pipeline
+		*/
+		void prepareSkinning(VkPipelineShaderStageCreateInfo shader, VkQueue queue, VkPipelineCache pipelineCache = VK_NULL_HANDLE)
+		{
+			if (skinnedRanges.empty() || skinning.pipeline) {
+				return;
+			}
+			const VkDeviceSize vertexBufferSize = vertices.count * sizeof(Vertex);
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&skinning.vertices,
+				vertexBufferSize));
+			// Unskinned vertices are never written by the compute shader, so they are copied once
+			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			VkBufferCopy copyRegion = {};
+			copyRegion.size = vertexBufferSize;
+			vkCmdCopyBuffer(copyCmd, vertices.buffer, skinning.vertices.buffer, 1, &copyRegion);
+			device->flushCommandBuffer(copyCmd, queue, true);
+
+			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+			};
+			VkDescriptorSetLayoutCreateInfo descriptorLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &skinning.descriptorSetLayout));
+
+			std::vector<VkDescriptorPoolSize> poolSizes = {
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3),
+			};
+			VkDescriptorPoolCreateInfo descriptorPoolCI = vks::initializers::descriptorPoolCreateInfo(poolSizes, 1);
+			VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolCI, nullptr, &skinning.descriptorPool));
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(skinning.descriptorPool, &skinning.descriptorSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &skinning.descriptorSet));
+			VkDescriptorBufferInfo sourceDescriptor = { vertices.buffer, 0, vertexBufferSize };
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+				vks::initializers::writeDescriptorSet(skinning.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &sourceDescriptor),
+				vks::initializers::writeDescriptorSet(skinning.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &skinning.vertices.descriptor),
+				vks::initializers::writeDescriptorSet(skinning.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &jointBuffer.descriptor),
+			};
+			vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+			VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(SkinnedRange), 0);
+			VkPipelineLayoutCreateInfo pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(&skinning.descriptorSetLayout, 1);
+			pipelineLayoutCI.pushConstantRangeCount = 1;
+			pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+			VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutCI, nullptr, &skinning.pipelineLayout));
+
+			VkComputePipelineCreateInfo computePipelineCI = vks::initializers::computePipelineCreateInfo(skinning.pipelineLayout, 0);
+			computePipelineCI.stage = shader;
+			VK_CHECK_RESULT(vkCreateComputePipelines(device->logicalDevice, pipelineCache, 1, &computePipelineCI, nullptr, &skinning.pipeline));
+		}
+
+		/*
+			Skin the vertices of all skinned meshes with the current joint palette
+			Must be recorded outside of a render pass, all following passes (shadow, depth, color) reuse the result
+		*/
+		void cmdSkin(VkCommandBuffer commandBuffer)
+		{
+			if (!skinning.pipeline) {
+				return;
+			}
+			// Draws of the previous frame may still read the skinned vertices
+			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+			bufferBarrier.srcAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.buffer = skinning.vertices.buffer;
+			bufferBarrier.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinning.pipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinning.pipelineLayout, 0, 1, &skinning.descriptorSet, 0, nullptr);
+			for (const SkinnedRange &range : skinnedRanges) {
+				vkCmdPushConstants(commandBuffer, skinning.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SkinnedRange), &range);
+				vkCmdDispatch(commandBuffer, (range.vertexCount + 63) / 64, 1, 1);
+			}
+
+			bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+		}
+
+		/** @brief Bind the (pre-skinned if prepared) vertex buffer and the index buffer */
+		void bindBuffers(VkCommandBuffer commandBuffer)
+		{
+			const VkDeviceSize offsets[1] = { 0 };
+			const VkBuffer vertexBuffer = skinning.pipeline ? skinning.vertices.buffer : vertices.buffer;
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, indices.type);
+		}
+
+		/** @brief Bind the model's descriptor set with the dynamic offset of the mesh's uniform block */
+		void bindMesh(VkCommandBuffer commandBuffer, const Mesh *mesh, VkPipelineLayout pipelineLayout, uint32_t bindSet)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, bindSet, 1, &descriptorSet, 1, &mesh->dynamicOffset);
+		}
+
+		void drawNode(Node *node, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindSet = 0)
 		{
 			if (node->mesh) {
+				if (pipelineLayout) {
+					bindMesh(commandBuffer, node->mesh, pipelineLayout, bindSet);
+				}
 				for (Primitive *primitive : node->mesh->primitives) {
-					vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, 0, 0);
+					vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, static_cast<int32_t>(primitive->vertexStart), 0);
 				}
 			}
 			for (auto& child : node->children) {
-				drawNode(child, commandBuffer);
+				drawNode(child, commandBuffer, pipelineLayout, bindSet);
 			}
 		}
 
-		void draw(VkCommandBuffer commandBuffer)
+		/*
+			Draw all nodes
+			If a pipeline layout is passed, the model's descriptor set is bound to bindSet with each mesh's dynamic offset
+		*/
+		void draw(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindSet = 0)
 		{
-			const VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
-			vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+			bindBuffers(commandBuffer);
 			for (auto& node : nodes) {
-				drawNode(node, commandBuffer);
+				drawNode(node, commandBuffer, pipelineLayout, bindSet);
+			}
+		}
+
+		/*
+			Draw only the primitives whose world space bounds intersect the given frustum
+			If a pipeline layout is passed, the model's descriptor set is bound to bindSet whenever the mesh changes
+		*/
+		void draw(VkCommandBuffer commandBuffer, const vks::Frustum &frustum, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindSet = 0)
+		{
+			std::vector<uint32_t> visible;
+			getVisiblePrimitives(frustum, visible);
+			bindBuffers(commandBuffer);
+			const Mesh *boundMesh = nullptr;
+			for (uint32_t index : visible) {
+				const Mesh *mesh = scenePrimitives[index].node->mesh;
+				if (pipelineLayout && (mesh != boundMesh)) {
+					bindMesh(commandBuffer, mesh, pipelineLayout, bindSet);
+					boundMesh = mesh;
+				}
+				const Primitive *primitive = scenePrimitives[index].primitive;
+				vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, static_cast<int32_t>(primitive->vertexStart), 0);
+			}
+		}
+
+		/*
+			Draw the primitives intersecting the frustum sorted by state through a render queue
+			Packets are keyed by alpha mode, material, mesh and view distance, blended primitives are drawn last and back to front
+			Only state that changes between draws is bound, see queue.getStatistics for the number of binds
+		*/
+		void draw(VkCommandBuffer commandBuffer, const vks::Frustum &frustum, const glm::vec3 &cameraPosition, vks::RenderQueue &queue, const DrawBindings &bindings)
+		{
+			std::vector<uint32_t> visible;
+			getVisiblePrimitives(frustum, visible);
+			queue.clear();
+			for (uint32_t index : visible) {
+				const ScenePrimitive &scenePrimitive = scenePrimitives[index];
+				const Primitive *primitive = scenePrimitive.primitive;
+				const glm::vec3 center = glm::vec3(scenePrimitive.node->getMatrix() * glm::vec4(primitive->dimensions.center, 1.0f));
+				const uint32_t material = static_cast<uint32_t>(&primitive->material - materials.data());
+				const uint32_t mesh = scenePrimitive.node->mesh->dynamicOffset / meshBufferStride;
+				const Material::AlphaMode alphaMode = primitive->material.alphaMode;
+				queue.add(alphaMode, material, mesh, primitive->firstIndex, primitive->indexCount, static_cast<int32_t>(primitive->vertexStart), glm::distance(center, cameraPosition), alphaMode == Material::ALPHAMODE_BLEND);
+			}
+			queue.sort();
+			bindBuffers(commandBuffer);
+			queue.submit(commandBuffer,
+				[&](uint32_t pipeline) {
+					if (bindings.pipelines[pipeline]) {
+						vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bindings.pipelines[pipeline]);
+					}
+				},
+				[&](uint32_t material) {
+					if (bindings.pipelineLayout && materials[material].descriptorSet) {
+						vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bindings.pipelineLayout, bindings.materialSet, 1, &materials[material].descriptorSet, 0, nullptr);
+					}
+				},
+				[&](uint32_t mesh) {
+					if (bindings.pipelineLayout) {
+						const uint32_t dynamicOffset = mesh * meshBufferStride;
+						vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bindings.pipelineLayout, bindings.meshSet, 1, &descriptorSet, 1, &dynamicOffset);
+					}
+				});
+		}
+
+		/*
+			Cull the meshlets of all scene primitives against the view frustum and their normal cones and write the indirect draw commands used by drawMeshlets
+			The first instance of each command is the index of its scene primitive, so per node data can be fetched in the shader
+			Meshlets are culled with their node's matrix, skinned primitives are culled in their bind pose
+		*/
+		uint32_t updateMeshlets(const glm::mat4 &viewProjection, const glm::vec3 &cameraPosition)
+		{
+			assert(meshletCommands.mapped);
+			VkDrawIndexedIndirectCommand *commands = static_cast<VkDrawIndexedIndirectCommand*>(meshletCommands.mapped);
+			visibleMeshletCount = 0;
+			for (uint32_t i = 0; i < static_cast<uint32_t>(scenePrimitives.size()); i++) {
+				const Primitive *primitive = scenePrimitives[i].primitive;
+				if (primitive->meshletCount == 0) {
+					continue;
+				}
+				visibleMeshletCount += vks::meshlet::cull(&meshlets[primitive->meshletOffset], primitive->meshletCount, viewProjection, scenePrimitives[i].node->getMatrix(), cameraPosition, &commands[primitive->meshletOffset], i);
+			}
+			return visibleMeshletCount;
+		}
+
+		/*
+			Draw all meshlets with the commands written by updateMeshlets
+			Without the multiDrawIndirect device feature one indirect draw per meshlet is recorded
+		*/
+		void drawMeshlets(VkCommandBuffer commandBuffer, bool multiDrawIndirect)
+		{
+			if (meshlets.empty()) {
+				return;
+			}
+			bindBuffers(commandBuffer);
+			if (multiDrawIndirect) {
+				vkCmdDrawIndexedIndirect(commandBuffer, meshletCommands.buffer, 0, static_cast<uint32_t>(meshlets.size()), sizeof(VkDrawIndexedIndirectCommand));
+			} else {
+				for (uint32_t i = 0; i < static_cast<uint32_t>(meshlets.size()); i++) {
+					vkCmdDrawIndexedIndirect(commandBuffer, meshletCommands.buffer, i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+				}
 			}
 		}
 
 		void getNodeDimensions(Node *node, glm::vec3 &min, glm::vec3 &max)
 		{
 			if (node->mesh) {
+				const glm::mat4 m = node->getMatrix();
 				for (Primitive *primitive : node->mesh->primitives) {
-					glm::vec4 locMin = glm::vec4(primitive->dimensions.min, 1.0f) * node->getMatrix();
-					glm::vec4 locMax = glm::vec4(primitive->dimensions.max, 1.0f) * node->getMatrix();
-					if (locMin.x < min.x) { min.x = locMin.x; }
-					if (locMin.y < min.y) { min.y = locMin.y; }
-					if (locMin.z < min.z) { min.z = locMin.z; }
-					if (locMax.x > max.x) { max.x = locMax.x; }
-					if (locMax.y > max.y) { max.y = locMax.y; }
-					if (locMax.z > max.z) { max.z = locMax.z; }
+					vks::AABB bounds = vks::AABB(primitive->dimensions.min, primitive->dimensions.max).transform(m);
+					min = glm::min(min, bounds.min);
+					max = glm::max(max, bounds.max);
 				}
 			}
 			for (auto child : node->children) {
@@ -1126,71 +1938,162 @@ namespace vkglTF
 
 		void getSceneDimensions()
 		{
-			dimensions.min = glm::vec3(FLT_MAX);
-			dimensions.max = glm::vec3(-FLT_MAX);
-			for (auto node : nodes) {
-				getNodeDimensions(node, dimensions.min, dimensions.max);
+			if (!bvh.empty()) {
+				// The root of the hierarchy already bounds all primitives
+				vks::AABB bounds = bvh.bounds();
+				dimensions.min = bounds.min;
+				dimensions.max = bounds.max;
+			} else {
+				dimensions.min = glm::vec3(FLT_MAX);
+				dimensions.max = glm::vec3(-FLT_MAX);
+				for (auto node : nodes) {
+					getNodeDimensions(node, dimensions.min, dimensions.max);
+				}
 			}
 			dimensions.size = dimensions.max - dimensions.min;
 			dimensions.center = (dimensions.min + dimensions.max) / 2.0f;
 			dimensions.radius = glm::distance(dimensions.min, dimensions.max) / 2.0f;
 		}
 
-		void updateAnimation(uint32_t index, float time) 
+		/*
+			Build the bounding volume hierarchy over the world space bounds of all primitives of the current pose
+		*/
+		void buildBVH()
 		{
-			if (index > static_cast<uint32_t>(animations.size()) - 1) {
-				std::cout << "No animation with index " << index << std::endl;
-				return;
+			scenePrimitives.clear();
+			std::vector<vks::AABB> bounds;
+			for (auto node : linearNodes) {
+				if (!node->mesh) {
+					continue;
+				}
+				const glm::mat4 m = node->getMatrix();
+				for (Primitive *primitive : node->mesh->primitives) {
+					scenePrimitives.push_back({ node, primitive });
+					bounds.push_back(vks::AABB(primitive->dimensions.min, primitive->dimensions.max).transform(m));
+				}
 			}
-			Animation &animation = animations[index];
+			bvh.build(bounds);
+		}
 
-			bool updated = false;
-			for (auto& channel : animation.channels) {
-				vkglTF::AnimationSampler &sampler = animation.samplers[channel.samplerIndex];
-				if (sampler.inputs.size() > sampler.outputsVec4.size()) {
+		/*
+			Refit the bounding volume hierarchy after nodes have been moved (e.g. by an animation)
+			Only primitives of nodes whose world matrix changed in the last transform update are refitted
+		*/
+		void updateBVH()
+		{
+			for (uint32_t i = 0; i < static_cast<uint32_t>(scenePrimitives.size()); i++) {
+				const ScenePrimitive &scenePrimitive = scenePrimitives[i];
+				if (!transforms.isChanged(scenePrimitive.node->transform)) {
 					continue;
 				}
+				const Primitive::Dimensions &dim = scenePrimitive.primitive->dimensions;
+				bvh.update(i, vks::AABB(dim.min, dim.max).transform(scenePrimitive.node->getMatrix()));
+			}
+			bvh.refit();
+		}
 
-				for (auto i = 0; i < sampler.inputs.size() - 1; i++) {
-					if ((time >= sampler.inputs[i]) && (time <= sampler.inputs[i + 1])) {
-						float u = std::max(0.0f, time - sampler.inputs[i]) / (sampler.inputs[i + 1] - sampler.inputs[i]);
-						if (u <= 1.0f) {
-							switch (channel.path) {
-							case vkglTF::AnimationChannel::PathType::TRANSLATION: {
-								glm::vec4 trans = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], u);
-								channel.node->translation = glm::vec3(trans);
-								break;
-							}
-							case vkglTF::AnimationChannel::PathType::SCALE: {
-								glm::vec4 trans = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], u);
-								channel.node->scale = glm::vec3(trans);
-								break;
-							}
-							case vkglTF::AnimationChannel::PathType::ROTATION: {
-								glm::quat q1;
-								q1.x = sampler.outputsVec4[i].x;
-								q1.y = sampler.outputsVec4[i].y;
-								q1.z = sampler.outputsVec4[i].z;
-								q1.w = sampler.outputsVec4[i].w;
-								glm::quat q2;
-								q2.x = sampler.outputsVec4[i + 1].x;
-								q2.y = sampler.outputsVec4[i + 1].y;
-								q2.z = sampler.outputsVec4[i + 1].z;
-								q2.w = sampler.outputsVec4[i + 1].w;
-								channel.node->rotation = glm::normalize(glm::slerp(q1, q2, u));
-								break;
-							}
-							}
-							updated = true;
-						}
-					}
+		/** @brief True if any joint of the skin moved in the last transform update */
+		bool isSkinChanged(const Skin *skin) const
+		{
+			for (const Node *joint : skin->joints) {
+				if (transforms.isChanged(joint->transform)) {
+					return true;
 				}
 			}
-			if (updated) {
-				for (auto &node : nodes) {
+			return false;
+		}
+
+		/*
+			Propagate changed local transforms to the world matrices in a single pass over the hierarchy
+			Only meshes whose node or joints moved are written to their uniform buffers
+		*/
+		void updateTransforms()
+		{
+			if (!transforms.update()) {
+				return;
+			}
+			for (auto node : linearNodes) {
+				if (node->mesh && (transforms.isChanged(node->transform) || (node->skin && isSkinChanged(node->skin)))) {
 					node->update();
 				}
 			}
+			updateBVH();
+		}
+
+		/*
+			Get the indices (into scenePrimitives) of all primitives intersecting the given frustum
+		*/
+		void getVisiblePrimitives(const vks::Frustum &frustum, std::vector<uint32_t> &visible)
+		{
+			visible.clear();
+			bvh.queryFrustum(frustum, visible);
+		}
+
+		/*
+			Get the indices (into scenePrimitives) of all primitives overlapping the given world space box
+		*/
+		void getPrimitivesInBox(const vks::AABB &box, std::vector<uint32_t> &result)
+		{
+			result.clear();
+			bvh.queryAABB(box, result);
+		}
+
+		/*
+			Returns the primitive with the closest world space bounds hit by the given ray, or nullptr if nothing was hit
+		*/
+		ScenePrimitive* pick(const glm::vec3 &origin, const glm::vec3 &direction, float *distance = nullptr)
+		{
+			uint32_t index;
+			float t;
+			if (!bvh.raycast(origin, direction, index, t)) {
+				return nullptr;
+			}
+			if (distance) {
+				*distance = t;
+			}
+			return &scenePrimitives[index];
+		}
+
+		/*
+			Sample an animation and update the transforms it moved
+			Advancing time reuses each channel's last key interval, seeking falls back to a binary search
+		*/
+		void updateAnimation(uint32_t index, float time) 
+		{
+			if (index >= static_cast<uint32_t>(animations.size())) {
+				std::cout << "No animation with index " << index << std::endl;
+				return;
+			}
+			const Animation &animation = animations[index];
+			vks::animation::State &state = animationStates[index];
+			vks::animation::sample(animation, time, state);
+			if (vks::animation::apply(animation, state, transforms)) {
+				updateTransforms();
+			}
+		}
+
+		/*
+			Shared skeleton of a skin for animating many instances of the model with a vks::animation::Animator
+			Joint matrices are relative to the first node using the skin, like the ones written by Node::update
+			Instances start from the loaded pose, not from the current pose of the model's own animations
+		*/
+		vks::animation::Skeleton getSkeleton(uint32_t skinIndex) const
+		{
+			vks::animation::Skeleton skeleton;
+			skeleton.rest = &restTransforms;
+			const Skin *skin = skins[skinIndex];
+			for (const Node *joint : skin->joints) {
+				skeleton.joints.push_back(joint->transform);
+			}
+			skeleton.inverseBindMatrices = skin->inverseBindMatrices;
+			skeleton.inverseBindMatrices.resize(skeleton.joints.size(), glm::mat4(1.0f));
+			for (const Node *node : linearNodes) {
+				if (node->skin == skin) {
+					skeleton.root = static_cast<int32_t>(node->transform);
+					break;
+				}
+			}
+			return skeleton;
 		}
 
 		/*
@@ -1220,29 +2123,5 @@ namespace vkglTF
 			}
 			return nodeFound;
 		}
-
-		void prepareNodeDescriptor(vkglTF::Node *node, VkDescriptorSetLayout descriptorSetLayout) {
-			if (node->mesh) {
-				VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
-				descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-				descriptorSetAllocInfo.descriptorPool = descriptorPool;
-				descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayout;
-				descriptorSetAllocInfo.descriptorSetCount = 1;
-				VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &node->mesh->uniformBuffer.descriptorSet));
-
-				VkWriteDescriptorSet writeDescriptorSet{};
-				writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-				writeDescriptorSet.descriptorCount = 1;
-				writeDescriptorSet.dstSet = node->mesh->uniformBuffer.descriptorSet;
-				writeDescriptorSet.dstBinding = 0;
-				writeDescriptorSet.pBufferInfo = &node->mesh->uniformBuffer.descriptor;
-
-				vkUpdateDescriptorSets(device->logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
-			}
-			for (auto& child : node->children) {
-				prepareNodeDescriptor(child, descriptorSetLayout);
-			}
-		}
 	};
 }
\ No newline at end of file
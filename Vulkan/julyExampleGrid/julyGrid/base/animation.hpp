@@ -0,0 +1,271 @@
+/*
+* Keyframe animation sampling
+*
+* Samples glTF style animation clips (linear, step and cubic spline keys) into a transform hierarchy
+* Every channel keeps a cursor to its last key interval, so advancing time finds the active keys in constant time
+* and only seeking falls back to a binary search. All channels are reduced to a weighted sum of four key values
+* that is evaluated in one branch free (SSE) pass
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define VKS_ANIMATION_SSE2
+#endif
+
+#include "transformhierarchy.hpp"
+
+namespace vks
+{
+	namespace animation
+	{
+		enum Interpolation { interpolationLinear, interpolationStep, interpolationCubicSpline };
+		enum Path { pathTranslation, pathRotation, pathScale };
+
+		/** @brief Key times and values, cubic spline samplers store (in tangent, value, out tangent) per key */
+		struct Sampler
+		{
+			Interpolation interpolation = interpolationLinear;
+			std::vector<float> inputs;
+			std::vector<glm::vec4> outputs;
+
+			/** @brief True if there are enough output values for the keys */
+			bool valid() const
+			{
+				return !inputs.empty() && (outputs.size() >= inputs.size() * ((interpolation == interpolationCubicSpline) ? 3 : 1));
+			}
+		};
+
+		/** @brief Animates one component of a transform in the hierarchy */
+		struct Channel
+		{
+			Path path = pathTranslation;
+			uint32_t sampler = 0;
+			uint32_t target = 0;
+		};
+
+		struct Clip
+		{
+			std::string name;
+			std::vector<Sampler> samplers;
+			std::vector<Channel> channels;
+			float start = std::numeric_limits<float>::max();
+			float end = std::numeric_limits<float>::lowest();
+		};
+
+		namespace detail
+		{
+			/** @brief Four key values and their weights, the sampled value is the weighted sum */
+			struct Blend
+			{
+				const glm::vec4 *keys[4];
+				float weights[4];
+			};
+
+			/*
+			* Find the key interval containing time
+			* Checks the cursor's interval and the next one first, which covers time advancing by less than a key per update
+			*/
+			inline uint32_t findKey(const std::vector<float> &inputs, float time, uint32_t &cursor)
+			{
+				const uint32_t last = static_cast<uint32_t>(inputs.size()) - 1;
+				uint32_t key = cursor;
+				if ((key < last) && (inputs[key] <= time)) {
+					if (time < inputs[key + 1]) {
+						return key;
+					}
+					if ((key + 1 < last) && (time < inputs[key + 2])) {
+						cursor = key + 1;
+						return cursor;
+					}
+				}
+				key = static_cast<uint32_t>(std::upper_bound(inputs.begin(), inputs.end(), time) - inputs.begin());
+				cursor = std::min(std::max(key, 1u) - 1, last - 1);
+				return cursor;
+			}
+
+			inline void setupBlend(const Sampler &sampler, Path path, float time, uint32_t &cursor, Blend &blend)
+			{
+				const glm::vec4 *outputs = sampler.outputs.data();
+				const bool cubic = (sampler.interpolation == interpolationCubicSpline);
+				// Value of key k, cubic spline samplers store it between the key's tangents
+				auto value = [outputs, cubic](uint32_t k) { return cubic ? &outputs[k * 3 + 1] : &outputs[k]; };
+
+				blend.keys[0] = blend.keys[1] = blend.keys[2] = blend.keys[3] = value(0);
+				blend.weights[0] = 1.0f;
+				blend.weights[1] = blend.weights[2] = blend.weights[3] = 0.0f;
+				if (sampler.inputs.size() < 2) {
+					return;
+				}
+				const uint32_t last = static_cast<uint32_t>(sampler.inputs.size()) - 1;
+				if (time <= sampler.inputs[0]) {
+					cursor = 0;
+					return;
+				}
+				if (time >= sampler.inputs[last]) {
+					cursor = last - 1;
+					blend.keys[0] = value(last);
+					return;
+				}
+
+				const uint32_t k = findKey(sampler.inputs, time, cursor);
+				const float t0 = sampler.inputs[k];
+				const float dt = sampler.inputs[k + 1] - t0;
+				const float t = (dt > 0.0f) ? (time - t0) / dt : 0.0f;
+				blend.keys[0] = value(k);
+				switch (sampler.interpolation) {
+				case interpolationStep:
+					break;
+				case interpolationLinear:
+					blend.keys[2] = value(k + 1);
+					if (path == pathRotation) {
+						// Spherical interpolation along the shorter arc, expressed as weights of the two keys
+						const glm::vec4 &a = *blend.keys[0];
+						const glm::vec4 &b = *blend.keys[2];
+						float cosTheta = glm::dot(a, b);
+						const float sign = (cosTheta < 0.0f) ? -1.0f : 1.0f;
+						cosTheta *= sign;
+						if (cosTheta > 0.9995f) {
+							// Nearly parallel, fall back to a normalized linear interpolation
+							blend.weights[0] = 1.0f - t;
+							blend.weights[2] = t * sign;
+						} else {
+							const float theta = std::acos(cosTheta);
+							const float sinTheta = std::sin(theta);
+							blend.weights[0] = std::sin((1.0f - t) * theta) / sinTheta;
+							blend.weights[2] = std::sin(t * theta) / sinTheta * sign;
+						}
+					} else {
+						blend.weights[0] = 1.0f - t;
+						blend.weights[2] = t;
+					}
+					break;
+				case interpolationCubicSpline: {
+					// Hermite spline between the two values with the out tangent of the first and the in tangent of the second key
+					const float t2 = t * t;
+					const float t3 = t2 * t;
+					blend.keys[1] = &outputs[k * 3 + 2];
+					blend.keys[2] = value(k + 1);
+					blend.keys[3] = &outputs[(k + 1) * 3];
+					blend.weights[0] = 2.0f * t3 - 3.0f * t2 + 1.0f;
+					blend.weights[1] = (t3 - 2.0f * t2 + t) * dt;
+					blend.weights[2] = -2.0f * t3 + 3.0f * t2;
+					blend.weights[3] = (t3 - t2) * dt;
+					break;
+				}
+				}
+			}
+
+			inline void evaluate(const Blend *blends, size_t count, glm::vec4 *values)
+			{
+				for (size_t i = 0; i < count; i++) {
+					const Blend &blend = blends[i];
+#if defined(VKS_ANIMATION_SSE2)
+					__m128 result = _mm_mul_ps(_mm_loadu_ps(&blend.keys[0]->x), _mm_set1_ps(blend.weights[0]));
+					result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(&blend.keys[1]->x), _mm_set1_ps(blend.weights[1])));
+					result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(&blend.keys[2]->x), _mm_set1_ps(blend.weights[2])));
+					result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(&blend.keys[3]->x), _mm_set1_ps(blend.weights[3])));
+					_mm_storeu_ps(&values[i].x, result);
+#else
+					values[i] = *blend.keys[0] * blend.weights[0] + *blend.keys[1] * blend.weights[1] + *blend.keys[2] * blend.weights[2] + *blend.keys[3] * blend.weights[3];
+#endif
+				}
+			}
+		}
+
+		/** @brief Playback state of a clip, one per animated instance so instances can share clips */
+		struct State
+		{
+			// Last key interval of each channel
+			std::vector<uint32_t> cursors;
+			// Sampled value of each channel, rotations are normalized quaternions (x, y, z, w)
+			std::vector<glm::vec4> values;
+			// Scratch space reused by every sample call
+			std::vector<detail::Blend> blends;
+		};
+
+		/** @brief Size the state for a clip and reset its cursors */
+		inline void reset(const Clip &clip, State &state)
+		{
+			state.cursors.assign(clip.channels.size(), 0);
+			state.values.assign(clip.channels.size(), glm::vec4(0.0f));
+			state.blends.resize(clip.channels.size());
+		}
+
+		/*
+		* Sample all channels of a clip
+		*
+		* @param clip Clip to sample
+		* @param time Time in seconds, clamped to the keys of each sampler
+		* @param state Cursors used as search start and updated, receives the sampled values
+		*/
+		inline void sample(const Clip &clip, float time, State &state)
+		{
+			if (state.cursors.size() != clip.channels.size()) {
+				reset(clip, state);
+			}
+			for (size_t i = 0; i < clip.channels.size(); i++) {
+				const Channel &channel = clip.channels[i];
+				detail::setupBlend(clip.samplers[channel.sampler], channel.path, time, state.cursors[i], state.blends[i]);
+			}
+			detail::evaluate(state.blends.data(), state.blends.size(), state.values.data());
+			for (size_t i = 0; i < clip.channels.size(); i++) {
+				if (clip.channels[i].path == pathRotation) {
+					const float length = glm::length(state.values[i]);
+					state.values[i] = (length > 0.0f) ? state.values[i] / length : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+				}
+			}
+		}
+
+		/*
+		* Write the sampled values to their target transforms
+		* Transforms are only marked dirty if their value changed, so static channels don't cause subtree updates
+		*
+		* @return True if any transform was changed
+		*/
+		inline bool apply(const Clip &clip, const State &state, TransformHierarchy &transforms)
+		{
+			bool changed = false;
+			for (size_t i = 0; i < clip.channels.size(); i++) {
+				const Channel &channel = clip.channels[i];
+				const glm::vec4 &value = state.values[i];
+				switch (channel.path) {
+				case pathTranslation:
+					if (transforms.translations[channel.target] != glm::vec3(value)) {
+						transforms.setTranslation(channel.target, glm::vec3(value));
+						changed = true;
+					}
+					break;
+				case pathScale:
+					if (transforms.scales[channel.target] != glm::vec3(value)) {
+						transforms.setScale(channel.target, glm::vec3(value));
+						changed = true;
+					}
+					break;
+				case pathRotation: {
+					const glm::quat rotation(value.w, value.x, value.y, value.z);
+					if (transforms.rotations[channel.target] != rotation) {
+						transforms.setRotation(channel.target, rotation);
+						changed = true;
+					}
+					break;
+				}
+				}
+			}
+			return changed;
+		}
+	}
+}
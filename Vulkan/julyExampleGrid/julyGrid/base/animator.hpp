@@ -0,0 +1,291 @@
+/*
+* Animated instances with clip blending
+*
+* Separates the shared data of an animated model (rest pose hierarchy, skin joints and clips) from the pose of each instance
+* Every instance plays a stack of clip layers that are crossfaded or added on top of each other, all instances are
+* evaluated as parallel jobs and their joint matrices are written to one contiguous array that can be uploaded as is
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "transformhierarchy.hpp"
+#include "animation.hpp"
+#include "threadpool.hpp"
+
+namespace vks
+{
+	namespace animation
+	{
+		/** @brief Data shared by all instances of an animated model */
+		struct Skeleton
+		{
+			// Hierarchy in its rest pose, every instance starts from a copy of it
+			const TransformHierarchy *rest = nullptr;
+			// Transform of the skinned mesh's node, joint matrices are relative to it (-1 for world space joint matrices)
+			int32_t root = -1;
+			std::vector<uint32_t> joints;
+			std::vector<glm::mat4> inverseBindMatrices;
+		};
+
+		/** @brief Clip playing on an instance */
+		struct Layer
+		{
+			const Clip *clip = nullptr;
+			float time = 0.0f;
+			float speed = 1.0f;
+			bool loop = true;
+			float weight = 1.0f;
+			// Change of the weight per second, the layer is removed once it faded out
+			float fade = 0.0f;
+			// Additive layers add their difference to the clip's first frame on top of the layers below
+			bool additive = false;
+			// Crossfaded layers remove the non additive layers below them once they reach full weight
+			bool replaces = false;
+			State state;
+			State reference;
+		};
+
+		/** @brief Pose of one animated instance */
+		struct Instance
+		{
+			TransformHierarchy pose;
+			std::vector<Layer> layers;
+			// Blended local transforms, reused between updates
+			std::vector<glm::vec3> translations;
+			std::vector<glm::quat> rotations;
+			std::vector<glm::vec3> scales;
+
+			/*
+			* Add a clip layer
+			*
+			* @param clip Clip to play, has to outlive the layer
+			* @param weight (Optional) Blend weight of the layer
+			* @param additive (Optional) Add the clip's difference to its first frame instead of blending towards it
+			*
+			* @return The layer, valid until layers are added or removed
+			*/
+			Layer &play(const Clip *clip, float weight = 1.0f, bool additive = false)
+			{
+				Layer layer;
+				layer.clip = clip;
+				layer.weight = weight;
+				layer.additive = additive;
+				reset(*clip, layer.state);
+				if (additive) {
+					sample(*clip, clip->start, layer.reference);
+				}
+				layers.push_back(std::move(layer));
+				return layers.back();
+			}
+
+			/*
+			* Fade in a clip over duration seconds and replace all other non additive layers
+			* The layers below keep their weight while the new one blends over them and are removed once it reached full weight,
+			* fading them out at the same time would let the rest pose show through halfway
+			*/
+			Layer &crossfade(const Clip *clip, float duration)
+			{
+				const float rate = (duration > 0.0f) ? 1.0f / duration : 1e6f;
+				Layer &layer = play(clip, 0.0f);
+				layer.fade = rate;
+				layer.replaces = true;
+				return layer;
+			}
+		};
+
+		namespace detail
+		{
+			/** @brief Normalized linear interpolation along the shorter arc */
+			inline glm::quat nlerp(const glm::quat &a, const glm::quat &b, float t)
+			{
+				const float sign = (glm::dot(a, b) < 0.0f) ? -1.0f : 1.0f;
+				return glm::normalize(glm::quat(
+					a.w + (b.w * sign - a.w) * t,
+					a.x + (b.x * sign - a.x) * t,
+					a.y + (b.y * sign - a.y) * t,
+					a.z + (b.z * sign - a.z) * t));
+			}
+
+			inline glm::quat toQuat(const glm::vec4 &value)
+			{
+				return glm::quat(value.w, value.x, value.y, value.z);
+			}
+
+			/** @brief Blend a sampled layer into the instance's local transforms */
+			inline void blendLayer(Instance &instance, const Layer &layer)
+			{
+				const Clip &clip = *layer.clip;
+				const float weight = std::min(std::max(layer.weight, 0.0f), 1.0f);
+				if (weight <= 0.0f) {
+					return;
+				}
+				for (size_t i = 0; i < clip.channels.size(); i++) {
+					const Channel &channel = clip.channels[i];
+					const glm::vec4 &value = layer.state.values[i];
+					const uint32_t target = channel.target;
+					if (!layer.additive) {
+						switch (channel.path) {
+						case pathTranslation:
+							instance.translations[target] = glm::mix(instance.translations[target], glm::vec3(value), weight);
+							break;
+						case pathScale:
+							instance.scales[target] = glm::mix(instance.scales[target], glm::vec3(value), weight);
+							break;
+						case pathRotation:
+							instance.rotations[target] = nlerp(instance.rotations[target], toQuat(value), weight);
+							break;
+						}
+						continue;
+					}
+					const glm::vec4 &reference = layer.reference.values[i];
+					switch (channel.path) {
+					case pathTranslation:
+						instance.translations[target] += (glm::vec3(value) - glm::vec3(reference)) * weight;
+						break;
+					case pathScale: {
+						glm::vec3 ratio(1.0f);
+						for (int c = 0; c < 3; c++) {
+							if (reference[c] != 0.0f) {
+								ratio[c] = value[c] / reference[c];
+							}
+						}
+						instance.scales[target] *= glm::mix(glm::vec3(1.0f), ratio, weight);
+						break;
+					}
+					case pathRotation: {
+						const glm::quat delta = glm::inverse(toQuat(reference)) * toQuat(value);
+						instance.rotations[target] = glm::normalize(instance.rotations[target] * nlerp(glm::quat(), delta, weight));
+						break;
+					}
+					}
+				}
+			}
+		}
+
+		/** @brief Plays and blends the clips of many instances of one skeleton */
+		class Animator
+		{
+		public:
+			const Skeleton *skeleton = nullptr;
+			std::vector<Instance> instances;
+			// Joint matrices of all instances, instance i starts at i * getJointCount()
+			std::vector<glm::mat4> jointMatrices;
+
+			explicit Animator(const Skeleton *skeleton) : skeleton(skeleton) {}
+
+			uint32_t getJointCount() const
+			{
+				return static_cast<uint32_t>(skeleton->joints.size());
+			}
+
+			/** @brief Add an instance in the skeleton's rest pose, returns its index */
+			uint32_t addInstance()
+			{
+				Instance instance;
+				instance.pose = *skeleton->rest;
+				instances.push_back(std::move(instance));
+				jointMatrices.resize(instances.size() * skeleton->joints.size(), glm::mat4(1.0f));
+				return static_cast<uint32_t>(instances.size() - 1);
+			}
+
+			/*
+			* Advance, blend and evaluate a single instance
+			*
+			* @param index Index of the instance
+			* @param deltaTime Time since the last update in seconds
+			* @param dst Receives the instance's joint matrices
+			*/
+			void updateInstance(uint32_t index, float deltaTime, glm::mat4 *dst)
+			{
+				Instance &instance = instances[index];
+				const TransformHierarchy &rest = *skeleton->rest;
+
+				// Advance layers and drop the ones that faded out or were replaced by a completed crossfade
+				size_t replaced = 0;
+				for (size_t i = 0; i < instance.layers.size(); i++) {
+					Layer &layer = instance.layers[i];
+					layer.weight = std::min(std::max(layer.weight + layer.fade * deltaTime, 0.0f), 1.0f);
+					layer.time += deltaTime * layer.speed;
+					const float duration = layer.clip->end - layer.clip->start;
+					if (layer.loop && (duration > 0.0f)) {
+						layer.time = layer.clip->start + std::fmod(std::fmod(layer.time - layer.clip->start, duration) + duration, duration);
+					}
+					if (layer.replaces && (layer.weight >= 1.0f)) {
+						layer.replaces = false;
+						replaced = i;
+					}
+				}
+				for (size_t i = 0; i < replaced; i++) {
+					if (!instance.layers[i].additive) {
+						instance.layers[i].fade = -1.0f;
+						instance.layers[i].weight = 0.0f;
+					}
+				}
+				instance.layers.erase(std::remove_if(instance.layers.begin(), instance.layers.end(), [](const Layer &layer) {
+					return (layer.fade < 0.0f) && (layer.weight <= 0.0f);
+				}), instance.layers.end());
+
+				// Blend all layers on top of the rest pose
+				instance.translations = rest.translations;
+				instance.rotations = rest.rotations;
+				instance.scales = rest.scales;
+				for (Layer &layer : instance.layers) {
+					sample(*layer.clip, layer.time, layer.state);
+					detail::blendLayer(instance, layer);
+				}
+
+				// Only transforms with a changed value are marked dirty
+				TransformHierarchy &pose = instance.pose;
+				for (uint32_t i = 0; i < static_cast<uint32_t>(pose.size()); i++) {
+					if (pose.translations[i] != instance.translations[i]) {
+						pose.setTranslation(i, instance.translations[i]);
+					}
+					if (pose.rotations[i] != instance.rotations[i]) {
+						pose.setRotation(i, instance.rotations[i]);
+					}
+					if (pose.scales[i] != instance.scales[i]) {
+						pose.setScale(i, instance.scales[i]);
+					}
+				}
+				pose.update();
+
+				const glm::mat4 inverseRoot = (skeleton->root >= 0) ? glm::inverse(pose.getWorldMatrix(skeleton->root)) : glm::mat4(1.0f);
+				for (size_t i = 0; i < skeleton->joints.size(); i++) {
+					dst[i] = inverseRoot * pose.getWorldMatrix(skeleton->joints[i]) * skeleton->inverseBindMatrices[i];
+				}
+			}
+
+			/*
+			* Update all instances
+			*
+			* @param deltaTime Time since the last update in seconds
+			* @param pool (Optional) Thread pool the instances are distributed on
+			* @param dst (Optional) Destination of the joint matrices (e.g. a mapped buffer) instead of jointMatrices
+			*/
+			void update(float deltaTime, ThreadPool *pool = nullptr, glm::mat4 *dst = nullptr)
+			{
+				glm::mat4 *output = dst ? dst : jointMatrices.data();
+				const size_t jointCount = skeleton->joints.size();
+				auto job = [this, deltaTime, output, jointCount](uint32_t first, uint32_t last) {
+					for (uint32_t i = first; i < last; i++) {
+						updateInstance(i, deltaTime, output + i * jointCount);
+					}
+				};
+				if (pool) {
+					pool->parallelFor(static_cast<uint32_t>(instances.size()), job);
+				} else {
+					job(0, static_cast<uint32_t>(instances.size()));
+				}
+			}
+		};
+	}
+}
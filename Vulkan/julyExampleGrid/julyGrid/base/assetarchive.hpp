@@ -0,0 +1,539 @@
+/*
+* Packed asset archive
+*
+* Single file container for the contents of the data folder, with a hashed path index in front of the data
+* Entries are stored raw or LZ4 compressed and start on 4 KB boundaries, so raw entries can be used in place from the mapped archive
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+
+#include "mappedfile.hpp"
+#include "threadpool.hpp"
+
+namespace vks
+{
+	namespace archive
+	{
+		enum Compression { compressionNone = 0, compressionLZ4 = 1 };
+
+		/** @brief Alignment of entry data in the archive, a multiple of the page size so raw entries can be mapped directly */
+		const uint64_t alignment = 4096;
+
+		/** @brief Index entry, the index is sorted by hash */
+		struct Entry
+		{
+			uint64_t hash;
+			// Offset of the stored data from the start of the archive
+			uint64_t offset;
+			uint64_t storedSize;
+			uint64_t size;
+			uint32_t compression;
+			uint32_t pathOffset;
+			uint32_t pathLength;
+			uint32_t reserved;
+		};
+
+		namespace detail
+		{
+			const char magic[4] = { 'V', 'K', 'P', 'K' };
+			const uint32_t version = 1;
+
+			// The entries and the path table follow the header, data starts at the next aligned offset
+			struct Header
+			{
+				char magic[4];
+				uint32_t version;
+				uint32_t entryCount;
+				uint32_t pathTableSize;
+				uint64_t dataOffset;
+				uint64_t dataSize;
+			};
+
+			inline uint64_t align(uint64_t offset)
+			{
+				return (offset + alignment - 1) & ~(alignment - 1);
+			}
+		}
+
+		/** @brief Path as it is stored in the archive: forward slashes, no empty or "." segments and ".." resolved where possible */
+		inline std::string normalizePath(const std::string &path)
+		{
+			std::vector<std::string> segments;
+			size_t start = 0;
+			while (start <= path.size()) {
+				size_t end = path.find_first_of("/\\", start);
+				if (end == std::string::npos) {
+					end = path.size();
+				}
+				const std::string segment = path.substr(start, end - start);
+				if ((segment == "..") && !segments.empty() && (segments.back() != "..")) {
+					segments.pop_back();
+				} else if (!segment.empty() && (segment != ".")) {
+					segments.push_back(segment);
+				}
+				start = end + 1;
+			}
+			std::string normalized = (!path.empty() && ((path[0] == '/') || (path[0] == '\\'))) ? "/" : "";
+			for (size_t i = 0; i < segments.size(); i++) {
+				normalized += (i > 0) ? "/" + segments[i] : segments[i];
+			}
+			return normalized;
+		}
+
+		/** @brief 64 bit FNV-1a hash of a normalized path */
+		inline uint64_t hashPath(const std::string &path)
+		{
+			uint64_t hash = 0xcbf29ce484222325ull;
+			for (const char c : path) {
+				hash ^= static_cast<uint8_t>(c);
+				hash *= 0x100000001b3ull;
+			}
+			return hash;
+		}
+
+		/*
+		* LZ4 block format, the archive stores every compressed entry as a single block
+		* See https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+		*/
+		namespace lz4
+		{
+			/** @brief Upper bound of the compressed size of size bytes */
+			inline size_t getBound(size_t size)
+			{
+				return size + size / 255 + 16;
+			}
+
+			/*
+			* Compress a block with greedy hash matching
+			*
+			* @param src Data to compress
+			* @param size Size of the data in bytes
+			* @param dst Receives the compressed block
+			* @param capacity Size of dst, getBound(size) always suffices
+			*
+			* @return Size of the compressed block, 0 if it doesn't fit into capacity
+			*/
+			inline size_t compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity)
+			{
+				const size_t minMatch = 4;
+				// The last five bytes are always literals and no match may start within the last twelve bytes
+				const size_t lastLiterals = 5;
+				const size_t matchLimit = 12;
+				const size_t maxOffset = 65535;
+				const uint32_t hashBits = 16;
+
+				uint8_t *out = dst;
+				uint8_t *const outEnd = dst + capacity;
+				size_t anchor = 0;
+
+				auto read32 = [src](size_t position) {
+					uint32_t value;
+					memcpy(&value, src + position, sizeof(value));
+					return value;
+				};
+				auto hash = [](uint32_t value) {
+					return (value * 2654435761u) >> (32 - hashBits);
+				};
+				auto writeLength = [&out, outEnd](size_t length) {
+					for (; length >= 255; length -= 255) {
+						if (out >= outEnd) {
+							return false;
+						}
+						*out++ = 255;
+					}
+					if (out >= outEnd) {
+						return false;
+					}
+					*out++ = static_cast<uint8_t>(length);
+					return true;
+				};
+				// Sequence of the literals from anchor to literalEnd followed by a match, the last sequence has no match
+				auto writeSequence = [&](size_t literalEnd, size_t offset, size_t matchLength) {
+					const size_t literalLength = literalEnd - anchor;
+					if (out >= outEnd) {
+						return false;
+					}
+					uint8_t *token = out++;
+					*token = static_cast<uint8_t>(std::min<size_t>(literalLength, 15) << 4);
+					if ((literalLength >= 15) && !writeLength(literalLength - 15)) {
+						return false;
+					}
+					if (static_cast<size_t>(outEnd - out) < literalLength) {
+						return false;
+					}
+					memcpy(out, src + anchor, literalLength);
+					out += literalLength;
+					if (matchLength == 0) {
+						return true;
+					}
+					if (outEnd - out < 2) {
+						return false;
+					}
+					*out++ = static_cast<uint8_t>(offset & 0xFF);
+					*out++ = static_cast<uint8_t>(offset >> 8);
+					const size_t length = matchLength - minMatch;
+					*token |= static_cast<uint8_t>(std::min<size_t>(length, 15));
+					return (length < 15) || writeLength(length - 15);
+				};
+
+				if (size > matchLimit) {
+					std::vector<size_t> table(size_t(1) << hashBits, 0);
+					const size_t limit = size - matchLimit;
+					size_t position = 0;
+					while (position < limit) {
+						const uint32_t value = read32(position);
+						size_t &slot = table[hash(value)];
+						const size_t candidate = slot;
+						slot = position;
+						if ((candidate >= position) || (position - candidate > maxOffset) || (read32(candidate) != value)) {
+							// Step faster through data that doesn't compress
+							position += 1 + ((position - anchor) >> 6);
+							continue;
+						}
+						size_t start = position;
+						size_t reference = candidate;
+						size_t length = minMatch;
+						const size_t matchEnd = size - lastLiterals;
+						while ((start + length < matchEnd) && (src[reference + length] == src[start + length])) {
+							length++;
+						}
+						while ((start > anchor) && (reference > 0) && (src[start - 1] == src[reference - 1])) {
+							start--;
+							reference--;
+							length++;
+						}
+						if (!writeSequence(start, start - reference, length)) {
+							return 0;
+						}
+						position = start + length;
+						anchor = position;
+						if (position - 2 < limit) {
+							table[hash(read32(position - 2))] = position - 2;
+						}
+					}
+				}
+				if (!writeSequence(size, 0, 0)) {
+					return 0;
+				}
+				return static_cast<size_t>(out - dst);
+			}
+
+			/*
+			* Decompress a block, malformed input is rejected instead of read or written out of bounds
+			*
+			* @param src Compressed block
+			* @param size Size of the block in bytes
+			* @param dst Receives the decompressed data
+			* @param dstSize Exact size of the decompressed data
+			*
+			* @return True if the block decompressed to exactly dstSize bytes
+			*/
+			inline bool decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t dstSize)
+			{
+				const uint8_t *in = src;
+				const uint8_t *const inEnd = src + size;
+				uint8_t *out = dst;
+				uint8_t *const outEnd = dst + dstSize;
+
+				auto readLength = [&in, inEnd](size_t &length) {
+					uint8_t value;
+					do {
+						if (in >= inEnd) {
+							return false;
+						}
+						value = *in++;
+						length += value;
+					} while (value == 255);
+					return true;
+				};
+
+				while (in < inEnd) {
+					const uint8_t token = *in++;
+					size_t literalLength = token >> 4;
+					if ((literalLength == 15) && !readLength(literalLength)) {
+						return false;
+					}
+					if ((static_cast<size_t>(inEnd - in) < literalLength) || (static_cast<size_t>(outEnd - out) < literalLength)) {
+						return false;
+					}
+					memcpy(out, in, literalLength);
+					in += literalLength;
+					out += literalLength;
+					if (in == inEnd) {
+						break;
+					}
+					if (inEnd - in < 2) {
+						return false;
+					}
+					const size_t offset = static_cast<size_t>(in[0]) | (static_cast<size_t>(in[1]) << 8);
+					in += 2;
+					if ((offset == 0) || (offset > static_cast<size_t>(out - dst))) {
+						return false;
+					}
+					size_t matchLength = token & 15;
+					if ((matchLength == 15) && !readLength(matchLength)) {
+						return false;
+					}
+					matchLength += 4;
+					if (static_cast<size_t>(outEnd - out) < matchLength) {
+						return false;
+					}
+					const uint8_t *match = out - offset;
+					if (offset >= matchLength) {
+						memcpy(out, match, matchLength);
+					} else {
+						// Overlapping matches repeat the last offset bytes
+						for (size_t i = 0; i < matchLength; i++) {
+							out[i] = match[i];
+						}
+					}
+					out += matchLength;
+				}
+				return out == outEnd;
+			}
+		}
+
+		/** @brief Read only access to an archive, the whole archive is mapped once and the index is kept in memory */
+		class Archive
+		{
+		private:
+			MappedFile file;
+			MappedFile::View view;
+			std::vector<Entry> entries;
+			std::string paths;
+
+		public:
+			/** @brief Open and map an archive, returns false if the file is missing or not a valid archive */
+			bool open(const std::string &filename)
+			{
+				close();
+				if (!file.open(filename)) {
+					return false;
+				}
+				view = file.map();
+				detail::Header header;
+				if (!view.valid() || (view.size() < sizeof(header))) {
+					close();
+					return false;
+				}
+				memcpy(&header, view.data(), sizeof(header));
+				const uint64_t indexSize = sizeof(header) + uint64_t(header.entryCount) * sizeof(Entry) + header.pathTableSize;
+				if ((memcmp(header.magic, detail::magic, sizeof(header.magic)) != 0) || (header.version != detail::version) ||
+					(indexSize > header.dataOffset) || (header.dataOffset + header.dataSize > view.size())) {
+					close();
+					return false;
+				}
+				entries.resize(header.entryCount);
+				if (header.entryCount > 0) {
+					memcpy(entries.data(), view.data() + sizeof(header), entries.size() * sizeof(Entry));
+				}
+				paths.assign(reinterpret_cast<const char*>(view.data()) + sizeof(header) + entries.size() * sizeof(Entry), header.pathTableSize);
+				for (const Entry &entry : entries) {
+					if ((entry.offset < header.dataOffset) || (entry.offset + entry.storedSize > header.dataOffset + header.dataSize) ||
+						(uint64_t(entry.pathOffset) + entry.pathLength > paths.size()) || (entry.compression > compressionLZ4)) {
+						close();
+						return false;
+					}
+				}
+				return true;
+			}
+
+			void close()
+			{
+				view.release();
+				file.close();
+				entries.clear();
+				paths.clear();
+			}
+
+			bool isOpen() const { return view.valid(); }
+
+			/** @brief Read the whole archive ahead, cold start loading then turns into a few large sequential reads */
+			void prefetch() const
+			{
+				view.prefetch();
+			}
+
+			const std::vector<Entry> &getEntries() const { return entries; }
+
+			std::string getPath(const Entry &entry) const
+			{
+				return paths.substr(entry.pathOffset, entry.pathLength);
+			}
+
+			/** @brief Find the entry of a normalized path, nullptr if the archive doesn't contain it */
+			const Entry *find(const std::string &path) const
+			{
+				const uint64_t hash = hashPath(path);
+				auto it = std::lower_bound(entries.begin(), entries.end(), hash, [](const Entry &entry, uint64_t value) { return entry.hash < value; });
+				for (; (it != entries.end()) && (it->hash == hash); ++it) {
+					if ((it->pathLength == path.size()) && (paths.compare(it->pathOffset, it->pathLength, path) == 0)) {
+						return &*it;
+					}
+				}
+				return nullptr;
+			}
+
+			/** @brief Stored bytes of an entry, only usable in place for uncompressed entries */
+			const uint8_t *getData(const Entry &entry) const
+			{
+				return view.data() + entry.offset;
+			}
+
+			/** @brief Decompress an entry into dst, which must hold entry.size bytes */
+			bool extract(const Entry &entry, uint8_t *dst) const
+			{
+				if (entry.compression == compressionNone) {
+					memcpy(dst, getData(entry), static_cast<size_t>(entry.size));
+					return true;
+				}
+				return lz4::decompress(getData(entry), static_cast<size_t>(entry.storedSize), dst, static_cast<size_t>(entry.size));
+			}
+		};
+
+		/** @brief Builds an archive, entries are written in the order they were added so files loaded together can be kept together */
+		class Writer
+		{
+		private:
+			struct Item
+			{
+				std::string path;
+				std::string sourceFile;
+				bool compress;
+				Entry entry;
+				std::vector<uint8_t> stored;
+			};
+			std::vector<Item> items;
+
+		public:
+			/*
+			* Add a file to the archive
+			*
+			* @param path Path of the entry in the archive, normalized before it is stored
+			* @param sourceFile File on disk to read the contents from
+			* @param compress (Optional) Try to compress the entry, it is still stored raw if compression doesn't pay off
+			*
+			* @return False if the archive already contains the path
+			*/
+			bool add(const std::string &path, const std::string &sourceFile, bool compress = true)
+			{
+				const std::string normalized = normalizePath(path);
+				for (const Item &item : items) {
+					if (item.path == normalized) {
+						return false;
+					}
+				}
+				Item item;
+				item.path = normalized;
+				item.sourceFile = sourceFile;
+				item.compress = compress;
+				items.push_back(std::move(item));
+				return true;
+			}
+
+			size_t getEntryCount() const { return items.size(); }
+
+			/*
+			* Read, compress and write all entries
+			*
+			* @param filename Archive to write
+			* @param pool (Optional) Thread pool the entries are compressed on
+			*
+			* @return False if a source file can't be read or the archive can't be written
+			*/
+			bool write(const std::string &filename, ThreadPool *pool = nullptr)
+			{
+				std::vector<uint8_t> failed(items.size(), 0);
+				auto pack = [this, &failed](size_t first, size_t last) {
+					for (size_t i = first; i < last; i++) {
+						Item &item = items[i];
+						MappedFile source;
+						if (!source.open(item.sourceFile)) {
+							failed[i] = 1;
+							continue;
+						}
+						MappedFile::View view = source.map();
+						item.entry = Entry();
+						item.entry.hash = hashPath(item.path);
+						item.entry.size = source.size();
+						item.entry.compression = compressionNone;
+						item.stored.clear();
+						if (item.compress && view.valid()) {
+							item.stored.resize(lz4::getBound(view.size()));
+							const size_t storedSize = lz4::compress(view.data(), view.size(), item.stored.data(), item.stored.size());
+							// Keep entries raw unless compression saves at least an eighth, raw entries are used in place
+							if ((storedSize > 0) && (storedSize <= view.size() - view.size() / 8)) {
+								item.stored.resize(storedSize);
+								item.entry.compression = compressionLZ4;
+							}
+						}
+						if (item.entry.compression == compressionNone) {
+							item.stored.assign(view.data(), view.data() + view.size());
+						}
+						item.entry.storedSize = item.stored.size();
+					}
+				};
+				if (pool) {
+					pool->parallelFor(items.size(), pack);
+				} else {
+					pack(0, items.size());
+				}
+				if (std::find(failed.begin(), failed.end(), 1) != failed.end()) {
+					return false;
+				}
+
+				std::string paths;
+				for (Item &item : items) {
+					item.entry.pathOffset = static_cast<uint32_t>(paths.size());
+					item.entry.pathLength = static_cast<uint32_t>(item.path.size());
+					paths += item.path;
+				}
+				detail::Header header;
+				memcpy(header.magic, detail::magic, sizeof(header.magic));
+				header.version = detail::version;
+				header.entryCount = static_cast<uint32_t>(items.size());
+				header.pathTableSize = static_cast<uint32_t>(paths.size());
+				header.dataOffset = detail::align(sizeof(header) + items.size() * sizeof(Entry) + paths.size());
+				uint64_t offset = header.dataOffset;
+				for (Item &item : items) {
+					item.entry.offset = offset;
+					offset = detail::align(offset + item.entry.storedSize);
+				}
+				header.dataSize = items.empty() ? 0 : (items.back().entry.offset + items.back().entry.storedSize - header.dataOffset);
+
+				std::vector<Entry> index;
+				index.reserve(items.size());
+				for (const Item &item : items) {
+					index.push_back(item.entry);
+				}
+				std::sort(index.begin(), index.end(), [](const Entry &a, const Entry &b) { return a.hash < b.hash; });
+
+				std::ofstream stream(filename, std::ios::binary);
+				if (!stream.is_open()) {
+					return false;
+				}
+				const std::vector<char> padding(static_cast<size_t>(alignment), 0);
+				stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				stream.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(Entry));
+				stream.write(paths.data(), paths.size());
+				uint64_t position = sizeof(header) + index.size() * sizeof(Entry) + paths.size();
+				for (const Item &item : items) {
+					stream.write(padding.data(), static_cast<std::streamsize>(item.entry.offset - position));
+					stream.write(reinterpret_cast<const char*>(item.stored.data()), item.stored.size());
+					position = item.entry.offset + item.entry.storedSize;
+				}
+				return stream.good();
+			}
+		};
+	}
+}
@@ -0,0 +1,489 @@
+/*
+* Block compression
+*
+* CPU encoders for the BC1, BC3, BC4, BC5 and BC7 block compressed formats
+* Used by the offline texture cooker, input is an RGBA8 mip chain laid out as returned by mipgen::getLevels
+* BC7 blocks are always written in mode 6 (one subset, RGBA endpoints with per endpoint p-bits, 4 bit indices)
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <cfloat>
+#include <algorithm>
+
+#include "threadpool.hpp"
+#include "mipgen.hpp"
+
+namespace vks
+{
+	namespace blockcompress
+	{
+		enum Format { formatBC1, formatBC3, formatBC4, formatBC5, formatBC7 };
+
+		/** @brief Size in bytes of one 4x4 block */
+		inline uint32_t getBlockSize(Format format)
+		{
+			return (format == formatBC1 || format == formatBC4) ? 8 : 16;
+		}
+
+		/**
+		* Layout of the block compressed version of a mip chain
+		*
+		* @param format Target format
+		* @param levels Layout of the uncompressed chain, only the level extents are used
+		*/
+		inline std::vector<mipgen::Level> getLevels(Format format, const std::vector<mipgen::Level> &levels)
+		{
+			std::vector<mipgen::Level> blockLevels(levels.size());
+			size_t offset = 0;
+			for (size_t i = 0; i < levels.size(); i++) {
+				blockLevels[i].width = levels[i].width;
+				blockLevels[i].height = levels[i].height;
+				blockLevels[i].offset = offset;
+				blockLevels[i].size = static_cast<size_t>((levels[i].width + 3) / 4) * ((levels[i].height + 3) / 4) * getBlockSize(format);
+				offset += blockLevels[i].size;
+			}
+			return blockLevels;
+		}
+
+		namespace detail
+		{
+			// Texels of one block in row major order, blocks overlapping the level edge repeat the last row and column
+			struct Block {
+				float texels[16][4];
+			};
+
+			inline void loadBlock(const uint8_t *src, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, Block &block)
+			{
+				for (uint32_t y = 0; y < 4; y++) {
+					const uint32_t sy = std::min(blockY * 4 + y, height - 1);
+					for (uint32_t x = 0; x < 4; x++) {
+						const uint32_t sx = std::min(blockX * 4 + x, width - 1);
+						const uint8_t *texel = src + (static_cast<size_t>(sy) * width + sx) * 4;
+						for (uint32_t c = 0; c < 4; c++) {
+							block.texels[y * 4 + x][c] = texel[c];
+						}
+					}
+				}
+			}
+
+			/** @brief Principal axis of the first channelCount channels through power iteration on the covariance matrix */
+			inline void principalAxis(const Block &block, uint32_t channelCount, float mean[4], float axis[4])
+			{
+				float covariance[4][4] = {};
+				float minimum[4], maximum[4];
+				for (uint32_t c = 0; c < 4; c++) {
+					mean[c] = 0.0f;
+					axis[c] = 0.0f;
+					minimum[c] = 255.0f;
+					maximum[c] = 0.0f;
+				}
+				for (uint32_t i = 0; i < 16; i++) {
+					for (uint32_t c = 0; c < channelCount; c++) {
+						mean[c] += block.texels[i][c] / 16.0f;
+						minimum[c] = std::min(minimum[c], block.texels[i][c]);
+						maximum[c] = std::max(maximum[c], block.texels[i][c]);
+					}
+				}
+				for (uint32_t i = 0; i < 16; i++) {
+					for (uint32_t a = 0; a < channelCount; a++) {
+						for (uint32_t b = 0; b < channelCount; b++) {
+							covariance[a][b] += (block.texels[i][a] - mean[a]) * (block.texels[i][b] - mean[b]);
+						}
+					}
+				}
+				// The bounding box diagonal is a good start vector and converges within a few iterations
+				float v[4] = {};
+				for (uint32_t c = 0; c < channelCount; c++) {
+					v[c] = maximum[c] - minimum[c];
+				}
+				for (uint32_t iteration = 0; iteration < 8; iteration++) {
+					float r[4] = {};
+					for (uint32_t a = 0; a < channelCount; a++) {
+						for (uint32_t b = 0; b < channelCount; b++) {
+							r[a] += covariance[a][b] * v[b];
+						}
+					}
+					float length = 0.0f;
+					for (uint32_t c = 0; c < channelCount; c++) {
+						length = std::max(length, fabsf(r[c]));
+					}
+					if (length < 1e-6f) {
+						break;
+					}
+					for (uint32_t c = 0; c < channelCount; c++) {
+						v[c] = r[c] / length;
+					}
+				}
+				float length = 0.0f;
+				for (uint32_t c = 0; c < channelCount; c++) {
+					length += v[c] * v[c];
+				}
+				if (length > 1e-12f) {
+					length = sqrtf(length);
+					for (uint32_t c = 0; c < channelCount; c++) {
+						axis[c] = v[c] / length;
+					}
+				}
+			}
+
+			/** @brief Initial endpoints at the extremes of the block's projection on its principal axis */
+			inline void fitEndpoints(const Block &block, uint32_t channelCount, float endpoint0[4], float endpoint1[4])
+			{
+				float mean[4], axis[4];
+				principalAxis(block, channelCount, mean, axis);
+				float tMin = 0.0f, tMax = 0.0f;
+				for (uint32_t i = 0; i < 16; i++) {
+					float t = 0.0f;
+					for (uint32_t c = 0; c < channelCount; c++) {
+						t += (block.texels[i][c] - mean[c]) * axis[c];
+					}
+					tMin = std::min(tMin, t);
+					tMax = std::max(tMax, t);
+				}
+				for (uint32_t c = 0; c < 4; c++) {
+					endpoint0[c] = std::min(std::max(mean[c] + axis[c] * tMax, 0.0f), 255.0f);
+					endpoint1[c] = std::min(std::max(mean[c] + axis[c] * tMin, 0.0f), 255.0f);
+				}
+			}
+
+			/**
+			* Least squares endpoints for fixed indices
+			*
+			* @param weights Interpolation weight of endpoint1 for each texel
+			* @return False if the system is singular (all texels use the same weight), the endpoints are left untouched then
+			*/
+			inline bool refineEndpoints(const Block &block, uint32_t channelCount, const float weights[16], float endpoint0[4], float endpoint1[4])
+			{
+				float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+				float ax[4] = {}, bx[4] = {};
+				for (uint32_t i = 0; i < 16; i++) {
+					const float b = weights[i];
+					const float a = 1.0f - b;
+					aa += a * a;
+					ab += a * b;
+					bb += b * b;
+					for (uint32_t c = 0; c < channelCount; c++) {
+						ax[c] += a * block.texels[i][c];
+						bx[c] += b * block.texels[i][c];
+					}
+				}
+				const float determinant = aa * bb - ab * ab;
+				if (fabsf(determinant) < 1e-6f) {
+					return false;
+				}
+				for (uint32_t c = 0; c < channelCount; c++) {
+					endpoint0[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+					endpoint1[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+				}
+				return true;
+			}
+
+			inline uint16_t packRGB565(const float color[4])
+			{
+				const uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+				const uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+				const uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+				return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+			}
+
+			inline void unpackRGB565(uint16_t packed, float color[3])
+			{
+				const uint32_t r = (packed >> 11) & 31;
+				const uint32_t g = (packed >> 5) & 63;
+				const uint32_t b = packed & 31;
+				color[0] = static_cast<float>((r << 3) | (r >> 2));
+				color[1] = static_cast<float>((g << 2) | (g >> 4));
+				color[2] = static_cast<float>((b << 3) | (b >> 2));
+			}
+
+			/** @brief Chooses the closest palette entry for every texel and returns the summed squared error */
+			inline float assignIndices(const Block &block, uint32_t channelCount, const float (*palette)[4], uint32_t paletteSize, uint32_t indices[16])
+			{
+				float totalError = 0.0f;
+				for (uint32_t i = 0; i < 16; i++) {
+					float bestError = FLT_MAX;
+					for (uint32_t p = 0; p < paletteSize; p++) {
+						float error = 0.0f;
+						for (uint32_t c = 0; c < channelCount; c++) {
+							const float d = block.texels[i][c] - palette[p][c];
+							error += d * d;
+						}
+						if (error < bestError) {
+							bestError = error;
+							indices[i] = p;
+						}
+					}
+					totalError += bestError;
+				}
+				return totalError;
+			}
+
+			/** @brief Opaque BC1 color block, always uses the four color mode so it can also be used as the color part of BC3 */
+			inline void encodeColorBlock(const Block &block, uint8_t *dst)
+			{
+				// Weight of the second endpoint for palette entries 0..3
+				const float paletteWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+				float endpoint0[4], endpoint1[4];
+				fitEndpoints(block, 3, endpoint0, endpoint1);
+
+				uint16_t color0 = 0, color1 = 0;
+				uint32_t indices[16] = {};
+				float bestError = FLT_MAX;
+				for (uint32_t iteration = 0; iteration < 2; iteration++) {
+					uint16_t c0 = packRGB565(endpoint0);
+					uint16_t c1 = packRGB565(endpoint1);
+					if (c0 < c1) {
+						std::swap(c0, c1);
+						std::swap(endpoint0, endpoint1);
+					}
+					uint32_t candidate[16] = {};
+					float error = 0.0f;
+					if (c0 != c1) {
+						float palette[4][4] = {};
+						unpackRGB565(c0, palette[0]);
+						unpackRGB565(c1, palette[1]);
+						for (uint32_t c = 0; c < 3; c++) {
+							palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+							palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+						}
+						error = assignIndices(block, 3, palette, 4, candidate);
+					} else {
+						// Equal endpoints select the three color mode, index 0 still decodes to color0
+						float palette[1][4] = {};
+						unpackRGB565(c0, palette[0]);
+						error = assignIndices(block, 3, palette, 1, candidate);
+					}
+					if (error < bestError) {
+						bestError = error;
+						color0 = c0;
+						color1 = c1;
+						memcpy(indices, candidate, sizeof(indices));
+					}
+					if (c0 == c1) {
+						break;
+					}
+					float weights[16];
+					for (uint32_t i = 0; i < 16; i++) {
+						weights[i] = paletteWeights[candidate[i]];
+					}
+					if (!refineEndpoints(block, 3, weights, endpoint0, endpoint1)) {
+						break;
+					}
+				}
+
+				uint32_t packedIndices = 0;
+				for (uint32_t i = 0; i < 16; i++) {
+					packedIndices |= indices[i] << (i * 2);
+				}
+				dst[0] = static_cast<uint8_t>(color0 & 0xFF);
+				dst[1] = static_cast<uint8_t>(color0 >> 8);
+				dst[2] = static_cast<uint8_t>(color1 & 0xFF);
+				dst[3] = static_cast<uint8_t>(color1 >> 8);
+				for (uint32_t i = 0; i < 4; i++) {
+					dst[4 + i] = static_cast<uint8_t>((packedIndices >> (i * 8)) & 0xFF);
+				}
+			}
+
+			/** @brief BC4 block of one channel, uses the eight value mode with the extremes of the block as endpoints */
+			inline void encodeChannelBlock(const Block &block, uint32_t channel, uint8_t *dst)
+			{
+				float minimum = 255.0f, maximum = 0.0f;
+				for (uint32_t i = 0; i < 16; i++) {
+					minimum = std::min(minimum, block.texels[i][channel]);
+					maximum = std::max(maximum, block.texels[i][channel]);
+				}
+				const uint8_t value0 = static_cast<uint8_t>(maximum);
+				const uint8_t value1 = static_cast<uint8_t>(minimum);
+				dst[0] = value0;
+				dst[1] = value1;
+				uint64_t packedIndices = 0;
+				if (value0 > value1) {
+					const float scale = 7.0f / (value0 - value1);
+					for (uint32_t i = 0; i < 16; i++) {
+						// Position along the ramp from value0 (0) to value1 (7), stored as 0, 2..7, 1
+						const uint32_t position = static_cast<uint32_t>((value0 - block.texels[i][channel]) * scale + 0.5f);
+						const uint64_t index = (position == 0) ? 0 : (position == 7) ? 1 : position + 1;
+						packedIndices |= index << (i * 3);
+					}
+				}
+				for (uint32_t i = 0; i < 6; i++) {
+					dst[2 + i] = static_cast<uint8_t>((packedIndices >> (i * 8)) & 0xFF);
+				}
+			}
+
+			/** @brief Little endian bit writer for 128 bit blocks */
+			struct BlockWriter {
+				uint64_t bits[2] = { 0, 0 };
+				uint32_t position = 0;
+
+				void write(uint32_t value, uint32_t count)
+				{
+					for (uint32_t i = 0; i < count; i++, position++) {
+						bits[position / 64] |= static_cast<uint64_t>((value >> i) & 1) << (position % 64);
+					}
+				}
+
+				void store(uint8_t *dst) const
+				{
+					for (uint32_t i = 0; i < 16; i++) {
+						dst[i] = static_cast<uint8_t>((bits[i / 8] >> ((i % 8) * 8)) & 0xFF);
+					}
+				}
+			};
+
+			/** @brief Quantizes an endpoint to 7 bits per channel plus the shared p-bit that reconstructs it best */
+			inline void quantizeEndpointBC7(const float endpoint[4], uint32_t quantized[4], uint32_t &pBit)
+			{
+				float bestError = FLT_MAX;
+				for (uint32_t p = 0; p < 2; p++) {
+					uint32_t candidate[4];
+					float error = 0.0f;
+					for (uint32_t c = 0; c < 4; c++) {
+						const float value = std::min(std::max(floorf((endpoint[c] - p) * 0.5f + 0.5f), 0.0f), 127.0f);
+						candidate[c] = static_cast<uint32_t>(value);
+						const float d = static_cast<float>((candidate[c] << 1) | p) - endpoint[c];
+						error += d * d;
+					}
+					if (error < bestError) {
+						bestError = error;
+						memcpy(quantized, candidate, sizeof(candidate));
+						pBit = p;
+					}
+				}
+			}
+
+			inline void encodeBC7Block(const Block &block, uint8_t *dst)
+			{
+				static const uint32_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+				float endpoint0[4], endpoint1[4];
+				fitEndpoints(block, 4, endpoint0, endpoint1);
+
+				uint32_t best0[4] = {}, best1[4] = {}, bestP0 = 0, bestP1 = 0;
+				uint32_t indices[16] = {};
+				float bestError = FLT_MAX;
+				for (uint32_t iteration = 0; iteration < 3; iteration++) {
+					uint32_t q0[4], q1[4], p0 = 0, p1 = 0;
+					quantizeEndpointBC7(endpoint0, q0, p0);
+					quantizeEndpointBC7(endpoint1, q1, p1);
+					float palette[16][4];
+					for (uint32_t p = 0; p < 16; p++) {
+						for (uint32_t c = 0; c < 4; c++) {
+							const uint32_t e0 = (q0[c] << 1) | p0;
+							const uint32_t e1 = (q1[c] << 1) | p1;
+							palette[p][c] = static_cast<float>(((64 - weights[p]) * e0 + weights[p] * e1 + 32) >> 6);
+						}
+					}
+					uint32_t candidate[16];
+					const float error = assignIndices(block, 4, palette, 16, candidate);
+					if (error < bestError) {
+						bestError = error;
+						memcpy(best0, q0, sizeof(q0));
+						memcpy(best1, q1, sizeof(q1));
+						bestP0 = p0;
+						bestP1 = p1;
+						memcpy(indices, candidate, sizeof(indices));
+					}
+					if (error == 0.0f) {
+						break;
+					}
+					float refineWeights[16];
+					for (uint32_t i = 0; i < 16; i++) {
+						refineWeights[i] = weights[candidate[i]] / 64.0f;
+					}
+					if (!refineEndpoints(block, 4, refineWeights, endpoint0, endpoint1)) {
+						break;
+					}
+				}
+
+				// The most significant index bit of the first texel is implied zero, swap the endpoints if it is set
+				if (indices[0] >= 8) {
+					std::swap(best0, best1);
+					std::swap(bestP0, bestP1);
+					for (uint32_t i = 0; i < 16; i++) {
+						indices[i] = 15 - indices[i];
+					}
+				}
+
+				BlockWriter writer;
+				writer.write(1 << 6, 7);
+				for (uint32_t c = 0; c < 4; c++) {
+					writer.write(best0[c], 7);
+					writer.write(best1[c], 7);
+				}
+				writer.write(bestP0, 1);
+				writer.write(bestP1, 1);
+				writer.write(indices[0], 3);
+				for (uint32_t i = 1; i < 16; i++) {
+					writer.write(indices[i], 4);
+				}
+				assert(writer.position == 128);
+				writer.store(dst);
+			}
+		}
+
+		/** @brief Encode one 4x4 block of RGBA8 texels, BC4 and BC5 read the red (and green) channel */
+		inline void encodeBlock(Format format, const detail::Block &block, uint8_t *dst)
+		{
+			switch (format) {
+			case formatBC1:
+				detail::encodeColorBlock(block, dst);
+				break;
+			case formatBC3:
+				detail::encodeChannelBlock(block, 3, dst);
+				detail::encodeColorBlock(block, dst + 8);
+				break;
+			case formatBC4:
+				detail::encodeChannelBlock(block, 0, dst);
+				break;
+			case formatBC5:
+				detail::encodeChannelBlock(block, 0, dst);
+				detail::encodeChannelBlock(block, 1, dst + 8);
+				break;
+			case formatBC7:
+				detail::encodeBC7Block(block, dst);
+				break;
+			}
+		}
+
+		/**
+		* Compress an RGBA8 mip chain
+		*
+		* @param format Target format
+		* @param src Uncompressed chain
+		* @param levels Layout of the uncompressed chain as returned by mipgen::getLevels
+		* @param dst Destination of the compressed chain laid out as returned by getLevels(format, levels)
+		* @param pool (Optional) Block rows of each level are distributed over the pool's threads, must be null when called from one of its jobs
+		*/
+		inline void compress(Format format, const uint8_t *src, const std::vector<mipgen::Level> &levels, uint8_t *dst, vks::ThreadPool *pool = nullptr)
+		{
+			const std::vector<mipgen::Level> blockLevels = getLevels(format, levels);
+			const uint32_t blockSize = getBlockSize(format);
+			for (size_t l = 0; l < levels.size(); l++) {
+				const mipgen::Level &level = levels[l];
+				const uint32_t blocksX = (level.width + 3) / 4;
+				const uint32_t blocksY = (level.height + 3) / 4;
+				const uint8_t *levelSrc = src + level.offset;
+				uint8_t *levelDst = dst + blockLevels[l].offset;
+				mipgen::detail::parallelRows(pool, blocksY, [&](uint32_t first, uint32_t last) {
+					detail::Block block;
+					for (uint32_t by = first; by < last; by++) {
+						for (uint32_t bx = 0; bx < blocksX; bx++) {
+							detail::loadBlock(levelSrc, level.width, level.height, bx, by, block);
+							encodeBlock(format, block, levelDst + (static_cast<size_t>(by) * blocksX + bx) * blockSize);
+						}
+					}
+				});
+			}
+		}
+	}
+}
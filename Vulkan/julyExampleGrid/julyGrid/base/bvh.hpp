@@ -0,0 +1,533 @@
+/*
+* Dynamic bounding volume hierarchy for scene level spatial queries
+*
+* Built with a binned surface area heuristic (SAH) and refitted incrementally
+* when primitive bounds change (e.g. by animated nodes)
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <float.h>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+
+namespace vks
+{
+	/** @brief Axis aligned bounding box */
+	struct AABB
+	{
+		glm::vec3 min = glm::vec3(FLT_MAX);
+		glm::vec3 max = glm::vec3(-FLT_MAX);
+
+		AABB() {};
+		AABB(glm::vec3 min, glm::vec3 max) : min(min), max(max) {};
+
+		bool valid() const
+		{
+			return (min.x <= max.x) && (min.y <= max.y) && (min.z <= max.z);
+		}
+
+		void grow(const glm::vec3 &p)
+		{
+			min = glm::min(min, p);
+			max = glm::max(max, p);
+		}
+
+		void grow(const AABB &other)
+		{
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+
+		glm::vec3 center() const
+		{
+			return (min + max) * 0.5f;
+		}
+
+		glm::vec3 extent() const
+		{
+			return max - min;
+		}
+
+		float surfaceArea() const
+		{
+			if (!valid()) {
+				return 0.0f;
+			}
+			glm::vec3 e = max - min;
+			return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+		}
+
+		bool overlaps(const AABB &other) const
+		{
+			return (min.x <= other.max.x) && (max.x >= other.min.x) &&
+				(min.y <= other.max.y) && (max.y >= other.min.y) &&
+				(min.z <= other.max.z) && (max.z >= other.min.z);
+		}
+
+		bool operator==(const AABB &other) const
+		{
+			return (min == other.min) && (max == other.max);
+		}
+
+		bool operator!=(const AABB &other) const
+		{
+			return !(*this == other);
+		}
+
+		/** @brief Returns the bounding box of this box transformed by the given matrix (Arvo's method) */
+		AABB transform(const glm::mat4 &m) const
+		{
+			AABB res;
+			res.min = res.max = glm::vec3(m[3]);
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 3; j++) {
+					float a = m[j][i] * min[j];
+					float b = m[j][i] * max[j];
+					res.min[i] += std::min(a, b);
+					res.max[i] += std::max(a, b);
+				}
+			}
+			return res;
+		}
+
+		/**
+		* Intersect a ray with this box (slab test)
+		*
+		* @param origin Ray origin
+		* @param invDir Reciprocal of the ray direction
+		* @param tMax Maximum distance along the ray to accept hits for
+		* @param tHit Distance to the entry point (set if intersecting)
+		*
+		* @return True if the ray hits the box within [0, tMax]
+		*/
+		bool intersectRay(const glm::vec3 &origin, const glm::vec3 &invDir, float tMax, float &tHit) const
+		{
+			glm::vec3 t0 = (min - origin) * invDir;
+			glm::vec3 t1 = (max - origin) * invDir;
+			glm::vec3 tNear = glm::min(t0, t1);
+			glm::vec3 tFar = glm::max(t0, t1);
+			float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+			float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+			if (tEnter > tExit) {
+				return false;
+			}
+			tHit = tEnter;
+			return true;
+		}
+	};
+
+	/** @brief Bounding volume hierarchy over a set of primitive bounding boxes */
+	class BVH
+	{
+	public:
+		/** @brief Maximum number of primitives stored in a leaf node */
+		uint32_t maxLeafSize = 4;
+		/** @brief Number of bins used to evaluate the surface area heuristic per axis */
+		static const uint32_t binCount = 16;
+
+		/** @brief Flattened tree node, children of inner nodes are stored next to each other */
+		struct Node {
+			AABB bounds;
+			// Index of the left child for inner nodes, first entry in primitiveIndices for leaves
+			uint32_t leftFirst = 0;
+			// Number of primitives for leaves, 0 for inner nodes
+			uint32_t count = 0;
+			bool isLeaf() const { return count > 0; }
+		};
+
+		std::vector<Node> nodes;
+		/** @brief Primitive indices referenced by the leaf nodes */
+		std::vector<uint32_t> primitiveIndices;
+		/** @brief Current bounds of all primitives */
+		std::vector<AABB> primitiveBounds;
+
+		bool empty() const
+		{
+			return nodes.empty();
+		}
+
+		/** @brief Returns the bounds of the whole hierarchy */
+		AABB bounds() const
+		{
+			return nodes.empty() ? AABB() : nodes[0].bounds;
+		}
+
+		/**
+		* Build the hierarchy from scratch
+		*
+		* @param bounds Bounding boxes of the primitives to insert, the index into this list identifies the primitive in all queries
+		*/
+		void build(const std::vector<AABB> &bounds)
+		{
+			primitiveBounds = bounds;
+			const uint32_t primitiveCount = static_cast<uint32_t>(bounds.size());
+
+			nodes.clear();
+			parents.clear();
+			dirty.clear();
+			primitiveIndices.resize(primitiveCount);
+			primitiveLeaf.resize(primitiveCount);
+			centroids.resize(primitiveCount);
+			for (uint32_t i = 0; i < primitiveCount; i++) {
+				primitiveIndices[i] = i;
+				centroids[i] = bounds[i].center();
+			}
+
+			if (primitiveCount == 0) {
+				return;
+			}
+
+			// A binary tree with n leaves has at most 2n - 1 nodes
+			nodes.reserve(primitiveCount * 2);
+			parents.reserve(primitiveCount * 2);
+			nodes.push_back(Node());
+			parents.push_back(UINT32_MAX);
+			nodes[0].leftFirst = 0;
+			nodes[0].count = primitiveCount;
+			updateNodeBounds(0);
+			subdivide(0);
+
+			dirty.assign(nodes.size(), 0);
+			for (uint32_t i = 0; i < static_cast<uint32_t>(nodes.size()); i++) {
+				const Node &node = nodes[i];
+				for (uint32_t j = 0; j < node.count; j++) {
+					primitiveLeaf[primitiveIndices[node.leftFirst + j]] = i;
+				}
+			}
+		}
+
+		/**
+		* Update the bounds of a single primitive
+		*
+		* @note Changes are applied to the tree with the next call to refit()
+		*/
+		void update(uint32_t primitive, const AABB &bounds)
+		{
+			assert(primitive < primitiveBounds.size());
+			if (primitiveBounds[primitive] == bounds) {
+				return;
+			}
+			primitiveBounds[primitive] = bounds;
+			// Mark the leaf and all of its ancestors, stop at the first one that is already marked
+			uint32_t node = primitiveLeaf[primitive];
+			while ((node != UINT32_MAX) && !dirty[node]) {
+				dirty[node] = 1;
+				node = parents[node];
+			}
+			refitPending = true;
+		}
+
+		/** @brief Recompute the bounds of all nodes touched by update() since the last refit */
+		void refit()
+		{
+			if (!refitPending) {
+				return;
+			}
+			// Children are always stored after their parents, so a reverse pass visits them first
+			for (size_t i = nodes.size(); i-- > 0;) {
+				if (!dirty[i]) {
+					continue;
+				}
+				Node &node = nodes[i];
+				if (node.isLeaf()) {
+					updateNodeBounds(static_cast<uint32_t>(i));
+				} else {
+					node.bounds = nodes[node.leftFirst].bounds;
+					node.bounds.grow(nodes[node.leftFirst + 1].bounds);
+				}
+				dirty[i] = 0;
+			}
+			refitPending = false;
+		}
+
+		/**
+		* Collect all primitives whose bounds are (partially) inside the frustum
+		*
+		* @param frustum View frustum to test against
+		* @param result List the visible primitive indices are appended to
+		*/
+		void queryFrustum(const vks::Frustum &frustum, std::vector<uint32_t> &result) const
+		{
+			if (nodes.empty()) {
+				return;
+			}
+			std::vector<uint32_t> stack;
+			stack.reserve(64);
+			stack.push_back(0);
+			while (!stack.empty()) {
+				const Node &node = nodes[stack.back()];
+				stack.pop_back();
+				vks::Frustum::Intersection res = frustum.classifyBox(node.bounds.min, node.bounds.max);
+				if (res == vks::Frustum::OUTSIDE) {
+					continue;
+				}
+				if (res == vks::Frustum::INSIDE) {
+					// Node fully inside, no need to test the subtree any further
+					collect(node, result);
+					continue;
+				}
+				if (node.isLeaf()) {
+					for (uint32_t i = 0; i < node.count; i++) {
+						uint32_t primitive = primitiveIndices[node.leftFirst + i];
+						if (frustum.checkBox(primitiveBounds[primitive].min, primitiveBounds[primitive].max)) {
+							result.push_back(primitive);
+						}
+					}
+					continue;
+				}
+				stack.push_back(node.leftFirst);
+				stack.push_back(node.leftFirst + 1);
+			}
+		}
+
+		/**
+		* Collect all primitives whose bounds overlap the given box
+		*
+		* @param box Axis aligned box to test against
+		* @param result List the overlapping primitive indices are appended to
+		*/
+		void queryAABB(const AABB &box, std::vector<uint32_t> &result) const
+		{
+			if (nodes.empty()) {
+				return;
+			}
+			std::vector<uint32_t> stack;
+			stack.reserve(64);
+			stack.push_back(0);
+			while (!stack.empty()) {
+				const Node &node = nodes[stack.back()];
+				stack.pop_back();
+				if (!node.bounds.overlaps(box)) {
+					continue;
+				}
+				if (node.isLeaf()) {
+					for (uint32_t i = 0; i < node.count; i++) {
+						uint32_t primitive = primitiveIndices[node.leftFirst + i];
+						if (primitiveBounds[primitive].overlaps(box)) {
+							result.push_back(primitive);
+						}
+					}
+					continue;
+				}
+				stack.push_back(node.leftFirst);
+				stack.push_back(node.leftFirst + 1);
+			}
+		}
+
+		/**
+		* Find the closest primitive bounding box hit by a ray (e.g. for picking)
+		*
+		* @param origin Ray origin
+		* @param direction Ray direction (does not need to be normalized, distances are in multiples of it)
+		* @param primitive Index of the closest primitive hit (set if a hit was found)
+		* @param distance Distance along the ray to the hit (set if a hit was found)
+		* @param (Optional) tMax Maximum distance along the ray
+		*
+		* @return True if any primitive was hit
+		*/
+		bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, uint32_t &primitive, float &distance, float tMax = FLT_MAX) const
+		{
+			if (nodes.empty()) {
+				return false;
+			}
+			const glm::vec3 invDir = 1.0f / direction;
+			bool hit = false;
+			float tNode;
+			if (!nodes[0].bounds.intersectRay(origin, invDir, tMax, tNode)) {
+				return false;
+			}
+			std::vector<uint32_t> stack;
+			stack.reserve(64);
+			stack.push_back(0);
+			while (!stack.empty()) {
+				const Node &node = nodes[stack.back()];
+				stack.pop_back();
+				if (node.isLeaf()) {
+					for (uint32_t i = 0; i < node.count; i++) {
+						uint32_t index = primitiveIndices[node.leftFirst + i];
+						float t;
+						if (primitiveBounds[index].intersectRay(origin, invDir, tMax, t)) {
+							tMax = t;
+							primitive = index;
+							hit = true;
+						}
+					}
+					continue;
+				}
+				// Visit the closer child first so that tMax shrinks as early as possible
+				uint32_t first = node.leftFirst;
+				uint32_t second = node.leftFirst + 1;
+				float tFirst, tSecond;
+				bool hitFirst = nodes[first].bounds.intersectRay(origin, invDir, tMax, tFirst);
+				bool hitSecond = nodes[second].bounds.intersectRay(origin, invDir, tMax, tSecond);
+				if (hitFirst && hitSecond) {
+					if (tSecond < tFirst) {
+						std::swap(first, second);
+					}
+					stack.push_back(second);
+					stack.push_back(first);
+				} else if (hitFirst) {
+					stack.push_back(first);
+				} else if (hitSecond) {
+					stack.push_back(second);
+				}
+			}
+			if (hit) {
+				distance = tMax;
+			}
+			return hit;
+		}
+
+	private:
+		std::vector<uint32_t> parents;
+		std::vector<uint32_t> primitiveLeaf;
+		std::vector<uint8_t> dirty;
+		std::vector<glm::vec3> centroids;
+		bool refitPending = false;
+
+		struct Bin {
+			AABB bounds;
+			uint32_t count = 0;
+		};
+
+		void collect(const Node &node, std::vector<uint32_t> &result) const
+		{
+			if (node.isLeaf()) {
+				result.insert(result.end(), primitiveIndices.begin() + node.leftFirst, primitiveIndices.begin() + node.leftFirst + node.count);
+				return;
+			}
+			collect(nodes[node.leftFirst], result);
+			collect(nodes[node.leftFirst + 1], result);
+		}
+
+		void updateNodeBounds(uint32_t nodeIndex)
+		{
+			Node &node = nodes[nodeIndex];
+			node.bounds = AABB();
+			for (uint32_t i = 0; i < node.count; i++) {
+				node.bounds.grow(primitiveBounds[primitiveIndices[node.leftFirst + i]]);
+			}
+		}
+
+		// Find the best split plane using binned SAH, returns the cost of that split
+		float findBestSplit(const Node &node, int &bestAxis, float &bestPos) const
+		{
+			float bestCost = FLT_MAX;
+			for (int axis = 0; axis < 3; axis++) {
+				float boundsMin = FLT_MAX, boundsMax = -FLT_MAX;
+				for (uint32_t i = 0; i < node.count; i++) {
+					const glm::vec3 &c = centroids[primitiveIndices[node.leftFirst + i]];
+					boundsMin = std::min(boundsMin, c[axis]);
+					boundsMax = std::max(boundsMax, c[axis]);
+				}
+				if (boundsMin == boundsMax) {
+					continue;
+				}
+
+				Bin bins[binCount];
+				const float scale = binCount / (boundsMax - boundsMin);
+				for (uint32_t i = 0; i < node.count; i++) {
+					uint32_t primitive = primitiveIndices[node.leftFirst + i];
+					uint32_t binIndex = std::min(binCount - 1, static_cast<uint32_t>((centroids[primitive][axis] - boundsMin) * scale));
+					bins[binIndex].count++;
+					bins[binIndex].bounds.grow(primitiveBounds[primitive]);
+				}
+
+				// Sweep from both sides to get the area and count left and right of each of the binCount - 1 planes
+				float leftArea[binCount - 1], rightArea[binCount - 1];
+				uint32_t leftCount[binCount - 1], rightCount[binCount - 1];
+				AABB leftBox, rightBox;
+				uint32_t leftSum = 0, rightSum = 0;
+				for (uint32_t i = 0; i < binCount - 1; i++) {
+					leftSum += bins[i].count;
+					leftCount[i] = leftSum;
+					leftBox.grow(bins[i].bounds);
+					leftArea[i] = leftBox.surfaceArea();
+					rightSum += bins[binCount - 1 - i].count;
+					rightCount[binCount - 2 - i] = rightSum;
+					rightBox.grow(bins[binCount - 1 - i].bounds);
+					rightArea[binCount - 2 - i] = rightBox.surfaceArea();
+				}
+
+				const float binWidth = (boundsMax - boundsMin) / binCount;
+				for (uint32_t i = 0; i < binCount - 1; i++) {
+					float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+					if ((leftCount[i] > 0) && (rightCount[i] > 0) && (cost < bestCost)) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestPos = boundsMin + binWidth * (i + 1);
+					}
+				}
+			}
+			return bestCost;
+		}
+
+		void subdivide(uint32_t nodeIndex)
+		{
+			if (nodes[nodeIndex].count <= maxLeafSize) {
+				return;
+			}
+
+			int axis = -1;
+			float splitPos = 0.0f;
+			float splitCost = findBestSplit(nodes[nodeIndex], axis, splitPos);
+			float leafCost = nodes[nodeIndex].count * nodes[nodeIndex].bounds.surfaceArea();
+
+			uint32_t first = nodes[nodeIndex].leftFirst;
+			uint32_t count = nodes[nodeIndex].count;
+			uint32_t leftCount = 0;
+
+			if ((axis >= 0) && (splitCost < leafCost)) {
+				// Partition primitives in place
+				uint32_t i = first;
+				uint32_t j = first + count - 1;
+				while (i <= j) {
+					if (centroids[primitiveIndices[i]][axis] < splitPos) {
+						i++;
+					} else {
+						std::swap(primitiveIndices[i], primitiveIndices[j]);
+						if (j == 0) {
+							break;
+						}
+						j--;
+					}
+				}
+				leftCount = i - first;
+			}
+
+			if ((leftCount == 0) || (leftCount == count)) {
+				// Either splitting is not worth it, or all centroids coincide
+				if (count <= maxLeafSize * 4) {
+					return;
+				}
+				// Fall back to a median split so that leaves stay bounded in size
+				leftCount = count / 2;
+			}
+
+			uint32_t leftIndex = static_cast<uint32_t>(nodes.size());
+			nodes.push_back(Node());
+			nodes.push_back(Node());
+			parents.push_back(nodeIndex);
+			parents.push_back(nodeIndex);
+
+			nodes[leftIndex].leftFirst = first;
+			nodes[leftIndex].count = leftCount;
+			nodes[leftIndex + 1].leftFirst = first + leftCount;
+			nodes[leftIndex + 1].count = count - leftCount;
+			nodes[nodeIndex].leftFirst = leftIndex;
+			nodes[nodeIndex].count = 0;
+
+			updateNodeBounds(leftIndex);
+			updateNodeBounds(leftIndex + 1);
+			subdivide(leftIndex);
+			subdivide(leftIndex + 1);
+		}
+	};
+}
@@ -6,6 +6,8 @@
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
+#pragma once
+
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
@@ -71,6 +73,10 @@ public:
 		return keys.left || keys.right || keys.up || keys.down;
 	}
 
+	float getFov() {
+		return fov;
+	}
+
 	float getNearClip() { 
 		return znear;
 	}
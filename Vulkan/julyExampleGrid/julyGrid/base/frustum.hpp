@@ -6,6 +6,8 @@
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
+#pragma once
+
 #include <array>
 #include <math.h>
 #include <glm/glm.hpp>
@@ -16,6 +18,7 @@ namespace vks
 	{
 	public:
 		enum side { LEFT = 0, RIGHT = 1, TOP = 2, BOTTOM = 3, BACK = 4, FRONT = 5 };
+		enum Intersection { OUTSIDE = 0, INTERSECT = 1, INSIDE = 2 };
 		std::array<glm::vec4, 6> planes;
 
 		void update(glm::mat4 matrix)
@@ -57,7 +60,7 @@ namespace vks
 			}
 		}
 		
-		bool checkSphere(glm::vec3 pos, float radius)
+		bool checkSphere(glm::vec3 pos, float radius) const
 		{
 			for (auto i = 0; i < planes.size(); i++)
 			{
@@ -68,5 +71,30 @@ namespace vks
 			}
 			return true;
 		}
+
+		bool checkBox(glm::vec3 min, glm::vec3 max) const
+		{
+			return classifyBox(min, max) != OUTSIDE;
+		}
+
+		// Classify an axis aligned box against all planes, uses the box's positive and negative vertex per plane
+		Intersection classifyBox(const glm::vec3 &min, const glm::vec3 &max) const
+		{
+			Intersection res = INSIDE;
+			for (size_t i = 0; i < planes.size(); i++)
+			{
+				glm::vec3 positive((planes[i].x >= 0.0f) ? max.x : min.x, (planes[i].y >= 0.0f) ? max.y : min.y, (planes[i].z >= 0.0f) ? max.z : min.z);
+				if ((planes[i].x * positive.x) + (planes[i].y * positive.y) + (planes[i].z * positive.z) + planes[i].w < 0.0f)
+				{
+					return OUTSIDE;
+				}
+				glm::vec3 negative((planes[i].x >= 0.0f) ? min.x : max.x, (planes[i].y >= 0.0f) ? min.y : max.y, (planes[i].z >= 0.0f) ? min.z : max.z);
+				if ((planes[i].x * negative.x) + (planes[i].y * negative.y) + (planes[i].z * negative.z) + planes[i].w < 0.0f)
+				{
+					res = INTERSECT;
+				}
+			}
+			return res;
+		}
 	};
 }
@@ -0,0 +1,358 @@
+/*
+* KTX container
+*
+* Minimal reader and writer for KTX 1.1 files holding a single 2D image with its mip chain
+* Written by the texture cooker and read without gli by code that uploads the levels itself,
+* also picks the cooked variant of a source image that the device can sample
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+
+#include "vulkan/vulkan.h"
+
+#include "mipgen.hpp"
+#include "blockcompress.hpp"
+#include "vfs.hpp"
+
+namespace vks
+{
+	namespace ktx
+	{
+		// OpenGL format enums used in the KTX header, without the GL_ prefix so they can't clash with GL headers
+		enum : uint32_t {
+			RGBA8 = 0x8058,
+			SRGB8_ALPHA8 = 0x8C43,
+			COMPRESSED_RGB_S3TC_DXT1 = 0x83F0,
+			COMPRESSED_RGBA_S3TC_DXT1 = 0x83F1,
+			COMPRESSED_RGBA_S3TC_DXT5 = 0x83F3,
+			COMPRESSED_SRGB_S3TC_DXT1 = 0x8C4C,
+			COMPRESSED_SRGB_ALPHA_S3TC_DXT1 = 0x8C4D,
+			COMPRESSED_SRGB_ALPHA_S3TC_DXT5 = 0x8C4F,
+			COMPRESSED_RED_RGTC1 = 0x8DBB,
+			COMPRESSED_RG_RGTC2 = 0x8DBD,
+			COMPRESSED_RGBA_BPTC_UNORM = 0x8E8C,
+			COMPRESSED_SRGB_ALPHA_BPTC_UNORM = 0x8E8D,
+			COMPRESSED_RG11_EAC = 0x9272,
+			COMPRESSED_RGB8_ETC2 = 0x9274,
+			COMPRESSED_SRGB8_ETC2 = 0x9275,
+			COMPRESSED_RGBA8_ETC2_EAC = 0x9278,
+			COMPRESSED_SRGB8_ALPHA8_ETC2_EAC = 0x9279,
+			COMPRESSED_RGBA_ASTC_4x4 = 0x93B0,
+			COMPRESSED_RGBA_ASTC_8x8 = 0x93B7,
+			COMPRESSED_SRGB8_ALPHA8_ASTC_4x4 = 0x93D0,
+			COMPRESSED_SRGB8_ALPHA8_ASTC_8x8 = 0x93D7,
+			RED = 0x1903,
+			RGB = 0x1907,
+			RGBA = 0x1908,
+			RG = 0x8227,
+			UNSIGNED_BYTE = 0x1401,
+		};
+
+		/** @brief 2D image with all levels in one tightly packed buffer */
+		struct Image {
+			uint32_t glInternalFormat = 0;
+			VkFormat format = VK_FORMAT_UNDEFINED;
+			uint32_t width = 0;
+			uint32_t height = 0;
+			std::vector<mipgen::Level> levels;
+			std::vector<uint8_t> data;
+		};
+
+		/** @brief Variants written by the cooker, in the order they are preferred at runtime */
+		inline const std::vector<std::string> &getVariantSuffixes()
+		{
+			static const std::vector<std::string> suffixes = { ".astc.ktx", ".etc2.ktx", ".bc7.ktx", ".bc5.ktx", ".bc3.ktx", ".bc1.ktx", ".bc4.ktx" };
+			return suffixes;
+		}
+
+		inline const char *getVariantName(blockcompress::Format format)
+		{
+			switch (format) {
+			case blockcompress::formatBC1: return "bc1";
+			case blockcompress::formatBC3: return "bc3";
+			case blockcompress::formatBC4: return "bc4";
+			case blockcompress::formatBC5: return "bc5";
+			case blockcompress::formatBC7: return "bc7";
+			}
+			return "";
+		}
+
+		inline uint32_t getGlInternalFormat(blockcompress::Format format, bool srgb)
+		{
+			switch (format) {
+			case blockcompress::formatBC1: return srgb ? COMPRESSED_SRGB_S3TC_DXT1 : COMPRESSED_RGB_S3TC_DXT1;
+			case blockcompress::formatBC3: return srgb ? COMPRESSED_SRGB_ALPHA_S3TC_DXT5 : COMPRESSED_RGBA_S3TC_DXT5;
+			case blockcompress::formatBC4: return COMPRESSED_RED_RGTC1;
+			case blockcompress::formatBC5: return COMPRESSED_RG_RGTC2;
+			case blockcompress::formatBC7: return srgb ? COMPRESSED_SRGB_ALPHA_BPTC_UNORM : COMPRESSED_RGBA_BPTC_UNORM;
+			}
+			return 0;
+		}
+
+		inline uint32_t getGlBaseInternalFormat(uint32_t glInternalFormat)
+		{
+			switch (glInternalFormat) {
+			case COMPRESSED_RGB_S3TC_DXT1:
+			case COMPRESSED_SRGB_S3TC_DXT1:
+			case COMPRESSED_RGB8_ETC2:
+			case COMPRESSED_SRGB8_ETC2:
+				return RGB;
+			case COMPRESSED_RED_RGTC1:
+				return RED;
+			case COMPRESSED_RG_RGTC2:
+			case COMPRESSED_RG11_EAC:
+				return RG;
+			default:
+				return RGBA;
+			}
+		}
+
+		/** @brief Vulkan format of a KTX internal format, VK_FORMAT_UNDEFINED if it isn't supported by this loader */
+		inline VkFormat getVkFormat(uint32_t glInternalFormat)
+		{
+			switch (glInternalFormat) {
+			case RGBA8: return VK_FORMAT_R8G8B8A8_UNORM;
+			case SRGB8_ALPHA8: return VK_FORMAT_R8G8B8A8_SRGB;
+			case COMPRESSED_RGB_S3TC_DXT1: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+			case COMPRESSED_RGBA_S3TC_DXT1: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+			case COMPRESSED_SRGB_S3TC_DXT1: return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+			case COMPRESSED_SRGB_ALPHA_S3TC_DXT1: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+			case COMPRESSED_RGBA_S3TC_DXT5: return VK_FORMAT_BC3_UNORM_BLOCK;
+			case COMPRESSED_SRGB_ALPHA_S3TC_DXT5: return VK_FORMAT_BC3_SRGB_BLOCK;
+			case COMPRESSED_RED_RGTC1: return VK_FORMAT_BC4_UNORM_BLOCK;
+			case COMPRESSED_RG_RGTC2: return VK_FORMAT_BC5_UNORM_BLOCK;
+			case COMPRESSED_RGBA_BPTC_UNORM: return VK_FORMAT_BC7_UNORM_BLOCK;
+			case COMPRESSED_SRGB_ALPHA_BPTC_UNORM: return VK_FORMAT_BC7_SRGB_BLOCK;
+			case COMPRESSED_RG11_EAC: return VK_FORMAT_EAC_R11G11_UNORM_BLOCK;
+			case COMPRESSED_RGB8_ETC2: return VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK;
+			case COMPRESSED_SRGB8_ETC2: return VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK;
+			case COMPRESSED_RGBA8_ETC2_EAC: return VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK;
+			case COMPRESSED_SRGB8_ALPHA8_ETC2_EAC: return VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK;
+			case COMPRESSED_RGBA_ASTC_4x4: return VK_FORMAT_ASTC_4x4_UNORM_BLOCK;
+			case COMPRESSED_SRGB8_ALPHA8_ASTC_4x4: return VK_FORMAT_ASTC_4x4_SRGB_BLOCK;
+			case COMPRESSED_RGBA_ASTC_8x8: return VK_FORMAT_ASTC_8x8_UNORM_BLOCK;
+			case COMPRESSED_SRGB8_ALPHA8_ASTC_8x8: return VK_FORMAT_ASTC_8x8_SRGB_BLOCK;
+			default: return VK_FORMAT_UNDEFINED;
+			}
+		}
+
+		namespace detail
+		{
+			static const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+			struct Header {
+				uint8_t identifier[12];
+				uint32_t endianness;
+				uint32_t glType;
+				uint32_t glTypeSize;
+				uint32_t glFormat;
+				uint32_t glInternalFormat;
+				uint32_t glBaseInternalFormat;
+				uint32_t pixelWidth;
+				uint32_t pixelHeight;
+				uint32_t pixelDepth;
+				uint32_t numberOfArrayElements;
+				uint32_t numberOfFaces;
+				uint32_t numberOfMipmapLevels;
+				uint32_t bytesOfKeyValueData;
+			};
+			static_assert(sizeof(Header) == 64, "KTX header must be 64 bytes");
+
+			inline size_t align4(size_t value)
+			{
+				return (value + 3) & ~static_cast<size_t>(3);
+			}
+		}
+
+		/**
+		* Write a 2D image and its mip chain to a KTX file
+		*
+		* @param filename Destination file
+		* @param glInternalFormat Format of the level data, either RGBA8/SRGB8_ALPHA8 or a compressed format
+		* @param levels Location of each level inside data
+		* @param data Level data
+		*
+		* @return False if the file could not be written
+		*/
+		inline bool write(const std::string &filename, uint32_t glInternalFormat, const std::vector<mipgen::Level> &levels, const uint8_t *data)
+		{
+			assert(!levels.empty());
+			const bool uncompressed = (glInternalFormat == RGBA8) || (glInternalFormat == SRGB8_ALPHA8);
+
+			detail::Header header = {};
+			memcpy(header.identifier, detail::identifier, sizeof(detail::identifier));
+			header.endianness = 0x04030201;
+			header.glType = uncompressed ? static_cast<uint32_t>(UNSIGNED_BYTE) : 0;
+			header.glTypeSize = 1;
+			header.glFormat = uncompressed ? static_cast<uint32_t>(RGBA) : 0;
+			header.glInternalFormat = glInternalFormat;
+			header.glBaseInternalFormat = getGlBaseInternalFormat(glInternalFormat);
+			header.pixelWidth = levels[0].width;
+			header.pixelHeight = levels[0].height;
+			header.numberOfFaces = 1;
+			header.numberOfMipmapLevels = static_cast<uint32_t>(levels.size());
+
+			std::ofstream file(filename, std::ios::binary);
+			if (!file.is_open()) {
+				return false;
+			}
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			const uint8_t padding[4] = {};
+			for (const mipgen::Level &level : levels) {
+				const uint32_t imageSize = static_cast<uint32_t>(level.size);
+				file.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
+				file.write(reinterpret_cast<const char*>(data + level.offset), level.size);
+				file.write(reinterpret_cast<const char*>(padding), detail::align4(level.size) - level.size);
+			}
+			return file.good();
+		}
+
+		/**
+		* Parse the header and level table of a 2D KTX image without copying any level data
+		*
+		* @param data Contents of the file
+		* @param size Size of the file in bytes
+		* @param image Receives the format and extents, level offsets point into data and image.data is left empty
+		*
+		* @return False if the data isn't a little endian 2D KTX image in a format known to getVkFormat
+		*/
+		inline bool parse(const uint8_t *data, size_t size, Image &image)
+		{
+			detail::Header header;
+			if (size < sizeof(header)) {
+				return false;
+			}
+			memcpy(&header, data, sizeof(header));
+			if ((memcmp(header.identifier, detail::identifier, sizeof(detail::identifier)) != 0) || (header.endianness != 0x04030201)) {
+				return false;
+			}
+			if ((header.pixelDepth > 1) || (header.numberOfArrayElements > 1) || (header.numberOfFaces != 1) || (header.pixelWidth == 0)) {
+				return false;
+			}
+			image.glInternalFormat = header.glInternalFormat;
+			image.format = getVkFormat(header.glInternalFormat);
+			if (image.format == VK_FORMAT_UNDEFINED) {
+				return false;
+			}
+			image.width = header.pixelWidth;
+			image.height = std::max(header.pixelHeight, 1u);
+			image.data.clear();
+			const uint32_t levelCount = std::max(header.numberOfMipmapLevels, 1u);
+
+			image.levels.resize(levelCount);
+			size_t position = sizeof(header) + header.bytesOfKeyValueData;
+			for (uint32_t i = 0; i < levelCount; i++) {
+				uint32_t imageSize;
+				if (position + sizeof(imageSize) > size) {
+					return false;
+				}
+				memcpy(&imageSize, data + position, sizeof(imageSize));
+				position += sizeof(imageSize);
+				if (position + imageSize > size) {
+					return false;
+				}
+				image.levels[i].width = std::max(image.width >> i, 1u);
+				image.levels[i].height = std::max(image.height >> i, 1u);
+				image.levels[i].offset = position;
+				image.levels[i].size = imageSize;
+				position += detail::align4(imageSize);
+			}
+			return true;
+		}
+
+		/**
+		* Read a 2D KTX image from memory
+		*
+		* @param data Contents of the file
+		* @param size Size of the file in bytes
+		* @param image Receives the image, levels are packed without the KTX size fields and padding
+		*
+		* @return False if the data isn't a little endian 2D KTX image in a format known to getVkFormat
+		*/
+		inline bool read(const uint8_t *data, size_t size, Image &image)
+		{
+			if (!parse(data, size, image)) {
+				return false;
+			}
+			size_t offset = 0;
+			for (const mipgen::Level &level : image.levels) {
+				offset += level.size;
+			}
+			image.data.resize(offset);
+			offset = 0;
+			for (mipgen::Level &level : image.levels) {
+				memcpy(image.data.data() + offset, data + level.offset, level.size);
+				level.offset = offset;
+				offset += level.size;
+			}
+			return true;
+		}
+
+		/** @brief Read a 2D KTX image through the virtual file system, see read */
+		inline bool readFile(const std::string &filename, Image &image)
+		{
+			vks::vfs::File file = vks::vfs::open(filename);
+			return file.valid() && read(file.data(), file.size(), image);
+		}
+
+		/** @brief True if the format can be sampled with linear filtering and its compression feature has been enabled */
+		inline bool isSupported(VkPhysicalDevice physicalDevice, const VkPhysicalDeviceFeatures &enabledFeatures, VkFormat format)
+		{
+			if ((format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK) && (format <= VK_FORMAT_BC7_SRGB_BLOCK) && !enabledFeatures.textureCompressionBC) {
+				return false;
+			}
+			if ((format >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK) && (format <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK) && !enabledFeatures.textureCompressionETC2) {
+				return false;
+			}
+			if ((format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK) && (format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK) && !enabledFeatures.textureCompressionASTC_LDR) {
+				return false;
+			}
+			VkFormatProperties formatProperties;
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+			const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+			return (formatProperties.optimalTilingFeatures & required) == required;
+		}
+
+		/**
+		* Find the preferred cooked variant of a source image that the device can sample
+		* Variants sit next to the source with its extension replaced, e.g. chalet.jpg -> chalet.bc7.ktx
+		*
+		* @param physicalDevice Device the texture will be created on
+		* @param enabledFeatures Features the logical device was created with
+		* @param sourceFile Path of the source image
+		* @param image Receives the variant's contents
+		*
+		* @return Path of the variant that was read, empty if there is none the device supports
+		*/
+		inline std::string loadVariant(VkPhysicalDevice physicalDevice, const VkPhysicalDeviceFeatures &enabledFeatures, const std::string &sourceFile, Image &image)
+		{
+			const size_t extension = sourceFile.find_last_of('.');
+			const size_t separator = sourceFile.find_last_of("/\\");
+			const std::string base = ((extension != std::string::npos) && ((separator == std::string::npos) || (extension > separator))) ? sourceFile.substr(0, extension) : sourceFile;
+			for (const std::string &suffix : getVariantSuffixes()) {
+				const std::string filename = base + suffix;
+				vks::vfs::File file = vks::vfs::open(filename);
+				// Check the format in the header before copying any level data
+				detail::Header header;
+				if (!file.valid() || (file.size() < sizeof(header))) {
+					continue;
+				}
+				memcpy(&header, file.data(), sizeof(header));
+				const VkFormat format = getVkFormat(header.glInternalFormat);
+				if ((format != VK_FORMAT_UNDEFINED) && isSupported(physicalDevice, enabledFeatures, format) && read(file.data(), file.size(), image)) {
+					return filename;
+				}
+			}
+			image = Image();
+			return std::string();
+		}
+	}
+}
@@ -0,0 +1,280 @@
+/*
+* Read only memory mapped files
+*
+* Maps files (or windows of files larger than the address space or physical memory) into memory so their contents
+* can be read in place without copying them to heap allocations first
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace vks
+{
+	class MappedFile
+	{
+	private:
+#if defined(_WIN32)
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+#else
+		int file = -1;
+#endif
+		uint64_t fileSize = 0;
+
+		/** @brief Offsets of mapped views need to be multiples of the allocation granularity */
+		static uint64_t granularity()
+		{
+#if defined(_WIN32)
+			SYSTEM_INFO systemInfo;
+			GetSystemInfo(&systemInfo);
+			return systemInfo.dwAllocationGranularity;
+#else
+			return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+		}
+
+	public:
+		/** @brief Mapped range of a file, unmapped on destruction */
+		class View
+		{
+		private:
+			void *base = nullptr;
+			size_t baseSize = 0;
+			const uint8_t *ptr = nullptr;
+			size_t viewSize = 0;
+
+			friend class MappedFile;
+
+		public:
+			View() {}
+			View(const View&) = delete;
+			View &operator=(const View&) = delete;
+			View(View &&other) { *this = std::move(other); }
+			View &operator=(View &&other)
+			{
+				if (this != &other)
+				{
+					release();
+					std::swap(base, other.base);
+					std::swap(baseSize, other.baseSize);
+					std::swap(ptr, other.ptr);
+					std::swap(viewSize, other.viewSize);
+				}
+				return *this;
+			}
+			~View() { release(); }
+
+			const uint8_t *data() const { return ptr; }
+			size_t size() const { return viewSize; }
+			bool valid() const { return ptr != nullptr; }
+
+			/** @brief Ask the OS to read the whole view ahead, so it is fetched in large sequential reads instead of page by page on first access */
+			void prefetch() const
+			{
+				if (!base)
+				{
+					return;
+				}
+#if defined(_WIN32)
+#if defined(_WIN32_WINNT) && (_WIN32_WINNT >= 0x0602)
+				WIN32_MEMORY_RANGE_ENTRY range = { base, baseSize };
+				PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+				madvise(base, baseSize, MADV_WILLNEED);
+#endif
+			}
+
+			void release()
+			{
+				if (base)
+				{
+#if defined(_WIN32)
+					UnmapViewOfFile(base);
+#else
+					munmap(base, baseSize);
+#endif
+				}
+				base = nullptr;
+				baseSize = 0;
+				ptr = nullptr;
+				viewSize = 0;
+			}
+		};
+
+		/**
+		* Sliding window over a mapped file, the mapping is only moved when a requested range is outside of the current window
+		* @note Windows are not thread safe, use one window per thread
+		*/
+		class Window
+		{
+		private:
+			const MappedFile *file = nullptr;
+			View view;
+			uint64_t viewOffset = 0;
+			size_t windowSize;
+
+		public:
+			/**
+			* @param file Opened file to read from
+			* @param windowSize (Optional) Size of the mapped window, larger requests are mapped as a whole
+			*/
+			Window(const MappedFile &file, size_t windowSize = 64 * 1024 * 1024) : file(&file), windowSize(windowSize) {}
+
+			/** @brief Pointer to size bytes at the given file offset, only valid until the next call */
+			const uint8_t *get(uint64_t offset, size_t size)
+			{
+				if (!view.valid() || (offset < viewOffset) || (offset + size > viewOffset + view.size()))
+				{
+					viewOffset = offset;
+					view = file->map(offset, std::max(size, static_cast<size_t>(std::min<uint64_t>(windowSize, file->size() - offset))));
+					if (!view.valid())
+					{
+						return nullptr;
+					}
+				}
+				return view.data() + (offset - viewOffset);
+			}
+		};
+
+		MappedFile() {}
+		MappedFile(const MappedFile&) = delete;
+		MappedFile &operator=(const MappedFile&) = delete;
+		~MappedFile() { close(); }
+
+		/** @brief Open a file for mapping, returns false if the file can't be opened */
+		bool open(const std::string &filename)
+		{
+			close();
+#if defined(_WIN32)
+			file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			LARGE_INTEGER size;
+			GetFileSizeEx(file, &size);
+			fileSize = static_cast<uint64_t>(size.QuadPart);
+			if (fileSize > 0)
+			{
+				mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+				if (mapping == NULL)
+				{
+					close();
+					return false;
+				}
+			}
+#else
+			file = ::open(filename.c_str(), O_RDONLY);
+			if (file < 0)
+			{
+				return false;
+			}
+			struct stat fileStat;
+			if (fstat(file, &fileStat) != 0)
+			{
+				close();
+				return false;
+			}
+			fileSize = static_cast<uint64_t>(fileStat.st_size);
+#endif
+			return true;
+		}
+
+		void close()
+		{
+#if defined(_WIN32)
+			if (mapping != NULL)
+			{
+				CloseHandle(mapping);
+				mapping = NULL;
+			}
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file);
+				file = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (file >= 0)
+			{
+				::close(file);
+				file = -1;
+			}
+#endif
+			fileSize = 0;
+		}
+
+		bool isOpen() const
+		{
+#if defined(_WIN32)
+			return file != INVALID_HANDLE_VALUE;
+#else
+			return file >= 0;
+#endif
+		}
+
+		uint64_t size() const { return fileSize; }
+
+		/**
+		* Map a range of the file
+		*
+		* @param offset Offset of the range in bytes, doesn't need to be aligned
+		* @param size Size of the range in bytes, clamped to the end of the file
+		*
+		* @return View of the range, invalid if the range is empty or mapping failed
+		*/
+		View map(uint64_t offset, size_t size) const
+		{
+			View view;
+			if (!isOpen() || (offset >= fileSize) || (size == 0))
+			{
+				return view;
+			}
+			size = static_cast<size_t>(std::min<uint64_t>(size, fileSize - offset));
+			const uint64_t alignedOffset = offset - (offset % granularity());
+			const size_t mappedSize = static_cast<size_t>(offset - alignedOffset) + size;
+#if defined(_WIN32)
+			void *base = MapViewOfFile(mapping, FILE_MAP_READ, static_cast<DWORD>(alignedOffset >> 32), static_cast<DWORD>(alignedOffset & 0xFFFFFFFF), mappedSize);
+			if (base == NULL)
+			{
+				return view;
+			}
+#else
+			void *base = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, file, static_cast<off_t>(alignedOffset));
+			if (base == MAP_FAILED)
+			{
+				return view;
+			}
+#endif
+			view.base = base;
+			view.baseSize = mappedSize;
+			view.ptr = static_cast<const uint8_t*>(base) + (offset - alignedOffset);
+			view.viewSize = size;
+			return view;
+		}
+
+		/** @brief Map the whole file */
+		View map() const
+		{
+			return map(0, static_cast<size_t>(fileSize));
+		}
+	};
+}
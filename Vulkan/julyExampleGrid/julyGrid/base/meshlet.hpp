@@ -0,0 +1,277 @@
+/*
+* Meshlet (cluster) builder and culling
+*
+* Partitions triangle lists into small clusters with a bounded number of vertices and triangles
+* Each meshlet stores a bounding sphere and a normal cone so that clusters outside of the view frustum
+* or facing away from the camera can be rejected before drawing
+*
+* The triangles of a meshlet are stored contiguously in the index buffer, so meshlets can be drawn
+* with one indexed indirect draw command each on hardware without mesh shader support
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+
+#include "vulkan/vulkan.h"
+#include "frustum.hpp"
+
+#include <glm/glm.hpp>
+
+namespace vks
+{
+	/**
+	* @brief Meshlet bounds and draw range
+	* @note Layout is std430 compatible so the array can also be consumed by a compute culling pass
+	*/
+	struct Meshlet {
+		// Bounding sphere in model space
+		glm::vec3 center;
+		float radius;
+		// Average triangle normal and the cosine of the cone's opening angle (complement), a cutoff of 1 disables cone culling
+		glm::vec3 coneAxis;
+		float coneCutoff;
+		// Index range of the meshlet's triangles in the index buffer and the vertex offset used for drawing them
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		int32_t vertexOffset;
+		uint32_t pad;
+	};
+
+	namespace meshlet
+	{
+		/** @brief Limits used by the builder, chosen to match typical mesh shader output limits */
+		const uint32_t maxVertices = 64;
+		const uint32_t maxTriangles = 124;
+
+		/**
+		* Partition a triangle list into meshlets, triangles are reordered in place so each meshlet's triangles are contiguous
+		*
+		* @param meshlets Meshlets are appended to this array
+		* @param indices Triangle list indices, reordered in place
+		* @param indexCount Number of indices (multiple of three)
+		* @param positions Pointer to the first vertex position (three floats)
+		* @param vertexCount Number of vertices referenced by the indices
+		* @param positionStride Distance in bytes between two vertex positions
+		* @param firstIndex Offset of indices in the index buffer, stored in the meshlets' draw ranges
+		* @param vertexOffset Vertex offset stored in the meshlets' draw ranges
+		* @param clockwise (Optional) Front faces are wound clockwise in model space, flips the normal cones
+		* @param maxMeshletVertices (Optional) Maximum number of unique vertices per meshlet
+		* @param maxMeshletTriangles (Optional) Maximum number of triangles per meshlet
+		*
+		* @return Number of meshlets added
+		*/
+		inline size_t build(std::vector<Meshlet> &meshlets, uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount, size_t positionStride,
+			uint32_t firstIndex, int32_t vertexOffset, bool clockwise = false, uint32_t maxMeshletVertices = maxVertices, uint32_t maxMeshletTriangles = maxTriangles)
+		{
+			assert(indexCount % 3 == 0);
+			assert(maxMeshletVertices >= 3 && maxMeshletTriangles >= 1);
+			const size_t triangleCount = indexCount / 3;
+			const size_t meshletStart = meshlets.size();
+			if (triangleCount == 0) {
+				return 0;
+			}
+
+			auto position = [&](uint32_t v) {
+				const float *p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + v * positionStride);
+				return glm::vec3(p[0], p[1], p[2]);
+			};
+
+			// Vertex to triangle adjacency
+			std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+			for (size_t i = 0; i < indexCount; i++) {
+				adjacencyOffsets[indices[i] + 1]++;
+			}
+			for (size_t v = 0; v < vertexCount; v++) {
+				adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+			}
+			std::vector<uint32_t> adjacency(indexCount);
+			{
+				std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+				for (size_t i = 0; i < indexCount; i++) {
+					adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+				}
+			}
+
+			// Meshlet membership of vertices is tracked with the index of the meshlet they were last added to
+			std::vector<uint32_t> vertexMeshlet(vertexCount, UINT32_MAX);
+			std::vector<bool> emitted(triangleCount, false);
+			std::vector<uint32_t> result;
+			result.reserve(indexCount);
+			std::vector<uint32_t> candidates;
+			std::vector<uint32_t> meshletVertices;
+			std::vector<uint32_t> meshletTriangles;
+			size_t cursor = 0;
+
+			auto newVertices = [&](uint32_t triangle, uint32_t meshletIndex) {
+				uint32_t count = 0;
+				for (uint32_t k = 0; k < 3; k++) {
+					count += (vertexMeshlet[indices[triangle * 3 + k]] != meshletIndex) ? 1 : 0;
+				}
+				return count;
+			};
+
+			while (result.size() < indexCount) {
+				const uint32_t meshletIndex = static_cast<uint32_t>(meshlets.size());
+				meshletVertices.clear();
+				meshletTriangles.clear();
+				candidates.clear();
+
+				// Start the meshlet at the next unused triangle in input order, this keeps the vertex cache order mostly intact
+				while (emitted[cursor]) {
+					cursor++;
+				}
+				uint32_t next = static_cast<uint32_t>(cursor);
+
+				// Grow the meshlet with adjacent triangles that add the fewest new vertices
+				while (next != UINT32_MAX) {
+					const uint32_t added = newVertices(next, meshletIndex);
+					if ((meshletVertices.size() + added > maxMeshletVertices) || (meshletTriangles.size() + 1 > maxMeshletTriangles)) {
+						break;
+					}
+					emitted[next] = true;
+					meshletTriangles.push_back(next);
+					for (uint32_t k = 0; k < 3; k++) {
+						const uint32_t v = indices[next * 3 + k];
+						result.push_back(v);
+						if (vertexMeshlet[v] != meshletIndex) {
+							vertexMeshlet[v] = meshletIndex;
+							meshletVertices.push_back(v);
+							for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; a++) {
+								if (!emitted[adjacency[a]]) {
+									candidates.push_back(adjacency[a]);
+								}
+							}
+						}
+					}
+
+					next = UINT32_MAX;
+					uint32_t bestScore = UINT32_MAX;
+					size_t writeIndex = 0;
+					for (size_t c = 0; c < candidates.size(); c++) {
+						const uint32_t triangle = candidates[c];
+						if (emitted[triangle]) {
+							continue;
+						}
+						candidates[writeIndex++] = triangle;
+						const uint32_t score = newVertices(triangle, meshletIndex);
+						if ((score < bestScore) || ((score == bestScore) && (triangle < next))) {
+							bestScore = score;
+							next = triangle;
+						}
+					}
+					candidates.resize(writeIndex);
+				}
+
+				// Bounding sphere around the meshlet's vertices
+				glm::vec3 min(FLT_MAX);
+				glm::vec3 max(-FLT_MAX);
+				for (uint32_t v : meshletVertices) {
+					min = glm::min(min, position(v));
+					max = glm::max(max, position(v));
+				}
+				Meshlet meshlet{};
+				meshlet.center = (min + max) * 0.5f;
+				for (uint32_t v : meshletVertices) {
+					meshlet.radius = std::max(meshlet.radius, glm::length(position(v) - meshlet.center));
+				}
+
+				// Normal cone from the area weighted average normal and the widest deviation of any triangle from it
+				glm::vec3 axis(0.0f);
+				std::vector<glm::vec3> normals;
+				normals.reserve(meshletTriangles.size());
+				for (uint32_t triangle : meshletTriangles) {
+					const glm::vec3 p0 = position(indices[triangle * 3 + 0]);
+					glm::vec3 normal = glm::cross(position(indices[triangle * 3 + 1]) - p0, position(indices[triangle * 3 + 2]) - p0);
+					if (clockwise) {
+						normal = -normal;
+					}
+					axis += normal;
+					const float length = glm::length(normal);
+					if (length > 0.0f) {
+						normals.push_back(normal / length);
+					}
+				}
+				const float axisLength = glm::length(axis);
+				meshlet.coneCutoff = 1.0f;
+				if (axisLength > 0.0f) {
+					axis /= axisLength;
+					float minDot = 1.0f;
+					for (const glm::vec3 &normal : normals) {
+						minDot = std::min(minDot, glm::dot(normal, axis));
+					}
+					// Cones wider than a hemisphere can't be culled
+					if (minDot > 0.0f) {
+						meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+					}
+					meshlet.coneAxis = axis;
+				}
+
+				meshlet.firstIndex = firstIndex + static_cast<uint32_t>(result.size() - meshletTriangles.size() * 3);
+				meshlet.indexCount = static_cast<uint32_t>(meshletTriangles.size() * 3);
+				meshlet.vertexOffset = vertexOffset;
+				meshlets.push_back(meshlet);
+			}
+
+			std::copy(result.begin(), result.end(), indices);
+			return meshlets.size() - meshletStart;
+		}
+
+		/**
+		* Test a meshlet against the view frustum and its normal cone against the view direction
+		*
+		* @param meshlet Meshlet to test
+		* @param frustum View frustum in the meshlet's model space (e.g. updated with viewProjection * modelMatrix)
+		* @param cameraPosition Camera position in the meshlet's model space
+		*/
+		inline bool visible(const Meshlet &meshlet, const vks::Frustum &frustum, const glm::vec3 &cameraPosition)
+		{
+			if (!frustum.checkSphere(meshlet.center, meshlet.radius)) {
+				return false;
+			}
+			// Back facing if the whole sphere lies behind the cone of triangle planes
+			const glm::vec3 direction = meshlet.center - cameraPosition;
+			return glm::dot(direction, meshlet.coneAxis) < meshlet.coneCutoff * glm::length(direction) + meshlet.radius;
+		}
+
+		/**
+		* Cull meshlets and write one indirect draw command per meshlet, culled meshlets get an instance count of zero
+		*
+		* @param meshlets Meshlets to cull
+		* @param meshletCount Number of meshlets
+		* @param viewProjection Combined view and projection matrix
+		* @param modelMatrix Model matrix the meshlets are drawn with
+		* @param cameraPosition Camera position in world space
+		* @param commands Destination for meshletCount draw commands
+		* @param firstInstance (Optional) Passed as first instance of all commands (e.g. to index per object data in the shader)
+		*
+		* @return Number of visible meshlets
+		*/
+		inline uint32_t cull(const Meshlet *meshlets, size_t meshletCount, const glm::mat4 &viewProjection, const glm::mat4 &modelMatrix, const glm::vec3 &cameraPosition,
+			VkDrawIndexedIndirectCommand *commands, uint32_t firstInstance = 0)
+		{
+			vks::Frustum frustum;
+			frustum.update(viewProjection * modelMatrix);
+			const glm::vec3 localCameraPosition = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(cameraPosition, 1.0f));
+			uint32_t visibleCount = 0;
+			for (size_t i = 0; i < meshletCount; i++) {
+				const Meshlet &meshlet = meshlets[i];
+				const bool isVisible = visible(meshlet, frustum, localCameraPosition);
+				commands[i].indexCount = meshlet.indexCount;
+				commands[i].instanceCount = isVisible ? 1 : 0;
+				commands[i].firstIndex = meshlet.firstIndex;
+				commands[i].vertexOffset = meshlet.vertexOffset;
+				commands[i].firstInstance = firstInstance;
+				visibleCount += isVisible ? 1 : 0;
+			}
+			return visibleCount;
+		}
+	}
+}
@@ -0,0 +1,857 @@
+/*
+* Import time mesh optimization
+*
+* Reorders triangle lists for the post-transform vertex cache (Tipsify, Sander et al. 2007),
+* reduces overdraw by sorting cache coherent triangle clusters front to back from the outside in
+* and remaps vertices into first use order for vertex fetch locality
+*
+* Generates simplified index lists for levels of detail with an edge collapse simplifier driven by quadric error metrics
+* (Garland and Heckbert 1997), collapses only remove vertices so all levels can share the source vertex buffer
+*
+* All functions work on triangle lists with 32 bit indices relative to the first vertex of the mesh
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <glm/glm.hpp>
+
+namespace vks
+{
+	namespace meshopt
+	{
+		/** @brief Size of the simulated FIFO post-transform cache, matches most desktop GPUs closely enough */
+		const uint32_t defaultCacheSize = 16;
+
+		/** @brief Result of a vertex cache simulation, counts can be accumulated over several meshes */
+		struct VertexCacheStatistics {
+			uint64_t triangleCount = 0;
+			uint64_t vertexCount = 0;
+			uint64_t verticesTransformed = 0;
+
+			/** @brief Average cache miss ratio, transformed vertices per triangle (0.5 is optimal for regular grids, 3.0 is worst case) */
+			float acmr() const
+			{
+				return triangleCount ? static_cast<float>(verticesTransformed) / static_cast<float>(triangleCount) : 0.0f;
+			}
+
+			/** @brief Average transform to vertex ratio, transformed vertices per referenced vertex (1.0 is optimal) */
+			float atvr() const
+			{
+				return vertexCount ? static_cast<float>(verticesTransformed) / static_cast<float>(vertexCount) : 0.0f;
+			}
+
+			VertexCacheStatistics& operator+=(const VertexCacheStatistics &other)
+			{
+				triangleCount += other.triangleCount;
+				vertexCount += other.vertexCount;
+				verticesTransformed += other.verticesTransformed;
+				return *this;
+			}
+		};
+
+		/** @brief Vertex cache statistics before and after optimization */
+		struct Statistics {
+			VertexCacheStatistics before;
+			VertexCacheStatistics after;
+
+			Statistics& operator+=(const Statistics &other)
+			{
+				before += other.before;
+				after += other.after;
+				return *this;
+			}
+		};
+
+		/**
+		* Simulate a FIFO post-transform vertex cache for the given triangle list
+		*
+		* @param indices Triangle list indices
+		* @param indexCount Number of indices (multiple of three)
+		* @param vertexCount Number of vertices referenced by the indices
+		* @param cacheSize (Optional) Number of cache entries
+		*/
+		inline VertexCacheStatistics analyzeVertexCache(const uint32_t *indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = defaultCacheSize)
+		{
+			assert(indexCount % 3 == 0);
+			VertexCacheStatistics statistics;
+			statistics.triangleCount = indexCount / 3;
+
+			// A vertex is in the cache if it was transformed less than cacheSize misses ago
+			std::vector<uint32_t> timestamps(vertexCount, 0);
+			uint32_t time = cacheSize + 1;
+			for (size_t i = 0; i < indexCount; i++) {
+				const uint32_t v = indices[i];
+				assert(v < vertexCount);
+				if (timestamps[v] == 0) {
+					statistics.vertexCount++;
+				}
+				if (time - timestamps[v] > cacheSize) {
+					timestamps[v] = time++;
+					statistics.verticesTransformed++;
+				}
+			}
+			return statistics;
+		}
+
+		/**
+		* Reorder triangles for the post-transform vertex cache using Tipsify
+		*
+		* @param destination Reordered indices (must not alias indices)
+		* @param indices Source triangle list indices
+		* @param indexCount Number of indices (multiple of three)
+		* @param vertexCount Number of vertices referenced by the indices
+		* @param cacheSize (Optional) Size of the cache the order is optimized for
+		*/
+		inline void optimizeVertexCache(uint32_t *destination, const uint32_t *indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = defaultCacheSize)
+		{
+			assert(destination != indices);
+			assert(indexCount % 3 == 0);
+			const size_t triangleCount = indexCount / 3;
+			if (triangleCount == 0) {
+				return;
+			}
+
+			// Vertex to triangle adjacency
+			std::vector<uint32_t> liveTriangles(vertexCount, 0);
+			for (size_t i = 0; i < indexCount; i++) {
+				liveTriangles[indices[i]]++;
+			}
+			std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+			for (size_t v = 0; v < vertexCount; v++) {
+				adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+			}
+			std::vector<uint32_t> adjacency(indexCount);
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < indexCount; i++) {
+				adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+
+			std::vector<uint32_t> timestamps(vertexCount, 0);
+			std::vector<bool> emitted(triangleCount, false);
+			std::vector<uint32_t> deadEnd;
+			deadEnd.reserve(indexCount);
+			std::vector<uint32_t> candidates;
+			candidates.reserve(64);
+
+			uint32_t time = cacheSize + 1;
+			size_t cursor = 0;
+			size_t outputIndex = 0;
+			int64_t fanningVertex = indices[0];
+
+			while (fanningVertex >= 0) {
+				const uint32_t f = static_cast<uint32_t>(fanningVertex);
+				candidates.clear();
+
+				// Emit all remaining triangles around the fanning vertex
+				for (uint32_t a = adjacencyOffsets[f]; a < adjacencyOffsets[f + 1]; a++) {
+					const uint32_t triangle = adjacency[a];
+					if (emitted[triangle]) {
+						continue;
+					}
+					for (uint32_t k = 0; k < 3; k++) {
+						const uint32_t v = indices[triangle * 3 + k];
+						destination[outputIndex++] = v;
+						deadEnd.push_back(v);
+						candidates.push_back(v);
+						liveTriangles[v]--;
+						if (time - timestamps[v] > cacheSize) {
+							timestamps[v] = time++;
+						}
+					}
+					emitted[triangle] = true;
+				}
+
+				// Next fanning vertex is the candidate that is still in cache after its remaining triangles are emitted
+				fanningVertex = -1;
+				int64_t bestPriority = -1;
+				for (uint32_t v : candidates) {
+					if (liveTriangles[v] == 0) {
+						continue;
+					}
+					int64_t priority = 0;
+					if (time - timestamps[v] + 2 * liveTriangles[v] <= cacheSize) {
+						priority = time - timestamps[v];
+					}
+					if (priority > bestPriority) {
+						bestPriority = priority;
+						fanningVertex = v;
+					}
+				}
+
+				// Dead end: use the most recently referenced vertex with live triangles, or continue with the next unprocessed vertex in input order
+				if (fanningVertex < 0) {
+					while (!deadEnd.empty()) {
+						const uint32_t v = deadEnd.back();
+						deadEnd.pop_back();
+						if (liveTriangles[v] > 0) {
+							fanningVertex = v;
+							break;
+						}
+					}
+				}
+				if (fanningVertex < 0) {
+					while (cursor < indexCount) {
+						const uint32_t v = indices[cursor++];
+						if (liveTriangles[v] > 0) {
+							fanningVertex = v;
+							break;
+						}
+					}
+				}
+			}
+			assert(outputIndex == indexCount);
+		}
+
+		/**
+		* Reduce overdraw by reordering clusters of triangles so that outward facing clusters on the outside of the mesh are drawn first
+		* Cluster boundaries are placed where the vertex cache is flushed anyway and where the cluster's cache efficiency is within the threshold,
+		* so that the vertex cache optimization done before is mostly preserved
+		*
+		* @param destination Reordered indices (must not alias indices)
+		* @param indices Source triangle list indices, should already be optimized for the vertex cache
+		* @param indexCount Number of indices (multiple of three)
+		* @param positions Pointer to the first vertex position (three floats)
+		* @param vertexCount Number of vertices referenced by the indices
+		* @param positionStride Distance in bytes between two vertex positions
+		* @param threshold (Optional) Allowed increase of the ACMR, 1.05 allows for 5% more vertex transforms
+		* @param cacheSize (Optional) Size of the cache the order was optimized for
+		*/
+		inline void optimizeOverdraw(uint32_t *destination, const uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount, size_t positionStride, float threshold = 1.05f, uint32_t cacheSize = defaultCacheSize)
+		{
+			assert(destination != indices);
+			assert(indexCount % 3 == 0);
+			const size_t triangleCount = indexCount / 3;
+			if (triangleCount == 0) {
+				return;
+			}
+
+			auto position = [&](uint32_t v) {
+				const float *p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + v * positionStride);
+				return glm::vec3(p[0], p[1], p[2]);
+			};
+
+			std::vector<uint32_t> timestamps(vertexCount, 0);
+			uint32_t time = cacheSize + 1;
+			auto cacheMisses = [&](size_t triangle) {
+				uint32_t misses = 0;
+				for (uint32_t k = 0; k < 3; k++) {
+					const uint32_t v = indices[triangle * 3 + k];
+					if (time - timestamps[v] > cacheSize) {
+						timestamps[v] = time++;
+						misses++;
+					}
+				}
+				return misses;
+			};
+
+			// Hard boundaries: triangles that start with an empty cache as seen by the vertex cache optimization
+			std::vector<size_t> hardClusters;
+			for (size_t t = 0; t < triangleCount; t++) {
+				if (cacheMisses(t) == 3) {
+					hardClusters.push_back(t);
+				}
+			}
+			if (hardClusters.empty() || hardClusters[0] != 0) {
+				hardClusters.insert(hardClusters.begin(), 0);
+			}
+			hardClusters.push_back(triangleCount);
+
+			// Soft boundaries: split hard clusters further wherever the running ACMR is within the threshold of the whole cluster's
+			std::vector<size_t> clusters;
+			for (size_t c = 0; c + 1 < hardClusters.size(); c++) {
+				const size_t start = hardClusters[c];
+				const size_t end = hardClusters[c + 1];
+
+				time += cacheSize + 1;
+				uint32_t clusterMisses = 0;
+				for (size_t t = start; t < end; t++) {
+					clusterMisses += cacheMisses(t);
+				}
+				const float clusterThreshold = threshold * static_cast<float>(clusterMisses) / static_cast<float>(end - start);
+
+				clusters.push_back(start);
+				time += cacheSize + 1;
+				uint32_t runningMisses = 0;
+				size_t runningStart = start;
+				for (size_t t = start; t < end; t++) {
+					runningMisses += cacheMisses(t);
+					if ((t + 1 < end) && (static_cast<float>(runningMisses) / static_cast<float>(t + 1 - runningStart) <= clusterThreshold)) {
+						clusters.push_back(t + 1);
+						time += cacheSize + 1;
+						runningMisses = 0;
+						runningStart = t + 1;
+					}
+				}
+			}
+			clusters.push_back(triangleCount);
+			const size_t clusterCount = clusters.size() - 1;
+
+			// Sort clusters by how far they face outwards from the mesh center
+			glm::vec3 meshCenter(0.0f);
+			float meshArea = 0.0f;
+			std::vector<glm::vec3> clusterCenters(clusterCount, glm::vec3(0.0f));
+			std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+			std::vector<float> clusterAreas(clusterCount, 0.0f);
+			for (size_t c = 0; c < clusterCount; c++) {
+				for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+					const glm::vec3 p0 = position(indices[t * 3 + 0]);
+					const glm::vec3 p1 = position(indices[t * 3 + 1]);
+					const glm::vec3 p2 = position(indices[t * 3 + 2]);
+					const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+					const float area = glm::length(normal);
+					const glm::vec3 center = (p0 + p1 + p2) / 3.0f;
+					clusterCenters[c] += center * area;
+					clusterNormals[c] += normal;
+					clusterAreas[c] += area;
+					meshCenter += center * area;
+					meshArea += area;
+				}
+			}
+			if (meshArea > 0.0f) {
+				meshCenter /= meshArea;
+			}
+			std::vector<float> sortKeys(clusterCount, 0.0f);
+			for (size_t c = 0; c < clusterCount; c++) {
+				if (clusterAreas[c] <= 0.0f) {
+					continue;
+				}
+				const glm::vec3 center = clusterCenters[c] / clusterAreas[c];
+				const float normalLength = glm::length(clusterNormals[c]);
+				if (normalLength > 0.0f) {
+					sortKeys[c] = glm::dot(center - meshCenter, clusterNormals[c] / normalLength);
+				}
+			}
+
+			std::vector<uint32_t> order(clusterCount);
+			std::iota(order.begin(), order.end(), 0);
+			std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+			size_t outputIndex = 0;
+			for (uint32_t c : order) {
+				const size_t first = clusters[c] * 3;
+				const size_t count = (clusters[c + 1] - clusters[c]) * 3;
+				memcpy(destination + outputIndex, indices + first, count * sizeof(uint32_t));
+				outputIndex += count;
+			}
+			assert(outputIndex == indexCount);
+		}
+
+		/**
+		* Reorder vertices in the order they are first referenced by the indices and rewrite the indices accordingly
+		* Vertices that aren't referenced are dropped
+		*
+		* @param destination Reordered vertices (must not alias vertices, needs room for vertexCount vertices)
+		* @param indices Triangle list indices, rewritten in place
+		* @param indexCount Number of indices
+		* @param vertices Source vertices
+		* @param vertexCount Number of source vertices
+		* @param vertexSize Size of a single vertex in bytes
+		*
+		* @return Number of vertices written to destination
+		*/
+		inline size_t optimizeVertexFetch(void *destination, uint32_t *indices, size_t indexCount, const void *vertices, size_t vertexCount, size_t vertexSize)
+		{
+			assert(destination != vertices);
+			std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+			uint32_t next = 0;
+			for (size_t i = 0; i < indexCount; i++) {
+				const uint32_t v = indices[i];
+				assert(v < vertexCount);
+				if (remap[v] == UINT32_MAX) {
+					memcpy(static_cast<uint8_t*>(destination) + next * vertexSize, static_cast<const uint8_t*>(vertices) + v * vertexSize, vertexSize);
+					remap[v] = next++;
+				}
+				indices[i] = remap[v];
+			}
+			return next;
+		}
+
+		/**
+		* Run the vertex cache and overdraw optimization on a triangle list in place
+		*
+		* @param indices Triangle list indices, rewritten in place
+		* @param indexCount Number of indices (multiple of three)
+		* @param positions Pointer to the first vertex position (three floats)
+		* @param vertexCount Number of vertices referenced by the indices
+		* @param positionStride Distance in bytes between two vertex positions
+		*/
+		inline void optimizeIndices(uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount, size_t positionStride)
+		{
+			if (indexCount < 3) {
+				return;
+			}
+			std::vector<uint32_t> cacheOptimized(indexCount);
+			optimizeVertexCache(cacheOptimized.data(), indices, indexCount, vertexCount);
+			optimizeOverdraw(indices, cacheOptimized.data(), indexCount, positions, vertexCount, positionStride);
+		}
+
+		namespace detail
+		{
+			/** @brief Symmetric quadric (A, b, c) with the accumulated weight of all planes added to it */
+			struct Quadric {
+				double a00 = 0.0, a11 = 0.0, a22 = 0.0, a01 = 0.0, a02 = 0.0, a12 = 0.0;
+				double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+				double c = 0.0;
+				double weight = 0.0;
+
+				void addPlane(const glm::vec3 &n, float d, float w)
+				{
+					a00 += w * n.x * n.x; a11 += w * n.y * n.y; a22 += w * n.z * n.z;
+					a01 += w * n.x * n.y; a02 += w * n.x * n.z; a12 += w * n.y * n.z;
+					b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+					c += w * d * d;
+					weight += w;
+				}
+
+				Quadric& operator+=(const Quadric &q)
+				{
+					a00 += q.a00; a11 += q.a11; a22 += q.a22; a01 += q.a01; a02 += q.a02; a12 += q.a12;
+					b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; weight += q.weight;
+					return *this;
+				}
+
+				/** @brief Weighted average squared distance of p to all planes */
+				float error(const glm::vec3 &p) const
+				{
+					const double rx = a00 * p.x + a01 * p.y + a02 * p.z;
+					const double ry = a01 * p.x + a11 * p.y + a12 * p.z;
+					const double rz = a02 * p.x + a12 * p.y + a22 * p.z;
+					double e = rx * p.x + ry * p.y + rz * p.z + 2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+					return (weight > 0.0) ? static_cast<float>(fabs(e) / weight) : 0.0f;
+				}
+			};
+
+			struct PositionHash {
+				size_t operator()(const glm::vec3 &p) const
+				{
+					uint32_t h[3];
+					memcpy(h, &p, sizeof(h));
+					return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+				}
+			};
+
+			inline uint64_t edgeKey(uint32_t a, uint32_t b)
+			{
+				return (static_cast<uint64_t>(a) << 32) | b;
+			}
+
+			// Manifold vertices can collapse along any edge, border and seam vertices only along their border or seam, locked vertices never move
+			enum VertexKind : uint8_t { KIND_MANIFOLD, KIND_BORDER, KIND_SEAM, KIND_LOCKED };
+		}
+
+		/**
+		* Returns the scale used to normalize errors of simplify (the largest extent of the positions)
+		*/
+		inline float simplifyScale(const float *positions, size_t vertexCount, size_t positionStride)
+		{
+			glm::vec3 min(FLT_MAX);
+			glm::vec3 max(-FLT_MAX);
+			for (size_t v = 0; v < vertexCount; v++) {
+				const float *p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + v * positionStride);
+				min = glm::min(min, glm::vec3(p[0], p[1], p[2]));
+				max = glm::max(max, glm::vec3(p[0], p[1], p[2]));
+			}
+			const glm::vec3 extent = max - min;
+			return (vertexCount > 0) ? std::max(extent.x, std::max(extent.y, extent.z)) : 0.0f;
+		}
+
+		/**
+		* Reduce the number of triangles of a mesh by collapsing edges in the order of their quadric error
+		* Vertices are never moved or added, so the result references a subset of the source vertices
+		*
+		* Vertices that share a position but differ in their attributes (seams) are collapsed together along the seam,
+		* mesh borders are only collapsed along the border
+		*
+		* @param destination Simplified indices (needs room for indexCount indices, may alias indices)
+		* @param indices Source triangle list indices
+		* @param indexCount Number of indices (multiple of three)
+		* @param positions Pointer to the first vertex position (three floats)
+		* @param vertexCount Number of vertices referenced by the indices
+		* @param positionStride Distance in bytes between two vertex positions
+		* @param targetIndexCount Number of indices to stop at
+		* @param targetError Maximum error relative to the mesh extent (e.g. 0.01 for 1%), see simplifyScale
+		* @param resultError (Optional) Receives the error of the result relative to the mesh extent
+		* @param attributes (Optional) Pointer to the first vertex attribute (attributeCount floats), differences are added to the collapse cost
+		* @param attributeStride Distance in bytes between the attributes of two vertices
+		* @param attributeWeights Weight for each attribute
+		* @param attributeCount Number of attribute floats per vertex
+		*
+		* @return Number of indices written to destination
+		*/
+		inline size_t simplify(uint32_t *destination, const uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount, size_t positionStride,
+			size_t targetIndexCount, float targetError, float *resultError = nullptr,
+			const float *attributes = nullptr, size_t attributeStride = 0, const float *attributeWeights = nullptr, size_t attributeCount = 0)
+		{
+			using namespace detail;
+			assert(indexCount % 3 == 0);
+
+			std::vector<uint32_t> result(indices, indices + indexCount);
+			if (resultError) {
+				*resultError = 0.0f;
+			}
+
+			// Positions are normalized to the unit cube so errors are independent of the mesh scale
+			const float scale = simplifyScale(positions, vertexCount, positionStride);
+			const float invScale = (scale > 0.0f) ? 1.0f / scale : 0.0f;
+			std::vector<glm::vec3> pos(vertexCount);
+			for (size_t v = 0; v < vertexCount; v++) {
+				const float *p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + v * positionStride);
+				pos[v] = glm::vec3(p[0], p[1], p[2]) * invScale;
+			}
+
+			// Vertices sharing a position are linked in a ring (wedges), remap points to the first vertex at a position
+			std::vector<uint32_t> remap(vertexCount);
+			std::vector<uint32_t> wedge(vertexCount);
+			{
+				std::unordered_map<glm::vec3, uint32_t, PositionHash> unique;
+				unique.reserve(vertexCount);
+				for (uint32_t v = 0; v < vertexCount; v++) {
+					auto it = unique.insert(std::make_pair(pos[v], v));
+					const uint32_t r = it.first->second;
+					remap[v] = r;
+					wedge[v] = v;
+					if (r != v) {
+						wedge[v] = wedge[r];
+						wedge[r] = v;
+					}
+				}
+			}
+
+			auto attributeError = [&](uint32_t a, uint32_t b) {
+				float e = 0.0f;
+				if (attributes) {
+					const float *aa = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(attributes) + a * attributeStride);
+					const float *ab = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(attributes) + b * attributeStride);
+					for (size_t i = 0; i < attributeCount; i++) {
+						const float d = aa[i] - ab[i];
+						e += attributeWeights[i] * d * d;
+					}
+				}
+				return e;
+			};
+
+			// Plane quadrics weighted by triangle area, borders get an additional perpendicular plane to keep their shape
+			const float borderWeight = 10.0f;
+			std::vector<Quadric> quadrics(vertexCount);
+			{
+				std::unordered_set<uint64_t> positionEdges;
+				for (size_t i = 0; i < indexCount; i += 3) {
+					for (uint32_t k = 0; k < 3; k++) {
+						positionEdges.insert(edgeKey(remap[result[i + k]], remap[result[i + (k + 1) % 3]]));
+					}
+				}
+				for (size_t i = 0; i < indexCount; i += 3) {
+					const glm::vec3 &p0 = pos[result[i + 0]];
+					const glm::vec3 &p1 = pos[result[i + 1]];
+					const glm::vec3 &p2 = pos[result[i + 2]];
+					glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+					const float length = glm::length(normal);
+					if (length == 0.0f) {
+						continue;
+					}
+					normal /= length;
+					for (uint32_t k = 0; k < 3; k++) {
+						quadrics[remap[result[i + k]]].addPlane(normal, -glm::dot(normal, p0), length * 0.5f);
+					}
+					for (uint32_t k = 0; k < 3; k++) {
+						const uint32_t a = remap[result[i + k]];
+						const uint32_t b = remap[result[i + (k + 1) % 3]];
+						if (positionEdges.count(edgeKey(b, a)) == 0) {
+							const glm::vec3 edge = pos[b] - pos[a];
+							const float edgeLength = glm::length(edge);
+							if (edgeLength > 0.0f) {
+								const glm::vec3 borderNormal = glm::normalize(glm::cross(edge, normal));
+								const float d = -glm::dot(borderNormal, pos[a]);
+								quadrics[a].addPlane(borderNormal, d, edgeLength * edgeLength * borderWeight);
+								quadrics[b].addPlane(borderNormal, d, edgeLength * edgeLength * borderWeight);
+							}
+						}
+					}
+				}
+			}
+
+			struct Collapse {
+				uint32_t v0;
+				uint32_t v1;
+				// Target of the second wedge for seam collapses
+				uint32_t w0;
+				uint32_t w1;
+				float cost;
+			};
+
+			std::vector<uint32_t> collapseRemap(vertexCount);
+			std::iota(collapseRemap.begin(), collapseRemap.end(), 0);
+			std::vector<uint8_t> kinds(vertexCount);
+			std::vector<uint8_t> collapseLocked(vertexCount);
+			std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+			std::vector<uint32_t> adjacency;
+			std::vector<Collapse> collapses;
+			std::unordered_set<uint64_t> attributeEdges;
+			std::unordered_set<uint64_t> positionEdges;
+			std::vector<uint32_t> attributeOpenOut(vertexCount), attributeOpenIn(vertexCount);
+			std::vector<uint32_t> positionOpenOut(vertexCount), positionOpenIn(vertexCount);
+			const float errorLimit = targetError * targetError;
+			float maxError = 0.0f;
+
+			while (result.size() > targetIndexCount) {
+				const size_t triangleCount = result.size() / 3;
+
+				// Classify vertices on the current mesh
+				attributeEdges.clear();
+				positionEdges.clear();
+				for (size_t i = 0; i < result.size(); i += 3) {
+					for (uint32_t k = 0; k < 3; k++) {
+						const uint32_t a = result[i + k];
+						const uint32_t b = result[i + (k + 1) % 3];
+						attributeEdges.insert(edgeKey(a, b));
+						positionEdges.insert(edgeKey(remap[a], remap[b]));
+					}
+				}
+				std::fill(attributeOpenOut.begin(), attributeOpenOut.end(), 0);
+				std::fill(attributeOpenIn.begin(), attributeOpenIn.end(), 0);
+				std::fill(positionOpenOut.begin(), positionOpenOut.end(), 0);
+				std::fill(positionOpenIn.begin(), positionOpenIn.end(), 0);
+				for (size_t i = 0; i < result.size(); i += 3) {
+					for (uint32_t k = 0; k < 3; k++) {
+						const uint32_t a = result[i + k];
+						const uint32_t b = result[i + (k + 1) % 3];
+						if (attributeEdges.count(edgeKey(b, a)) == 0) {
+							attributeOpenOut[a]++;
+							attributeOpenIn[b]++;
+						}
+						if (positionEdges.count(edgeKey(remap[b], remap[a])) == 0) {
+							positionOpenOut[remap[a]]++;
+							positionOpenIn[remap[b]]++;
+						}
+					}
+				}
+				for (uint32_t v = 0; v < vertexCount; v++) {
+					if (remap[v] != v) {
+						continue;
+					}
+					uint32_t wedgeCount = 1;
+					for (uint32_t w = wedge[v]; w != v; w = wedge[w]) {
+						wedgeCount++;
+					}
+					uint8_t kind = KIND_LOCKED;
+					const bool positionClosed = (positionOpenOut[v] == 0) && (positionOpenIn[v] == 0);
+					if (wedgeCount == 1) {
+						if (positionClosed) {
+							kind = KIND_MANIFOLD;
+						} else if ((positionOpenOut[v] == 1) && (positionOpenIn[v] == 1)) {
+							kind = KIND_BORDER;
+						}
+					} else if ((wedgeCount == 2) && positionClosed) {
+						const uint32_t w = wedge[v];
+						if ((attributeOpenOut[v] == 1) && (attributeOpenIn[v] == 1) && (attributeOpenOut[w] == 1) && (attributeOpenIn[w] == 1)) {
+							kind = KIND_SEAM;
+						}
+					}
+					kinds[v] = kind;
+				}
+
+				// Vertex to triangle adjacency by position
+				std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+				for (uint32_t index : result) {
+					adjacencyOffsets[remap[index] + 1]++;
+				}
+				for (size_t v = 0; v < vertexCount; v++) {
+					adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+				}
+				adjacency.resize(result.size());
+				{
+					std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+					for (size_t i = 0; i < result.size(); i++) {
+						adjacency[fill[remap[result[i]]]++] = static_cast<uint32_t>(i / 3);
+					}
+				}
+
+				// Gather valid collapses along all edges
+				collapses.clear();
+				for (size_t i = 0; i < result.size(); i += 3) {
+					for (uint32_t k = 0; k < 6; k++) {
+						const uint32_t v0 = result[i + (k % 3)];
+						const uint32_t v1 = result[i + (k % 3 + ((k < 3) ? 1 : 2)) % 3];
+						const uint32_t p0 = remap[v0];
+						const uint32_t p1 = remap[v1];
+						if (p0 == p1) {
+							continue;
+						}
+						const uint8_t kind0 = kinds[p0];
+						const uint8_t kind1 = kinds[p1];
+						Collapse collapse = { v0, v1, UINT32_MAX, UINT32_MAX, 0.0f };
+						if (kind0 == KIND_LOCKED) {
+							continue;
+						}
+						if (kind0 == KIND_BORDER) {
+							const bool borderEdge = (positionEdges.count(edgeKey(p1, p0)) == 0) || (positionEdges.count(edgeKey(p0, p1)) == 0);
+							if (!borderEdge || ((kind1 != KIND_BORDER) && (kind1 != KIND_LOCKED))) {
+								continue;
+							}
+						}
+						if (kind0 == KIND_SEAM) {
+							const bool seamEdge = (attributeEdges.count(edgeKey(v1, v0)) == 0) || (attributeEdges.count(edgeKey(v0, v1)) == 0);
+							if (!seamEdge || ((kind1 != KIND_SEAM) && (kind1 != KIND_LOCKED))) {
+								continue;
+							}
+							// The other wedge collapses to the vertex at the target position it shares the seam edge with
+							const uint32_t w0 = wedge[v0];
+							uint32_t w1 = v1;
+							do {
+								if ((w1 != v1) && (attributeEdges.count(edgeKey(w0, w1)) || attributeEdges.count(edgeKey(w1, w0)))) {
+									collapse.w0 = w0;
+									collapse.w1 = w1;
+									break;
+								}
+								w1 = wedge[w1];
+							} while (w1 != v1);
+							if (collapse.w0 == UINT32_MAX) {
+								continue;
+							}
+						}
+						Quadric q = quadrics[p0];
+						q += quadrics[p1];
+						collapse.cost = q.error(pos[v1]) + attributeError(v0, v1);
+						if (collapse.w0 != UINT32_MAX) {
+							collapse.cost += attributeError(collapse.w0, collapse.w1);
+						}
+						collapses.push_back(collapse);
+					}
+				}
+				if (collapses.empty()) {
+					break;
+				}
+				std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+				// Apply cheapest collapses first, each vertex takes part in at most one collapse per pass
+				std::fill(collapseLocked.begin(), collapseLocked.end(), 0);
+				const size_t trianglesToRemove = triangleCount - targetIndexCount / 3;
+				size_t trianglesRemoved = 0;
+				size_t collapsesApplied = 0;
+				for (const Collapse &collapse : collapses) {
+					if (collapse.cost > errorLimit) {
+						break;
+					}
+					const uint32_t p0 = remap[collapse.v0];
+					const uint32_t p1 = remap[collapse.v1];
+					if (collapseLocked[p0] || collapseLocked[p1]) {
+						continue;
+					}
+
+					// Reject collapses that flip the remaining triangles around the collapsed vertex
+					bool flipped = false;
+					size_t removed = 0;
+					for (uint32_t a = adjacencyOffsets[p0]; a < adjacencyOffsets[p0 + 1] && !flipped; a++) {
+						const size_t t = adjacency[a] * 3;
+						uint32_t corners[3];
+						for (uint32_t k = 0; k < 3; k++) {
+							corners[k] = remap[collapseRemap[result[t + k]]];
+						}
+						if ((corners[0] == p1) || (corners[1] == p1) || (corners[2] == p1)) {
+							removed++;
+							continue;
+						}
+						const glm::vec3 before = glm::cross(pos[corners[1]] - pos[corners[0]], pos[corners[2]] - pos[corners[0]]);
+						glm::vec3 after[3];
+						for (uint32_t k = 0; k < 3; k++) {
+							after[k] = (corners[k] == p0) ? pos[p1] : pos[corners[k]];
+						}
+						const glm::vec3 afterNormal = glm::cross(after[1] - after[0], after[2] - after[0]);
+						flipped = glm::dot(before, afterNormal) <= 0.0f;
+					}
+					if (flipped) {
+						continue;
+					}
+
+					collapseRemap[collapse.v0] = collapse.v1;
+					if (collapse.w0 != UINT32_MAX) {
+						collapseRemap[collapse.w0] = collapse.w1;
+					}
+					quadrics[p1] += quadrics[p0];
+					collapseLocked[p0] = 1;
+					collapseLocked[p1] = 1;
+					maxError = std::max(maxError, collapse.cost);
+					collapsesApplied++;
+					trianglesRemoved += removed;
+					if (trianglesRemoved >= trianglesToRemove) {
+						break;
+					}
+				}
+				if (collapsesApplied == 0) {
+					break;
+				}
+
+				// Rewrite indices and drop collapsed triangles
+				size_t writeIndex = 0;
+				for (size_t i = 0; i < result.size(); i += 3) {
+					const uint32_t a = collapseRemap[result[i + 0]];
+					const uint32_t b = collapseRemap[result[i + 1]];
+					const uint32_t c = collapseRemap[result[i + 2]];
+					if ((remap[a] == remap[b]) || (remap[b] == remap[c]) || (remap[a] == remap[c])) {
+						continue;
+					}
+					result[writeIndex++] = a;
+					result[writeIndex++] = b;
+					result[writeIndex++] = c;
+				}
+				result.resize(writeIndex);
+				for (uint32_t v = 0; v < vertexCount; v++) {
+					collapseRemap[v] = v;
+				}
+			}
+
+			if (resultError) {
+				*resultError = sqrtf(maxError);
+			}
+			memcpy(destination, result.data(), result.size() * sizeof(uint32_t));
+			return result.size();
+		}
+
+		/**
+		* Run the complete optimization pipeline (vertex cache, overdraw and vertex fetch) on a mesh in place
+		*
+		* @param indices Triangle list indices relative to the first vertex, rewritten in place
+		* @param indexCount Number of indices (multiple of three)
+		* @param vertices Interleaved vertex data, reordered in place
+		* @param vertexCount Number of vertices
+		* @param vertexSize Size of a single vertex in bytes
+		* @param positions Pointer to the first vertex position (three floats) in the original vertex order, may point into vertices
+		* @param positionStride Distance in bytes between two vertex positions
+		* @param statistics (Optional) Receives the vertex cache statistics before and after optimization
+		*
+		* @return Number of vertices after unreferenced vertices have been dropped
+		*/
+		inline size_t optimizeMesh(uint32_t *indices, size_t indexCount, void *vertices, size_t vertexCount, size_t vertexSize, const float *positions, size_t positionStride, Statistics *statistics = nullptr)
+		{
+			if (indexCount < 3 || vertexCount == 0) {
+				return vertexCount;
+			}
+			if (statistics) {
+				statistics->before += analyzeVertexCache(indices, indexCount, vertexCount);
+			}
+
+			optimizeIndices(indices, indexCount, positions, vertexCount, positionStride);
+
+			std::vector<uint8_t> sourceVertices(static_cast<uint8_t*>(vertices), static_cast<uint8_t*>(vertices) + vertexCount * vertexSize);
+			const size_t usedVertexCount = optimizeVertexFetch(vertices, indices, indexCount, sourceVertices.data(), vertexCount, vertexSize);
+
+			if (statistics) {
+				statistics->after += analyzeVertexCache(indices, indexCount, usedVertexCount);
+			}
+			return usedVertexCount;
+		}
+	}
+}
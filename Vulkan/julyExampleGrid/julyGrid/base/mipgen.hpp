@@ -0,0 +1,364 @@
+/*
+* CPU mip chain generation
+*
+* Generates the mip chain of RGBA8 images with a separable box, Kaiser windowed sinc or Lanczos filter
+* Used for formats that don't support linear blits and for offline texture cooking
+* Color channels of sRGB images are filtered in linear space, alpha can be rescaled per level so alpha tested
+* geometry keeps its coverage in the distance
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define VKS_MIPGEN_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VKS_MIPGEN_NEON
+#endif
+
+#include "threadpool.hpp"
+
+namespace vks
+{
+	namespace mipgen
+	{
+		enum Filter { filterBox, filterKaiser, filterLanczos };
+
+		struct Options {
+			Filter filter = filterKaiser;
+			// Color channels hold sRGB encoded values and are filtered in linear space
+			bool srgb = false;
+			// Alpha of each level is scaled so the fraction of texels above this cutoff matches the top level, zero disables it
+			float alphaCutoff = 0.0f;
+		};
+
+		/** @brief Location of one level in a tightly packed RGBA8 mip chain */
+		struct Level {
+			uint32_t width;
+			uint32_t height;
+			size_t offset;
+			size_t size;
+		};
+
+		inline uint32_t getLevelCount(uint32_t width, uint32_t height)
+		{
+			return static_cast<uint32_t>(floor(log2(std::max(width, height)))) + 1;
+		}
+
+		/**
+		* Layout of a tightly packed RGBA8 mip chain
+		*
+		* @param width Width of the top level
+		* @param height Height of the top level
+		* @param levelCount (Optional) Number of levels, zero for a full chain
+		*/
+		inline std::vector<Level> getLevels(uint32_t width, uint32_t height, uint32_t levelCount = 0)
+		{
+			if (levelCount == 0) {
+				levelCount = getLevelCount(width, height);
+			}
+			std::vector<Level> levels(levelCount);
+			size_t offset = 0;
+			for (uint32_t i = 0; i < levelCount; i++) {
+				levels[i].width = std::max(width >> i, 1u);
+				levels[i].height = std::max(height >> i, 1u);
+				levels[i].offset = offset;
+				levels[i].size = static_cast<size_t>(levels[i].width) * levels[i].height * 4;
+				offset += levels[i].size;
+			}
+			return levels;
+		}
+
+		inline size_t getSize(const std::vector<Level> &levels)
+		{
+			return levels.empty() ? 0 : levels.back().offset + levels.back().size;
+		}
+
+		namespace detail
+		{
+			// One RGBA pixel per vector register
+#if defined(VKS_MIPGEN_SSE2)
+			typedef __m128 Pixel;
+			inline Pixel zero() { return _mm_setzero_ps(); }
+			inline Pixel load(const float *p) { return _mm_loadu_ps(p); }
+			inline void store(float *p, Pixel v) { _mm_storeu_ps(p, v); }
+			inline Pixel madd(Pixel acc, Pixel v, float w) { return _mm_add_ps(acc, _mm_mul_ps(v, _mm_set1_ps(w))); }
+#elif defined(VKS_MIPGEN_NEON)
+			typedef float32x4_t Pixel;
+			inline Pixel zero() { return vdupq_n_f32(0.0f); }
+			inline Pixel load(const float *p) { return vld1q_f32(p); }
+			inline void store(float *p, Pixel v) { vst1q_f32(p, v); }
+			inline Pixel madd(Pixel acc, Pixel v, float w) { return vmlaq_n_f32(acc, v, w); }
+#else
+			struct Pixel { float v[4]; };
+			inline Pixel zero() { Pixel p = { { 0.0f, 0.0f, 0.0f, 0.0f } }; return p; }
+			inline Pixel load(const float *p) { Pixel r; memcpy(r.v, p, sizeof(r.v)); return r; }
+			inline void store(float *p, Pixel v) { memcpy(p, v.v, sizeof(v.v)); }
+			inline Pixel madd(Pixel acc, Pixel v, float w) { for (int i = 0; i < 4; i++) { acc.v[i] += v.v[i] * w; } return acc; }
+#endif
+
+			inline float sinc(float x)
+			{
+				if (fabsf(x) < 1e-6f) {
+					return 1.0f;
+				}
+				const float px = 3.14159265358979f * x;
+				return sinf(px) / px;
+			}
+
+			// Modified Bessel function of the first kind used by the Kaiser window
+			inline float besselI0(float x)
+			{
+				float sum = 1.0f;
+				float term = 1.0f;
+				for (int k = 1; k < 16; k++) {
+					term *= (x * 0.5f / k) * (x * 0.5f / k);
+					sum += term;
+				}
+				return sum;
+			}
+
+			inline float filterRadius(Filter filter)
+			{
+				return (filter == filterBox) ? 0.5f : 3.0f;
+			}
+
+			inline float filterWeight(Filter filter, float x)
+			{
+				const float radius = filterRadius(filter);
+				if (fabsf(x) >= radius) {
+					return (filter == filterBox && fabsf(x) == radius) ? 0.5f : 0.0f;
+				}
+				switch (filter) {
+				case filterBox:
+					return 1.0f;
+				case filterKaiser: {
+					const float alpha = 4.0f;
+					const float t = x / radius;
+					return sinc(x) * besselI0(alpha * sqrtf(1.0f - t * t)) / besselI0(alpha);
+				}
+				case filterLanczos:
+					return sinc(x) * sinc(x / radius);
+				}
+				return 0.0f;
+			}
+
+			/** @brief Source indices and normalized weights of a fixed number of taps per destination texel of one axis */
+			struct Taps {
+				uint32_t count;
+				std::vector<uint32_t> indices;
+				std::vector<float> weights;
+
+				Taps(Filter filter, uint32_t srcSize, uint32_t dstSize)
+				{
+					const float scale = static_cast<float>(srcSize) / dstSize;
+					const float support = filterRadius(filter) * scale;
+					count = static_cast<uint32_t>(ceilf(support * 2.0f)) + 1;
+					indices.resize(static_cast<size_t>(dstSize) * count);
+					weights.resize(static_cast<size_t>(dstSize) * count);
+					for (uint32_t i = 0; i < dstSize; i++) {
+						const float center = (i + 0.5f) * scale;
+						const int32_t first = static_cast<int32_t>(floorf(center - support));
+						float sum = 0.0f;
+						for (uint32_t t = 0; t < count; t++) {
+							const int32_t s = first + static_cast<int32_t>(t);
+							const float w = filterWeight(filter, (s + 0.5f - center) / scale);
+							indices[i * count + t] = static_cast<uint32_t>(std::min(std::max(s, 0), static_cast<int32_t>(srcSize) - 1));
+							weights[i * count + t] = w;
+							sum += w;
+						}
+						for (uint32_t t = 0; t < count; t++) {
+							weights[i * count + t] /= sum;
+						}
+					}
+				}
+			};
+
+			inline float srgbToLinear(float c)
+			{
+				return (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			}
+
+			inline float linearToSrgb(float c)
+			{
+				return (c <= 0.0031308f) ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+			}
+
+			inline const float *srgbDecodeTable()
+			{
+				static const std::vector<float> table = [] {
+					std::vector<float> t(256);
+					for (int i = 0; i < 256; i++) {
+						t[i] = srgbToLinear(i / 255.0f);
+					}
+					return t;
+				}();
+				return table.data();
+			}
+
+			// Indexed with 16 bit linear values, fine enough to round-trip all 8 bit sRGB values
+			inline const uint8_t *srgbEncodeTable()
+			{
+				static const std::vector<uint8_t> table = [] {
+					std::vector<uint8_t> t(65536);
+					for (int i = 0; i < 65536; i++) {
+						t[i] = static_cast<uint8_t>(linearToSrgb(i / 65535.0f) * 255.0f + 0.5f);
+					}
+					return t;
+				}();
+				return table.data();
+			}
+
+			inline float saturate(float v)
+			{
+				return std::min(std::max(v, 0.0f), 1.0f);
+			}
+
+			inline void parallelRows(vks::ThreadPool *pool, uint32_t count, const std::function<void(uint32_t, uint32_t)> &function)
+			{
+				if (pool) {
+					pool->parallelFor(count, function);
+				} else {
+					function(0, count);
+				}
+			}
+
+			inline float coverage(const float *pixels, size_t count, float alphaScale, float cutoff)
+			{
+				size_t passed = 0;
+				for (size_t i = 0; i < count; i++) {
+					passed += (pixels[i * 4 + 3] * alphaScale > cutoff) ? 1 : 0;
+				}
+				return static_cast<float>(passed) / count;
+			}
+		}
+
+		/**
+		* Generate the mip chain of an RGBA8 image
+		*
+		* @param src Top level pixels
+		* @param dst Destination of the whole chain laid out as returned by getLevels, the top level is copied from src
+		* @param levels Layout of the chain, levels[0] is the size of the source image
+		* @param options (Optional) Filter, color space and alpha coverage settings
+		* @param pool (Optional) Rows of each level are distributed over the pool's threads, must be null when called from one of its jobs
+		*/
+		inline void generate(const uint8_t *src, uint8_t *dst, const std::vector<Level> &levels, const Options &options = Options(), vks::ThreadPool *pool = nullptr)
+		{
+			assert(!levels.empty());
+			if (src != dst + levels[0].offset) {
+				memcpy(dst + levels[0].offset, src, levels[0].size);
+			}
+			if (levels.size() < 2) {
+				return;
+			}
+
+			// The top level is decoded row by row while filtering the second level, all further levels are filtered from the previous level kept at full float precision
+			const float *decode = options.srgb ? detail::srgbDecodeTable() : nullptr;
+			const uint8_t *encode = options.srgb ? detail::srgbEncodeTable() : nullptr;
+			float topCoverage = 0.0f;
+			if (options.alphaCutoff > 0.0f) {
+				const size_t topCount = static_cast<size_t>(levels[0].width) * levels[0].height;
+				size_t passed = 0;
+				for (size_t i = 0; i < topCount; i++) {
+					passed += (src[i * 4 + 3] / 255.0f > options.alphaCutoff) ? 1 : 0;
+				}
+				topCoverage = static_cast<float>(passed) / topCount;
+			}
+
+			std::vector<float> current;
+			std::vector<float> horizontal;
+			std::vector<float> next;
+			for (size_t l = 1; l < levels.size(); l++) {
+				const Level &srcLevel = levels[l - 1];
+				const Level &dstLevel = levels[l];
+				const detail::Taps tapsX(options.filter, srcLevel.width, dstLevel.width);
+				const detail::Taps tapsY(options.filter, srcLevel.height, dstLevel.height);
+
+				// Horizontal pass (dst width x src height), then vertical pass (dst width x dst height)
+				horizontal.resize(static_cast<size_t>(dstLevel.width) * srcLevel.height * 4);
+				detail::parallelRows(pool, srcLevel.height, [&](uint32_t first, uint32_t last) {
+					std::vector<float> decoded((l == 1) ? srcLevel.width * 4 : 0);
+					for (uint32_t y = first; y < last; y++) {
+						const float *row;
+						if (l == 1) {
+							const uint8_t *srcRow = src + static_cast<size_t>(y) * srcLevel.width * 4;
+							for (uint32_t i = 0; i < srcLevel.width * 4; i++) {
+								decoded[i] = ((i & 3) != 3 && decode) ? decode[srcRow[i]] : srcRow[i] / 255.0f;
+							}
+							row = decoded.data();
+						} else {
+							row = current.data() + static_cast<size_t>(y) * srcLevel.width * 4;
+						}
+						float *out = horizontal.data() + static_cast<size_t>(y) * dstLevel.width * 4;
+						for (uint32_t x = 0; x < dstLevel.width; x++) {
+							detail::Pixel sum = detail::zero();
+							for (uint32_t t = 0; t < tapsX.count; t++) {
+								const size_t tap = static_cast<size_t>(x) * tapsX.count + t;
+								sum = detail::madd(sum, detail::load(row + tapsX.indices[tap] * 4), tapsX.weights[tap]);
+							}
+							detail::store(out + x * 4, sum);
+						}
+					}
+				});
+				next.resize(static_cast<size_t>(dstLevel.width) * dstLevel.height * 4);
+				detail::parallelRows(pool, dstLevel.height, [&](uint32_t first, uint32_t last) {
+					for (uint32_t y = first; y < last; y++) {
+						float *out = next.data() + static_cast<size_t>(y) * dstLevel.width * 4;
+						for (uint32_t x = 0; x < dstLevel.width; x++) {
+							detail::Pixel sum = detail::zero();
+							for (uint32_t t = 0; t < tapsY.count; t++) {
+								const size_t tap = static_cast<size_t>(y) * tapsY.count + t;
+								sum = detail::madd(sum, detail::load(horizontal.data() + (static_cast<size_t>(tapsY.indices[tap]) * dstLevel.width + x) * 4), tapsY.weights[tap]);
+							}
+							detail::store(out + x * 4, sum);
+						}
+					}
+				});
+				current.swap(next);
+
+				// Alpha scale that restores the top level's coverage, found by bisection
+				const size_t count = static_cast<size_t>(dstLevel.width) * dstLevel.height;
+				float alphaScale = 1.0f;
+				if (options.alphaCutoff > 0.0f) {
+					float low = 0.0f;
+					float high = 4.0f;
+					for (int i = 0; i < 12; i++) {
+						const float scale = (low + high) * 0.5f;
+						if (detail::coverage(current.data(), count, scale, options.alphaCutoff) < topCoverage) {
+							low = scale;
+						} else {
+							high = scale;
+						}
+					}
+					// Coverage is a step function, use whichever bound is closer
+					const float lowError = fabsf(detail::coverage(current.data(), count, low, options.alphaCutoff) - topCoverage);
+					const float highError = fabsf(detail::coverage(current.data(), count, high, options.alphaCutoff) - topCoverage);
+					alphaScale = (lowError < highError) ? low : high;
+				}
+
+				// Quantize, the unscaled float level is kept as the source of the next level
+				uint8_t *out = dst + dstLevel.offset;
+				detail::parallelRows(pool, dstLevel.height, [&](uint32_t first, uint32_t last) {
+					for (size_t i = static_cast<size_t>(first) * dstLevel.width; i < static_cast<size_t>(last) * dstLevel.width; i++) {
+						const float *p = current.data() + i * 4;
+						for (int c = 0; c < 3; c++) {
+							const float v = detail::saturate(p[c]);
+							out[i * 4 + c] = encode ? encode[static_cast<uint32_t>(v * 65535.0f + 0.5f)] : static_cast<uint8_t>(v * 255.0f + 0.5f);
+						}
+						out[i * 4 + 3] = static_cast<uint8_t>(detail::saturate(p[3] * alphaScale) * 255.0f + 0.5f);
+					}
+				});
+			}
+		}
+	}
+}
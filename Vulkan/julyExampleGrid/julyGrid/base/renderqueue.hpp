@@ -0,0 +1,198 @@
+/*
+* State sorted draw submission
+*
+* Visible draws are collected as compact packets with a 64 bit sort key (pipeline, material, mesh, depth) and radix sorted,
+* so submission only binds state when it changes and packets sharing state with contiguous index ranges are merged into one draw
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#include "vulkan/vulkan.h"
+
+namespace vks
+{
+	class RenderQueue
+	{
+	public:
+		static const uint32_t pipelineBits = 8;
+		static const uint32_t materialBits = 16;
+		static const uint32_t meshBits = 20;
+		static const uint32_t depthBits = 20;
+
+		/** @brief Indexed draw and the state it needs */
+		struct Packet
+		{
+			uint64_t key;
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			int32_t vertexOffset;
+			uint32_t pipeline;
+			uint32_t material;
+			uint32_t mesh;
+		};
+
+		/** @brief Counters of the last submit */
+		struct Statistics
+		{
+			uint32_t packets = 0;
+			uint32_t draws = 0;
+			uint32_t pipelineBinds = 0;
+			uint32_t materialBinds = 0;
+			uint32_t meshBinds = 0;
+		};
+
+		/** @brief Called with the pipeline, material or mesh index whenever the bound state has to change */
+		typedef std::function<void(uint32_t)> BindCallback;
+
+		/*
+		* Build a sort key
+		* Opaque draws sort by pipeline, material, mesh and then front to back, back to front draws (e.g. blended) sort by
+		* pipeline and then far to near so they stay correctly ordered, state changes only break ties
+		*
+		* Indices beyond the range of their key field are clamped so they can't overflow into the neighbouring fields, such packets
+		* only sort less precisely, binds and merges compare the full indices stored in the packet
+		*
+		* @param depth Non negative view distance
+		*/
+		static uint64_t makeKey(uint32_t pipeline, uint32_t material, uint32_t mesh, float depth, bool backToFront = false)
+		{
+			pipeline = std::min(pipeline, (1u << pipelineBits) - 1);
+			material = std::min(material, (1u << materialBits) - 1);
+			mesh = std::min(mesh, (1u << meshBits) - 1);
+			// Bit patterns of non negative floats are ordered like their values, the top bits keep the exponent and a part of the mantissa
+			uint32_t depthKey;
+			const float clamped = (depth > 0.0f) ? depth : 0.0f;
+			memcpy(&depthKey, &clamped, sizeof(uint32_t));
+			depthKey >>= (31 - depthBits);
+			if (backToFront) {
+				depthKey = ((1u << depthBits) - 1) - depthKey;
+				return (uint64_t(pipeline) << (64 - pipelineBits)) | (uint64_t(depthKey) << (materialBits + meshBits)) | (uint64_t(material) << meshBits) | uint64_t(mesh);
+			}
+			return (uint64_t(pipeline) << (64 - pipelineBits)) | (uint64_t(material) << (meshBits + depthBits)) | (uint64_t(mesh) << depthBits) | uint64_t(depthKey);
+		}
+
+		void clear()
+		{
+			packets.clear();
+			sorted.clear();
+		}
+
+		void add(uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t firstIndex, uint32_t indexCount, int32_t vertexOffset, float depth, bool backToFront = false)
+		{
+			packets.push_back({ makeKey(pipeline, material, mesh, depth, backToFront), firstIndex, indexCount, vertexOffset, pipeline, material, mesh });
+		}
+
+		/*
+		* Sort the packets by key and merge neighbours that share state and continue each other's index range
+		* Least significant byte first radix sort, passes over bytes that are equal for all keys are skipped
+		*/
+		void sort()
+		{
+			const size_t count = packets.size();
+			keys.resize(count);
+			scratch.resize(count);
+			// One histogram per key byte, all built in a single pass
+			uint32_t histograms[8][256];
+			memset(histograms, 0, sizeof(histograms));
+			for (size_t i = 0; i < count; i++) {
+				const uint64_t key = packets[i].key;
+				keys[i] = { key, static_cast<uint32_t>(i) };
+				for (uint32_t pass = 0; pass < 8; pass++) {
+					histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+				}
+			}
+			for (uint32_t pass = 0; (pass < 8) && (count > 1); pass++) {
+				uint32_t *histogram = histograms[pass];
+				const uint32_t shift = pass * 8;
+				if (histogram[(keys[0].key >> shift) & 0xFF] == count) {
+					continue;
+				}
+				uint32_t offset = 0;
+				for (uint32_t bucket = 0; bucket < 256; bucket++) {
+					const uint32_t bucketCount = histogram[bucket];
+					histogram[bucket] = offset;
+					offset += bucketCount;
+				}
+				for (size_t i = 0; i < count; i++) {
+					scratch[histogram[(keys[i].key >> shift) & 0xFF]++] = keys[i];
+				}
+				keys.swap(scratch);
+			}
+
+			sorted.clear();
+			for (size_t i = 0; i < count; i++) {
+				const Packet &packet = packets[keys[i].index];
+				if (!sorted.empty()) {
+					Packet &last = sorted.back();
+					if ((last.pipeline == packet.pipeline) && (last.material == packet.material) && (last.mesh == packet.mesh) &&
+						(last.vertexOffset == packet.vertexOffset) && (last.firstIndex + last.indexCount == packet.firstIndex)) {
+						last.indexCount += packet.indexCount;
+						continue;
+					}
+				}
+				sorted.push_back(packet);
+			}
+		}
+
+		/** @brief Sorted and merged packets of the last sort */
+		const std::vector<Packet> &getPackets() const
+		{
+			return sorted;
+		}
+
+		/*
+		* Record the sorted packets, state is only bound when it differs from the previous packet
+		* A pipeline change rebinds the material and mesh as the new pipeline may use a different layout
+		*/
+		void submit(VkCommandBuffer commandBuffer, const BindCallback &bindPipeline, const BindCallback &bindMaterial, const BindCallback &bindMesh)
+		{
+			statistics = Statistics();
+			statistics.packets = static_cast<uint32_t>(packets.size());
+			const Packet *previous = nullptr;
+			for (const Packet &packet : sorted) {
+				const bool pipelineChanged = !previous || (previous->pipeline != packet.pipeline);
+				if (pipelineChanged) {
+					bindPipeline(packet.pipeline);
+					statistics.pipelineBinds++;
+				}
+				if (pipelineChanged || (previous->material != packet.material)) {
+					bindMaterial(packet.material);
+					statistics.materialBinds++;
+				}
+				if (pipelineChanged || (previous->mesh != packet.mesh)) {
+					bindMesh(packet.mesh);
+					statistics.meshBinds++;
+				}
+				vkCmdDrawIndexed(commandBuffer, packet.indexCount, 1, packet.firstIndex, packet.vertexOffset, 0);
+				statistics.draws++;
+				previous = &packet;
+			}
+		}
+
+		const Statistics &getStatistics() const
+		{
+			return statistics;
+		}
+
+	private:
+		struct SortKey
+		{
+			uint64_t key;
+			uint32_t index;
+		};
+
+		std::vector<Packet> packets;
+		std::vector<Packet> sorted;
+		std::vector<SortKey> keys;
+		std::vector<SortKey> scratch;
+		Statistics statistics;
+	};
+}
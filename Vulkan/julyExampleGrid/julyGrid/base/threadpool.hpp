@@ -6,12 +6,16 @@
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
+#pragma once
+
 #include <vector>
+#include <memory>
 #include <thread>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <algorithm>
 
 // make_unique is not available in C++11
 // Taken from Herb Sutter's blog (https://herbsutter.com/gotw/_102/)
@@ -91,6 +95,12 @@ namespace vks
 			std::unique_lock<std::mutex> lock(queueMutex);
 			condition.wait(lock, [this]() { return jobQueue.empty(); });
 		}
+
+		// True if called from within one of this thread's jobs
+		bool isCurrent() const
+		{
+			return worker.get_id() == std::this_thread::get_id();
+		}
 	};
 	
 	class ThreadPool
@@ -116,6 +126,63 @@ namespace vks
 				thread->wait();
 			}
 		}
+
+		/*
+		* Split [0, count) into one contiguous range per thread and wait until all ranges have been processed
+		* Only waits for the ranges of this call, jobs added by others keep running. Calls from within a job of this pool run
+		* inline, as the calling thread can't process its own queue while it waits
+		*/
+		void parallelFor(uint32_t count, const std::function<void(uint32_t first, uint32_t last)> &function)
+		{
+			const uint32_t threadCount = static_cast<uint32_t>(threads.size());
+			if (threadCount < 2 || count < 2 * threadCount || isWorker())
+			{
+				function(0, count);
+				return;
+			}
+			const uint32_t rangeSize = (count + threadCount - 1) / threadCount;
+			const uint32_t rangeCount = (count + rangeSize - 1) / rangeSize;
+			// Shared with the jobs so the last one can still notify after the caller returned
+			auto counter = std::make_shared<Counter>();
+			counter->remaining = rangeCount;
+			for (uint32_t t = 0; t < rangeCount; t++)
+			{
+				const uint32_t first = t * rangeSize;
+				const uint32_t last = std::min(first + rangeSize, count);
+				threads[t]->addJob([&function, counter, first, last]
+				{
+					function(first, last);
+					std::lock_guard<std::mutex> lock(counter->mutex);
+					if (--counter->remaining == 0)
+					{
+						counter->condition.notify_one();
+					}
+				});
+			}
+			std::unique_lock<std::mutex> lock(counter->mutex);
+			counter->condition.wait(lock, [&counter]() { return counter->remaining == 0; });
+		}
+
+	private:
+		// Number of unfinished ranges of one parallelFor call
+		struct Counter
+		{
+			std::mutex mutex;
+			std::condition_variable condition;
+			uint32_t remaining = 0;
+		};
+
+		bool isWorker() const
+		{
+			for (auto &thread : threads)
+			{
+				if (thread->isCurrent())
+				{
+					return true;
+				}
+			}
+			return false;
+		}
 	};
 
 }
@@ -0,0 +1,140 @@
+/*
+* Flattened transform hierarchy
+*
+* Local transforms, parents and cached world matrices of a node tree stored as structure of arrays in topological order
+* (parents before children), so all world matrices are updated in a single linear pass that only touches dirty subtrees
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace vks
+{
+	class TransformHierarchy
+	{
+	public:
+		std::vector<glm::vec3> translations;
+		std::vector<glm::quat> rotations;
+		std::vector<glm::vec3> scales;
+		// Constant matrix applied after translation, rotation and scale (glTF nodes either use TRS or a matrix)
+		std::vector<glm::mat4> baseMatrices;
+		// Parent of each transform, -1 for roots, always less than the transform's own index
+		std::vector<int32_t> parents;
+		std::vector<glm::mat4> localMatrices;
+		std::vector<glm::mat4> worldMatrices;
+		// Local transform changed since the last update
+		std::vector<uint8_t> dirty;
+		// World matrix was recomputed by the last update
+		std::vector<uint8_t> changed;
+
+		/*
+		* Add a transform, parents have to be added before their children
+		*
+		* @param parent Index of the parent transform, -1 for a root
+		*
+		* @return Index of the new transform
+		*/
+		uint32_t add(int32_t parent, const glm::vec3 &translation = glm::vec3(0.0f), const glm::quat &rotation = glm::quat(), const glm::vec3 &scale = glm::vec3(1.0f), const glm::mat4 &baseMatrix = glm::mat4(1.0f))
+		{
+			const uint32_t index = static_cast<uint32_t>(parents.size());
+			assert(parent < static_cast<int32_t>(index));
+			translations.push_back(translation);
+			rotations.push_back(rotation);
+			scales.push_back(scale);
+			baseMatrices.push_back(baseMatrix);
+			parents.push_back(parent);
+			localMatrices.push_back(glm::mat4(1.0f));
+			worldMatrices.push_back(glm::mat4(1.0f));
+			dirty.push_back(1);
+			changed.push_back(0);
+			return index;
+		}
+
+		void clear()
+		{
+			translations.clear();
+			rotations.clear();
+			scales.clear();
+			baseMatrices.clear();
+			parents.clear();
+			localMatrices.clear();
+			worldMatrices.clear();
+			dirty.clear();
+			changed.clear();
+		}
+
+		size_t size() const { return parents.size(); }
+
+		void setTranslation(uint32_t index, const glm::vec3 &translation)
+		{
+			translations[index] = translation;
+			dirty[index] = 1;
+		}
+
+		void setRotation(uint32_t index, const glm::quat &rotation)
+		{
+			rotations[index] = rotation;
+			dirty[index] = 1;
+		}
+
+		void setScale(uint32_t index, const glm::vec3 &scale)
+		{
+			scales[index] = scale;
+			dirty[index] = 1;
+		}
+
+		void markDirty(uint32_t index)
+		{
+			dirty[index] = 1;
+		}
+
+		glm::mat4 getLocalMatrix(uint32_t index) const
+		{
+			return glm::translate(glm::mat4(1.0f), translations[index]) * glm::mat4_cast(rotations[index]) * glm::scale(glm::mat4(1.0f), scales[index]) * baseMatrices[index];
+		}
+
+		/** @brief World matrix as of the last update */
+		const glm::mat4 &getWorldMatrix(uint32_t index) const
+		{
+			return worldMatrices[index];
+		}
+
+		bool isChanged(uint32_t index) const
+		{
+			return changed[index] != 0;
+		}
+
+		/*
+		* Recompute the world matrices of all dirty transforms and their descendants
+		* A transform whose parent changed only needs one matrix product, its local matrix is reused
+		*
+		* @return True if any world matrix changed, see isChanged for which ones
+		*/
+		bool update()
+		{
+			bool anyChanged = false;
+			for (size_t i = 0; i < parents.size(); i++) {
+				const int32_t parent = parents[i];
+				changed[i] = dirty[i] || ((parent >= 0) && changed[parent]);
+				if (!changed[i]) {
+					continue;
+				}
+				if (dirty[i]) {
+					localMatrices[i] = getLocalMatrix(static_cast<uint32_t>(i));
+					dirty[i] = 0;
+				}
+				worldMatrices[i] = (parent >= 0) ? worldMatrices[parent] * localMatrices[i] : localMatrices[i];
+				anyChanged = true;
+			}
+			return anyChanged;
+		}
+	};
+}
@@ -0,0 +1,269 @@
+/*
+* Virtual file system
+*
+* Single entry point for reading assets, files are looked up in the mounted archives first and read from disk otherwise
+* Raw archive entries and loose files are returned mapped in place, compressed entries are decompressed into a private buffer
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <unordered_set>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mappedfile.hpp"
+#include "assetarchive.hpp"
+
+namespace vks
+{
+	namespace vfs
+	{
+		class File;
+		inline File open(const std::string &filename);
+
+		/** @brief Contents of an opened file, pointers into mounted archives stay valid until the archive is unmounted */
+		class File
+		{
+		private:
+			std::unique_ptr<MappedFile> file;
+			MappedFile::View view;
+			std::vector<uint8_t> buffer;
+			const uint8_t *ptr = nullptr;
+			size_t fileSize = 0;
+			bool opened = false;
+			bool mapped = false;
+
+			friend File open(const std::string &filename);
+
+		public:
+			File() {}
+			File(File&&) = default;
+			File &operator=(File&&) = default;
+
+			const uint8_t *data() const { return ptr; }
+			size_t size() const { return fileSize; }
+			bool valid() const { return opened; }
+			/** @brief True if the contents are read in place from a mapping instead of a private copy */
+			bool isMapped() const { return mapped; }
+		};
+
+		namespace detail
+		{
+			struct Mount
+			{
+				std::string prefix;
+				std::unique_ptr<archive::Archive> archive;
+				// Modification time of the archive file when it was mounted
+				int64_t modified = 0;
+			};
+
+			struct State
+			{
+				std::vector<Mount> mounts;
+				std::mutex logMutex;
+				std::ofstream accessLog;
+				std::string accessLogRoot;
+				std::unordered_set<std::string> logged;
+			};
+
+			inline State &getState()
+			{
+				static State state;
+				return state;
+			}
+
+			/** @brief Path relative to root, false if the path is outside of it */
+			inline bool getRelativePath(const std::string &root, const std::string &path, std::string &relative)
+			{
+				if (root.empty()) {
+					relative = path;
+					return true;
+				}
+				if ((path.size() > root.size()) && (path.compare(0, root.size(), root) == 0) && (path[root.size()] == '/')) {
+					relative = path.substr(root.size() + 1);
+					return true;
+				}
+				return false;
+			}
+
+			/** @brief Size and modification time of a file on disk */
+			inline bool getFileStat(const std::string &filename, uint64_t &size, int64_t &modified)
+			{
+#if defined(_WIN32)
+				struct _stat64 fileStat;
+				if (_stat64(filename.c_str(), &fileStat) != 0)
+#else
+				struct stat fileStat;
+				if (::stat(filename.c_str(), &fileStat) != 0)
+#endif
+				{
+					return false;
+				}
+				size = static_cast<uint64_t>(fileStat.st_size);
+				modified = static_cast<int64_t>(fileStat.st_mtime);
+				return true;
+			}
+
+			inline void logAccess(const std::string &path)
+			{
+				State &state = getState();
+				std::lock_guard<std::mutex> lock(state.logMutex);
+				std::string relative;
+				if (state.accessLog.is_open() && getRelativePath(state.accessLogRoot, path, relative) && state.logged.insert(relative).second) {
+					state.accessLog << relative << std::endl;
+				}
+			}
+		}
+
+		/*
+		* Mount an archive, files below the prefix are looked up in the archive before the disk
+		* Archives mounted later take precedence, mount before loading starts as lookups don't lock the mount table
+		*
+		* @param archiveFile Archive written by the asset packer
+		* @param prefix (Optional) Directory the archive contents appear in, usually the asset path
+		* @param prefetch (Optional) Read the whole archive ahead of its first use
+		*
+		* @return False if the archive can't be opened
+		*/
+		inline bool mount(const std::string &archiveFile, const std::string &prefix = "", bool prefetch = true)
+		{
+			detail::Mount mount;
+			mount.archive.reset(new archive::Archive());
+			if (!mount.archive->open(archiveFile)) {
+				return false;
+			}
+			if (prefetch) {
+				mount.archive->prefetch();
+			}
+			uint64_t size;
+			detail::getFileStat(archiveFile, size, mount.modified);
+			mount.prefix = archive::normalizePath(prefix);
+			std::vector<detail::Mount> &mounts = detail::getState().mounts;
+			mounts.insert(mounts.begin(), std::move(mount));
+			return true;
+		}
+
+		/** @brief Unmount all archives, files opened from them must have been released */
+		inline void unmountAll()
+		{
+			detail::getState().mounts.clear();
+		}
+
+		/*
+		* Record the first access of every file below root, in the order they are opened
+		* The list is passed to the asset packer with -order so the archive layout follows the load order
+		*/
+		inline bool recordAccesses(const std::string &logFile, const std::string &root = "")
+		{
+			detail::State &state = detail::getState();
+			std::lock_guard<std::mutex> lock(state.logMutex);
+			state.accessLog.open(logFile);
+			state.accessLogRoot = archive::normalizePath(root);
+			state.logged.clear();
+			return state.accessLog.is_open();
+		}
+
+		/** @brief Open a file from the mounted archives or the disk, the returned file is invalid if neither contains it */
+		inline File open(const std::string &filename)
+		{
+			File file;
+			const std::string path = archive::normalizePath(filename);
+			detail::logAccess(path);
+			for (const detail::Mount &mount : detail::getState().mounts) {
+				std::string relative;
+				const archive::Entry *entry = detail::getRelativePath(mount.prefix, path, relative) ? mount.archive->find(relative) : nullptr;
+				if (!entry) {
+					continue;
+				}
+				file.fileSize = static_cast<size_t>(entry->size);
+				if (entry->compression == archive::compressionNone) {
+					file.ptr = mount.archive->getData(*entry);
+					file.mapped = true;
+				} else {
+					file.buffer.resize(file.fileSize);
+					if (!mount.archive->extract(*entry, file.buffer.data())) {
+						std::cerr << "Corrupt archive entry " << relative << std::endl;
+						return File();
+					}
+					file.ptr = file.buffer.data();
+				}
+				file.opened = true;
+				return file;
+			}
+			file.file.reset(new MappedFile());
+			if (!file.file->open(filename)) {
+				return File();
+			}
+			file.view = file.file->map();
+			file.ptr = file.view.data();
+			file.fileSize = file.view.size();
+			file.opened = true;
+			file.mapped = true;
+			return file;
+		}
+
+		/** @brief Size and version of a file as returned by open */
+		struct FileInfo
+		{
+			uint64_t size = 0;
+			// Changes whenever the contents may have changed, derived from the archive file and the entry's location for archived files
+			// and from the modification time for files on disk
+			uint64_t stamp = 0;
+			bool archived = false;
+		};
+
+		/*
+		* Get the size and version of a file without opening it, looked up in the same order as open
+		* Used to validate data derived from a file (e.g. cooked caches) against the source that would actually be loaded
+		*
+		* @return False if neither a mounted archive nor the disk contain the file
+		*/
+		inline bool stat(const std::string &filename, FileInfo &info)
+		{
+			const std::string path = archive::normalizePath(filename);
+			for (const detail::Mount &mount : detail::getState().mounts) {
+				std::string relative;
+				const archive::Entry *entry = detail::getRelativePath(mount.prefix, path, relative) ? mount.archive->find(relative) : nullptr;
+				if (!entry) {
+					continue;
+				}
+				info.size = entry->size;
+				info.stamp = archive::hashPath(mount.prefix);
+				for (uint64_t value : { static_cast<uint64_t>(mount.modified), entry->offset, entry->storedSize, static_cast<uint64_t>(entry->compression) }) {
+					info.stamp = (info.stamp ^ value) * 0x100000001b3ull;
+				}
+				info.archived = true;
+				return true;
+			}
+			int64_t modified;
+			if (!detail::getFileStat(filename, info.size, modified)) {
+				return false;
+			}
+			info.stamp = static_cast<uint64_t>(modified);
+			info.archived = false;
+			return true;
+		}
+
+		/** @brief True if the file is in a mounted archive or on disk */
+		inline bool exists(const std::string &filename)
+		{
+			const std::string path = archive::normalizePath(filename);
+			for (const detail::Mount &mount : detail::getState().mounts) {
+				std::string relative;
+				if (detail::getRelativePath(mount.prefix, path, relative) && mount.archive->find(relative)) {
+					return true;
+				}
+			}
+			MappedFile file;
+			return file.open(filename);
+		}
+	}
+}
@@ -204,6 +204,9 @@ void VulkanExampleBase::prepare()
 		UIOverlay.prepareResources();
 		UIOverlay.preparePipeline(pipelineCache, renderPass);
 	}
+	if (settings.assetStreaming) {
+		assetStreamer = new vks::AssetStreamer(vulkanDevice, queue, settings.assetUploadBudget);
+	}
 }
 
 VkPipelineShaderStageCreateInfo VulkanExampleBase::loadShader(std::string fileName, VkShaderStageFlagBits stage)
@@ -619,6 +622,10 @@ void VulkanExampleBase::drawUI(const VkCommandBuffer commandBuffer)
 
 void VulkanExampleBase::prepareFrame()
 {
+	// Record the uploads of assets that finished loading, metered to the per frame budget
+	if (assetStreamer) {
+		assetStreamer->update();
+	}
 	// Acquire the next image from the swap chain
 	VkResult err = swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer);
 	// Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
@@ -660,6 +667,8 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 #endif
 		exit(-1);
 	}
+	// Assets are read from the packed archive if it has been built (packAssets target), loose files are used otherwise
+	vks::vfs::mount(getAssetPath() + "assets.vpk", getAssetPath());
 #endif
 
 	settings.validation = enableValidation;
@@ -675,6 +684,10 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 		if (args[i] == std::string("-vsync")) {
 			settings.vsync = true;
 		}
+		// Write the order assets are loaded in, the asset packer lays out the archive in this order
+		if (args[i] == std::string("--recordassets")) {
+			vks::vfs::recordAccesses(getAssetPath() + "assets.order", getAssetPath());
+		}
 		if ((args[i] == std::string("-f")) || (args[i] == std::string("--fullscreen"))) {
 			settings.fullscreen = true;
 		}
@@ -790,6 +803,8 @@ VulkanExampleBase::~VulkanExampleBase()
 		UIOverlay.freeResources();
 	}
 
+	delete assetStreamer;
+
 	delete vulkanDevice;
 
 	if (settings.validation)
@@ -2020,6 +2035,13 @@ void VulkanExampleBase::setupDepthStencil()
 	image.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 	image.flags = 0;
 
+	// Allow sampling the depth buffer (e.g. for building a Hi-Z pyramid) if supported by the format
+	VkFormatProperties formatProps;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, depthFormat, &formatProps);
+	if (formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) {
+		image.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+	}
+
 	VkMemoryAllocateInfo mem_alloc = {};
 	mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	mem_alloc.pNext = NULL;
@@ -53,6 +53,7 @@
 #include "VulkanSwapChain.hpp"
 #include "camera.hpp"
 #include "benchmark.hpp"
+#include "VulkanAssetStreamer.hpp"
 
 class VulkanExampleBase
 {
@@ -157,8 +158,15 @@ public:
 		bool vsync = false;
 		/** @brief Enable UI overlay */
 		bool overlay = false;
+		/** @brief Create the asset streamer in prepare, set by examples that load assets in the background */
+		bool assetStreaming = false;
+		/** @brief Maximum number of bytes the asset streamer uploads per frame */
+		VkDeviceSize assetUploadBudget = 8 * 1024 * 1024;
 	} settings;
 
+	/** @brief Background loader for assets requested with priorities, updated once per frame in prepareFrame (null unless settings.assetStreaming is set) */
+	vks::AssetStreamer *assetStreamer = nullptr;
+
 	VkClearColorValue defaultClearColor = { { 0.025f, 0.025f, 0.025f, 1.0f } };
 
 	float zoom = 0;
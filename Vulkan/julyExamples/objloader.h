@@ -0,0 +1,375 @@
+/*
+* Multi threaded Wavefront OBJ loader
+*
+* The file is read through the virtual file system (mapped in place where possible) and split into one line aligned chunk per thread, each chunk is parsed independently
+* and the results are concatenated into arrays that are sized up front
+* Vertices are deduplicated on their (position, texcoord, normal) index triples with an open addressing hash table
+*
+* Only geometry is read (v, vt, vn and f), polygons are triangulated as fans, materials and groups are ignored
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "vfs.hpp"
+
+namespace obj {
+
+  /** @brief Indices of one triangle corner into the position, texcoord and normal arrays, -1 if not present */
+  struct Index {
+    int32_t position;
+    int32_t texcoord;
+    int32_t normal;
+
+    bool operator==(const Index& other) const {
+      return position == other.position && texcoord == other.texcoord && normal == other.normal;
+    }
+  };
+
+  struct Mesh {
+    // Three floats per position and normal, two per texcoord
+    std::vector<float> positions;
+    std::vector<float> texcoords;
+    std::vector<float> normals;
+    // Three corners per triangle
+    std::vector<Index> indices;
+
+    size_t positionCount() const { return positions.size() / 3; }
+    size_t texcoordCount() const { return texcoords.size() / 2; }
+    size_t normalCount() const { return normals.size() / 3; }
+  };
+
+  namespace detail {
+
+    inline bool isSpace(char c) {
+      return c == ' ' || c == '\t';
+    }
+
+    inline void skipSpaces(const char*& p, const char* end) {
+      while (p < end && isSpace(*p)) {
+        p++;
+      }
+    }
+
+    inline void skipLine(const char*& p, const char* end) {
+      while (p < end && *p != '\n') {
+        p++;
+      }
+      if (p < end) {
+        p++;
+      }
+    }
+
+    inline bool parseInt(const char*& p, const char* end, int32_t& value) {
+      bool negative = false;
+      if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+      }
+      if (p >= end || *p < '0' || *p > '9') {
+        return false;
+      }
+      int32_t result = 0;
+      while (p < end && *p >= '0' && *p <= '9') {
+        result = result * 10 + (*p - '0');
+        p++;
+      }
+      value = negative ? -result : result;
+      return true;
+    }
+
+    // Locale independent and much faster than strtof, exact for the short decimals OBJ exporters write
+    inline float parseFloat(const char*& p, const char* end) {
+      static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+      skipSpaces(p, end);
+      bool negative = false;
+      if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+      }
+      uint64_t mantissa = 0;
+      int32_t exponent = 0;
+      int32_t digits = 0;
+      while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 18) {
+          mantissa = mantissa * 10 + (*p - '0');
+          digits += (mantissa > 0) ? 1 : 0;
+        } else {
+          exponent++;
+        }
+        p++;
+      }
+      if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+          if (digits < 18) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += (mantissa > 0) ? 1 : 0;
+            exponent--;
+          }
+          p++;
+        }
+      }
+      if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int32_t e = 0;
+        if (parseInt(p, end, e)) {
+          exponent += e;
+        }
+      }
+      double value = static_cast<double>(mantissa);
+      while (exponent > 18) {
+        value *= 1e18;
+        exponent -= 18;
+      }
+      while (exponent < -18) {
+        value /= 1e18;
+        exponent += 18;
+      }
+      value = (exponent >= 0) ? value * powers[exponent] : value / powers[-exponent];
+      return static_cast<float>(negative ? -value : value);
+    }
+
+    /*
+      Result of parsing one chunk
+      Positive OBJ indices are absolute and stored zero based, negative ones are relative to the elements
+      defined so far and are stored biased by relativeBias until the chunk's base offsets are known
+      Relative indices can point to elements of previous chunks, so chunk local indices may be negative
+    */
+    struct Chunk {
+      std::vector<float> positions;
+      std::vector<float> texcoords;
+      std::vector<float> normals;
+      std::vector<Index> indices;
+    };
+
+    const int32_t relativeBias = -(1 << 30);
+
+    inline int32_t encodeIndex(int32_t value, size_t localCount) {
+      if (value > 0) {
+        return value - 1;
+      }
+      if (value < 0) {
+        return relativeBias + static_cast<int32_t>(localCount) + value;
+      }
+      return -1;
+    }
+
+    inline int32_t resolveIndex(int32_t value, size_t base) {
+      return (value < -1) ? static_cast<int32_t>(base) + (value - relativeBias) : value;
+    }
+
+    inline void parseChunk(const char* p, const char* end, Chunk& chunk) {
+      // A rough guess of 40 bytes per line avoids most reallocations
+      const size_t estimate = static_cast<size_t>(end - p) / 40;
+      chunk.positions.reserve(estimate * 3);
+      chunk.indices.reserve(estimate * 3);
+      std::vector<Index> polygon;
+      while (p < end) {
+        skipSpaces(p, end);
+        if (p + 1 >= end) {
+          break;
+        }
+        if (p[0] == 'v' && isSpace(p[1])) {
+          p++;
+          for (int i = 0; i < 3; i++) {
+            chunk.positions.push_back(parseFloat(p, end));
+          }
+        } else if (p[0] == 'v' && p[1] == 't' && p + 2 < end && isSpace(p[2])) {
+          p += 2;
+          for (int i = 0; i < 2; i++) {
+            chunk.texcoords.push_back(parseFloat(p, end));
+          }
+        } else if (p[0] == 'v' && p[1] == 'n' && p + 2 < end && isSpace(p[2])) {
+          p += 2;
+          for (int i = 0; i < 3; i++) {
+            chunk.normals.push_back(parseFloat(p, end));
+          }
+        } else if (p[0] == 'f' && isSpace(p[1])) {
+          p++;
+          polygon.clear();
+          while (true) {
+            skipSpaces(p, end);
+            int32_t value;
+            if (!parseInt(p, end, value)) {
+              break;
+            }
+            Index index = { encodeIndex(value, chunk.positions.size() / 3), -1, -1 };
+            if (p < end && *p == '/') {
+              p++;
+              if (parseInt(p, end, value)) {
+                index.texcoord = encodeIndex(value, chunk.texcoords.size() / 2);
+              }
+              if (p < end && *p == '/') {
+                p++;
+                if (parseInt(p, end, value)) {
+                  index.normal = encodeIndex(value, chunk.normals.size() / 3);
+                }
+              }
+            }
+            polygon.push_back(index);
+          }
+          for (size_t i = 2; i < polygon.size(); i++) {
+            chunk.indices.push_back(polygon[0]);
+            chunk.indices.push_back(polygon[i - 1]);
+            chunk.indices.push_back(polygon[i]);
+          }
+        }
+        skipLine(p, end);
+      }
+    }
+
+    inline uint32_t hashIndex(const Index& index) {
+      uint32_t h = static_cast<uint32_t>(index.position) * 0x9E3779B1u;
+      h ^= static_cast<uint32_t>(index.texcoord) * 0x85EBCA77u;
+      h ^= static_cast<uint32_t>(index.normal) * 0xC2B2AE3Du;
+      return h ^ (h >> 15);
+    }
+  }
+
+  /**
+  * Parse an OBJ file
+  *
+  * @param filename Path of the file
+  * @param threadCount (Optional) Number of parsing threads, defaults to the number of cores
+  *
+  * @throws std::runtime_error if the file can't be opened or references elements that don't exist
+  */
+  inline Mesh load(const std::string& filename, uint32_t threadCount = 0) {
+    vks::vfs::File file = vks::vfs::open(filename);
+    if (!file.valid()) {
+      throw std::runtime_error("failed to open " + filename);
+    }
+    Mesh mesh;
+    if (file.size() == 0) {
+      return mesh;
+    }
+    const char* begin = reinterpret_cast<const char*>(file.data());
+    const char* end = begin + file.size();
+
+    // Small files aren't worth the thread start up
+    if (threadCount == 0) {
+      threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount = static_cast<uint32_t>(std::max<size_t>(std::min<size_t>(threadCount, file.size() / (1024 * 1024)), 1));
+
+    // Chunk boundaries are moved to the start of the next line
+    std::vector<const char*> bounds(threadCount + 1, end);
+    bounds[0] = begin;
+    for (uint32_t i = 1; i < threadCount; i++) {
+      const char* p = std::max(begin + file.size() * i / threadCount, bounds[i - 1]);
+      detail::skipLine(p, end);
+      bounds[i] = p;
+    }
+
+    std::vector<detail::Chunk> chunks(threadCount);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < threadCount; i++) {
+      threads.emplace_back(detail::parseChunk, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+    }
+    detail::parseChunk(bounds[0], bounds[1], chunks[0]);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    size_t positionCount = 0, texcoordCount = 0, normalCount = 0, indexCount = 0;
+    for (const auto& chunk : chunks) {
+      positionCount += chunk.positions.size();
+      texcoordCount += chunk.texcoords.size();
+      normalCount += chunk.normals.size();
+      indexCount += chunk.indices.size();
+    }
+    mesh.positions.resize(positionCount);
+    mesh.texcoords.resize(texcoordCount);
+    mesh.normals.resize(normalCount);
+    mesh.indices.resize(indexCount);
+
+    // Concatenate the chunks and resolve relative indices, each chunk is copied by its own thread
+    auto merge = [&](uint32_t c, size_t positionOffset, size_t texcoordOffset, size_t normalOffset, size_t indexOffset) {
+      detail::Chunk& chunk = chunks[c];
+      std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.positions.begin() + positionOffset);
+      std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), mesh.texcoords.begin() + texcoordOffset);
+      std::copy(chunk.normals.begin(), chunk.normals.end(), mesh.normals.begin() + normalOffset);
+      Index* dst = mesh.indices.data() + indexOffset;
+      for (const Index& index : chunk.indices) {
+        dst->position = detail::resolveIndex(index.position, positionOffset / 3);
+        dst->texcoord = detail::resolveIndex(index.texcoord, texcoordOffset / 2);
+        dst->normal = detail::resolveIndex(index.normal, normalOffset / 3);
+        dst++;
+      }
+      chunk = detail::Chunk();
+    };
+    threads.clear();
+    size_t positionOffset = 0, texcoordOffset = 0, normalOffset = 0, indexOffset = 0;
+    for (uint32_t i = 0; i < threadCount; i++) {
+      const detail::Chunk& chunk = chunks[i];
+      const size_t positionSize = chunk.positions.size(), texcoordSize = chunk.texcoords.size(), normalSize = chunk.normals.size(), indexSize = chunk.indices.size();
+      threads.emplace_back(merge, i, positionOffset, texcoordOffset, normalOffset, indexOffset);
+      positionOffset += positionSize;
+      texcoordOffset += texcoordSize;
+      normalOffset += normalSize;
+      indexOffset += indexSize;
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    for (const Index& index : mesh.indices) {
+      if (index.position < 0 || static_cast<size_t>(index.position) >= mesh.positionCount() ||
+        static_cast<size_t>(index.texcoord + 1) > mesh.texcoordCount() || static_cast<size_t>(index.normal + 1) > mesh.normalCount()) {
+        throw std::runtime_error("invalid index in " + filename);
+      }
+    }
+    return mesh;
+  }
+
+  /**
+  * Build an indexed vertex list, corners that share the same position, texcoord and normal indices share one vertex
+  *
+  * @param mesh Parsed OBJ mesh
+  * @param vertices Unique vertices are appended to this array
+  * @param indices One index per triangle corner is appended to this array
+  * @param makeVertex Callable that creates a vertex from an obj::Index
+  */
+  template<typename Vertex, typename MakeVertex>
+  void buildIndexed(const Mesh& mesh, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, MakeVertex makeVertex) {
+    const size_t cornerCount = mesh.indices.size();
+    // Most meshes have about as many unique vertices as positions
+    vertices.reserve(vertices.size() + std::max(mesh.positionCount(), cornerCount / 6));
+    indices.reserve(indices.size() + cornerCount);
+
+    // Power of two table with at most 50% load, keys and values are stored next to each other for cache friendly probing
+    struct Slot {
+      Index key;
+      uint32_t vertex;
+    };
+    size_t capacity = 16;
+    while (capacity < cornerCount * 2) {
+      capacity *= 2;
+    }
+    const size_t mask = capacity - 1;
+    std::vector<Slot> table(capacity, Slot{ { -1, -1, -1 }, UINT32_MAX });
+
+    for (const Index& index : mesh.indices) {
+      size_t slot = detail::hashIndex(index) & mask;
+      while (table[slot].vertex != UINT32_MAX && !(table[slot].key == index)) {
+        slot = (slot + 1) & mask;
+      }
+      if (table[slot].vertex == UINT32_MAX) {
+        table[slot].key = index;
+        table[slot].vertex = static_cast<uint32_t>(vertices.size());
+        vertices.push_back(makeVertex(index));
+      }
+      indices.push_back(table[slot].vertex);
+    }
+  }
+}
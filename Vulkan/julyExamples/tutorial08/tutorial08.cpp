@@ -5,16 +5,16 @@
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
-#define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtx/hash.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+#include "objloader.h"
+#include "mipgen.hpp"
+#include "ktxfile.hpp"
+#include "vfs.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -27,7 +27,6 @@
 #include <array>
 #include "optional.h"
 #include <set>
-#include <unordered_map>
 
 
 const int WIDTH = 800;
@@ -141,20 +140,8 @@ struct Vertex {
 
     return attributeDescriptions;
   }
-
-  bool operator==(const Vertex& other) const {
-    return pos == other.pos && color == other.color && texCoord == other.texCoord;
-  }
 };
 
-namespace std {
-  template<> struct hash<Vertex> {
-    size_t operator()(Vertex const& vertex) const {
-      return ((hash<glm::vec3>()(vertex.pos) ^ (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.texCoord) << 1);
-    }
-  };
-}
-
 struct UniformBufferObject {
   alignas(16) glm::mat4 model;
   alignas(16) glm::mat4 view;
@@ -179,6 +166,7 @@ private:
 
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
   VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+  VkPhysicalDeviceFeatures deviceFeatures = {};
   VkDevice device;
 
   VkQueue graphicsQueue;
@@ -207,6 +195,7 @@ private:
   VkImageView depthImageView;
 
   uint32_t mipLevels;
+  VkFormat textureFormat = VK_FORMAT_R8G8B8A8_UNORM;
   VkImage textureImage;
   VkDeviceMemory textureImageMemory;
   VkImageView textureImageView;
@@ -250,6 +239,7 @@ private:
   }
 
   void initVulkan() {
+    mountAssets();
     createInstance();
     setupDebugMessenger();
     createSurface();
@@ -473,8 +463,14 @@ private:
       queueCreateInfos.push_back(queueCreateInfo);
     }
 
-    VkPhysicalDeviceFeatures deviceFeatures = {};
+    // Block compression is enabled where available so cooked texture variants can be used
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    deviceFeatures = {};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+    deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+    deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
 
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -872,23 +868,47 @@ private:
     return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
   }
 
+  void mountAssets() {
+    // Serve all assets from the packed archive if it has been built (packAssets target), loose files are used otherwise
+    if (vks::vfs::mount(getAssetPath() + "assets.vpk", getAssetPath())) {
+      std::cout << "Loading assets from " << getAssetPath() << "assets.vpk" << std::endl;
+    }
+  }
+
   void createTextureImage() {
+    // A cooked block compressed variant needs no decoding and already contains its mip chain
+    vks::ktx::Image cookedImage;
+    if (!vks::ktx::loadVariant(physicalDevice, deviceFeatures, TEXTURE_PATH, cookedImage).empty()) {
+      createCompressedTextureImage(cookedImage);
+      return;
+    }
+
     int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    vks::vfs::File textureFile = vks::vfs::open(TEXTURE_PATH);
+    stbi_uc* pixels = textureFile.valid() ? stbi_load_from_memory(textureFile.data(), static_cast<int>(textureFile.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha) : nullptr;
     mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
     if (!pixels) {
       throw std::runtime_error("failed to load texture image!");
     }
 
+    // Without linear blit support the whole mip chain is generated on the CPU and uploaded at once
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+    const bool blitMipmaps = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) &&
+      (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT) && (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
+    const std::vector<vks::mipgen::Level> levels = vks::mipgen::getLevels(texWidth, texHeight, blitMipmaps ? 1 : mipLevels);
+    VkDeviceSize imageSize = vks::mipgen::getSize(levels);
+
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingBufferMemory;
     createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
     void* data;
     vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
+    vks::mipgen::Options mipOptions;
+    mipOptions.srgb = true;
+    vks::mipgen::generate(pixels, static_cast<uint8_t*>(data), levels, mipOptions);
     vkUnmapMemory(device, stagingBufferMemory);
 
     stbi_image_free(pixels);
@@ -896,13 +916,42 @@ private:
     createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
 
     transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-    copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-    //transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
+    copyBufferToImage(stagingBuffer, textureImage, levels);
 
     vkDestroyBuffer(device, stagingBuffer, nullptr);
     vkFreeMemory(device, stagingBufferMemory, nullptr);
 
-    generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
+    if (blitMipmaps) {
+      //transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
+      generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
+    }
+    else {
+      transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+    }
+  }
+
+  void createCompressedTextureImage(const vks::ktx::Image& image) {
+    textureFormat = image.format;
+    mipLevels = static_cast<uint32_t>(image.levels.size());
+    VkDeviceSize imageSize = image.data.size();
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+    void* data;
+    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+    memcpy(data, image.data.data(), static_cast<size_t>(imageSize));
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    createImage(image.width, image.height, mipLevels, VK_SAMPLE_COUNT_1_BIT, textureFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+
+    transitionImageLayout(textureImage, textureFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+    copyBufferToImage(stagingBuffer, textureImage, image.levels);
+    transitionImageLayout(textureImage, textureFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingBufferMemory, nullptr);
   }
 
   void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
@@ -1008,7 +1057,7 @@ private:
   }
 
   void createTextureImageView() {
-    textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+    textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
   }
 
   void createTextureSampler() {
@@ -1163,66 +1212,55 @@ private:
     endSingleTimeCommands(commandBuffer);
   }
 
-  void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
+  void copyBufferToImage(VkBuffer buffer, VkImage image, const std::vector<vks::mipgen::Level>& levels) {
     VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
-    VkBufferImageCopy region = {};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = { 0, 0, 0 };
-    region.imageExtent = {
-      width,
-      height,
-      1
-    };
-
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    std::vector<VkBufferImageCopy> regions(levels.size());
+    for (uint32_t i = 0; i < levels.size(); i++) {
+      VkBufferImageCopy& region = regions[i];
+      region.bufferOffset = levels[i].offset;
+      region.bufferRowLength = 0;
+      region.bufferImageHeight = 0;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel = i;
+      region.imageSubresource.baseArrayLayer = 0;
+      region.imageSubresource.layerCount = 1;
+      region.imageOffset = { 0, 0, 0 };
+      region.imageExtent = {
+        levels[i].width,
+        levels[i].height,
+        1
+      };
+    }
+
+    vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
 
     endSingleTimeCommands(commandBuffer);
   }
 
   void loadModel() {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn, err;
-
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str())) {
-      throw std::runtime_error(warn + err);
-    }
-
-    std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
-
-    for (const auto& shape : shapes) {
-      for (const auto& index : shape.mesh.indices) {
-        Vertex vertex = {};
-
-        vertex.pos = {
-          attrib.vertices[3 * index.vertex_index + 0],
-          attrib.vertices[3 * index.vertex_index + 1],
-          attrib.vertices[3 * index.vertex_index + 2]
-        };
+    // Vertices are deduplicated on their OBJ index triples, so no float compares or hashes are needed
+    const obj::Mesh mesh = obj::load(MODEL_PATH);
+    obj::buildIndexed(mesh, vertices, indices, [&mesh](const obj::Index& index) {
+      Vertex vertex = {};
+
+      vertex.pos = {
+        mesh.positions[3 * index.position + 0],
+        mesh.positions[3 * index.position + 1],
+        mesh.positions[3 * index.position + 2]
+      };
 
+      if (index.texcoord >= 0) {
         vertex.texCoord = {
-          attrib.texcoords[2 * index.texcoord_index + 0],
-          1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+          mesh.texcoords[2 * index.texcoord + 0],
+          1.0f - mesh.texcoords[2 * index.texcoord + 1]
         };
+      }
 
-        vertex.color = { 1.0f, 1.0f, 1.0f };
-
-        if (uniqueVertices.count(vertex) == 0) {
-          uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-          vertices.push_back(vertex);
-        }
+      vertex.color = { 1.0f, 1.0f, 1.0f };
 
-        indices.push_back(uniqueVertices[vertex]);
-      }
-    }
+      return vertex;
+    });
   }
 
   void createVertexBuffer() {
@@ -1774,21 +1812,14 @@ private:
   }
 
   static std::vector<char> readFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    vks::vfs::File file = vks::vfs::open(filename);
 
-    if (!file.is_open()) {
+    if (!file.valid()) {
       throw std::runtime_error("failed to open file!");
     }
 
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<char> buffer(fileSize);
-
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-
-    file.close();
-
-    return buffer;
+    const char* data = reinterpret_cast<const char*>(file.data());
+    return std::vector<char>(data, data + file.size());
   }
 
   static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData) {
@@ -0,0 +1,213 @@
+/*
+* Asset packer
+*
+* Packs a data folder into a single archive that vks::vfs::mount serves all asset loads from
+* Entries listed in the order file (see vks::vfs::recordAccesses) are written first and in that order, the rest follows sorted by path
+* Already compressed formats are stored raw so they can be read in place from the mapped archive
+*
+* Usage: assetpacker [-order listfile] [-raw ext,ext,...] [-store] -o archive root
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "threadpool.hpp"
+#include "assetarchive.hpp"
+
+struct PackSettings {
+	std::string orderFile;
+	// Extensions of formats that don't compress any further, or that are read in place
+	std::set<std::string> rawExtensions = { "jpg", "jpeg", "png", "ktx", "ktx2", "dds" };
+	bool store = false;
+	std::string output;
+	std::string root;
+};
+
+static void printUsage()
+{
+	std::cout << "Usage: assetpacker [-order listfile] [-raw ext,ext,...] [-store] -o archive root\n";
+}
+
+/** @brief Collect the paths of all files below root relative to it */
+static void listFiles(const std::string &root, const std::string &directory, std::vector<std::string> &files)
+{
+	const std::string path = directory.empty() ? root : root + "/" + directory;
+#if defined(_WIN32)
+	WIN32_FIND_DATAA findData;
+	HANDLE find = FindFirstFileA((path + "/*").c_str(), &findData);
+	if (find == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	do {
+		const std::string name = findData.cFileName;
+		if ((name == ".") || (name == "..")) {
+			continue;
+		}
+		const std::string relative = directory.empty() ? name : directory + "/" + name;
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			listFiles(root, relative, files);
+		} else {
+			files.push_back(relative);
+		}
+	} while (FindNextFileA(find, &findData));
+	FindClose(find);
+#else
+	DIR *dir = opendir(path.c_str());
+	if (!dir) {
+		return;
+	}
+	while (dirent *entry = readdir(dir)) {
+		const std::string name = entry->d_name;
+		if ((name == ".") || (name == "..")) {
+			continue;
+		}
+		const std::string relative = directory.empty() ? name : directory + "/" + name;
+		struct stat info;
+		if (stat((root + "/" + relative).c_str(), &info) != 0) {
+			continue;
+		}
+		if (S_ISDIR(info.st_mode)) {
+			listFiles(root, relative, files);
+		} else if (S_ISREG(info.st_mode)) {
+			files.push_back(relative);
+		}
+	}
+	closedir(dir);
+#endif
+}
+
+static std::string getExtension(const std::string &path)
+{
+	const size_t extension = path.find_last_of('.');
+	const size_t separator = path.find_last_of('/');
+	if ((extension == std::string::npos) || ((separator != std::string::npos) && (extension < separator))) {
+		return "";
+	}
+	std::string result = path.substr(extension + 1);
+	std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+	return result;
+}
+
+static std::vector<std::string> getPackOrder(const std::vector<std::string> &files, const std::string &orderFile)
+{
+	std::vector<std::string> sorted(files);
+	std::sort(sorted.begin(), sorted.end());
+	if (orderFile.empty()) {
+		return sorted;
+	}
+	std::ifstream stream(orderFile);
+	if (!stream.is_open()) {
+		std::cerr << "Could not open order file " << orderFile << ", packing sorted by path\n";
+		return sorted;
+	}
+	const std::set<std::string> available(files.begin(), files.end());
+	std::set<std::string> packed;
+	std::vector<std::string> order;
+	std::string line;
+	while (std::getline(stream, line)) {
+		const std::string path = vks::archive::normalizePath(line);
+		if (available.count(path) && packed.insert(path).second) {
+			order.push_back(path);
+		}
+	}
+	for (const std::string &path : sorted) {
+		if (!packed.count(path)) {
+			order.push_back(path);
+		}
+	}
+	return order;
+}
+
+int main(const int argc, const char *argv[])
+{
+	PackSettings settings;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const bool hasValue = (i + 1 < argc);
+		if ((arg == "-order") && hasValue) {
+			settings.orderFile = argv[++i];
+		} else if ((arg == "-raw") && hasValue) {
+			settings.rawExtensions.clear();
+			std::string list = argv[++i];
+			size_t start = 0;
+			while (start <= list.size()) {
+				const size_t end = std::min(list.find(',', start), list.size());
+				if (end > start) {
+					settings.rawExtensions.insert(list.substr(start, end - start));
+				}
+				start = end + 1;
+			}
+		} else if (arg == "-store") {
+			settings.store = true;
+		} else if ((arg == "-o") && hasValue) {
+			settings.output = argv[++i];
+		} else if (!arg.empty() && (arg[0] == '-')) {
+			printUsage();
+			return EXIT_FAILURE;
+		} else {
+			settings.root = arg;
+		}
+	}
+	if (settings.output.empty() || settings.root.empty()) {
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	const auto tStart = std::chrono::high_resolution_clock::now();
+
+	std::vector<std::string> files;
+	listFiles(settings.root, "", files);
+	// Don't pack previous archives, the archive that is about to be written or recorded load orders
+	const std::string output = vks::archive::normalizePath(settings.output);
+	files.erase(std::remove_if(files.begin(), files.end(), [&](const std::string &path) {
+		return (getExtension(path) == "vpk") || (getExtension(path) == "order") || (vks::archive::normalizePath(settings.root + "/" + path) == output);
+	}), files.end());
+
+	vks::archive::Writer writer;
+	for (const std::string &path : getPackOrder(files, settings.orderFile)) {
+		const bool compress = !settings.store && !settings.rawExtensions.count(getExtension(path));
+		writer.add(path, settings.root + "/" + path, compress);
+	}
+
+	vks::ThreadPool pool;
+	pool.setThreadCount(std::max(std::thread::hardware_concurrency(), 1u));
+	if (!writer.write(settings.output, &pool)) {
+		std::cerr << "Could not write " << settings.output << "\n";
+		return EXIT_FAILURE;
+	}
+
+	vks::archive::Archive archive;
+	if (!archive.open(settings.output)) {
+		std::cerr << "Could not read back " << settings.output << "\n";
+		return EXIT_FAILURE;
+	}
+	uint64_t size = 0;
+	uint64_t storedSize = 0;
+	size_t compressed = 0;
+	for (const vks::archive::Entry &entry : archive.getEntries()) {
+		size += entry.size;
+		storedSize += entry.storedSize;
+		compressed += (entry.compression != vks::archive::compressionNone) ? 1 : 0;
+	}
+	const auto tEnd = std::chrono::high_resolution_clock::now();
+	std::cout << settings.root << " -> " << settings.output << " (" << archive.getEntries().size() << " files, " << compressed << " compressed, "
+		<< size / 1024 << " KB -> " << storedSize / 1024 << " KB, "
+		<< std::chrono::duration<double, std::milli>(tEnd - tStart).count() << " ms)\n";
+	return EXIT_SUCCESS;
+}
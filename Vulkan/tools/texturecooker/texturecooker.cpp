@@ -0,0 +1,156 @@
+/*
+* Texture cooker
+*
+* Converts source images (jpg, png, tga, ...) to block compressed KTX files with a precomputed mip chain
+* The output is written next to the source as <name>.<format>.ktx, where vks::ktx::loadVariant picks it up at runtime
+*
+* Usage: texturecooker [-format bc1|bc3|bc4|bc5|bc7] [-srgb] [-srgbmips] [-filter box|kaiser|lanczos] [-alphacutoff value] [-o output] image...
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+
+#include "threadpool.hpp"
+#include "mipgen.hpp"
+#include "blockcompress.hpp"
+#include "ktxfile.hpp"
+
+struct CookSettings {
+	vks::blockcompress::Format format = vks::blockcompress::formatBC7;
+	// Filter the color channels in linear space and store them in an sRGB format
+	bool srgb = false;
+	// Filter the color channels in linear space but keep a UNORM format, for images that are sampled as UNORM
+	bool srgbMips = false;
+	vks::mipgen::Filter filter = vks::mipgen::filterKaiser;
+	float alphaCutoff = 0.0f;
+	std::string output;
+};
+
+static void printUsage()
+{
+	std::cout << "Usage: texturecooker [-format bc1|bc3|bc4|bc5|bc7] [-srgb] [-srgbmips] [-filter box|kaiser|lanczos] [-alphacutoff value] [-o output] image...\n";
+}
+
+static bool parseFormat(const std::string &name, vks::blockcompress::Format &format)
+{
+	const vks::blockcompress::Format formats[] = { vks::blockcompress::formatBC1, vks::blockcompress::formatBC3, vks::blockcompress::formatBC4, vks::blockcompress::formatBC5, vks::blockcompress::formatBC7 };
+	for (vks::blockcompress::Format candidate : formats) {
+		if (name == vks::ktx::getVariantName(candidate)) {
+			format = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+static std::string getOutputName(const std::string &input, const CookSettings &settings)
+{
+	if (!settings.output.empty()) {
+		return settings.output;
+	}
+	const size_t extension = input.find_last_of('.');
+	const size_t separator = input.find_last_of("/\\");
+	const std::string base = ((extension != std::string::npos) && ((separator == std::string::npos) || (extension > separator))) ? input.substr(0, extension) : input;
+	return base + "." + vks::ktx::getVariantName(settings.format) + ".ktx";
+}
+
+static bool cook(const std::string &input, const CookSettings &settings, vks::ThreadPool &pool)
+{
+	const auto tStart = std::chrono::high_resolution_clock::now();
+
+	int width, height, channels;
+	stbi_uc *pixels = stbi_load(input.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels) {
+		std::cerr << "Could not load " << input << ": " << stbi_failure_reason() << "\n";
+		return false;
+	}
+
+	const std::vector<vks::mipgen::Level> levels = vks::mipgen::getLevels(width, height);
+	std::vector<uint8_t> chain(vks::mipgen::getSize(levels));
+	vks::mipgen::Options mipOptions;
+	mipOptions.filter = settings.filter;
+	mipOptions.srgb = settings.srgb || settings.srgbMips;
+	mipOptions.alphaCutoff = settings.alphaCutoff;
+	vks::mipgen::generate(pixels, chain.data(), levels, mipOptions, &pool);
+	stbi_image_free(pixels);
+
+	const std::vector<vks::mipgen::Level> blockLevels = vks::blockcompress::getLevels(settings.format, levels);
+	std::vector<uint8_t> blocks(vks::mipgen::getSize(blockLevels));
+	vks::blockcompress::compress(settings.format, chain.data(), levels, blocks.data(), &pool);
+
+	const std::string output = getOutputName(input, settings);
+	if (!vks::ktx::write(output, vks::ktx::getGlInternalFormat(settings.format, settings.srgb), blockLevels, blocks.data())) {
+		std::cerr << "Could not write " << output << "\n";
+		return false;
+	}
+
+	const auto tEnd = std::chrono::high_resolution_clock::now();
+	std::cout << input << " -> " << output << " (" << width << "x" << height << ", " << levels.size() << " levels, "
+		<< chain.size() / 1024 << " KB -> " << blocks.size() / 1024 << " KB, "
+		<< std::chrono::duration<double, std::milli>(tEnd - tStart).count() << " ms)\n";
+	return true;
+}
+
+int main(const int argc, const char *argv[])
+{
+	CookSettings settings;
+	std::vector<std::string> inputs;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const bool hasValue = (i + 1 < argc);
+		if ((arg == "-format") && hasValue) {
+			if (!parseFormat(argv[++i], settings.format)) {
+				std::cerr << "Unknown format " << argv[i] << "\n";
+				return EXIT_FAILURE;
+			}
+		} else if (arg == "-srgb") {
+			settings.srgb = true;
+		} else if (arg == "-srgbmips") {
+			settings.srgbMips = true;
+		} else if ((arg == "-filter") && hasValue) {
+			const std::string filter = argv[++i];
+			if (filter == "box") {
+				settings.filter = vks::mipgen::filterBox;
+			} else if (filter == "lanczos") {
+				settings.filter = vks::mipgen::filterLanczos;
+			} else {
+				settings.filter = vks::mipgen::filterKaiser;
+			}
+		} else if ((arg == "-alphacutoff") && hasValue) {
+			settings.alphaCutoff = static_cast<float>(atof(argv[++i]));
+		} else if ((arg == "-o") && hasValue) {
+			settings.output = argv[++i];
+		} else if (!arg.empty() && (arg[0] == '-')) {
+			printUsage();
+			return EXIT_FAILURE;
+		} else {
+			inputs.push_back(arg);
+		}
+	}
+	if (inputs.empty() || (!settings.output.empty() && (inputs.size() > 1))) {
+		printUsage();
+		return EXIT_FAILURE;
+	}
+	if ((settings.format == vks::blockcompress::formatBC4 || settings.format == vks::blockcompress::formatBC5) && (settings.srgb || settings.srgbMips)) {
+		std::cerr << "BC4 and BC5 store linear data, ignoring sRGB\n";
+		settings.srgb = settings.srgbMips = false;
+	}
+
+	vks::ThreadPool pool;
+	pool.setThreadCount(std::max(std::thread::hardware_concurrency(), 1u));
+
+	bool success = true;
+	for (const std::string &input : inputs) {
+		success &= cook(input, settings, pool);
+	}
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}